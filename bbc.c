@@ -1,31 +1,34 @@
 #include <stdio.h>
 #include <stdlib.h>
-#include "compiler.h"
-#include "lexer.h"
-#include "parser.h"
-#include "utils.h"
+#include <string.h>
+#include "driver.h"
+#include "options.h"
+#include "server.h"
+#include "watch.h"
 
 int main(int argc, char** argv) {
-    if (argc < 2) {
-        fprintf(stderr, "usage: %s <input.b>\n", argv[0]);
-        fprintf(stderr, "error: input file not specified\n");
-        exit(1);
+    if (argc > 1 && strcmp(argv[1], "--server") == 0) {
+        if (argc != 3) {
+            options_usage(argv[0]);
+            fprintf(stderr, "error: --server expects a socket path\n");
+            return 1;
+        }
+        return server_run(argv[2]);
+    }
+    if (argc > 1 && strcmp(argv[1], "--connect") == 0) {
+        if (argc < 3) {
+            options_usage(argv[0]);
+            fprintf(stderr, "error: --connect expects a socket path\n");
+            return 1;
+        }
+        // the remaining arguments are sent as they are, the server parses them
+        return server_request(argv[2], argc - 3, argv + 3);
     }
 
-    char* source = file_read(argv[1]);
-
-    // TODO: move token_array from main to parser
-    TokenArray token_array = lexer_lex(source);
-    lexer_print_output(token_array);
-    printf("----------------------------------------------------------------\n");
-    
-    ASTNode* ast = parser_parse(argv[1], &token_array);
-    parser_print_output(ast, 0);
-    printf("----------------------------------------------------------------\n");
-    compiler_compile(ast, "test.asm");
-
-    parser_free_ast(ast);
-    lexer_free_tokens(&token_array);
-    free(source);
+    Options options = options_parse(argc, argv);
+    if (options.watch) {
+        return watch_run(&options);
+    }
+    driver_compile(&options);
     return 0;
 }
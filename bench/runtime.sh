@@ -0,0 +1,104 @@
+#!/bin/sh
+# Compiles every kernel of bench/runtime with bbc and its C version with $CC -O2, runs both
+# $TRIALS times and compares the fastest runs. Fails when the ratio of a kernel is above the
+# limit in bench/runtime/thresholds.
+#
+# BBC, FASM, CC and TRIALS can be set in the environment, BBC_FLAGS is passed to bbc.
+
+BENCH_DIR=$(cd "$(dirname "$0")" && pwd)
+KERNELS_DIR="$BENCH_DIR/runtime"
+BBC=${BBC:-"$BENCH_DIR/../bbc"}
+FASM=${FASM:-fasm}
+CC=${CC:-gcc}
+TRIALS=${TRIALS:-5}
+
+if ! command -v "$FASM" >/dev/null 2>&1; then
+    echo "error: fasm not found, set FASM to the assembler" >&2
+    exit 1
+fi
+if [ ! -x "$BBC" ]; then
+    echo "error: bbc not found at $BBC, build it with make or set BBC" >&2
+    exit 1
+fi
+
+WORK_DIR=$(mktemp -d)
+trap 'rm -rf "$WORK_DIR"' EXIT
+
+# instruction counts only when perf can read the counters here
+HAS_PERF=0
+if command -v perf >/dev/null 2>&1 && perf stat -x, -e instructions true >/dev/null 2>&1; then
+    HAS_PERF=1
+fi
+
+# nanoseconds of the fastest of $TRIALS runs of $1, whose output goes to $2
+best_time() {
+    best=
+    trial=0
+    while [ $trial -lt "$TRIALS" ]; do
+        start=$(date +%s%N)
+        "$1" >"$2"
+        end=$(date +%s%N)
+        time=$((end - start))
+        if [ -z "$best" ] || [ $time -lt "$best" ]; then
+            best=$time
+        fi
+        trial=$((trial + 1))
+    done
+    echo "$best"
+}
+
+instructions() {
+    if [ $HAS_PERF = 0 ]; then
+        echo -
+        return
+    fi
+    perf stat -x, -e instructions -o "$WORK_DIR/perf" "$1" >/dev/null 2>&1
+    awk -F, '/instructions/ { print $1; exit }' "$WORK_DIR/perf"
+}
+
+# gcc puts main in .text.startup
+text_size() {
+    size -A "$1" | awk '$1 ~ /^\.text/ { size += $2 } END { print size }'
+}
+
+threshold() {
+    awk -v kernel="$1" '$1 == kernel { print $2 }' "$KERNELS_DIR/thresholds"
+}
+
+failed=0
+printf "%-8s %10s %10s %7s %7s %14s %14s %8s %8s\n" \
+    kernel "bbc ms" "cc ms" ratio limit "bbc instrs" "cc instrs" "bbc text" "cc text"
+for source in "$KERNELS_DIR"/*.b; do
+    kernel=$(basename "$source" .b)
+    b="$WORK_DIR/$kernel"
+    c="$WORK_DIR/$kernel-c"
+    # the stages bbc prints are not needed
+    if ! "$BBC" $BBC_FLAGS -o "$b.asm" "$source" >/dev/null \
+        || ! "$FASM" "$b.asm" "$b.o" >/dev/null \
+        || ! "$CC" -no-pie -z noexecstack "$b.o" -o "$b" \
+        || ! "$CC" -O2 -c "$KERNELS_DIR/$kernel.c" -o "$c.o" \
+        || ! "$CC" "$c.o" -o "$c"; then
+        echo "error: $kernel does not build" >&2
+        exit 1
+    fi
+
+    b_time=$(best_time "$b" "$b.out")
+    c_time=$(best_time "$c" "$c.out")
+    if ! cmp -s "$b.out" "$c.out"; then
+        echo "error: $kernel prints something else than its C version" >&2
+        failed=1
+        continue
+    fi
+    ratio=$(awk -v b="$b_time" -v c="$c_time" 'BEGIN { printf "%.2f", b / c }')
+    limit=$(threshold "$kernel")
+    printf "%-8s %10.1f %10.1f %7s %7s %14s %14s %8s %8s\n" "$kernel" \
+        "$(awk -v t="$b_time" 'BEGIN { print t / 1000000 }')" \
+        "$(awk -v t="$c_time" 'BEGIN { print t / 1000000 }')" \
+        "$ratio" "${limit:--}" "$(instructions "$b")" "$(instructions "$c")" \
+        "$(text_size "$b.o")" "$(text_size "$c.o")"
+    if [ -n "$limit" ] && awk -v r="$ratio" -v l="$limit" 'BEGIN { exit !(r > l) }'; then
+        echo "error: $kernel runs $ratio times as long as its C version, the limit is $limit" >&2
+        failed=1
+    fi
+done
+exit $failed
@@ -0,0 +1,16 @@
+#include <stdint.h>
+#include <stdio.h>
+
+int main(void) {
+    int64_t i, x, y;
+    i = 0;
+    x = 1;
+    y = 0;
+    while (i < 30000000) {
+        x = (x * 1103 + 12345) % 1000003;
+        y = y + x / 7 - x % 13;
+        i = i + 1;
+    }
+    printf("%lld\n", (long long)y);
+    return 0;
+}
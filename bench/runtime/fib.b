@@ -0,0 +1,9 @@
+fib(n) {
+    if (n < 2) return (n);
+    return (fib(n - 1) + fib(n - 2));
+}
+
+main() {
+    extrn printf;
+    printf("%ld*n", fib(32));
+}
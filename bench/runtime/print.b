@@ -0,0 +1,8 @@
+main() {
+    auto i;
+    i = 0;
+    while (i < 3000000) {
+        print i * 37 - 1000000;
+        i = i + 1;
+    }
+}
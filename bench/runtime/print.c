@@ -0,0 +1,12 @@
+#include <stdint.h>
+#include <stdio.h>
+
+int main(void) {
+    int64_t i;
+    i = 0;
+    while (i < 3000000) {
+        printf("%lld\n", (long long)(i * 37 - 1000000));
+        i = i + 1;
+    }
+    return 0;
+}
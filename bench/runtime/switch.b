@@ -0,0 +1,20 @@
+main() {
+    extrn printf;
+    auto i, s;
+    i = 0;
+    s = 0;
+    while (i < 20000000) {
+        switch ((i * 7 + i / 3) % 8) {
+            case 0: s = s + 1; break;
+            case 1: s = s - 3; break;
+            case 2: s = s * 3 % 1000003; break;
+            case 3: s = s + i % 5; break;
+            case 4: s = s - i / 1000; break;
+            case 5: s = s + 17; break;
+            case 6: s = -s; break;
+            default: s = s / 2;
+        }
+        i = i + 1;
+    }
+    printf("%ld*n", s);
+}
@@ -0,0 +1,35 @@
+auto a[9999], b[9999], c[9999];
+
+add(n) {
+    extrn a, b, c;
+    auto i;
+    i = 0;
+    while (i < n) {
+        c[i] = a[i] + b[i];
+        i = i + 1;
+    }
+}
+
+main() {
+    extrn printf, a, b, c;
+    auto i, pass, s;
+    i = 0;
+    while (i < 10000) {
+        a[i] = i % 100;
+        b[i] = i / 100;
+        i = i + 1;
+    }
+    s = 0;
+    pass = 0;
+    while (pass < 3000) {
+        add(10000);
+        i = 0;
+        while (i < 10000) {
+            s = s + c[i];
+            i = i + 1;
+        }
+        a[pass % 10000] = pass;
+        pass = pass + 1;
+    }
+    printf("%ld*n", s);
+}
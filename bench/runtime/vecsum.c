@@ -0,0 +1,37 @@
+#include <stdint.h>
+#include <stdio.h>
+
+int64_t a[10000], b[10000], c[10000];
+
+void add(int64_t n) {
+    int64_t i;
+    i = 0;
+    while (i < n) {
+        c[i] = a[i] + b[i];
+        i = i + 1;
+    }
+}
+
+int main(void) {
+    int64_t i, pass, s;
+    i = 0;
+    while (i < 10000) {
+        a[i] = i % 100;
+        b[i] = i / 100;
+        i = i + 1;
+    }
+    s = 0;
+    pass = 0;
+    while (pass < 3000) {
+        add(10000);
+        i = 0;
+        while (i < 10000) {
+            s = s + c[i];
+            i = i + 1;
+        }
+        a[pass % 10000] = pass;
+        pass = pass + 1;
+    }
+    printf("%lld\n", (long long)s);
+    return 0;
+}
@@ -0,0 +1,13 @@
+square(x) return (x * x);
+
+fact(n) {
+    if (n <= 1) return (1);
+    return (n * fact(n - 1));
+}
+
+main() {
+    extrn putchar;
+    putchar(square(8) + 1);
+    putchar(fact(4) + 42);
+    putchar(10);
+}
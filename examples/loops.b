@@ -0,0 +1,19 @@
+sum(n) {
+    auto i, total;
+    i = 0;
+    total = 0;
+    while (i < 4) {
+        auto row[2], rest;
+        row[0] = n * 2 + i;
+        row[1] = i;
+        rest = row + 8;
+        total = total + row[0] + rest[0];
+        i = i + 1;
+    }
+    return (total);
+}
+
+main() {
+    extrn printf;
+    printf("%d %d*n", sum(5), sum(7));
+}
@@ -0,0 +1,15 @@
+{
+    auto command;
+    auto result;
+    command = 3;
+    result = 0;
+    switch (command) {
+        case 0: result = 10; break;
+        case 1: result = 20; break;
+        case 2:
+        case 3: result = 30; break;
+        case 4: result = 40; break;
+        case 1000: result = 50; break;
+        default: result = -1;
+    }
+}
@@ -0,0 +1,27 @@
+offsets[4] 1, 2, 3, 4, 5;
+
+add(a, b, c, n) {
+    auto i;
+    i = 0;
+    while (i < n) {
+        a[i] = b[i] + c[i];
+        i = i + 1;
+    }
+}
+
+main() {
+    extrn putchar, offsets;
+    auto letters[4], i;
+    i = 0;
+    while (i <= 4) {
+        letters[i] = 64;
+        i = i + 1;
+    }
+    add(letters, letters, offsets, 5);
+    i = 0;
+    while (i <= 4) {
+        putchar(letters[i]);
+        i = i + 1;
+    }
+    putchar(10);
+}
@@ -0,0 +1,20 @@
+#pragma once
+#include <stdbool.h>
+#include "parser.h"
+#include "source.h"
+
+// AST files hold a parsed, unoptimized program, so it can be optimized and compiled again
+// with other options without lexing and parsing it. Nodes are records of 32-bit numbers that
+// refer to their children by offsets relative to themselves and to names by offsets into one
+// table of unique strings, the line table of the source comes with them for diagnostics.
+#define ASTFILE_VERSION 2
+
+// Writes the program with the path and the line table of its source.
+void astfile_write(const char* path, ASTNode* program, Source* source);
+// whether the file starts like an AST file, "-" never does
+bool astfile_is_ast_file(const char* path);
+// Maps the file and builds the tree it holds. The source gets the path and the line table of
+// the one the program was parsed from, but none of its text. The path is in the mapping, it
+// stays until astfile_close.
+ASTNode* astfile_load(const char* path, Source* source);
+void astfile_close();
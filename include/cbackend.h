@@ -0,0 +1,12 @@
+#pragma once
+#include "options.h"
+#include "parser.h"
+
+// Writes the program as C99 to options->output_path, to be optimized by a C compiler. It runs
+// like the code of compiler_compile: words are int64_t and wrap around, arguments are
+// evaluated right to left and a division stops the program with SIGFPE where idiv would.
+// Names that would clash with C keywords or with the names the output reserves (starting with
+// bbc_) are renamed for autos and rejected for functions, vectors and extrn declarations.
+void cbackend_compile(ASTNode* program, const Options* options);
+// releases what a compilation interrupted by fail() left open
+void cbackend_abort();
@@ -1,4 +1,74 @@
 #pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include "options.h"
 #include "parser.h"
 
-void compiler_compile(ASTNode* program, const char* filename);
+// What the code of a function needs to know about the rest of the program.
+typedef struct ProgramSymbols {
+    // names of the functions and external vectors in the order they are defined
+    const char** definitions;
+    bool* is_vector;
+    int definitions_count;
+    // names declared with extrn in the order of the functions declaring them, including
+    // repeated ones and ones the program defines itself
+    const char** extrns;
+    int extrns_count;
+    int extrns_capacity;
+} ProgramSymbols;
+
+#define COMPILER_MAX_THREADS 64
+
+// Writes the assembly of the program. With options->codegen_threads the functions are compiled
+// on several threads and merged in source order, giving the same output as on one.
+void compiler_compile(ASTNode* program, const Options* options);
+// compiler_compile for programs that arrive one definition at a time. The symbols are needed
+// up front for the header, functions are written as they come, the data at the end.
+void compiler_begin(const ProgramSymbols* symbols, Source* source, const Options* options);
+void compiler_compile_function(ASTNode* function);
+void compiler_end(ASTNode** vectors, int vectors_count, int site_count);
+
+// A string literal of the code, written at the end into one pool where strings that end like
+// a longer one share its bytes. The bytes are followed by '\0', like C expects them.
+typedef struct CompiledString {
+    int label;
+    char* bytes;
+    int length;
+} CompiledString;
+
+// The code of a function compiled on its own, with its labels numbered from 0. It only
+// depends on the function and on the names the program defines, so it can be written into
+// any compilation of a program defining the same ones.
+typedef struct FunctionCode {
+    char* text;
+    size_t text_size;
+    char* rodata;
+    size_t rodata_size;
+    char* cold_text;
+    size_t cold_text_size;
+    CompiledString* strings;
+    int strings_count;
+    int labels_count;
+    bool uses_simd_level;
+    // one bit for every function of the runtime it calls
+    unsigned runtime_functions;
+} FunctionCode;
+
+// compiler_compile_function for code the caller keeps, between compiler_begin and compiler_end
+void compiler_compile_code(ASTNode* function, FunctionCode* code);
+void compiler_write_code(const FunctionCode* code);
+void compiler_free_code(FunctionCode* code);
+// Appends the names the function declares with extrn to symbols->extrns, like
+// compiler_compile collects them.
+void compiler_collect_extrns(ASTNode* function, ProgramSymbols* symbols);
+// For programs compiled one top-level definition or statement at a time without knowing the
+// rest of them: names are defined as their definitions come, ones used before are checked at
+// the end, where the header is written. Only the names and the frame of main are kept.
+void compiler_begin_stream(Source* source, const Options* options);
+// a function or a vector definition
+void compiler_stream_definition(ASTNode* definition);
+// a block of statements outside of functions, they are compiled into the implicit main
+void compiler_stream_statements(ASTNode* statements);
+void compiler_end_stream(int site_count);
+// releases what a compilation interrupted by fail() left open
+void compiler_abort();
@@ -0,0 +1,17 @@
+#pragma once
+#include <stdbool.h>
+#include <stdio.h>
+#include "parser.h"
+
+// DWARF 3 line table and debug info for the generated assembly. The compiler marks source
+// locations while writing code, the sections are emitted at the end with debug_emit.
+void debug_begin(const char* source_path);
+void debug_begin_function(const char* name, int line);
+// parameter or auto at [rbp-offset] of the current function
+void debug_add_variable(const char* name, int line, Word offset, bool is_parameter);
+// places a label at the current position of the stream and maps it to the location,
+// code and cold_code are the two streams a function is written to
+void debug_mark_line(FILE* stream, bool is_cold, int line, int column);
+void debug_end_function(FILE* code, FILE* cold_code);
+void debug_emit(FILE* file);
+void debug_free();
@@ -0,0 +1,7 @@
+#pragma once
+#include "options.h"
+
+// Lexes, parses, optimizes and compiles options->input_path into options->output_path.
+void driver_compile(const Options* options);
+// releases what a compilation interrupted by fail() left behind
+void driver_abort();
@@ -1,5 +1,6 @@
 #pragma once
 #include <stdint.h>
+#include "source.h"
 
 // TODO: add assignment operators
 typedef enum TokenType {
@@ -47,28 +48,60 @@ typedef enum TokenType {
     TOKEN_ELSE,            // else
     TOKEN_SWITCH,          // switch
     TOKEN_CASE,            // case
+    TOKEN_DEFAULT,         // default
     TOKEN_GOTO,            // goto
     TOKEN_WHILE,           // while
+    TOKEN_BREAK,           // break
     TOKEN_RETURN,          // return
-    TOKEN_PRINT,           // print (TODO: temporary)
+    TOKEN_PRINT,           // print
 
     TOKEN_ERROR
 } TokenType;
 
+// Tokens refer to the source by offset, lines and columns are looked up in the source only
+// for diagnostics and debug info.
 typedef struct Token {
-    TokenType type;
-    const char* value;
-    int line;
-    int length;
+    uint32_t offset;
+    // for TOKEN_ERROR the index of the message, see token_value
+    uint32_t length : 24;
+    uint32_t type : 8;
 } Token;
 
+_Static_assert(sizeof(Token) == 8, "tokens are packed in 8 bytes");
+
+#define TOKEN_MAX_LENGTH ((1 << 24) - 1)
+
 typedef struct TokenArray {
     Token* tokens;
     int count;
     int capacity;
+    Source* source;
 } TokenArray;
 
-TokenArray lexer_lex(const char* source);
+// chunks smaller than this are not worth a thread
+#define LEXER_MIN_CHUNK_SIZE (256 * 1024)
+#define LEXER_MAX_THREADS 64
+
+// Refills the source as it goes, tokens point into its buffer.
+TokenArray lexer_lex(Source* source);
+// Token by token, for callers that do not keep all of them. The buffer moves when the source
+// is refilled, so it has to be read whole first when other threads look at the tokens.
+void lexer_begin(Source* source);
+// TOKEN_EOF at the end, again on every further call
+Token lexer_next();
+// Drops the source before offset once no token before it is looked at anymore, the tokens
+// after it move down by offset, including the ones lexer_next returns from now on.
+void lexer_drop_source(uint32_t offset);
+// Reads the whole source and lexes chunks of it on up to threads_count threads, the tokens
+// are the same as the ones of lexer_lex.
+TokenArray lexer_lex_parallel(Source* source, int threads_count);
+// Reads the whole source and lexes it reusing the tokens of an earlier version of it, whose
+// source is still open: only the bytes between the prefix and the suffix both have in common
+// are lexed again. The tokens are the same as the ones of lexer_lex.
+TokenArray lexer_relex(Source* source, const TokenArray* previous);
 void lexer_free_tokens(TokenArray* token_array);
 void lexer_print_output(TokenArray token_array);
 const char* token_as_cstr(TokenType type);
+// text of the token in the source, the message for TOKEN_ERROR
+const char* token_value(const TokenArray* token_array, const Token* token);
+int token_line(const TokenArray* token_array, const Token* token);
@@ -0,0 +1,17 @@
+#pragma once
+#include "options.h"
+#include "parser.h"
+
+void optimizer_optimize(ASTNode* program, const Options* options);
+// optimizer_optimize for functions that arrive one at a time, the caller checks the
+// optimization level. Calls are only inlined from functions added so far, so callees are
+// added before their callers are optimized.
+void optimizer_begin(const Options* options);
+void optimizer_add_function(ASTNode* function);
+void optimizer_optimize_function(ASTNode* function);
+// Folds constants in statements compiled without the rest of their function, the passes that
+// need the whole function are left out.
+void optimizer_optimize_statements(ASTNode* statements);
+void optimizer_end();
+// names of the functions the body calls, the ones inlining looks for, the array is the caller's
+int optimizer_callees(ASTNode* function, const char*** names);
@@ -0,0 +1,43 @@
+#pragma once
+#include <stdbool.h>
+
+typedef enum EmitFormat {
+    EMIT_ASM,
+    EMIT_C,
+    EMIT_AST,
+} EmitFormat;
+
+typedef struct Options {
+    const char* input_path;
+    const char* output_path;
+    // 0 disables the AST optimizer
+    int optimization_level;
+    // -Os: the shortest encodings and no code that trades size for speed
+    bool optimize_size;
+    // list converted and rejected tail calls on stderr
+    bool report_tail_calls;
+    // emit DWARF line tables and debug info for functions and locals
+    bool debug_info;
+    // instrumented programs write their branch counters to this file at exit
+    const char* profile_generate_path;
+    // branch counters of an earlier run of the instrumented program
+    const char* profile_use_path;
+    // lex on this many threads, 0 uses one per cpu
+    int lex_threads;
+    // generate the code of the functions on this many threads, 0 uses one per cpu
+    int codegen_threads;
+    // lex, parse and compile on separate threads
+    bool pipeline;
+    // compile every top-level definition and statement once it is parsed, in constant memory
+    bool stream;
+    // compile again every time the input is written
+    bool watch;
+    // fasm assembly, C99 for a C compiler to optimize, or the parsed program as an AST file
+    EmitFormat emit;
+    // print the tokens and the AST on stdout
+    bool print_stages;
+} Options;
+
+void options_usage(const char* program);
+// argv[0] is the program name, errors are reported with fail()
+Options options_parse(int argc, char** argv);
@@ -1,25 +1,40 @@
 #pragma once
+#include <stdbool.h>
 #include "lexer.h"
 
 typedef int64_t Word;
 
 typedef enum ASTNodeType {
     AST_NODE_PROGRAM,
+    AST_NODE_FUNCTION,
+    AST_NODE_VECTOR_DEFINITION,
     AST_NODE_BLOCK,
     AST_NODE_EXPRESSION_STATEMENT,
     AST_NODE_IF_STATEMENT,
     AST_NODE_WHILE_STATEMENT,
+    AST_NODE_SWITCH_STATEMENT,
+    AST_NODE_CASE,
+    AST_NODE_BREAK_STATEMENT,
+    AST_NODE_RETURN_STATEMENT,
     AST_NODE_VARIABLE_DECLARATION,
+    AST_NODE_EXTRN_DECLARATION,
 
     AST_NODE_ASSIGNMENT,
+    AST_NODE_SUBSCRIPT_ASSIGNMENT,
     AST_NODE_BINARY,
     AST_NODE_UNARY,
     AST_NODE_LITERAL,
+    AST_NODE_STRING,
     AST_NODE_VARIABLE,
+    AST_NODE_SUBSCRIPT,
+    AST_NODE_CALL,
+    AST_NODE_INLINED_CALL,
 } ASTNodeType;
 
 typedef struct ASTNode {
     ASTNodeType type;
+    // 1 + offset in the source of the first token of a statement, 0 for nodes made by the optimizer
+    uint32_t location;
 
     union {
         // program
@@ -27,9 +42,31 @@ typedef struct ASTNode {
             struct ASTNode** statements;
             int count;
             int capacity;
+            // number of if and while statements, see profile.h
+            int site_count;
+            // the locations of the nodes are in it
+            Source* source;
         } program;
 
-        // expression
+        // function definition
+        struct {
+            char* name;
+            char** parameters;
+            int parameter_count;
+            struct ASTNode* body;
+        } function;
+
+        // external vector, `name[bound] values;` outside of functions, or a single word for
+        // `auto name;` outside of functions
+        struct {
+            char* name;
+            Word bound;
+            Word* values;
+            int count;
+            bool is_scalar;
+        } vector;
+
+        // expression (also the value of return, NULL for a bare return)
         struct ASTNode* expression;
 
         // if
@@ -37,17 +74,44 @@ typedef struct ASTNode {
             struct ASTNode* condition;
             struct ASTNode* then_branch;
             struct ASTNode* else_branch;
+            int site;
         } if_statement;
 
         // while
         struct {
             struct ASTNode* condition;
             struct ASTNode* body;
+            int site;
         } while_statement;
 
-        // variable and declaration
+        // switch (cases point into the body, they are owned by it)
+        struct {
+            struct ASTNode* condition;
+            struct ASTNode* body;
+            struct ASTNode** cases;
+            int count;
+            int capacity;
+            struct ASTNode* default_case;
+        } switch_statement;
+
+        // case and default labels (label is assigned by the compiler)
+        struct {
+            Word value;
+            bool is_default;
+            int label;
+            struct ASTNode* statement;
+        } case_label;
+
+        // variable and extrn declaration
         char* name;
 
+        // auto declaration, `auto v[bound]` reserves the words v[0] to v[bound]
+        struct {
+            char* name;
+            bool is_vector;
+            Word bound;
+        } declaration;
+
         // block (TODO: same struct as program, maybe can be logically joined?)
         struct {
             struct ASTNode** statements;
@@ -61,6 +125,13 @@ typedef struct ASTNode {
             struct ASTNode* value;
         } assignment;
 
+        // vector[index], value is only used by the assignment
+        struct {
+            struct ASTNode* vector;
+            struct ASTNode* index;
+            struct ASTNode* value;
+        } subscript;
+
         // binary operation
         struct {
             struct ASTNode* left;
@@ -76,9 +147,63 @@ typedef struct ASTNode {
 
         // literal value
         Word literal;
+
+        // string literal with its escapes replaced, the value is the address of its bytes,
+        // which are followed by '\0'
+        struct {
+            char* bytes;
+            int length;
+        } string;
+
+        // call
+        struct {
+            char* name;
+            struct ASTNode** arguments;
+            int count;
+            int capacity;
+        } call;
+
+        // call replaced by the callee's body, arguments are stored into its parameters
+        struct {
+            char* name;
+            char** parameters;
+            struct ASTNode** arguments;
+            int count;
+            struct ASTNode* body;
+        } inlined_call;
     };
 } ASTNode;
 
 ASTNode* parser_parse(const char* file_path, TokenArray* token_array);
+// parser_parse for tokens that arrive in batches. Every batch holds whole top-level definitions
+// and statements and ends with TOKEN_EOF, first is its first new token.
+void parser_begin(const char* file_path);
+void parser_set_tokens(TokenArray* token_array, Token* first);
+// the next function or vector definition of the batch, NULL at its end
+ASTNode* parser_next_definition();
+// the statements outside of functions parsed since the last call as a block, NULL without any,
+// for callers that compile them as they come instead of waiting for parser_end
+ASTNode* parser_take_statements();
+// the implicit main made of the statements outside of functions, NULL without any
+ASTNode* parser_end(int* site_count);
+// A top-level definition or statement ends with ';' or '}' outside of any brackets, unless
+// an else follows. That holds for every valid program, an invalid one fails in the parser
+// before it reads past the end of a batch.
+typedef struct TopLevelSplitter {
+    int depth;
+    bool may_end;
+} TopLevelSplitter;
+
+// whether a definition or statement ended before the token
+bool parser_ends_before(TopLevelSplitter* splitter, Token token);
+// whether the tokens start a function or a vector definition
+bool parser_is_function_definition(const Token* tokens);
+bool parser_is_vector_definition(const Token* tokens);
+// Whether the tokens start `auto` declarations outside of functions. They define external
+// words and vectors, the statements of the implicit main after them declare them with extrn.
+bool parser_is_global_declaration(const Token* tokens);
+// The child of the node at the index, NULL past the last one. Optional children may be NULL
+// themselves. Walks that must not recurse keep the next index of every node on their way down.
+ASTNode** parser_child_slot(ASTNode* node, int index);
 void parser_free_ast(ASTNode* root);
 void parser_print_output(ASTNode* root, int indent);
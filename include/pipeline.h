@@ -0,0 +1,10 @@
+#pragma once
+#include "options.h"
+#include "source.h"
+
+// Compiles on four threads: the lexer passes batches of tokens to the parser, the parser
+// passes every definition to the code generator as soon as it is parsed, and a scanner finds
+// the names the code generator needs up front. The output is the one of driver_compile, except
+// that names declared with extrn in code the optimizer removed stay declared. The stages are
+// not printed.
+void pipeline_compile(Source* source, const Options* options);
@@ -0,0 +1,30 @@
+#pragma once
+#include <stdbool.h>
+#include "parser.h"
+
+// Every if and while statement is a profile site numbered in source order. Counter 0 counts
+// the then branch or the loop body, counter 1 the else branch (taken even without an else)
+// or the loop exit.
+#define PROFILE_COUNTERS_PER_SITE 2
+
+// the counters loaded on a thread
+typedef struct Profile {
+    Word* counters;
+    int sites_count;
+    Word hottest;
+} Profile;
+
+void profile_load(const char* path, int site_count);
+void profile_free();
+// Lets another thread read the profile loaded on this one while it stays loaded. A thread
+// reading a shared profile stops with profile_share((Profile) { 0 }) instead of profile_free.
+Profile profile_current();
+void profile_share(Profile profile);
+bool profile_is_loaded();
+Word profile_count(int site, int counter);
+// the site never ran
+bool profile_is_unreached(int site);
+// the counter ran in less than 1% of the executions of the site
+bool profile_is_cold(int site, int counter);
+// the site ran at least a tenth as often as the hottest site
+bool profile_is_hot(int site);
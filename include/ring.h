@@ -0,0 +1,29 @@
+#pragma once
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define RING_CAPACITY 64
+// a waiting side yields the cpu this many times before it starts to sleep between checks
+#define RING_YIELDS_BEFORE_SLEEP 64
+#define RING_SLEEP_NANOSECONDS 50000
+
+// Queue of pointers from one producer thread to one consumer thread. Only the producer moves
+// the tail and only the consumer moves the head, so no lock is needed. A full or empty ring
+// is waited on with ring_backoff.
+typedef struct Ring {
+    void* slots[RING_CAPACITY];
+    // on their own cache lines, each is written by one side
+    _Alignas(64) atomic_size_t head;
+    _Alignas(64) atomic_size_t tail;
+    // shared by the rings of a pipeline, stops the waiting on both sides
+    atomic_bool* is_cancelled;
+} Ring;
+
+// Waits a little longer every time nothing changed, attempts starts at 0.
+void ring_backoff(int* attempts);
+void ring_init(Ring* ring, atomic_bool* is_cancelled);
+// false when cancelled while the ring was full
+bool ring_push(Ring* ring, void* item);
+// false when cancelled while the ring was empty
+bool ring_pop(Ring* ring, void** item);
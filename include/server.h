@@ -0,0 +1,7 @@
+#pragma once
+
+// Listens on the unix socket at path and compiles the requests of bbc --connect on worker
+// threads, only returns if the socket can't be set up.
+int server_run(const char* path);
+// Sends the arguments to the server at path, prints its diagnostics and returns its exit status.
+int server_request(const char* path, int argc, char** argv);
@@ -0,0 +1,43 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Input read in chunks into one growing buffer, so it can come from a pipe. The bytes read
+// so far are always followed by '\0'. Tokens point into the buffer, so whoever refills it
+// has to move them when the buffer is reallocated. Bytes nothing looks at anymore may be
+// dropped from the front, offsets are relative to the first byte still in the buffer.
+typedef struct Source {
+    const char* path;
+    FILE* file;
+    char* buffer;
+    size_t size;
+    size_t capacity;
+    bool is_at_end;
+    // offsets of the first byte of every line, extended on lookups
+    uint32_t* line_starts;
+    int lines_count;
+    int lines_capacity;
+    // bytes searched for newlines so far
+    size_t lines_scanned;
+    // lines that were dropped whole, and the dropped bytes of the first line in the buffer
+    int dropped_lines;
+    size_t dropped_columns;
+} Source;
+
+// "-" reads the standard input
+Source source_open(const char* path);
+// Appends the next chunk of the input, returns false when there is nothing more to read.
+bool source_refill(Source* source);
+// Reads the rest of the input, which has to fit offsets of tokens.
+void source_read_all(Source* source);
+// 1-based line and column of the byte at offset, once the whole input is read and one lookup
+// scanned it, lookups may run on several threads
+void source_locate(Source* source, size_t offset, int* line, int* column);
+// diagnostics() after the place of an error, "path:line: " for 1 + the offset of its first
+// byte, or "path: " for 0
+FILE* source_diagnostics(Source* source, uint32_t location);
+// Drops the first count bytes, lines and columns of the rest are still counted from the start
+// of the input.
+void source_drop(Source* source, size_t count);
+void source_close(Source* source);
@@ -0,0 +1,11 @@
+#pragma once
+#include "options.h"
+#include "source.h"
+
+// Compiles every top-level definition or statement as soon as it is lexed and parsed, then
+// frees its tokens, its tree and the source before it, so memory does not grow with the size
+// of the input. Calls are not inlined and statements outside of functions are not optimized
+// past folding constants. The stages are not printed.
+void stream_compile(Source* source, const Options* options);
+// releases what a compilation interrupted by fail() left behind
+void stream_abort();
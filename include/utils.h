@@ -1,4 +1,8 @@
 #pragma once
+#include <setjmp.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
 
 #define GROW_CAPACITY(capacity) \
     ((capacity) < 4 ? 4 : (capacity) * 2)
@@ -6,6 +10,40 @@
 #define GROW_ARRAY(type, pointer, old_count, new_count) \
     (type*)reallocate(pointer, sizeof(type) * (new_count))
 
-void* reallocate(void* pointer, int new_size);
+void* reallocate(void* pointer, size_t new_size);
 
-char* file_read(const char* file_path);
+// FNV-1a, hash_bytes goes on from the hash of the bytes before
+#define HASH_SEED 14695981039346656037u
+uint64_t hash_bytes(uint64_t hash, const void* data, size_t size);
+uint64_t hash_string(const char* string);
+
+// Open addressing from a hash, and a name when there is one, to an index into an array of the
+// caller. The names are not copied. The table is at most half full, so probes stay short.
+typedef struct HashSlot {
+    uint64_t hash;
+    const char* name;
+    // -1 for an empty slot
+    int index;
+} HashSlot;
+
+typedef struct HashTable {
+    HashSlot* slots;
+    size_t capacity;
+    size_t count;
+} HashTable;
+
+// -1 when the table does not have the key
+int hash_table_find(const HashTable* table, uint64_t hash, const char* name);
+// the index the key already has, or the given one it is added with
+int hash_table_add(HashTable* table, uint64_t hash, const char* name, int index);
+// empties the table and keeps its slots
+void hash_table_clear(HashTable* table);
+void hash_table_free(HashTable* table);
+
+// Errors are reported to diagnostics() and end the compilation with fail(). Both are per
+// thread: a server worker captures the messages of a request and recovers from fail() with
+// longjmp, everywhere else they go to stderr and the process exits.
+FILE* diagnostics();
+void set_diagnostics(FILE* stream);
+void set_fail_handler(jmp_buf* handler);
+_Noreturn void fail();
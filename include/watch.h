@@ -0,0 +1,8 @@
+#pragma once
+#include "options.h"
+
+// Compiles options->input_path, then again every time the file is written, until the process
+// is killed. Every top-level definition is only parsed and compiled again when its tokens,
+// the names the program defines or the functions it may inline changed, the code of the
+// others comes from the previous compilations. Only returns if the file can't be watched.
+int watch_run(const Options* options);
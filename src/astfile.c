@@ -0,0 +1,828 @@
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "astfile.h"
+#include "utils.h"
+
+#define ASTFILE_MAGIC "bbc-ast\n"
+#define ASTFILE_MAGIC_SIZE 8
+// written as the machine stores it, a machine with the other byte order reads it swapped
+#define ASTFILE_BYTE_ORDER 0x01020304u
+// a reference to no node, real ones point back to children written before their parents
+#define ASTFILE_NO_NODE 0
+// the record of a missing optional child, referenced as ASTFILE_NO_NODE
+#define ASTFILE_NO_RECORD UINT32_MAX
+
+// Numbers are in the byte order of the machine that wrote the file. The nodes come right
+// after the header, then the strings and the line starts, each 4-byte aligned.
+typedef struct {
+    char magic[ASTFILE_MAGIC_SIZE];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t word_size;
+    uint32_t site_count;
+    // offset of the program record in the nodes
+    uint32_t root;
+    uint32_t nodes_offset;
+    uint32_t nodes_size;
+    uint32_t strings_offset;
+    uint32_t strings_size;
+    // offset of the path of the source in the strings
+    uint32_t source_path;
+    uint32_t lines_offset;
+    uint32_t lines_count;
+} ASTFileHeader;
+
+// Every node is a record of 32-bit numbers: its type, its location and then its fields, see
+// write_record. References to children are the offset of the child minus the one of the record,
+// names are offsets into the strings and words take two numbers, the low one first.
+
+// the file being written
+static _Thread_local uint32_t* records = NULL;
+static _Thread_local int records_count = 0;
+static _Thread_local int records_capacity = 0;
+static _Thread_local char* strings = NULL;
+static _Thread_local int strings_size = 0;
+static _Thread_local int strings_capacity = 0;
+// offsets of the strings, the names it keys on belong to the tree being written
+static _Thread_local HashTable string_offsets = { 0 };
+// the nodes on the way down to the one being written, with the index of their next child
+typedef struct {
+    ASTNode* node;
+    int next_child;
+} WrittenNode;
+
+static _Thread_local WrittenNode* written_nodes = NULL;
+static _Thread_local int written_nodes_count = 0;
+static _Thread_local int written_nodes_capacity = 0;
+// the records of the children written so far whose parents are not written yet
+static _Thread_local uint32_t* child_records = NULL;
+static _Thread_local int child_records_count = 0;
+static _Thread_local int child_records_capacity = 0;
+
+// the file being loaded
+static _Thread_local const char* file_path = NULL;
+static _Thread_local void* mapping = NULL;
+static _Thread_local size_t mapping_size = 0;
+static _Thread_local const uint32_t* nodes = NULL;
+static _Thread_local uint32_t nodes_size = 0;
+static _Thread_local const char* loaded_strings = NULL;
+static _Thread_local uint32_t loaded_strings_size = 0;
+// records already turned into nodes, one flag for every number, so no node has two parents
+static _Thread_local bool* is_loaded = NULL;
+// the switch whose body is being loaded, its case labels are collected like the parser does
+static _Thread_local ASTNode* current_switch = NULL;
+
+static void emit(uint32_t number) {
+    if (records_capacity < records_count + 1) {
+        int old_capacity = records_capacity;
+        records_capacity = GROW_CAPACITY(old_capacity);
+        records = GROW_ARRAY(uint32_t, records, old_capacity, records_capacity);
+    }
+    records[records_count++] = number;
+}
+
+static void emit_word(Word word) {
+    emit((uint32_t)word);
+    emit((uint32_t)((uint64_t)word >> 32));
+}
+
+// every name is stored once, however many nodes use it
+static uint32_t add_string(const char* string) {
+    int offset = hash_table_add(&string_offsets, hash_string(string), string, strings_size);
+    if (offset != strings_size) return offset;
+
+    int size = (int)strlen(string) + 1;
+    if (strings_capacity < strings_size + size) {
+        int old_capacity = strings_capacity;
+        strings_capacity = GROW_CAPACITY(old_capacity);
+        while (strings_capacity < strings_size + size) {
+            strings_capacity *= 2;
+        }
+        strings = GROW_ARRAY(char, strings, old_capacity, strings_capacity);
+    }
+    memcpy(strings + strings_size, string, size);
+    strings_size += size;
+    return offset;
+}
+
+static uint32_t begin_record(ASTNode* node) {
+    uint32_t start = records_count * sizeof(uint32_t);
+    emit(node->type);
+    emit(node->location);
+    return start;
+}
+
+static void emit_reference(uint32_t record, uint32_t child) {
+    emit(child == ASTFILE_NO_RECORD ? ASTFILE_NO_NODE : child - record);
+}
+
+static void emit_references(uint32_t record, const uint32_t* offsets, int count) {
+    emit(count);
+    for (int i = 0; i < count; ++i) {
+        emit_reference(record, offsets[i]);
+    }
+}
+
+// The record of the node, children holds the records of its children in the order of
+// parser_child_slot, ASTFILE_NO_RECORD for the missing optional ones.
+static uint32_t write_record(ASTNode* node, const uint32_t* children) {
+    switch (node->type) {
+        case AST_NODE_PROGRAM: {
+            uint32_t record = begin_record(node);
+            emit_references(record, children, node->program.count);
+            return record;
+        }
+        case AST_NODE_FUNCTION: {
+            uint32_t record = begin_record(node);
+            emit(add_string(node->function.name));
+            emit(node->function.parameter_count);
+            for (int i = 0; i < node->function.parameter_count; ++i) {
+                emit(add_string(node->function.parameters[i]));
+            }
+            emit_reference(record, children[0]);
+            return record;
+        }
+        case AST_NODE_VECTOR_DEFINITION: {
+            uint32_t record = begin_record(node);
+            emit(add_string(node->vector.name));
+            emit(node->vector.is_scalar);
+            emit_word(node->vector.bound);
+            emit(node->vector.count);
+            for (int i = 0; i < node->vector.count; ++i) {
+                emit_word(node->vector.values[i]);
+            }
+            return record;
+        }
+        case AST_NODE_BLOCK: {
+            uint32_t record = begin_record(node);
+            emit_references(record, children, node->block.count);
+            return record;
+        }
+        case AST_NODE_EXPRESSION_STATEMENT:
+        case AST_NODE_RETURN_STATEMENT: {
+            uint32_t record = begin_record(node);
+            emit_reference(record, children[0]);
+            return record;
+        }
+        case AST_NODE_IF_STATEMENT: {
+            uint32_t record = begin_record(node);
+            emit_reference(record, children[0]);
+            emit_reference(record, children[1]);
+            emit_reference(record, children[2]);
+            emit(node->if_statement.site);
+            return record;
+        }
+        case AST_NODE_WHILE_STATEMENT: {
+            uint32_t record = begin_record(node);
+            emit_reference(record, children[0]);
+            emit_reference(record, children[1]);
+            emit(node->while_statement.site);
+            return record;
+        }
+        case AST_NODE_SWITCH_STATEMENT: {
+            // the cases are in the body, loading it collects them again
+            uint32_t record = begin_record(node);
+            emit_reference(record, children[0]);
+            emit_reference(record, children[1]);
+            emit(node->switch_statement.count);
+            return record;
+        }
+        case AST_NODE_CASE: {
+            uint32_t record = begin_record(node);
+            emit_word(node->case_label.value);
+            emit(node->case_label.is_default);
+            emit_reference(record, children[0]);
+            return record;
+        }
+        case AST_NODE_BREAK_STATEMENT: {
+            return begin_record(node);
+        }
+        case AST_NODE_VARIABLE_DECLARATION: {
+            uint32_t record = begin_record(node);
+            emit(add_string(node->declaration.name));
+            emit(node->declaration.is_vector);
+            emit_word(node->declaration.bound);
+            return record;
+        }
+        case AST_NODE_EXTRN_DECLARATION:
+        case AST_NODE_VARIABLE: {
+            uint32_t record = begin_record(node);
+            emit(add_string(node->name));
+            return record;
+        }
+        case AST_NODE_ASSIGNMENT: {
+            uint32_t record = begin_record(node);
+            emit(add_string(node->assignment.name));
+            emit_reference(record, children[0]);
+            return record;
+        }
+        case AST_NODE_SUBSCRIPT:
+        case AST_NODE_SUBSCRIPT_ASSIGNMENT: {
+            uint32_t record = begin_record(node);
+            emit_reference(record, children[0]);
+            emit_reference(record, children[1]);
+            emit_reference(record, children[2]);
+            return record;
+        }
+        case AST_NODE_BINARY: {
+            uint32_t record = begin_record(node);
+            emit(node->binary.op);
+            emit_reference(record, children[0]);
+            emit_reference(record, children[1]);
+            return record;
+        }
+        case AST_NODE_UNARY: {
+            uint32_t record = begin_record(node);
+            emit(node->unary.op);
+            emit_reference(record, children[0]);
+            return record;
+        }
+        case AST_NODE_LITERAL: {
+            uint32_t record = begin_record(node);
+            emit_word(node->literal);
+            return record;
+        }
+        case AST_NODE_STRING: {
+            // the bytes can hold '\0', they are not in the strings
+            uint32_t record = begin_record(node);
+            emit(node->string.length);
+            for (int i = 0; i < node->string.length; i += sizeof(uint32_t)) {
+                uint32_t number = 0;
+                int size = node->string.length - i < (int)sizeof(uint32_t) ? node->string.length - i : (int)sizeof(uint32_t);
+                memcpy(&number, node->string.bytes + i, size);
+                emit(number);
+            }
+            return record;
+        }
+        case AST_NODE_CALL: {
+            uint32_t record = begin_record(node);
+            emit(add_string(node->call.name));
+            emit_references(record, children, node->call.count);
+            return record;
+        }
+        case AST_NODE_INLINED_CALL: {
+            uint32_t record = begin_record(node);
+            emit(add_string(node->inlined_call.name));
+            emit_references(record, children, node->inlined_call.count);
+            for (int i = 0; i < node->inlined_call.count; ++i) {
+                emit(add_string(node->inlined_call.parameters[i]));
+            }
+            emit_reference(record, children[node->inlined_call.count]);
+            return record;
+        }
+    }
+    fprintf(diagnostics(), "error: unknown AST node to write: %d\n", node->type);
+    fail();
+}
+
+static void push_written(ASTNode* node) {
+    if (written_nodes_capacity < written_nodes_count + 1) {
+        int old_capacity = written_nodes_capacity;
+        written_nodes_capacity = GROW_CAPACITY(old_capacity);
+        written_nodes = GROW_ARRAY(WrittenNode, written_nodes, old_capacity, written_nodes_capacity);
+    }
+    written_nodes[written_nodes_count++] = (WrittenNode) { .node = node, .next_child = 0 };
+}
+
+static void push_child_record(uint32_t record) {
+    if (child_records_capacity < child_records_count + 1) {
+        int old_capacity = child_records_capacity;
+        child_records_capacity = GROW_CAPACITY(old_capacity);
+        child_records = GROW_ARRAY(uint32_t, child_records, old_capacity, child_records_capacity);
+    }
+    child_records[child_records_count++] = record;
+}
+
+// Children are written before their parents, so the program comes last. The nodes on the way
+// down are on a stack instead of the C stack, so deep trees only need memory.
+static uint32_t write_tree(ASTNode* root) {
+    push_written(root);
+    while (written_nodes_count > 0) {
+        WrittenNode* top = &written_nodes[written_nodes_count - 1];
+        ASTNode** child = parser_child_slot(top->node, top->next_child++);
+        if (child == NULL) {
+            child_records_count -= top->next_child - 1;
+            ASTNode* node = top->node;
+            --written_nodes_count;
+            uint32_t record = write_record(node, &child_records[child_records_count]);
+            push_child_record(record);
+        }
+        else if (*child == NULL) {
+            push_child_record(ASTFILE_NO_RECORD);
+        }
+        else {
+            push_written(*child);
+        }
+    }
+    return child_records[--child_records_count];
+}
+
+static void free_writer() {
+    free(records);
+    records = NULL;
+    records_count = 0;
+    records_capacity = 0;
+    free(strings);
+    strings = NULL;
+    strings_size = 0;
+    strings_capacity = 0;
+    hash_table_free(&string_offsets);
+    free(written_nodes);
+    written_nodes = NULL;
+    written_nodes_count = 0;
+    written_nodes_capacity = 0;
+    free(child_records);
+    child_records = NULL;
+    child_records_count = 0;
+    child_records_capacity = 0;
+}
+
+static void write_padding(FILE* file, size_t size) {
+    static const char zeros[sizeof(uint32_t)] = { 0 };
+    fwrite(zeros, 1, (sizeof(uint32_t) - size % sizeof(uint32_t)) % sizeof(uint32_t), file);
+}
+
+void astfile_write(const char* path, ASTNode* program, Source* source) {
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) {
+        fprintf(diagnostics(), "error: failed to open file: %s\n", path);
+        fail();
+    }
+
+    // the lookup scans the whole input into the line table
+    int line, column;
+    source_locate(source, 0, &line, &column);
+
+    free_writer();
+    uint32_t root = write_tree(program);
+    uint32_t source_path = add_string(source->path);
+
+    size_t nodes_bytes = records_count * sizeof(uint32_t);
+    size_t strings_offset = sizeof(ASTFileHeader) + nodes_bytes;
+    size_t lines_offset = strings_offset + strings_size + (sizeof(uint32_t) - strings_size % sizeof(uint32_t)) % sizeof(uint32_t);
+    if (lines_offset + source->lines_count * sizeof(uint32_t) > UINT32_MAX) {
+        free_writer();
+        fclose(file);
+        fprintf(diagnostics(), "error: the AST of %s does not fit in 4 GiB\n", source->path);
+        fail();
+    }
+
+    ASTFileHeader header = {
+        .version = ASTFILE_VERSION,
+        .byte_order = ASTFILE_BYTE_ORDER,
+        .word_size = sizeof(Word),
+        .site_count = program->program.site_count,
+        .root = root,
+        .nodes_offset = sizeof(ASTFileHeader),
+        .nodes_size = nodes_bytes,
+        .strings_offset = strings_offset,
+        .strings_size = strings_size,
+        .source_path = source_path,
+        .lines_offset = lines_offset,
+        .lines_count = source->lines_count,
+    };
+    memcpy(header.magic, ASTFILE_MAGIC, ASTFILE_MAGIC_SIZE);
+    fwrite(&header, sizeof(header), 1, file);
+    fwrite(records, sizeof(uint32_t), records_count, file);
+    fwrite(strings, 1, strings_size, file);
+    write_padding(file, strings_size);
+    fwrite(source->line_starts, sizeof(uint32_t), source->lines_count, file);
+    free_writer();
+
+    if (ferror(file)) {
+        fclose(file);
+        fprintf(diagnostics(), "error: failed to write file: %s\n", path);
+        fail();
+    }
+    fclose(file);
+}
+
+bool astfile_is_ast_file(const char* path) {
+    if (strcmp(path, "-") == 0) return false;
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) return false;
+    char magic[ASTFILE_MAGIC_SIZE];
+    bool is_ast_file = fread(magic, 1, ASTFILE_MAGIC_SIZE, file) == ASTFILE_MAGIC_SIZE
+        && memcmp(magic, ASTFILE_MAGIC, ASTFILE_MAGIC_SIZE) == 0;
+    fclose(file);
+    return is_ast_file;
+}
+
+static _Noreturn void fail_invalid() {
+    fprintf(diagnostics(), "error: invalid AST file: %s\n", file_path);
+    fail();
+}
+
+// The numbers of a record, read in order.
+typedef struct {
+    uint32_t start;
+    uint32_t position;
+} Record;
+
+// a node being loaded, its record is read up to the reference of the child at next_child
+typedef struct {
+    ASTNode* node;
+    Record record;
+    int next_child;
+    // the switch to go back to after the body of a switch
+    ASTNode* enclosing_switch;
+} LoadedNode;
+
+static _Thread_local LoadedNode* loaded_nodes = NULL;
+static _Thread_local int loaded_nodes_count = 0;
+static _Thread_local int loaded_nodes_capacity = 0;
+
+static uint32_t next_number(Record* record) {
+    if (record->position >= nodes_size) {
+        fail_invalid();
+    }
+    uint32_t number = nodes[record->position / sizeof(uint32_t)];
+    record->position += sizeof(uint32_t);
+    return number;
+}
+
+static Word next_word(Record* record) {
+    uint64_t low = next_number(record);
+    uint64_t high = next_number(record);
+    return (Word)(low | high << 32);
+}
+
+// a count of elements taking at least size bytes each, which have to fit in the nodes
+static int next_count(Record* record, uint32_t size) {
+    uint32_t count = next_number(record);
+    if (count > (nodes_size - record->position) / size) {
+        fail_invalid();
+    }
+    return (int)count;
+}
+
+static char* next_string(Record* record) {
+    uint32_t offset = next_number(record);
+    if (offset >= loaded_strings_size) {
+        fail_invalid();
+    }
+    // the strings end with '\0', which was checked with the header
+    return strdup(loaded_strings + offset);
+}
+
+static char** next_strings(Record* record, int count) {
+    if (count == 0) return NULL;
+    char** names = malloc(sizeof(char*) * count);
+    for (int i = 0; i < count; ++i) {
+        names[i] = next_string(record);
+    }
+    return names;
+}
+
+static TokenType next_operator(Record* record) {
+    uint32_t op = next_number(record);
+    if (op >= TOKEN_ERROR) {
+        fail_invalid();
+    }
+    return op;
+}
+
+static void add_case(ASTNode* node) {
+    if (current_switch == NULL) {
+        fail_invalid();
+    }
+    if (node->case_label.is_default) {
+        if (current_switch->switch_statement.default_case != NULL) {
+            fail_invalid();
+        }
+        current_switch->switch_statement.default_case = node;
+        return;
+    }
+    if (current_switch->switch_statement.capacity < current_switch->switch_statement.count + 1) {
+        int old_capacity = current_switch->switch_statement.capacity;
+        current_switch->switch_statement.capacity = GROW_CAPACITY(old_capacity);
+        current_switch->switch_statement.cases = GROW_ARRAY(
+            ASTNode*, current_switch->switch_statement.cases, old_capacity, current_switch->switch_statement.capacity
+        );
+    }
+    current_switch->switch_statement.cases[current_switch->switch_statement.count++] = node;
+}
+
+// The node of the record at offset with the fields before its first child, which the
+// frame reads on with. Children are loaded in the order the parser made them.
+static LoadedNode begin_node(uint32_t offset) {
+    if (offset % sizeof(uint32_t) != 0 || offset >= nodes_size || is_loaded[offset / sizeof(uint32_t)]) {
+        fail_invalid();
+    }
+    is_loaded[offset / sizeof(uint32_t)] = true;
+
+    Record record = { .start = offset, .position = offset };
+    uint32_t type = next_number(&record);
+    if (type > AST_NODE_INLINED_CALL) {
+        fail_invalid();
+    }
+    ASTNode* node = calloc(1, sizeof(ASTNode));
+    node->type = type;
+    node->location = next_number(&record);
+
+    switch (node->type) {
+        case AST_NODE_PROGRAM: {
+            fail_invalid();
+        }
+        case AST_NODE_FUNCTION: {
+            node->function.name = next_string(&record);
+            node->function.parameter_count = next_count(&record, sizeof(uint32_t));
+            node->function.parameters = next_strings(&record, node->function.parameter_count);
+        } break;
+        case AST_NODE_VECTOR_DEFINITION: {
+            node->vector.name = next_string(&record);
+            node->vector.is_scalar = next_number(&record) != 0;
+            node->vector.bound = next_word(&record);
+            node->vector.count = next_count(&record, sizeof(Word));
+            node->vector.values = malloc(sizeof(Word) * (node->vector.count > 0 ? node->vector.count : 1));
+            for (int i = 0; i < node->vector.count; ++i) {
+                node->vector.values[i] = next_word(&record);
+            }
+        } break;
+        case AST_NODE_BLOCK: {
+            node->block.count = next_count(&record, sizeof(uint32_t));
+            node->block.capacity = node->block.count;
+            node->block.statements = calloc(node->block.count > 0 ? node->block.count : 1, sizeof(ASTNode*));
+        } break;
+        case AST_NODE_CASE: {
+            node->case_label.value = next_word(&record);
+            node->case_label.is_default = next_number(&record) != 0;
+            node->case_label.label = -1;
+            add_case(node);
+        } break;
+        case AST_NODE_VARIABLE_DECLARATION: {
+            node->declaration.name = next_string(&record);
+            node->declaration.is_vector = next_number(&record) != 0;
+            node->declaration.bound = next_word(&record);
+        } break;
+        case AST_NODE_EXTRN_DECLARATION:
+        case AST_NODE_VARIABLE: {
+            node->name = next_string(&record);
+        } break;
+        case AST_NODE_ASSIGNMENT: {
+            node->assignment.name = next_string(&record);
+        } break;
+        case AST_NODE_BINARY: {
+            node->binary.op = next_operator(&record);
+        } break;
+        case AST_NODE_UNARY: {
+            node->unary.op = next_operator(&record);
+        } break;
+        case AST_NODE_LITERAL: {
+            node->literal = next_word(&record);
+        } break;
+        case AST_NODE_STRING: {
+            node->string.length = next_count(&record, 1);
+            node->string.bytes = malloc(node->string.length + 1);
+            for (int i = 0; i < node->string.length; i += sizeof(uint32_t)) {
+                uint32_t number = next_number(&record);
+                int size = node->string.length - i < (int)sizeof(uint32_t) ? node->string.length - i : (int)sizeof(uint32_t);
+                memcpy(node->string.bytes + i, &number, size);
+            }
+            node->string.bytes[node->string.length] = '\0';
+        } break;
+        case AST_NODE_CALL: {
+            node->call.name = next_string(&record);
+            node->call.count = next_count(&record, sizeof(uint32_t));
+            node->call.capacity = node->call.count;
+            node->call.arguments = calloc(node->call.count > 0 ? node->call.count : 1, sizeof(ASTNode*));
+        } break;
+        case AST_NODE_INLINED_CALL: {
+            node->inlined_call.name = next_string(&record);
+            node->inlined_call.count = next_count(&record, 2 * sizeof(uint32_t));
+            node->inlined_call.arguments = calloc(node->inlined_call.count > 0 ? node->inlined_call.count : 1, sizeof(ASTNode*));
+        } break;
+        default: break;
+    }
+    return (LoadedNode) { .node = node, .record = record, .next_child = 0 };
+}
+
+// the fields between the children of the node, before the child at the index
+static void continue_node(LoadedNode* loaded, int index) {
+    ASTNode* node = loaded->node;
+    if (node->type == AST_NODE_SWITCH_STATEMENT && index == 1) {
+        loaded->enclosing_switch = current_switch;
+        current_switch = node;
+    }
+    else if (node->type == AST_NODE_INLINED_CALL && index == node->inlined_call.count) {
+        node->inlined_call.parameters = next_strings(&loaded->record, node->inlined_call.count);
+    }
+}
+
+// the fields after the last child of the node
+static void end_node(LoadedNode* loaded) {
+    ASTNode* node = loaded->node;
+    switch (node->type) {
+        case AST_NODE_IF_STATEMENT: {
+            node->if_statement.site = next_number(&loaded->record);
+        } break;
+        case AST_NODE_WHILE_STATEMENT: {
+            node->while_statement.site = next_number(&loaded->record);
+        } break;
+        case AST_NODE_SWITCH_STATEMENT: {
+            current_switch = loaded->enclosing_switch;
+            if (next_number(&loaded->record) != (uint32_t)node->switch_statement.count) {
+                fail_invalid();
+            }
+        } break;
+        default: break;
+    }
+}
+
+// whether the child at the index may be missing
+static bool is_optional_child(ASTNode* node, int index) {
+    switch (node->type) {
+        case AST_NODE_RETURN_STATEMENT: return true;
+        case AST_NODE_IF_STATEMENT: return index == 2;
+        case AST_NODE_SUBSCRIPT:
+        case AST_NODE_SUBSCRIPT_ASSIGNMENT: return index == 2;
+        default: return false;
+    }
+}
+
+static void push_loaded(LoadedNode loaded) {
+    if (loaded_nodes_capacity < loaded_nodes_count + 1) {
+        int old_capacity = loaded_nodes_capacity;
+        loaded_nodes_capacity = GROW_CAPACITY(old_capacity);
+        loaded_nodes = GROW_ARRAY(LoadedNode, loaded_nodes, old_capacity, loaded_nodes_capacity);
+    }
+    loaded_nodes[loaded_nodes_count++] = loaded;
+}
+
+// The node the reference read from the record points to, NULL for no node. The nodes on the
+// way down are on a stack instead of the C stack, so deep trees only need memory.
+static ASTNode* next_optional(Record* record) {
+    uint32_t reference = next_number(record);
+    if (reference == ASTFILE_NO_NODE) return NULL;
+    // children come before their parents, so references can't go round in circles
+    int64_t offset = (int64_t)record->start + (int32_t)reference;
+    if ((int32_t)reference >= 0 || offset < 0) {
+        fail_invalid();
+    }
+    LoadedNode root = begin_node((uint32_t)offset);
+    int base = loaded_nodes_count;
+    push_loaded(root);
+    while (loaded_nodes_count > base) {
+        LoadedNode* top = &loaded_nodes[loaded_nodes_count - 1];
+        int index = top->next_child;
+        ASTNode** slot = parser_child_slot(top->node, index);
+        if (slot == NULL) {
+            end_node(top);
+            --loaded_nodes_count;
+            continue;
+        }
+        continue_node(top, index);
+        ++top->next_child;
+        reference = next_number(&top->record);
+        if (reference == ASTFILE_NO_NODE) {
+            if (!is_optional_child(top->node, index)) {
+                fail_invalid();
+            }
+            continue;
+        }
+        offset = (int64_t)top->record.start + (int32_t)reference;
+        if ((int32_t)reference >= 0 || offset < 0) {
+            fail_invalid();
+        }
+        // the child is linked before its frame is pushed, which may move the stack
+        LoadedNode child = begin_node((uint32_t)offset);
+        *slot = child.node;
+        push_loaded(child);
+    }
+    return root.node;
+}
+
+static ASTNode* next_node(Record* record) {
+    ASTNode* node = next_optional(record);
+    if (node == NULL) {
+        fail_invalid();
+    }
+    return node;
+}
+
+static ASTNode** next_nodes(Record* record, int count) {
+    ASTNode** children = malloc(sizeof(ASTNode*) * (count > 0 ? count : 1));
+    for (int i = 0; i < count; ++i) {
+        children[i] = next_node(record);
+    }
+    return children;
+}
+
+static ASTNode* load_program(uint32_t offset, int site_count, Source* source) {
+    if (offset % sizeof(uint32_t) != 0 || offset >= nodes_size) {
+        fail_invalid();
+    }
+    Record record = { .start = offset, .position = offset };
+    if (next_number(&record) != AST_NODE_PROGRAM) {
+        fail_invalid();
+    }
+    ASTNode* program = calloc(1, sizeof(ASTNode));
+    program->type = AST_NODE_PROGRAM;
+    program->location = next_number(&record);
+    program->program.count = next_count(&record, sizeof(uint32_t));
+    program->program.capacity = program->program.count;
+    program->program.statements = next_nodes(&record, program->program.count);
+    program->program.site_count = site_count;
+    program->program.source = source;
+    // the compiler takes everything that is not a vector for a function
+    for (int i = 0; i < program->program.count; ++i) {
+        ASTNodeType type = program->program.statements[i]->type;
+        if (type != AST_NODE_FUNCTION && type != AST_NODE_VECTOR_DEFINITION) {
+            fail_invalid();
+        }
+    }
+    return program;
+}
+
+static bool is_section_valid(uint32_t offset, uint64_t size) {
+    return offset % sizeof(uint32_t) == 0 && offset >= sizeof(ASTFileHeader) && offset + size <= mapping_size;
+}
+
+ASTNode* astfile_load(const char* path, Source* source) {
+    astfile_close();
+    file_path = path;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(diagnostics(), "error: failed to open file: %s\n", path);
+        fail();
+    }
+    struct stat status;
+    if (fstat(fd, &status) < 0 || (size_t)status.st_size < sizeof(ASTFileHeader)) {
+        close(fd);
+        fail_invalid();
+    }
+    mapping = mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        mapping = NULL;
+        fprintf(diagnostics(), "error: failed to map file: %s\n", path);
+        fail();
+    }
+    mapping_size = status.st_size;
+
+    ASTFileHeader header;
+    memcpy(&header, mapping, sizeof(header));
+    if (memcmp(header.magic, ASTFILE_MAGIC, ASTFILE_MAGIC_SIZE) != 0) {
+        fail_invalid();
+    }
+    if (header.version != ASTFILE_VERSION) {
+        fprintf(diagnostics(), "error: %s is an AST file of version %u, expected %d\n", path, header.version, ASTFILE_VERSION);
+        fail();
+    }
+    if (header.byte_order != ASTFILE_BYTE_ORDER || header.word_size != sizeof(Word)) {
+        fprintf(diagnostics(), "error: %s was written on a machine with another byte order or word size\n", path);
+        fail();
+    }
+    const char* bytes = mapping;
+    if (!is_section_valid(header.nodes_offset, header.nodes_size)
+        || !is_section_valid(header.lines_offset, (uint64_t)header.lines_count * sizeof(uint32_t))
+        || header.strings_offset < sizeof(ASTFileHeader)
+        || (uint64_t)header.strings_offset + header.strings_size > mapping_size
+        || header.strings_size == 0
+        || bytes[header.strings_offset + header.strings_size - 1] != '\0'
+        || header.source_path >= header.strings_size) {
+        fail_invalid();
+    }
+
+    nodes = (const uint32_t*)(bytes + header.nodes_offset);
+    nodes_size = header.nodes_size - header.nodes_size % sizeof(uint32_t);
+    loaded_strings = bytes + header.strings_offset;
+    loaded_strings_size = header.strings_size;
+    is_loaded = calloc(nodes_size / sizeof(uint32_t) + 1, sizeof(bool));
+    current_switch = NULL;
+
+    *source = (Source) {
+        .path = loaded_strings + header.source_path,
+        .is_at_end = true,
+        .line_starts = malloc(sizeof(uint32_t) * (header.lines_count > 0 ? header.lines_count : 1)),
+        .lines_count = header.lines_count,
+        .lines_capacity = header.lines_count,
+    };
+    memcpy(source->line_starts, bytes + header.lines_offset, sizeof(uint32_t) * header.lines_count);
+
+    ASTNode* program = load_program(header.root, header.site_count, source);
+    free(is_loaded);
+    is_loaded = NULL;
+    return program;
+}
+
+void astfile_close() {
+    if (mapping != NULL) {
+        munmap(mapping, mapping_size);
+    }
+    mapping = NULL;
+    mapping_size = 0;
+    free(is_loaded);
+    is_loaded = NULL;
+    current_switch = NULL;
+    free(loaded_nodes);
+    loaded_nodes = NULL;
+    loaded_nodes_count = 0;
+    loaded_nodes_capacity = 0;
+}
@@ -0,0 +1,1196 @@
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cbackend.h"
+#include "lexer.h"
+#include "parser.h"
+#include "source.h"
+#include "utils.h"
+
+// the inlined calls a return can be in
+#define INLINE_DEPTH_MAX 128
+// deeper statements are indented like the ones at this depth, so the output of deeply nested
+// code does not grow with the square of the depth
+#define INDENT_MAX 32
+
+typedef struct {
+    // points into the AST, NULL for an empty slot
+    const char* name;
+    bool is_function;
+    bool is_vector;
+    int parameter_count;
+    // declared with extrn somewhere in the program
+    bool is_extrn;
+    // used through extrn without being defined, in extern_names
+    bool is_external;
+    // called through extrn, declared as a function
+    bool is_called;
+} Global;
+
+// functions, vectors and names declared with extrn, found through global_names
+static _Thread_local Global* globals = NULL;
+static _Thread_local int globals_capacity = 0;
+static _Thread_local int globals_count = 0;
+static _Thread_local HashTable global_names = { 0 };
+// names used through extrn that the program does not define, in the order of their first use
+static _Thread_local const char** extern_names = NULL;
+static _Thread_local int extern_names_count = 0;
+static _Thread_local int extern_names_capacity = 0;
+
+typedef struct {
+    const char* name;
+    // the name in the output, the one of the global for extrn declarations
+    const char* c_name;
+    bool is_extrn;
+} Local;
+
+// the names in scope, the innermost declaration wins like in the compiler
+static _Thread_local Local* locals = NULL;
+static _Thread_local int locals_count = 0;
+static _Thread_local int locals_capacity = 0;
+// first local of the innermost scope (function body or inlined call)
+static _Thread_local int scope_start = 0;
+
+// Every auto of a function is declared at the top of its C function, so case labels can jump
+// anywhere and the autos of a block stay visible after it like in the compiler.
+typedef struct {
+    // owned
+    char* c_name;
+    // the words of the storage of an auto vector, 0 for a single word
+    Word words;
+} Declaration;
+
+static _Thread_local Declaration* declarations = NULL;
+static _Thread_local int declarations_count = 0;
+static _Thread_local int declarations_capacity = 0;
+static _Thread_local int renamed_count = 0;
+static _Thread_local int temporary_count = 0;
+static _Thread_local int label_count = 0;
+
+// a return inside an inlined body stores its value and jumps to the end of the inlined call
+typedef struct {
+    int result;
+    int label;
+    bool is_used;
+} InlineReturn;
+
+static _Thread_local InlineReturn inline_returns[INLINE_DEPTH_MAX];
+static _Thread_local int inline_returns_count = 0;
+
+static _Thread_local const Options* options = NULL;
+// for the lines of diagnostics
+static _Thread_local Source* source = NULL;
+static _Thread_local bool uses_print = false;
+static _Thread_local int indent = 0;
+// the file being written, the functions and the body of the current one are collected until
+// the declarations they need are known
+static _Thread_local FILE* output = NULL;
+static _Thread_local FILE* functions_text = NULL;
+static _Thread_local char* functions_buffer = NULL;
+static _Thread_local size_t functions_size = 0;
+static _Thread_local FILE* body = NULL;
+static _Thread_local char* body_buffer = NULL;
+static _Thread_local size_t body_size = 0;
+
+// A value computed by the statements written so far: a literal or a temporary. Every other
+// value is copied into a temporary, so the order of the B evaluation is kept by the order of
+// the C statements.
+typedef struct {
+    char text[32];
+} Operand;
+
+static const char* const c_keywords[] = {
+    "auto", "break", "case", "char", "const", "continue", "default", "do", "double", "else",
+    "enum", "extern", "float", "for", "goto", "if", "inline", "int", "long", "register",
+    "restrict", "return", "short", "signed", "sizeof", "static", "struct", "switch", "typedef",
+    "union", "unsigned", "void", "volatile", "while", "_Bool", "_Complex", "_Imaginary",
+};
+
+// names the included headers may define as types or macros
+static const char* const header_prefixes[] = {
+    "INT", "UINT", "PTRDIFF_", "SIZE_", "SIG_ATOMIC_", "WCHAR_", "WINT_",
+};
+
+// NULL for names the program neither defines nor declares with extrn
+static Global* lookup_global(const char* name) {
+    int index = hash_table_find(&global_names, hash_string(name), name);
+    return index >= 0 ? &globals[index] : NULL;
+}
+
+// Globals move when the table grows, so pointers to them are only good until the next one
+// is added.
+static Global* add_global(const char* name) {
+    Global* global = lookup_global(name);
+    if (global != NULL) return global;
+    if (globals_capacity < globals_count + 1) {
+        int old_capacity = globals_capacity;
+        globals_capacity = GROW_CAPACITY(old_capacity);
+        globals = GROW_ARRAY(Global, globals, old_capacity, globals_capacity);
+    }
+    global = &globals[globals_count];
+    *global = (Global) { .name = name };
+    hash_table_add(&global_names, hash_string(name), name, globals_count++);
+    return global;
+}
+
+static bool is_function(const char* name) {
+    Global* global = lookup_global(name);
+    return global != NULL && global->is_function;
+}
+
+// whether the name can be used in the output as it is
+static bool is_c_name(const char* name) {
+    if (name[0] == '_' || strncmp(name, "bbc_", 4) == 0 || strchr(name, '.') != NULL) return false;
+    size_t length = strlen(name);
+    if (length >= 2 && strcmp(name + length - 2, "_t") == 0) return false;
+    for (size_t i = 0; i < sizeof(c_keywords) / sizeof(c_keywords[0]); ++i) {
+        if (strcmp(name, c_keywords[i]) == 0) return false;
+    }
+    for (size_t i = 0; i < sizeof(header_prefixes) / sizeof(header_prefixes[0]); ++i) {
+        if (strncmp(name, header_prefixes[i], strlen(header_prefixes[i])) == 0) return false;
+    }
+    return true;
+}
+
+// the C name of a function, vector or external name, main is wrapped by the C main
+static const char* global_c_name(const char* name) {
+    return strcmp(name, "main") == 0 ? "bbc_main" : name;
+}
+
+static void check_global_name(const char* name) {
+    if (!is_c_name(name)) {
+        fprintf(diagnostics(), "error: '%s' cannot be used as a name in C\n", name);
+        fail();
+    }
+}
+
+static void define_global(const char* name, bool is_vector, int parameter_count) {
+    check_global_name(name);
+    Global* global = add_global(name);
+    if (global->is_function || global->is_vector) {
+        fprintf(diagnostics(), "error: '%s' already defined\n", name);
+        fail();
+    }
+    global->is_function = !is_vector;
+    global->is_vector = is_vector;
+    global->parameter_count = parameter_count;
+}
+
+// the statements collect_extrns has yet to look at, the last one first
+static _Thread_local ASTNode** pending_statements = NULL;
+static _Thread_local int pending_statements_count = 0;
+static _Thread_local int pending_statements_capacity = 0;
+
+static void push_pending_statement(ASTNode* statement) {
+    if (statement == NULL) return;
+    if (pending_statements_capacity < pending_statements_count + 1) {
+        int old_capacity = pending_statements_capacity;
+        pending_statements_capacity = GROW_CAPACITY(old_capacity);
+        pending_statements = GROW_ARRAY(ASTNode*, pending_statements, old_capacity, pending_statements_capacity);
+    }
+    pending_statements[pending_statements_count++] = statement;
+}
+
+static void collect_extrns(ASTNode* root) {
+    push_pending_statement(root);
+    while (pending_statements_count > 0) {
+        ASTNode* node = pending_statements[--pending_statements_count];
+        switch (node->type) {
+            case AST_NODE_BLOCK: {
+                for (int i = node->block.count - 1; i >= 0; --i) {
+                    push_pending_statement(node->block.statements[i]);
+                }
+            } break;
+            case AST_NODE_IF_STATEMENT: {
+                push_pending_statement(node->if_statement.else_branch);
+                push_pending_statement(node->if_statement.then_branch);
+            } break;
+            case AST_NODE_WHILE_STATEMENT: {
+                push_pending_statement(node->while_statement.body);
+            } break;
+            case AST_NODE_SWITCH_STATEMENT: {
+                push_pending_statement(node->switch_statement.body);
+            } break;
+            case AST_NODE_CASE: {
+                push_pending_statement(node->case_label.statement);
+            } break;
+            case AST_NODE_EXTRN_DECLARATION: {
+                check_global_name(node->name);
+                add_global(node->name)->is_extrn = true;
+            } break;
+            default: break;
+        }
+    }
+}
+
+// marks a name used through extrn, the ones the program does not define are declared
+static void use_external(const char* name, bool is_call) {
+    Global* global = add_global(name);
+    if (global->is_function || global->is_vector) return;
+    global->is_called |= is_call;
+    if (global->is_external) return;
+    global->is_external = true;
+    if (extern_names_capacity < extern_names_count + 1) {
+        int old_capacity = extern_names_capacity;
+        extern_names_capacity = GROW_CAPACITY(old_capacity);
+        extern_names = GROW_ARRAY(const char*, extern_names, old_capacity, extern_names_capacity);
+    }
+    extern_names[extern_names_count++] = global->name;
+}
+
+static void write_indent() {
+    for (int i = 0; i < indent && i < INDENT_MAX; ++i) {
+        fprintf(body, "    ");
+    }
+}
+
+// a line of the current function body at the current depth
+static void write_line(const char* format, ...) {
+    write_indent();
+    va_list arguments;
+    va_start(arguments, format);
+    vfprintf(body, format, arguments);
+    va_end(arguments);
+    fprintf(body, "\n");
+}
+
+static Operand literal_operand(Word value) {
+    Operand operand;
+    if (value == INT64_MIN) {
+        // -9223372036854775808 would be the negation of a constant too large for any type
+        snprintf(operand.text, sizeof(operand.text), "INT64_MIN");
+    }
+    else if (value < 0) {
+        snprintf(operand.text, sizeof(operand.text), "(%ld)", value);
+    }
+    else {
+        snprintf(operand.text, sizeof(operand.text), "%ld", value);
+    }
+    return operand;
+}
+
+static Operand new_temporary() {
+    Operand operand;
+    snprintf(operand.text, sizeof(operand.text), "bbc_t%d", ++temporary_count);
+    return operand;
+}
+
+static Local* find_local(const char* name) {
+    // innermost declaration wins
+    for (int i = locals_count; i > 0; --i) {
+        if (strcmp(name, locals[i - 1].name) == 0) {
+            return &locals[i - 1];
+        }
+    }
+    return NULL;
+}
+
+static bool is_c_name_taken(const char* c_name) {
+    if (lookup_global(c_name) != NULL) return true;
+    for (int i = 0; i < declarations_count; ++i) {
+        if (strcmp(declarations[i].c_name, c_name) == 0) return true;
+    }
+    return false;
+}
+
+static char* add_declaration(char* c_name, Word words) {
+    if (declarations_capacity < declarations_count + 1) {
+        int old_capacity = declarations_capacity;
+        declarations_capacity = GROW_CAPACITY(old_capacity);
+        declarations = GROW_ARRAY(Declaration, declarations, old_capacity, declarations_capacity);
+    }
+    declarations[declarations_count++] = (Declaration) { .c_name = c_name, .words = words };
+    return c_name;
+}
+
+static Local* declare_local(const char* name, bool is_extrn) {
+    Local* existing = find_local(name);
+    if (existing != NULL && existing - locals >= scope_start) {
+        fprintf(diagnostics(), "error: identifier '%s' already declared\n", name);
+        fail();
+    }
+    const char* c_name = name;
+    if (!is_extrn) {
+        // autos keep their names unless C, a global or an earlier auto of the function has it,
+        // the temporaries of the optimizer have a dot in theirs
+        if (is_c_name(name) && !is_c_name_taken(name)) {
+            c_name = add_declaration(strdup(name), 0);
+        }
+        else {
+            char* renamed = malloc(strlen(name) + 32);
+            int length = sprintf(renamed, "bbc_%d_", ++renamed_count);
+            for (const char* c = name; *c != '\0'; ++c) {
+                renamed[length++] = *c == '.' ? '_' : *c;
+            }
+            renamed[length] = '\0';
+            c_name = add_declaration(renamed, 0);
+        }
+    }
+    if (locals_capacity < locals_count + 1) {
+        int old_capacity = locals_capacity;
+        locals_capacity = GROW_CAPACITY(old_capacity);
+        locals = GROW_ARRAY(Local, locals, old_capacity, locals_capacity);
+    }
+    Local* local = &locals[locals_count++];
+    *local = (Local) { .name = name, .c_name = c_name, .is_extrn = is_extrn };
+    return local;
+}
+
+// The word an extrn declaration refers to as an lvalue. Vectors of the program start with a
+// pointer to their first element, functions are read as the words of their code like the
+// compiler does.
+static void write_extrn_word(const char* name, char* buffer, size_t size) {
+    Global* global = lookup_global(name);
+    if (global != NULL && global->is_vector) {
+        snprintf(buffer, size, "%s[0]", name);
+    }
+    else if (global != NULL && global->is_function) {
+        snprintf(buffer, size, "(*(int64_t*)(uintptr_t)%s)", global_c_name(name));
+    }
+    else {
+        use_external(name, false);
+        if (lookup_global(name)->is_called) {
+            snprintf(buffer, size, "(*(int64_t*)(uintptr_t)%s)", name);
+        }
+        else {
+            snprintf(buffer, size, "%s", name);
+        }
+    }
+}
+
+// Where lower goes on with a node once the children before it are written.
+typedef enum {
+    STEP_STATEMENT,
+    STEP_EXPRESSION,
+    STEP_EXPRESSION_STATEMENT_END,
+    STEP_IF_THEN,
+    STEP_IF_ELSE,
+    STEP_IF_END,
+    STEP_WHILE_BODY,
+    STEP_WHILE_END,
+    STEP_SWITCH_BODY,
+    STEP_LABELED_STATEMENT_END,
+    STEP_SWITCH_END,
+    STEP_RETURN_END,
+    STEP_ASSIGNMENT_STORE,
+    STEP_BINARY_OPERATION,
+    STEP_UNARY_OPERATION,
+    STEP_SUBSCRIPT_LOAD,
+    STEP_SUBSCRIPT_STORE,
+    STEP_CALL_END,
+    STEP_INLINED_CALL_BODY,
+    STEP_INLINED_CALL_END,
+} LowerStep;
+
+typedef struct {
+    ASTNode* node;
+    LowerStep step;
+    // whether the value of a call is used, the scope saved by an inlined call
+    int values[2];
+} LowerTask;
+
+// lower runs the tasks from a stack instead of recursing, so deep trees only need memory
+static _Thread_local LowerTask* tasks = NULL;
+static _Thread_local int tasks_count = 0;
+static _Thread_local int tasks_capacity = 0;
+// the values of the expressions written so far whose parents are not written yet
+static _Thread_local Operand* operands = NULL;
+static _Thread_local int operands_count = 0;
+static _Thread_local int operands_capacity = 0;
+
+// The task of the node is run after every task pushed after it, children are pushed last.
+static LowerTask* push_task(ASTNode* node, LowerStep step) {
+    if (tasks_capacity < tasks_count + 1) {
+        int old_capacity = tasks_capacity;
+        tasks_capacity = GROW_CAPACITY(old_capacity);
+        tasks = GROW_ARRAY(LowerTask, tasks, old_capacity, tasks_capacity);
+    }
+    LowerTask* task = &tasks[tasks_count++];
+    *task = (LowerTask) { .node = node, .step = step };
+    return task;
+}
+
+static void push_operand(Operand operand) {
+    if (operands_capacity < operands_count + 1) {
+        int old_capacity = operands_capacity;
+        operands_capacity = GROW_CAPACITY(old_capacity);
+        operands = GROW_ARRAY(Operand, operands, old_capacity, operands_capacity);
+    }
+    operands[operands_count++] = operand;
+}
+
+static Operand pop_operand() {
+    return operands[--operands_count];
+}
+
+// arguments are evaluated right to left, the first one ends on top of the operands
+static void push_arguments(ASTNode** arguments, int count) {
+    for (int i = 0; i < count; ++i) {
+        push_task(arguments[i], STEP_EXPRESSION);
+    }
+}
+
+// Writes the call once its arguments are, its value goes to a temporary when is_used.
+static void end_call(ASTNode* root, bool is_used) {
+    const char* name = root->call.name;
+    int count = root->call.count;
+    Operand* arguments = malloc(sizeof(Operand) * (count > 0 ? count : 1));
+    for (int i = 0; i < count; ++i) {
+        arguments[i] = pop_operand();
+    }
+
+    Local* local = find_local(name);
+    char callee[256];
+    if (local == NULL && strcmp(name, "print") == 0) {
+        // print is a keyword, nothing else can have the name
+        uses_print = true;
+        snprintf(callee, sizeof(callee), "printf");
+    }
+    else if (local != NULL && !local->is_extrn) {
+        snprintf(callee, sizeof(callee), "((int64_t (*)())(uintptr_t)%s)", local->c_name);
+    }
+    else if (is_function(name)) {
+        // the function has a prototype, a call with another number of arguments goes through a
+        // pointer without one like the code of the compiler does
+        if (lookup_global(name)->parameter_count == count) {
+            snprintf(callee, sizeof(callee), "%s", global_c_name(name));
+        }
+        else {
+            snprintf(callee, sizeof(callee), "((int64_t (*)())(uintptr_t)%s)", global_c_name(name));
+        }
+    }
+    else if (local != NULL) {
+        Global* global = lookup_global(name);
+        if (global != NULL && global->is_vector) {
+            snprintf(callee, sizeof(callee), "((int64_t (*)())(uintptr_t)%s)", name);
+        }
+        else {
+            use_external(name, true);
+            snprintf(callee, sizeof(callee), "%s", name);
+        }
+    }
+    else {
+        fprintf(source_diagnostics(source, root->location), "error: call to undeclared function '%s'\n", name);
+        fail();
+    }
+
+    Operand result = is_used ? new_temporary() : (Operand) { "" };
+    write_indent();
+    if (is_used) {
+        fprintf(body, "%s = ", result.text);
+    }
+    fprintf(body, "%s(", callee);
+    if (local == NULL && strcmp(name, "print") == 0) {
+        fprintf(body, "\"%%lld\\n\", (long long)%s", arguments[0].text);
+    }
+    else {
+        for (int i = 0; i < count; ++i) {
+            fprintf(body, i == 0 ? "%s" : ", %s", arguments[i].text);
+        }
+    }
+    fprintf(body, ");\n");
+    free(arguments);
+    push_operand(result);
+}
+
+// the parameters are autos of a scope of their own, a return in the body ends the call
+static void begin_inlined_body(ASTNode* root) {
+    int count = root->inlined_call.count;
+    Operand* arguments = malloc(sizeof(Operand) * (count > 0 ? count : 1));
+    for (int i = 0; i < count; ++i) {
+        arguments[i] = pop_operand();
+    }
+
+    LowerTask* end = push_task(root, STEP_INLINED_CALL_END);
+    end->values[0] = locals_count;
+    end->values[1] = scope_start;
+    scope_start = locals_count;
+    write_line("/* inlined %s */", root->inlined_call.name);
+    for (int i = 0; i < count; ++i) {
+        Local* parameter = declare_local(root->inlined_call.parameters[i], false);
+        write_line("%s = %s;", parameter->c_name, arguments[i].text);
+    }
+    free(arguments);
+
+    if (inline_returns_count == INLINE_DEPTH_MAX) {
+        fprintf(diagnostics(), "error: inlined calls nested too deep\n");
+        fail();
+    }
+    Operand result = new_temporary();
+    push_operand(result);
+    InlineReturn* inline_return = &inline_returns[inline_returns_count++];
+    *inline_return = (InlineReturn) { .result = temporary_count, .label = ++label_count, .is_used = false };
+    push_task(root->inlined_call.body, STEP_STATEMENT);
+}
+
+static void end_inlined_call(const LowerTask* task) {
+    --inline_returns_count;
+    write_line("%s = 0;", operands[operands_count - 1].text);
+    if (inline_returns[inline_returns_count].is_used) {
+        write_line("bbc_return_%d:;", inline_returns[inline_returns_count].label);
+    }
+
+    locals_count = task->values[0];
+    scope_start = task->values[1];
+}
+
+// A C string literal of the bytes, the others than printable ASCII as octal escapes.
+static void write_string_literal(FILE* file, const char* bytes, int length) {
+    fprintf(file, "\"");
+    for (int i = 0; i < length; ++i) {
+        unsigned char c = bytes[i];
+        bool is_plain = c >= ' ' && c <= '~' && c != '"' && c != '\\' && c != '?';
+        fprintf(file, is_plain ? "%c" : "\\%03o", c);
+    }
+    fprintf(file, "\"");
+}
+
+static void begin_expression(ASTNode* root) {
+    switch (root->type) {
+        case AST_NODE_LITERAL: {
+            push_operand(literal_operand(root->literal));
+        } break;
+        case AST_NODE_STRING: {
+            Operand result = new_temporary();
+            write_indent();
+            fprintf(body, "%s = (int64_t)(uintptr_t)", result.text);
+            write_string_literal(body, root->string.bytes, root->string.length);
+            fprintf(body, ";\n");
+            push_operand(result);
+        } break;
+        case AST_NODE_VARIABLE: {
+            Operand result = new_temporary();
+            Local* local = find_local(root->name);
+            if (local == NULL) {
+                // the address of a function defined in the program
+                if (is_function(root->name)) {
+                    write_line("%s = (int64_t)(uintptr_t)%s;", result.text, global_c_name(root->name));
+                    push_operand(result);
+                    break;
+                }
+                fprintf(source_diagnostics(source, root->location), "error: undeclared identifier '%s'\n", root->name);
+                fail();
+            }
+            if (local->is_extrn) {
+                char word[256];
+                write_extrn_word(root->name, word, sizeof(word));
+                write_line("%s = %s;", result.text, word);
+            }
+            else {
+                write_line("%s = %s;", result.text, local->c_name);
+            }
+            push_operand(result);
+        } break;
+        case AST_NODE_ASSIGNMENT: {
+            push_task(root, STEP_ASSIGNMENT_STORE);
+            push_task(root->assignment.value, STEP_EXPRESSION);
+        } break;
+        case AST_NODE_BINARY: {
+            push_task(root, STEP_BINARY_OPERATION);
+            push_task(root->binary.right, STEP_EXPRESSION);
+            push_task(root->binary.left, STEP_EXPRESSION);
+        } break;
+        case AST_NODE_UNARY: {
+            push_task(root, STEP_UNARY_OPERATION);
+            push_task(root->unary.right, STEP_EXPRESSION);
+        } break;
+        case AST_NODE_SUBSCRIPT: {
+            push_task(root, STEP_SUBSCRIPT_LOAD);
+            push_task(root->subscript.index, STEP_EXPRESSION);
+            push_task(root->subscript.vector, STEP_EXPRESSION);
+        } break;
+        case AST_NODE_SUBSCRIPT_ASSIGNMENT: {
+            push_task(root, STEP_SUBSCRIPT_STORE);
+            push_task(root->subscript.value, STEP_EXPRESSION);
+            push_task(root->subscript.index, STEP_EXPRESSION);
+            push_task(root->subscript.vector, STEP_EXPRESSION);
+        } break;
+        case AST_NODE_CALL: {
+            push_task(root, STEP_CALL_END)->values[0] = true;
+            push_arguments(root->call.arguments, root->call.count);
+        } break;
+        case AST_NODE_INLINED_CALL: {
+            push_task(root, STEP_INLINED_CALL_BODY);
+            push_arguments(root->inlined_call.arguments, root->inlined_call.count);
+        } break;
+        default: {
+            fprintf(diagnostics(), "Unknow AST node: %d\n", root->type);
+            fail();
+        };
+    }
+}
+
+static void end_binary(ASTNode* root) {
+    Operand right = pop_operand();
+    Operand left = pop_operand();
+    Operand result = new_temporary();
+    const char* comparison = NULL;
+    switch (root->binary.op) {
+        case TOKEN_SLASH: {
+            write_line("%s = bbc_divide(%s, %s);", result.text, left.text, right.text);
+        } break;
+        case TOKEN_PERCENT: {
+            write_line("%s = bbc_remainder(%s, %s);", result.text, left.text, right.text);
+        } break;
+        case TOKEN_ASTERISK: {
+            write_line("%s = (int64_t)((uint64_t)%s * (uint64_t)%s);", result.text, left.text, right.text);
+        } break;
+        case TOKEN_PLUS: {
+            write_line("%s = (int64_t)((uint64_t)%s + (uint64_t)%s);", result.text, left.text, right.text);
+        } break;
+        case TOKEN_MINUS: {
+            write_line("%s = (int64_t)((uint64_t)%s - (uint64_t)%s);", result.text, left.text, right.text);
+        } break;
+        case TOKEN_NOT_EQUAL: comparison = "!="; break;
+        case TOKEN_EQUAL_EQUAL: comparison = "=="; break;
+        case TOKEN_GREATER: comparison = ">"; break;
+        case TOKEN_GREATER_EQUAL: comparison = ">="; break;
+        case TOKEN_LESS: comparison = "<"; break;
+        case TOKEN_LESS_EQUAL: comparison = "<="; break;
+        default: {
+            fprintf(
+                diagnostics(),
+                "error: invalid operator in binary operation: %s\n",
+                token_as_cstr(root->binary.op)
+            );
+            fail();
+        } break;
+    }
+    if (comparison != NULL) {
+        write_line("%s = %s %s %s;", result.text, left.text, comparison, right.text);
+    }
+    push_operand(result);
+}
+
+static void end_unary(ASTNode* root) {
+    Operand right = pop_operand();
+    Operand result = new_temporary();
+    switch (root->unary.op) {
+        case TOKEN_MINUS: {
+            write_line("%s = (int64_t)(0 - (uint64_t)%s);", result.text, right.text);
+        } break;
+        case TOKEN_NOT: {
+            write_line("%s = !%s;", result.text, right.text);
+        } break;
+        default: {
+            fprintf(
+                diagnostics(),
+                "error: invalid operator in unary operation: %s\n",
+                token_as_cstr(root->unary.op)
+            );
+            fail();
+        }
+    }
+    push_operand(result);
+}
+
+static int compare_case_values(const void* a, const void* b) {
+    Word left = *(const Word*)a;
+    Word right = *(const Word*)b;
+    return (left > right) - (left < right);
+}
+
+// the second case of the switch with the value, in source order
+static ASTNode* duplicate_case(ASTNode* root, Word value) {
+    bool is_seen = false;
+    for (int i = 0; i < root->switch_statement.count; ++i) {
+        ASTNode* case_node = root->switch_statement.cases[i];
+        if (case_node->case_label.value != value) continue;
+        if (is_seen) return case_node;
+        is_seen = true;
+    }
+    return root;
+}
+
+static void check_case_values(ASTNode* root) {
+    int count = root->switch_statement.count;
+    if (count < 2) return;
+    Word* values = malloc(sizeof(Word) * count);
+    for (int i = 0; i < count; ++i) {
+        values[i] = root->switch_statement.cases[i]->case_label.value;
+    }
+    qsort(values, count, sizeof(Word), compare_case_values);
+    for (int i = 1; i < count; ++i) {
+        if (values[i] == values[i - 1]) {
+            Word value = values[i];
+            free(values);
+            ASTNode* duplicate = duplicate_case(root, value);
+            fprintf(source_diagnostics(source, duplicate->location), "error: duplicate case value %ld in switch\n", value);
+            fail();
+        }
+    }
+    free(values);
+}
+
+// a statement that can be the target of a label, also when it writes nothing
+static void push_labeled_statement(ASTNode* root) {
+    write_line("{");
+    ++indent;
+    push_task(root, STEP_LABELED_STATEMENT_END);
+    push_task(root, STEP_STATEMENT);
+}
+
+static void write_return(Operand value) {
+    if (inline_returns_count > 0) {
+        InlineReturn* inline_return = &inline_returns[inline_returns_count - 1];
+        inline_return->is_used = true;
+        write_line("bbc_t%d = %s;", inline_return->result, value.text);
+        write_line("goto bbc_return_%d;", inline_return->label);
+    }
+    else {
+        write_line("return %s;", value.text);
+    }
+}
+
+static void begin_statement(ASTNode* root) {
+    switch (root->type) {
+        case AST_NODE_BLOCK: {
+            for (int i = root->block.count - 1; i >= 0; --i) {
+                push_task(root->block.statements[i], STEP_STATEMENT);
+            }
+        } break;
+        case AST_NODE_EXPRESSION_STATEMENT: {
+            push_task(root, STEP_EXPRESSION_STATEMENT_END);
+            if (root->expression->type == AST_NODE_CALL) {
+                // the value of the call is not used
+                push_task(root->expression, STEP_CALL_END)->values[0] = false;
+                push_arguments(root->expression->call.arguments, root->expression->call.count);
+            }
+            else {
+                push_task(root->expression, STEP_EXPRESSION);
+            }
+        } break;
+        case AST_NODE_IF_STATEMENT: {
+            push_task(root, STEP_IF_THEN);
+            push_task(root->if_statement.condition, STEP_EXPRESSION);
+        } break;
+        case AST_NODE_WHILE_STATEMENT: {
+            // the condition is computed by statements, so it goes inside the loop
+            write_line("for (;;) {");
+            ++indent;
+            push_task(root, STEP_WHILE_BODY);
+            push_task(root->while_statement.condition, STEP_EXPRESSION);
+        } break;
+        case AST_NODE_SWITCH_STATEMENT: {
+            check_case_values(root);
+            push_task(root, STEP_SWITCH_BODY);
+            push_task(root->switch_statement.condition, STEP_EXPRESSION);
+        } break;
+        case AST_NODE_CASE: {
+            if (root->case_label.is_default) {
+                write_line("default:");
+            }
+            else {
+                write_line("case %s:", literal_operand(root->case_label.value).text);
+            }
+            push_labeled_statement(root->case_label.statement);
+        } break;
+        case AST_NODE_BREAK_STATEMENT: {
+            write_line("break;");
+        } break;
+        case AST_NODE_RETURN_STATEMENT: {
+            if (root->expression != NULL) {
+                push_task(root, STEP_RETURN_END);
+                push_task(root->expression, STEP_EXPRESSION);
+            }
+            else {
+                write_return(literal_operand(0));
+            }
+        } break;
+        case AST_NODE_VARIABLE_DECLARATION: {
+            Local* local = declare_local(root->declaration.name, false);
+            if (root->declaration.is_vector) {
+                // the words follow the pointer, v[0] to v[bound]
+                Word words = root->declaration.bound + 1;
+                char* storage = malloc(32);
+                snprintf(storage, 32, "bbc_vector_%d", ++renamed_count);
+                add_declaration(storage, words > 0 ? words : 1);
+                write_line("%s = (int64_t)(uintptr_t)%s;", local->c_name, storage);
+            }
+        } break;
+        case AST_NODE_EXTRN_DECLARATION: {
+            declare_local(root->name, true);
+        } break;
+        default: {
+            fprintf(diagnostics(), "Unknow AST node: %d\n", root->type);
+            fail();
+        };
+    }
+}
+
+static void continue_node(const LowerTask* task) {
+    ASTNode* root = task->node;
+    switch (task->step) {
+        case STEP_STATEMENT: {
+            begin_statement(root);
+        } break;
+        case STEP_EXPRESSION: {
+            begin_expression(root);
+        } break;
+        case STEP_EXPRESSION_STATEMENT_END: {
+            pop_operand();
+        } break;
+        case STEP_IF_THEN: {
+            write_line("if (%s) {", pop_operand().text);
+            ++indent;
+            push_task(root, STEP_IF_ELSE);
+            push_task(root->if_statement.then_branch, STEP_STATEMENT);
+        } break;
+        case STEP_IF_ELSE: {
+            --indent;
+            if (root->if_statement.else_branch != NULL) {
+                write_line("}");
+                write_line("else {");
+                ++indent;
+                push_task(root, STEP_IF_END);
+                push_task(root->if_statement.else_branch, STEP_STATEMENT);
+            }
+            else {
+                write_line("}");
+            }
+        } break;
+        case STEP_IF_END:
+        case STEP_WHILE_END:
+        case STEP_LABELED_STATEMENT_END:
+        case STEP_SWITCH_END: {
+            --indent;
+            write_line("}");
+        } break;
+        case STEP_WHILE_BODY: {
+            write_line("if (!%s) break;", pop_operand().text);
+            push_task(root, STEP_WHILE_END);
+            push_task(root->while_statement.body, STEP_STATEMENT);
+        } break;
+        case STEP_SWITCH_BODY: {
+            write_line("switch (%s) {", pop_operand().text);
+            ++indent;
+            push_task(root, STEP_SWITCH_END);
+            push_labeled_statement(root->switch_statement.body);
+        } break;
+        case STEP_RETURN_END: {
+            write_return(pop_operand());
+        } break;
+        case STEP_ASSIGNMENT_STORE: {
+            // the value stays on the operands as the value of the assignment
+            Operand value = operands[operands_count - 1];
+            Local* local = find_local(root->assignment.name);
+            if (local == NULL) {
+                fprintf(source_diagnostics(source, root->location), "error: undeclared identifier '%s'\n", root->assignment.name);
+                fail();
+            }
+            if (local->is_extrn) {
+                char word[256];
+                write_extrn_word(root->assignment.name, word, sizeof(word));
+                write_line("%s = %s;", word, value.text);
+            }
+            else {
+                write_line("%s = %s;", local->c_name, value.text);
+            }
+        } break;
+        case STEP_BINARY_OPERATION: {
+            end_binary(root);
+        } break;
+        case STEP_UNARY_OPERATION: {
+            end_unary(root);
+        } break;
+        case STEP_SUBSCRIPT_LOAD: {
+            Operand index = pop_operand();
+            Operand vector = pop_operand();
+            Operand result = new_temporary();
+            write_line("%s = *bbc_at(%s, %s);", result.text, vector.text, index.text);
+            push_operand(result);
+        } break;
+        case STEP_SUBSCRIPT_STORE: {
+            Operand value = pop_operand();
+            Operand index = pop_operand();
+            Operand vector = pop_operand();
+            write_line("*bbc_at(%s, %s) = %s;", vector.text, index.text, value.text);
+            push_operand(value);
+        } break;
+        case STEP_CALL_END: {
+            end_call(root, task->values[0]);
+        } break;
+        case STEP_INLINED_CALL_BODY: {
+            begin_inlined_body(root);
+        } break;
+        case STEP_INLINED_CALL_END: {
+            end_inlined_call(task);
+        } break;
+    }
+}
+
+static void lower_statement(ASTNode* root) {
+    int base = tasks_count;
+    push_task(root, STEP_STATEMENT);
+    while (tasks_count > base) {
+        // the steps push tasks, which may move the array
+        LowerTask task = tasks[--tasks_count];
+        continue_node(&task);
+    }
+}
+
+static void free_function_tables() {
+    for (int i = 0; i < declarations_count; ++i) {
+        free(declarations[i].c_name);
+    }
+    declarations_count = 0;
+    locals_count = 0;
+    scope_start = 0;
+    inline_returns_count = 0;
+}
+
+static void write_parameters(FILE* file, int count, bool has_names) {
+    if (count == 0) {
+        fprintf(file, "void");
+    }
+    for (int i = 0; i < count; ++i) {
+        fprintf(file, i == 0 ? "int64_t" : ", int64_t");
+        if (has_names) {
+            fprintf(file, " %s", declarations[i].c_name);
+        }
+    }
+}
+
+static void lower_function(ASTNode* function) {
+    int parameter_count = function->function.parameter_count;
+    renamed_count = 0;
+    temporary_count = 0;
+    label_count = 0;
+    for (int i = 0; i < parameter_count; ++i) {
+        declare_local(function->function.parameters[i], false);
+    }
+
+    body = open_memstream(&body_buffer, &body_size);
+    indent = 1;
+    lower_statement(function->function.body);
+    write_line("return 0;");
+    fclose(body);
+    body = NULL;
+
+    FILE* file = functions_text;
+    fprintf(file, "\nint64_t %s(", global_c_name(function->function.name));
+    write_parameters(file, parameter_count, true);
+    fprintf(file, ") {\n");
+    for (int i = parameter_count; i < declarations_count; ++i) {
+        if (declarations[i].words > 0) {
+            fprintf(file, "    int64_t %s[%ld];\n", declarations[i].c_name, declarations[i].words);
+        }
+        else {
+            fprintf(file, "    int64_t %s = 0;\n", declarations[i].c_name);
+        }
+    }
+    for (int i = 1; i <= temporary_count; ++i) {
+        fprintf(file, i % 8 == 1 ? "    int64_t bbc_t%d" : ", bbc_t%d", i);
+        if (i % 8 == 0 || i == temporary_count) {
+            fprintf(file, ";\n");
+        }
+    }
+    fwrite(body_buffer, 1, body_size, file);
+    fprintf(file, "}\n");
+    free(body_buffer);
+    body_buffer = NULL;
+
+    free_function_tables();
+}
+
+static void write_vector(FILE* file, ASTNode* vector) {
+    const char* name = vector->vector.name;
+    // an extrn of the word reads name[0] like the one of a vector
+    if (vector->vector.is_scalar) {
+        fprintf(file, "\nint64_t %s[1];\n", name);
+        return;
+    }
+    Word words = vector->vector.bound + 1;
+    if (words < vector->vector.count) {
+        words = vector->vector.count;
+    }
+    fprintf(file, "\nint64_t %s[%ld] = { (int64_t)(uintptr_t)&%s[1]", name, 1 + words, name);
+    for (int i = 0; i < vector->vector.count; ++i) {
+        fprintf(file, ", %s", literal_operand(vector->vector.values[i]).text);
+    }
+    fprintf(file, " };\n");
+}
+
+static void write_prelude(FILE* file) {
+    fprintf(file, "/* generated by bbc from %s */\n", options->input_path);
+    fprintf(file, "#include <stdint.h>\n");
+    fprintf(file, "\n");
+    // the external functions are declared without parameters, they take and return words
+    fprintf(file, "#if defined(__clang__)\n");
+    fprintf(file, "#pragma clang diagnostic ignored \"-Wincompatible-library-redeclaration\"\n");
+    fprintf(file, "#elif defined(__GNUC__)\n");
+    fprintf(file, "#pragma GCC diagnostic ignored \"-Wbuiltin-declaration-mismatch\"\n");
+    fprintf(file, "#endif\n");
+    fprintf(file, "\n");
+    // stdint.h declares no function, so every function name is left to the program
+    fprintf(file, "/* idiv stops the program when the quotient does not fit in a word, the volatile */\n");
+    fprintf(file, "/* operands make the C compiler divide at run time so it stops with the same SIGFPE */\n");
+    fprintf(file, "static inline int64_t bbc_divide(int64_t a, int64_t b) {\n");
+    fprintf(file, "    if (b == 0 || (a == INT64_MIN && b == -1)) {\n");
+    fprintf(file, "        volatile int64_t trapped_a = a, trapped_b = b;\n");
+    fprintf(file, "        return trapped_a / trapped_b;\n");
+    fprintf(file, "    }\n");
+    fprintf(file, "    return a / b;\n");
+    fprintf(file, "}\n");
+    fprintf(file, "\n");
+    fprintf(file, "static inline int64_t bbc_remainder(int64_t a, int64_t b) {\n");
+    fprintf(file, "    if (b == 0 || (a == INT64_MIN && b == -1)) {\n");
+    fprintf(file, "        volatile int64_t trapped_a = a, trapped_b = b;\n");
+    fprintf(file, "        return trapped_a %% trapped_b;\n");
+    fprintf(file, "    }\n");
+    fprintf(file, "    return a %% b;\n");
+    fprintf(file, "}\n");
+    fprintf(file, "\n");
+    fprintf(file, "/* v[i] is the word at the address v + 8 * i */\n");
+    fprintf(file, "static inline int64_t* bbc_at(int64_t vector, int64_t index) {\n");
+    fprintf(file, "    return (int64_t*)(uintptr_t)((uint64_t)vector + (uint64_t)index * 8);\n");
+    fprintf(file, "}\n");
+}
+
+static void free_tables() {
+    free_function_tables();
+    free(globals);
+    globals = NULL;
+    globals_capacity = 0;
+    globals_count = 0;
+    hash_table_free(&global_names);
+    free(extern_names);
+    extern_names = NULL;
+    extern_names_count = 0;
+    extern_names_capacity = 0;
+    free(locals);
+    locals = NULL;
+    locals_capacity = 0;
+    free(declarations);
+    declarations = NULL;
+    declarations_capacity = 0;
+    free(pending_statements);
+    pending_statements = NULL;
+    pending_statements_count = 0;
+    pending_statements_capacity = 0;
+    free(tasks);
+    tasks = NULL;
+    tasks_count = 0;
+    tasks_capacity = 0;
+    free(operands);
+    operands = NULL;
+    operands_count = 0;
+    operands_capacity = 0;
+}
+
+void cbackend_compile(ASTNode* program, const Options* compiler_options) {
+    if (program->type != AST_NODE_PROGRAM) {
+        fprintf(diagnostics(), "error: AST node for compiler is not a program\n");
+        fail();
+    }
+    options = compiler_options;
+    source = program->program.source;
+    uses_print = false;
+
+    int count = program->program.count;
+    for (int i = 0; i < count; ++i) {
+        ASTNode* definition = program->program.statements[i];
+        if (definition->type == AST_NODE_VECTOR_DEFINITION) {
+            define_global(definition->vector.name, true, 0);
+        }
+        else {
+            define_global(definition->function.name, false, definition->function.parameter_count);
+        }
+    }
+    for (int i = 0; i < count; ++i) {
+        ASTNode* definition = program->program.statements[i];
+        if (definition->type == AST_NODE_FUNCTION) {
+            collect_extrns(definition->function.body);
+        }
+    }
+
+    functions_text = open_memstream(&functions_buffer, &functions_size);
+    for (int i = 0; i < count; ++i) {
+        ASTNode* definition = program->program.statements[i];
+        if (definition->type == AST_NODE_FUNCTION) {
+            lower_function(definition);
+        }
+    }
+    fclose(functions_text);
+    functions_text = NULL;
+
+    output = fopen(options->output_path, "w");
+    if (output == NULL) {
+        fprintf(diagnostics(), "error: failed to open file: %s\n", options->output_path);
+        fail();
+    }
+    write_prelude(output);
+
+    fprintf(output, "\n");
+    if (uses_print) {
+        use_external("printf", true);
+    }
+    for (int i = 0; i < extern_names_count; ++i) {
+        const char* name = extern_names[i];
+        if (lookup_global(name)->is_called) {
+            fprintf(output, "int64_t %s();\n", name);
+        }
+        else {
+            fprintf(output, "extern int64_t %s;\n", name);
+        }
+    }
+    for (int i = 0; i < count; ++i) {
+        ASTNode* definition = program->program.statements[i];
+        if (definition->type == AST_NODE_FUNCTION) {
+            fprintf(output, "int64_t %s(", global_c_name(definition->function.name));
+            write_parameters(output, definition->function.parameter_count, false);
+            fprintf(output, ");\n");
+        }
+    }
+    for (int i = 0; i < count; ++i) {
+        ASTNode* definition = program->program.statements[i];
+        if (definition->type == AST_NODE_VECTOR_DEFINITION) {
+            write_vector(output, definition);
+        }
+    }
+    fwrite(functions_buffer, 1, functions_size, output);
+    free(functions_buffer);
+    functions_buffer = NULL;
+
+    Global* main = lookup_global("main");
+    if (main != NULL && main->is_function) {
+        // the arguments of the C main are the first ones of main, the others are 0
+        int parameter_count = main->parameter_count;
+        fprintf(output, "\nint main(int argc, char** argv) {\n");
+        fprintf(output, "    (void)argc;\n");
+        fprintf(output, "    (void)argv;\n");
+        fprintf(output, "    return (int)bbc_main(");
+        for (int i = 0; i < parameter_count; ++i) {
+            const char* argument = i == 0 ? "(int64_t)argc" : i == 1 ? "(int64_t)(uintptr_t)argv" : "0";
+            fprintf(output, i == 0 ? "%s" : ", %s", argument);
+        }
+        fprintf(output, ");\n");
+        fprintf(output, "}\n");
+    }
+
+    free_tables();
+    fclose(output);
+    output = NULL;
+}
+
+void cbackend_abort() {
+    if (body != NULL) {
+        fclose(body);
+        body = NULL;
+    }
+    free(body_buffer);
+    body_buffer = NULL;
+    if (functions_text != NULL) {
+        fclose(functions_text);
+        functions_text = NULL;
+    }
+    free(functions_buffer);
+    functions_buffer = NULL;
+    if (output != NULL) {
+        fclose(output);
+        output = NULL;
+    }
+    free_tables();
+}
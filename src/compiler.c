@@ -1,211 +1,3241 @@
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <unistd.h>
 #include "compiler.h"
+#include "debug.h"
 #include "lexer.h"
 #include "parser.h"
+#include "profile.h"
+#include "utils.h"
+
+// switch dispatch tuning: sets up to this size are lowered to a chain of compares
+#define SWITCH_COMPARE_CHAIN_MAX 3
+// a jump table needs at least this many cases, at least one in three slots used
+// and no more than SWITCH_JUMP_TABLE_MAX_SIZE slots
+#define SWITCH_JUMP_TABLE_MIN_CASES 4
+#define SWITCH_JUMP_TABLE_MIN_DENSITY 3
+#define SWITCH_JUMP_TABLE_MAX_SIZE 4096
+// the code generator walks functions on a stack of its own, its frames are small and fixed
+#define COMPILER_THREAD_STACK_SIZE (1024 * 1024)
+// functions compiled ahead of the first one not written yet
+#define COMPILER_MAX_PENDING_FUNCTIONS 256
 
 typedef struct {
     const char* name;
     Word offset;
+    // declared with extrn, lives outside of the frame
+    bool is_extrn;
 } AutoVar;
 
 // TODO: change to hash map
-static AutoVar vars[128];
-static size_t vars_index = 0;
-static size_t vars_offset = 0;
-static int pushed_on_stack = 0;
+static _Thread_local AutoVar* vars = NULL;
+static _Thread_local size_t vars_capacity = 0;
+static _Thread_local size_t vars_index = 0;
+static _Thread_local size_t vars_offset = 0;
+// first variable of the innermost scope (function body or inlined call)
+static _Thread_local size_t scope_start = 0;
+static _Thread_local int pushed_on_stack = 0;
+
+typedef struct {
+    // owned by the table
+    const char* name;
+    bool is_function;
+    bool is_vector;
+    // in extern_symbols
+    bool is_extern;
+    // declared with extrn in a stream, by a function or by the implicit main
+    bool is_function_extrn;
+    bool is_main_extrn;
+    // used as a function of the stream before its definition came
+    bool is_used_early;
+} Symbol;
+
+// functions and external vectors defined in the compiled program
+static _Thread_local const ProgramSymbols* symbols = NULL;
+// every name the program defines or declares with extrn, found through symbol_names
+static _Thread_local Symbol* symbol_table = NULL;
+static _Thread_local int symbol_table_count = 0;
+static _Thread_local int symbol_table_capacity = 0;
+static _Thread_local HashTable symbol_names = { 0 };
+// what compiler_compile collects from the whole program
+static _Thread_local ProgramSymbols program_symbols = { 0 };
+static _Thread_local ASTNode** vectors = NULL;
+// names declared with extrn that are not defined in the program
+static _Thread_local const char** extern_symbols = NULL;
+static _Thread_local int extern_symbols_count = 0;
+static _Thread_local int extern_symbols_capacity = 0;
+
+static const char* argument_registers[] = { "rdi", "rsi", "rdx", "rcx", "r8", "r9" };
+#define ARGUMENT_REGISTERS_COUNT 6
+
+static _Thread_local const Options* options = NULL;
+// the program was parsed from it, node locations are offsets into it
+static _Thread_local Source* source = NULL;
+static _Thread_local ASTNode* current_function = NULL;
+// label after the prologue of the current function, target of self tail calls
+static _Thread_local int function_body_label = 0;
+// with -Os the label before the end of the function returning 0, -1 until a return uses it
+static _Thread_local int function_end_label = -1;
+static _Thread_local bool shares_function_end = false;
+
+// return inside an inlined body jumps to the end of the inlined call instead
+static _Thread_local int* inline_return_labels = NULL;
+static _Thread_local int inline_return_labels_count = 0;
+static _Thread_local int inline_return_labels_capacity = 0;
+
+// labels starting with two dots are not attached to the previous global label in fasm
+static _Thread_local int label_count = 0;
+// innermost loop or switch is on top
+static _Thread_local int* break_labels = NULL;
+static _Thread_local int break_labels_count = 0;
+static _Thread_local int break_labels_capacity = 0;
+// the assembly file being written
+static _Thread_local FILE* output = NULL;
+// read-only data (jump tables) is collected here and emitted after the code
+static _Thread_local FILE* rodata = NULL;
+static _Thread_local char* rodata_buffer = NULL;
+static _Thread_local size_t rodata_size = 0;
+// branches a profile shows as cold are collected here and emitted in .text.unlikely
+static _Thread_local FILE* cold_text = NULL;
+static _Thread_local char* cold_text_buffer = NULL;
+static _Thread_local size_t cold_text_size = 0;
+// the function compiled on its own, its rodata and cold_text are NULL until written to
+static _Thread_local FunctionCode* compiled_code = NULL;
+// words and vectors without values, written to .bss with the ones of the runtime
+static _Thread_local FILE* bss = NULL;
+static _Thread_local char* bss_buffer = NULL;
+static _Thread_local size_t bss_size = 0;
+
+static _Thread_local CompiledString* strings = NULL;
+static _Thread_local int strings_count = 0;
+static _Thread_local int strings_capacity = 0;
+
+// A stream is compiled one top-level definition or statement at a time. Its functions are
+// collected in a temporary file until the header with the extrn declarations can be written,
+// the statements outside of functions in another one until the frame of main is known.
+static _Thread_local bool is_streaming = false;
+static _Thread_local FILE* function_text = NULL;
+static _Thread_local FILE* main_text = NULL;
+static _Thread_local FILE* vectors_text = NULL;
+static _Thread_local ASTNode main_function;
+static _Thread_local int main_body_label = 0;
+// variables of main while a function of the stream is compiled, see swap_main_frame
+static _Thread_local AutoVar* main_vars = NULL;
+static _Thread_local size_t main_vars_capacity = 0;
+static _Thread_local size_t main_vars_index = 0;
+static _Thread_local size_t main_vars_offset = 0;
+// names declared with extrn in the stream, by functions and by main, owned by the symbol table
+static _Thread_local const char** function_extrns = NULL;
+static _Thread_local int function_extrns_count = 0;
+static _Thread_local int function_extrns_capacity = 0;
+static _Thread_local const char** main_extrns = NULL;
+static _Thread_local int main_extrns_count = 0;
+static _Thread_local int main_extrns_capacity = 0;
+
+// a name taken for a function the stream defines later, checked at its end
+typedef struct {
+    const char* name;
+    bool is_call;
+    // the source before it may be dropped by the end, 0 for nodes made by the optimizer
+    int line;
+} EarlyUse;
+
+static _Thread_local EarlyUse* early_uses = NULL;
+static _Thread_local int early_uses_count = 0;
+static _Thread_local int early_uses_capacity = 0;
+
+typedef struct {
+    Word value;
+    int label;
+} SwitchCase;
+
+// `while (i < n) { a[i] = b[i] op c[i]; i = i + 1; }`
+typedef struct {
+    AutoVar* index;
+    ASTNode* bound;
+    AutoVar* destination;
+    AutoVar* left;
+    AutoVar* right;
+    TokenType op;
+} VectorLoop;
+
+// Where compile goes on with a node once the children before it are compiled.
+typedef enum {
+    STEP_START,
+    // writes the label in values[0], node is NULL
+    STEP_LABEL,
+    STEP_EXPRESSION_STATEMENT_END,
+    STEP_IF_THEN,
+    STEP_IF_ELSE,
+    STEP_INSTRUMENTED_IF_THEN,
+    STEP_INSTRUMENTED_IF_ELSE,
+    STEP_COLD_IF_HOT,
+    STEP_COLD_IF_COLD,
+    STEP_COLD_IF_END,
+    STEP_HOT_ELSE_ELSE,
+    STEP_HOT_ELSE_THEN,
+    STEP_WHILE_CONDITION,
+    STEP_WHILE_END,
+    STEP_COLD_WHILE_BODY,
+    STEP_COLD_WHILE_END,
+    STEP_SWITCH_DISPATCH,
+    STEP_SWITCH_END,
+    STEP_RETURN_END,
+    STEP_SELF_TAIL_CALL_END,
+    STEP_TAIL_CALL_END,
+    STEP_ASSIGNMENT_STORE,
+    STEP_BINARY_OPERATION,
+    STEP_UNARY_OPERATION,
+    STEP_SUBSCRIPT_LOAD,
+    STEP_SUBSCRIPT_STORE,
+    STEP_CALL_END,
+    STEP_INLINED_CALL_BODY,
+    STEP_INLINED_CALL_END,
+} CompileStep;
+
+typedef struct {
+    ASTNode* node;
+    FILE* file;
+    CompileStep step;
+    // labels and counts from the earlier steps of the node
+    int values[3];
+    size_t saved_vars_index;
+    size_t saved_scope_start;
+    SwitchCase* cases;
+} CompileTask;
+
+// compile runs the tasks from a stack instead of recursing, so deep trees only need memory
+static _Thread_local CompileTask* tasks = NULL;
+static _Thread_local int tasks_count = 0;
+static _Thread_local int tasks_capacity = 0;
+
+// set once a vectorized loop needs the cpuid check, it is emitted after the functions
+static _Thread_local bool uses_simd_level = false;
+
+// Calls answered by the runtime written after the functions, which collects the output in
+// one buffer instead of going through stdio. Calls of print come from the print statement,
+// putchar and printf are taken over when they are declared with extrn.
+typedef enum {
+    RUNTIME_PRINT,
+    RUNTIME_PUTCHAR,
+    RUNTIME_PRINTF,
+    RUNTIME_FUNCTIONS_COUNT
+} RuntimeFunction;
+
+static const char* const runtime_functions[] = { "print", "putchar", "printf" };
+static _Thread_local bool uses_runtime_function[RUNTIME_FUNCTIONS_COUNT];
+// the output buffer of the runtime, flushed when full and at exit
+#define RUNTIME_OUTPUT_SIZE (64 * 1024)
+
+// Words fasm takes for registers, operators, sizes, data and directives in any case, they
+// cannot name a label or a symbol.
+static const char* const fasm_reserved_words[] = {
+    "al", "cl", "dl", "bl", "ah", "ch", "dh", "bh", "spl", "bpl", "sil", "dil",
+    "ax", "cx", "dx", "bx", "sp", "bp", "si", "di",
+    "eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi",
+    "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+    "rip", "eip", "es", "cs", "ss", "ds", "fs", "gs", "st",
+    "byte", "word", "dword", "fword", "pword", "qword", "tbyte", "tword", "dqword", "xword",
+    "qqword", "yword", "dqqword", "zword", "near", "far", "short",
+    "mod", "and", "or", "xor", "shl", "shr", "not", "bsf", "bsr", "rva", "plt", "eq", "eqtype",
+    "relativeto", "in", "ptr", "at", "from", "as", "dup", "used", "defined", "definite",
+    "db", "dw", "du", "dd", "dp", "df", "dq", "dt", "rb", "rw", "rd", "rp", "rf", "rq", "rt",
+    "file", "equ", "label", "times", "align", "virtual", "load", "store", "repeat", "while",
+    "if", "else", "end", "break", "display", "err", "assert", "format", "section", "segment",
+    "entry", "public", "extrn", "stack", "heap", "org", "use16", "use32", "use64", "include",
+    "macro", "struc", "purge", "restore", "restruc", "rept", "irp", "irps", "irpv", "match",
+    "fix", "define", "common", "forward", "reverse", "local", "postpone",
+    "elf", "elf64", "executable", "readable", "writeable", "writable",
+};
+
+// registers with a number, r8 to r15 also with their b, w, d and l parts
+static const struct {
+    const char* prefix;
+    int first;
+    int last;
+} fasm_numbered_registers[] = {
+    { "r", 8, 15 }, { "mm", 0, 7 }, { "xmm", 0, 31 }, { "ymm", 0, 31 }, { "zmm", 0, 31 },
+    { "st", 0, 7 }, { "cr", 0, 15 }, { "dr", 0, 15 }, { "tr", 0, 7 }, { "k", 0, 7 },
+    { "bnd", 0, 3 },
+};
+
+static bool is_numbered_register(const char* name) {
+    for (size_t i = 0; i < sizeof(fasm_numbered_registers) / sizeof(fasm_numbered_registers[0]); ++i) {
+        size_t length = strlen(fasm_numbered_registers[i].prefix);
+        if (strncasecmp(name, fasm_numbered_registers[i].prefix, length) != 0) continue;
+        const char* digits = name + length;
+        int number = 0;
+        int digits_count = 0;
+        while (digits[digits_count] >= '0' && digits[digits_count] <= '9' && digits_count < 3) {
+            number = number * 10 + digits[digits_count++] - '0';
+        }
+        if (digits_count == 0 || (digits_count > 1 && digits[0] == '0')) continue;
+        if (number < fasm_numbered_registers[i].first || number > fasm_numbered_registers[i].last) continue;
+        const char* rest = digits + digits_count;
+        if (rest[0] == '\0') return true;
+        if (length == 1 && rest[1] == '\0' && strchr("bwdlBWDL", rest[0]) != NULL) return true;
+    }
+    return false;
+}
+
+// Functions, vectors and extrn names are written to the output as they are, so the ones fasm
+// reserves are rejected like the C backend rejects the names of C.
+static void check_fasm_name(ASTNode* node, const char* name) {
+    bool is_reserved = is_numbered_register(name);
+    for (size_t i = 0; !is_reserved && i < sizeof(fasm_reserved_words) / sizeof(fasm_reserved_words[0]); ++i) {
+        is_reserved = strcasecmp(name, fasm_reserved_words[i]) == 0;
+    }
+    if (is_reserved) {
+        fprintf(source_diagnostics(source, node->location), "error: '%s' cannot be used as a name in fasm\n", name);
+        fail();
+    }
+}
+
+// NULL for names the program neither defines nor declares with extrn
+static Symbol* find_symbol(const char* name) {
+    int index = hash_table_find(&symbol_names, hash_string(name), name);
+    return index >= 0 ? &symbol_table[index] : NULL;
+}
+
+// Symbols move when the table grows, so pointers to them are only good until the next one
+// is added.
+static Symbol* add_symbol(const char* name) {
+    Symbol* symbol = find_symbol(name);
+    if (symbol != NULL) return symbol;
+    if (symbol_table_capacity < symbol_table_count + 1) {
+        int old_capacity = symbol_table_capacity;
+        symbol_table_capacity = GROW_CAPACITY(old_capacity);
+        symbol_table = GROW_ARRAY(Symbol, symbol_table, old_capacity, symbol_table_capacity);
+    }
+    symbol = &symbol_table[symbol_table_count];
+    *symbol = (Symbol) { .name = strdup(name) };
+    hash_table_add(&symbol_names, hash_string(name), symbol->name, symbol_table_count++);
+    return symbol;
+}
+
+static void define_symbol(const char* name, bool is_vector) {
+    Symbol* symbol = add_symbol(name);
+    if (symbol->is_function || symbol->is_vector) {
+        fprintf(diagnostics(), "error: '%s' already defined\n", name);
+        fail();
+    }
+    symbol->is_function = !is_vector;
+    symbol->is_vector = is_vector;
+}
+
+static bool is_defined(const char* name, bool is_vector) {
+    Symbol* symbol = find_symbol(name);
+    return symbol != NULL && (is_vector ? symbol->is_vector : symbol->is_function);
+}
+
+static bool is_function(const char* name) {
+    return is_defined(name, false);
+}
+
+static bool is_vector(const char* name) {
+    return is_defined(name, true);
+}
 
 static AutoVar* find_auto_var(const char* name) {
-    for (size_t i = 0; i < vars_index; ++i) {
-        if (strcmp(name, vars[i].name) == 0) {
-            return &vars[i];
+    // innermost declaration wins
+    for (size_t i = vars_index; i > 0; --i) {
+        if (strcmp(name, vars[i - 1].name) == 0) {
+            return &vars[i - 1];
         }
     }
     return NULL;
 }
 
-static void compile(ASTNode* root, FILE* file) {
+static AutoVar* declare_var(const char* name, bool is_extrn) {
+    AutoVar* existing_var = find_auto_var(name);
+    if (existing_var != NULL && (size_t)(existing_var - vars) >= scope_start) {
+        fprintf(diagnostics(), "error: identifier '%s' already declared\n", name);
+        fail();
+    }
+    if (vars_capacity < vars_index + 1) {
+        size_t old_capacity = vars_capacity;
+        vars_capacity = GROW_CAPACITY(old_capacity);
+        vars = GROW_ARRAY(AutoVar, vars, old_capacity, vars_capacity);
+    }
+    // the statements of main in a stream are freed before the variables they declare
+    if (current_function == &main_function) {
+        name = add_symbol(name)->name;
+    }
+    AutoVar* var = &vars[vars_index++];
+    *var = (AutoVar) { .name = name, .offset = 0, .is_extrn = is_extrn };
+    if (!is_extrn) {
+        // the slot itself is reserved in the function prologue
+        vars_offset += sizeof(Word);
+        var->offset = vars_offset;
+    }
+    return var;
+}
+
+static void compile(ASTNode* root, FILE* file);
+
+// The task of the node is run after every task pushed after it, children are pushed last.
+static CompileTask* push_task(ASTNode* node, FILE* file, CompileStep step) {
+    if (tasks_capacity < tasks_count + 1) {
+        int old_capacity = tasks_capacity;
+        tasks_capacity = GROW_CAPACITY(old_capacity);
+        tasks = GROW_ARRAY(CompileTask, tasks, old_capacity, tasks_capacity);
+    }
+    CompileTask* task = &tasks[tasks_count++];
+    *task = (CompileTask) { .node = node, .file = file, .step = step };
+    return task;
+}
+
+static void push_node(ASTNode* node, FILE* file) {
+    push_task(node, file, STEP_START);
+}
+
+static void push_label_task(int label, FILE* file) {
+    push_task(NULL, file, STEP_LABEL)->values[0] = label;
+}
+
+// arguments are evaluated right to left
+static void push_arguments(ASTNode** arguments, int count, FILE* file) {
+    for (int i = 0; i < count; ++i) {
+        push_node(arguments[i], file);
+    }
+}
+
+// the targets of break and of return inside of inlined calls, innermost last
+static void push_jump_label(int** labels, int* count, int* capacity, int label) {
+    if (*capacity < *count + 1) {
+        int old_capacity = *capacity;
+        *capacity = GROW_CAPACITY(old_capacity);
+        *labels = GROW_ARRAY(int, *labels, old_capacity, *capacity);
+    }
+    (*labels)[(*count)++] = label;
+}
+
+// Maps the code that follows to the location of the statement. Nodes made by the optimizer
+// have no location and belong to the statement before them.
+static void compile_line(ASTNode* root, FILE* file) {
+    if (!options->debug_info || root->location == 0) return;
+    int line, column;
+    source_locate(source, root->location - 1, &line, &column);
+    debug_mark_line(file, file == cold_text, line, column);
+}
+
+static int line_of(ASTNode* node) {
+    if (node->location == 0) return 0;
+    int line, column;
+    source_locate(source, node->location - 1, &line, &column);
+    return line;
+}
+
+static int new_label() {
+    return label_count++;
+}
+
+static FILE* rodata_stream() {
+    if (rodata == NULL) {
+        rodata = open_memstream(&compiled_code->rodata, &compiled_code->rodata_size);
+    }
+    return rodata;
+}
+
+static FILE* cold_text_stream() {
+    if (cold_text == NULL) {
+        cold_text = open_memstream(&compiled_code->cold_text, &compiled_code->cold_text_size);
+    }
+    return cold_text;
+}
+
+// The annotations of the code, left out with -Os.
+static void write_comment(FILE* file, const char* format, ...) {
+    if (options->optimize_size) return;
+    va_list arguments;
+    va_start(arguments, format);
+    vfprintf(file, format, arguments);
+    va_end(arguments);
+}
+
+static void add_string(int label, const char* bytes, int length) {
+    if (strings_capacity < strings_count + 1) {
+        int old_capacity = strings_capacity;
+        strings_capacity = GROW_CAPACITY(old_capacity);
+        strings = GROW_ARRAY(CompiledString, strings, old_capacity, strings_capacity);
+    }
+    char* copy = malloc(length + 1);
+    memcpy(copy, bytes, length + 1);
+    strings[strings_count++] = (CompiledString) { .label = label, .bytes = copy, .length = length };
+}
+
+static void free_strings(CompiledString* list, int count) {
+    for (int i = 0; i < count; ++i) {
+        free(list[i].bytes);
+    }
+    free(list);
+}
+
+// Orders the strings by their bytes read backwards from the '\0', so one that ends another
+// comes right before it or before strings that end with it too.
+static int compare_reversed(const void* a, const void* b) {
+    const CompiledString* left = a;
+    const CompiledString* right = b;
+    int i = left->length;
+    int j = right->length;
+    for (; i >= 0 && j >= 0; --i, --j) {
+        unsigned char left_byte = left->bytes[i];
+        unsigned char right_byte = right->bytes[j];
+        if (left_byte != right_byte) return left_byte < right_byte ? -1 : 1;
+    }
+    if (i != j) return i < j ? -1 : 1;
+    return left->label < right->label ? -1 : left->label > right->label;
+}
+
+static bool is_ending_of(const CompiledString* string, const CompiledString* longer) {
+    int offset = longer->length - string->length;
+    return offset >= 0 && memcmp(longer->bytes + offset, string->bytes, string->length + 1) == 0;
+}
+
+static void write_string_bytes(FILE* file, const char* bytes, int count) {
+    fprintf(file, "\tdb ");
+    for (int i = 0; i < count; ++i) {
+        fprintf(file, i == 0 ? "%d" : ", %d", (unsigned char)bytes[i]);
+    }
+    fprintf(file, "\n");
+}
+
+// Writes the strings into rodata. A string is stored once with the labels of every string
+// ending it at their offsets, the others only get a label.
+static void write_string_pool(FILE* file) {
+    if (strings_count == 0) return;
+    qsort(strings, strings_count, sizeof(CompiledString), compare_reversed);
+    write_comment(file, ";---strings---\n");
+    int first = 0;
+    for (int last = 0; last < strings_count; ++last) {
+        if (last + 1 < strings_count && is_ending_of(&strings[last], &strings[last + 1])) continue;
+        // the strings from first to last end the last one, the shortest comes first
+        const CompiledString* stored = &strings[last];
+        int written = 0;
+        for (int i = last; i >= first; --i) {
+            int offset = stored->length - strings[i].length;
+            if (offset > written) {
+                write_string_bytes(file, stored->bytes + written, offset - written);
+                written = offset;
+            }
+            fprintf(file, "..L%d:\n", strings[i].label);
+        }
+        write_string_bytes(file, stored->bytes + written, stored->length + 1 - written);
+        first = last + 1;
+    }
+    free_strings(strings, strings_count);
+    strings = NULL;
+    strings_count = 0;
+    strings_capacity = 0;
+}
+
+// number of frame slots needed by autos and inlined parameters, reserved in the prologue
+static void push_child(ASTNode*** nodes, int* count, int* capacity, ASTNode* node) {
+    if (node == NULL) return;
+    if (*capacity < *count + 1) {
+        int old_capacity = *capacity;
+        *capacity = GROW_CAPACITY(old_capacity);
+        *nodes = GROW_ARRAY(ASTNode*, *nodes, old_capacity, *capacity);
+    }
+    (*nodes)[(*count)++] = node;
+}
+
+// the words the autos of a body take in the frame
+static size_t count_declarations(ASTNode* root) {
+    ASTNode** nodes = NULL;
+    int count = 0;
+    int capacity = 0;
+    size_t words = 0;
+    push_child(&nodes, &count, &capacity, root);
+    while (count > 0) {
+        ASTNode* node = nodes[--count];
+        switch (node->type) {
+            case AST_NODE_BLOCK: {
+                for (int i = 0; i < node->block.count; ++i) {
+                    push_child(&nodes, &count, &capacity, node->block.statements[i]);
+                }
+            } break;
+            case AST_NODE_EXPRESSION_STATEMENT:
+            case AST_NODE_RETURN_STATEMENT: {
+                push_child(&nodes, &count, &capacity, node->expression);
+            } break;
+            case AST_NODE_IF_STATEMENT: {
+                push_child(&nodes, &count, &capacity, node->if_statement.condition);
+                push_child(&nodes, &count, &capacity, node->if_statement.then_branch);
+                push_child(&nodes, &count, &capacity, node->if_statement.else_branch);
+            } break;
+            case AST_NODE_WHILE_STATEMENT: {
+                push_child(&nodes, &count, &capacity, node->while_statement.condition);
+                push_child(&nodes, &count, &capacity, node->while_statement.body);
+            } break;
+            case AST_NODE_SWITCH_STATEMENT: {
+                push_child(&nodes, &count, &capacity, node->switch_statement.condition);
+                push_child(&nodes, &count, &capacity, node->switch_statement.body);
+            } break;
+            case AST_NODE_CASE: {
+                push_child(&nodes, &count, &capacity, node->case_label.statement);
+            } break;
+            case AST_NODE_VARIABLE_DECLARATION: {
+                // a vector auto is a pointer followed by its words
+                words += node->declaration.is_vector ? 1 + node->declaration.bound + 1 : 1;
+            } break;
+            case AST_NODE_ASSIGNMENT: {
+                push_child(&nodes, &count, &capacity, node->assignment.value);
+            } break;
+            case AST_NODE_BINARY: {
+                push_child(&nodes, &count, &capacity, node->binary.left);
+                push_child(&nodes, &count, &capacity, node->binary.right);
+            } break;
+            case AST_NODE_UNARY: {
+                push_child(&nodes, &count, &capacity, node->unary.right);
+            } break;
+            case AST_NODE_SUBSCRIPT:
+            case AST_NODE_SUBSCRIPT_ASSIGNMENT: {
+                push_child(&nodes, &count, &capacity, node->subscript.vector);
+                push_child(&nodes, &count, &capacity, node->subscript.index);
+                push_child(&nodes, &count, &capacity, node->subscript.value);
+            } break;
+            case AST_NODE_CALL: {
+                for (int i = 0; i < node->call.count; ++i) {
+                    push_child(&nodes, &count, &capacity, node->call.arguments[i]);
+                }
+            } break;
+            case AST_NODE_INLINED_CALL: {
+                words += node->inlined_call.count;
+                for (int i = 0; i < node->inlined_call.count; ++i) {
+                    push_child(&nodes, &count, &capacity, node->inlined_call.arguments[i]);
+                }
+                push_child(&nodes, &count, &capacity, node->inlined_call.body);
+            } break;
+            default: break;
+        }
+    }
+    free(nodes);
+    return words;
+}
+
+static void append_name(const char*** names, int* count, int* capacity, const char* name) {
+    if (*capacity < *count + 1) {
+        int old_capacity = *capacity;
+        *capacity = GROW_CAPACITY(old_capacity);
+        *names = GROW_ARRAY(const char*, *names, old_capacity, *capacity);
+    }
+    (*names)[(*count)++] = name;
+}
+
+static void add_extern_symbol(const char* name) {
+    if (is_function(name) || is_vector(name)) return;
+    Symbol* symbol = add_symbol(name);
+    if (symbol->is_extern) return;
+    symbol->is_extern = true;
+    append_name(&extern_symbols, &extern_symbols_count, &extern_symbols_capacity, symbol->name);
+}
+
+// Keeps the extrn declarations of a stream for the header, every name once per list.
+static void add_stream_extrn(const char* name) {
+    Symbol* symbol = add_symbol(name);
+    if (current_function == &main_function && !symbol->is_main_extrn) {
+        symbol->is_main_extrn = true;
+        append_name(&main_extrns, &main_extrns_count, &main_extrns_capacity, symbol->name);
+    }
+    else if (current_function != &main_function && !symbol->is_function_extrn) {
+        symbol->is_function_extrn = true;
+        append_name(&function_extrns, &function_extrns_count, &function_extrns_capacity, symbol->name);
+    }
+}
+
+// Whether the name is a function of the program. A stream may still define it, so there an
+// unknown name is taken for one and checked at the end.
+static bool is_function_or_later(ASTNode* node, const char* name, bool is_call) {
+    if (is_function(name)) return true;
+    if (!is_streaming) return false;
+    Symbol* symbol = add_symbol(name);
+    if (symbol->is_vector) return false;
+    if (!symbol->is_used_early) {
+        symbol->is_used_early = true;
+        if (early_uses_capacity < early_uses_count + 1) {
+            int old_capacity = early_uses_capacity;
+            early_uses_capacity = GROW_CAPACITY(old_capacity);
+            early_uses = GROW_ARRAY(EarlyUse, early_uses, old_capacity, early_uses_capacity);
+        }
+        early_uses[early_uses_count++] = (EarlyUse) { .name = symbol->name, .is_call = is_call, .line = line_of(node) };
+    }
+    return true;
+}
+
+// the extrn declarations of a body in source order, the statements are visited last to first
+static void collect_extern_symbols(ASTNode* root, ProgramSymbols* symbols) {
+    ASTNode** nodes = NULL;
+    int count = 0;
+    int capacity = 0;
+    push_child(&nodes, &count, &capacity, root);
+    while (count > 0) {
+        ASTNode* node = nodes[--count];
+        switch (node->type) {
+            case AST_NODE_BLOCK: {
+                for (int i = node->block.count - 1; i >= 0; --i) {
+                    push_child(&nodes, &count, &capacity, node->block.statements[i]);
+                }
+            } break;
+            case AST_NODE_IF_STATEMENT: {
+                push_child(&nodes, &count, &capacity, node->if_statement.else_branch);
+                push_child(&nodes, &count, &capacity, node->if_statement.then_branch);
+            } break;
+            case AST_NODE_WHILE_STATEMENT: {
+                push_child(&nodes, &count, &capacity, node->while_statement.body);
+            } break;
+            case AST_NODE_SWITCH_STATEMENT: {
+                push_child(&nodes, &count, &capacity, node->switch_statement.body);
+            } break;
+            case AST_NODE_CASE: {
+                push_child(&nodes, &count, &capacity, node->case_label.statement);
+            } break;
+            case AST_NODE_EXTRN_DECLARATION: {
+                if (symbols->extrns_capacity < symbols->extrns_count + 1) {
+                    int old_capacity = symbols->extrns_capacity;
+                    symbols->extrns_capacity = GROW_CAPACITY(old_capacity);
+                    symbols->extrns = GROW_ARRAY(const char*, symbols->extrns, old_capacity, symbols->extrns_capacity);
+                }
+                symbols->extrns[symbols->extrns_count++] = node->name;
+            } break;
+            default: break;
+        }
+    }
+    free(nodes);
+}
+
+static bool fits_in_imm32(Word value) {
+    return value >= INT32_MIN && value <= INT32_MAX;
+}
+
+// Loads a constant into rax, with -Os in the shortest encoding: xor for 0, mov eax for what
+// zero-extends and push and pop for negative values that sign-extend from 32 bits.
+static void compile_load_rax(Word value, FILE* file) {
+    if (!options->optimize_size) {
+        fprintf(file, "\tmov rax, %ld\n", value);
+    }
+    else if (value == 0) {
+        fprintf(file, "\txor eax, eax\n");
+    }
+    else if (value > 0 && value <= UINT32_MAX) {
+        fprintf(file, "\tmov eax, %ld\n", value);
+    }
+    else if (value < 0 && fits_in_imm32(value)) {
+        fprintf(file, "\tpush %ld\n", value);
+        fprintf(file, "\tpop rax\n");
+    }
+    else {
+        fprintf(file, "\tmov rax, %ld\n", value);
+    }
+}
+
+// the frame of the function is torn down, leave is 4 bytes shorter
+static void compile_leave(FILE* file) {
+    if (options->optimize_size) {
+        fprintf(file, "\tleave\n");
+        return;
+    }
+    fprintf(file, "\tmov rsp, rbp\n");
+    fprintf(file, "\tpop rbp\n");
+}
+
+static void compile_epilogue(FILE* file) {
+    compile_leave(file);
+    fprintf(file, "\tret\n");
+}
+
+// the runtime function answering a call of the name, -1 for the others
+static int find_runtime_function(const char* name, AutoVar* var) {
+    for (int i = 0; i < RUNTIME_FUNCTIONS_COUNT; ++i) {
+        if (strcmp(name, runtime_functions[i]) != 0) continue;
+        // print is a keyword, nothing else can have the name
+        bool is_external = var != NULL && var->is_extrn && !is_function(name);
+        if (i == RUNTIME_PRINT || is_external) return i;
+    }
+    return -1;
+}
+
+// Arguments are evaluated right to left, so after the register ones are popped the rest are
+// already in place for the callee. rsp is kept 16-byte aligned at the call.
+// The arguments are compiled between begin_call and end_call.
+static void begin_call(ASTNode* root, FILE* file) {
+    const char* name = root->call.name;
+    AutoVar* var = find_auto_var(name);
+    int runtime = find_runtime_function(name, var);
+    if (var == NULL && runtime < 0 && !is_function_or_later(root, name, true)) {
+        fprintf(source_diagnostics(source, root->location), "error: call to undeclared function '%s'\n", name);
+        fail();
+    }
+
+    int count = root->call.count;
+    int stack_arguments = count > ARGUMENT_REGISTERS_COUNT ? count - ARGUMENT_REGISTERS_COUNT : 0;
+    int padding = (pushed_on_stack + stack_arguments) % 2;
+
+    write_comment(file, "\t;---call %s---\n", name);
+    if (padding) {
+        fprintf(file, "\tsub rsp, 8\n"); ++pushed_on_stack;
+    }
+    CompileTask* task = push_task(root, file, STEP_CALL_END);
+    task->values[0] = stack_arguments;
+    task->values[1] = padding;
+    push_arguments(root->call.arguments, count, file);
+}
+
+static void end_call(const CompileTask* task) {
+    ASTNode* root = task->node;
+    FILE* file = task->file;
+    const char* name = root->call.name;
+    AutoVar* var = find_auto_var(name);
+    bool is_indirect = var != NULL && !var->is_extrn;
+    bool is_external = var != NULL && var->is_extrn && !is_function(name);
+    int runtime = find_runtime_function(name, var);
+    int count = root->call.count;
+    int stack_arguments = task->values[0];
+    int padding = task->values[1];
+
+    for (int i = 0; i < count && i < ARGUMENT_REGISTERS_COUNT; ++i) {
+        fprintf(file, "\tpop %s\n", argument_registers[i]); --pushed_on_stack;
+    }
+    if (is_indirect) {
+        fprintf(file, "\tmov r11, [rbp-%zu]\n", var->offset);
+        fprintf(file, "\tcall r11\n");
+    }
+    else if (runtime >= 0) {
+        uses_runtime_function[runtime] = true;
+        fprintf(file, "\tcall ..bbc_%s\n", name);
+    }
+    else {
+        if (is_external) {
+            // variadic functions expect the number of vector arguments in al
+            fprintf(file, "\txor eax, eax\n");
+        }
+        fprintf(file, "\tcall %s\n", name);
+    }
+    if (stack_arguments + padding > 0) {
+        fprintf(file, "\tadd rsp, %d\n", (stack_arguments + padding) * (int)sizeof(Word));
+        pushed_on_stack -= stack_arguments + padding;
+    }
+    fprintf(file, "\tpush rax\n"); ++pushed_on_stack;
+}
+
+static void report_tail_call(const char* callee, const char* result) {
+    if (options->report_tail_calls) {
+        fprintf(diagnostics(), "tail call in '%s' to '%s': %s\n", current_function->function.name, callee, result);
+    }
+}
+
+// `return f(...)` becomes a jump: a self call stores the arguments into the parameters and
+// restarts the body, any other call leaves them in registers (or in the caller's own incoming
+// stack arguments) and jumps to the callee after tearing down the frame. Returns false when
+// the call has to stay a regular call, the arguments are compiled before end_tail_call.
+static bool begin_tail_call(ASTNode* root, FILE* file) {
+    ASTNode* call = root->expression;
+    const char* name = call->call.name;
+    int count = call->call.count;
+
+    if (inline_return_labels_count > 0) {
+        report_tail_call(name, "not converted (inside an inlined call)");
+        return false;
+    }
+
+    AutoVar* var = find_auto_var(name);
+    bool is_indirect = var != NULL && !var->is_extrn;
+    int runtime = find_runtime_function(name, var);
+    if (var == NULL && runtime < 0 && !is_function_or_later(call, name, true)) return false;
+
+    if (!is_indirect && strcmp(name, current_function->function.name) == 0) {
+        if (count != current_function->function.parameter_count) {
+            report_tail_call(name, "not converted (argument count differs from parameter count)");
+            return false;
+        }
+        write_comment(file, "\t;---tail call %s (self)---\n", name);
+        push_task(root, file, STEP_SELF_TAIL_CALL_END);
+        push_arguments(call->call.arguments, count, file);
+        return true;
+    }
+
+    int stack_arguments = count > ARGUMENT_REGISTERS_COUNT ? count - ARGUMENT_REGISTERS_COUNT : 0;
+    int parameter_count = current_function->function.parameter_count;
+    int incoming_stack_arguments = parameter_count > ARGUMENT_REGISTERS_COUNT ? parameter_count - ARGUMENT_REGISTERS_COUNT : 0;
+    if (stack_arguments > incoming_stack_arguments) {
+        report_tail_call(name, "not converted (stack arguments do not fit in the caller's frame)");
+        return false;
+    }
+
+    write_comment(file, "\t;---tail call %s---\n", name);
+    push_task(root, file, STEP_TAIL_CALL_END);
+    push_arguments(call->call.arguments, count, file);
+    return true;
+}
+
+static void end_self_tail_call(ASTNode* call, FILE* file) {
+    // parameters are the first variables of the frame
+    for (int i = 0; i < call->call.count; ++i) {
+        fprintf(file, "\tpop rax\n"); --pushed_on_stack;
+        fprintf(file, "\tmov QWORD [rbp-%zu], rax\n", vars[i].offset);
+    }
+    fprintf(file, "\tjmp ..L%d\n", function_body_label);
+    report_tail_call(call->call.name, "converted (self call)");
+}
+
+static void end_tail_call(ASTNode* call, FILE* file) {
+    const char* name = call->call.name;
+    AutoVar* var = find_auto_var(name);
+    bool is_indirect = var != NULL && !var->is_extrn;
+    int runtime = find_runtime_function(name, var);
+    for (int i = 0; i < call->call.count; ++i) {
+        if (i < ARGUMENT_REGISTERS_COUNT) {
+            fprintf(file, "\tpop %s\n", argument_registers[i]); --pushed_on_stack;
+        }
+        else {
+            fprintf(file, "\tpop QWORD [rbp+%zu]\n", 16 + (i - ARGUMENT_REGISTERS_COUNT) * sizeof(Word)); --pushed_on_stack;
+        }
+    }
+    if (is_indirect) {
+        fprintf(file, "\tmov r11, [rbp-%zu]\n", var->offset);
+    }
+    else if (var != NULL && !is_function(name) && runtime < 0) {
+        // variadic functions expect the number of vector arguments in al
+        fprintf(file, "\txor eax, eax\n");
+    }
+    compile_leave(file);
+    if (is_indirect) {
+        fprintf(file, "\tjmp r11\n");
+    }
+    else if (runtime >= 0) {
+        uses_runtime_function[runtime] = true;
+        fprintf(file, "\tjmp ..bbc_%s\n", name);
+    }
+    else {
+        fprintf(file, "\tjmp %s\n", name);
+    }
+    report_tail_call(name, "converted (sibling call)");
+}
+
+// The arguments are evaluated right to left in the scope of the caller, then stored into the
+// parameters by begin_inlined_body.
+static void begin_inlined_call(ASTNode* root, FILE* file) {
+    write_comment(file, "\t;---inlined %s---\n", root->inlined_call.name);
+    push_task(root, file, STEP_INLINED_CALL_BODY)->values[0] = new_label();
+    push_arguments(root->inlined_call.arguments, root->inlined_call.count, file);
+}
+
+static void begin_inlined_body(const CompileTask* task) {
+    ASTNode* root = task->node;
+    FILE* file = task->file;
+    int count = root->inlined_call.count;
+    int end_label = task->values[0];
+
+    CompileTask* end = push_task(root, file, STEP_INLINED_CALL_END);
+    end->values[0] = end_label;
+    end->saved_vars_index = vars_index;
+    end->saved_scope_start = scope_start;
+    scope_start = vars_index;
+    // declaring the next parameter may move the variables
+    size_t first_offset = 0;
+    for (int i = 0; i < count; ++i) {
+        AutoVar* parameter = declare_var(root->inlined_call.parameters[i], false);
+        if (i == 0) first_offset = parameter->offset;
+    }
+    for (int i = 0; i < count; ++i) {
+        fprintf(file, "\tpop rax\n"); --pushed_on_stack;
+        fprintf(file, "\tmov QWORD [rbp-%zu], rax\n", first_offset + i * sizeof(Word));
+    }
+
+    push_jump_label(&inline_return_labels, &inline_return_labels_count, &inline_return_labels_capacity, end_label);
+    push_node(root->inlined_call.body, file);
+}
+
+static void end_inlined_call(const CompileTask* task) {
+    FILE* file = task->file;
+    --inline_return_labels_count;
+    compile_load_rax(0, file);
+    fprintf(file, "..L%d:\n", task->values[0]);
+    fprintf(file, "\tpush rax\n"); ++pushed_on_stack;
+
+    vars_index = task->saved_vars_index;
+    scope_start = task->saved_scope_start;
+}
+
+static bool ends_with_return(ASTNode* statement) {
+    while (statement->type == AST_NODE_BLOCK && statement->block.count > 0) {
+        statement = statement->block.statements[statement->block.count - 1];
+    }
+    return statement->type == AST_NODE_RETURN_STATEMENT;
+}
+
+static void write_function(ASTNode* function, FILE* file) {
+    const char* name = function->function.name;
+    int parameter_count = function->function.parameter_count;
+
+    vars_index = 0;
+    vars_offset = 0;
+    scope_start = 0;
+    pushed_on_stack = 0;
+    current_function = function;
+    function_body_label = new_label();
+    function_end_label = -1;
+    shares_function_end = options->optimize_size;
+
+    size_t frame_size = (parameter_count + count_declarations(function->function.body)) * sizeof(Word);
+    // keep the stack 16-byte aligned
+    frame_size = (frame_size + 15) & ~(size_t)15;
+
+    check_fasm_name(function, name);
+    write_comment(file, ";---func %s---\n", name);
+    fprintf(file, "public %s\n", name);
+    fprintf(file, "%s:\n", name);
+    if (options->debug_info) {
+        debug_begin_function(name, line_of(function));
+        compile_line(function, file);
+    }
+    fprintf(file, "\tpush rbp\n");
+    fprintf(file, "\tmov rbp, rsp\n");
+    if (frame_size > 0) {
+        fprintf(file, "\tsub rsp, %zu\n", frame_size);
+    }
+
+    // parameters are copied to the frame, stack ones are above the return address
+    for (int i = 0; i < parameter_count; ++i) {
+        AutoVar* parameter = declare_var(function->function.parameters[i], false);
+        if (i < ARGUMENT_REGISTERS_COUNT) {
+            fprintf(file, "\tmov QWORD [rbp-%zu], %s\n", parameter->offset, argument_registers[i]);
+        }
+        else {
+            fprintf(file, "\tmov rax, [rbp+%zu]\n", 16 + (i - ARGUMENT_REGISTERS_COUNT) * sizeof(Word));
+            fprintf(file, "\tmov QWORD [rbp-%zu], rax\n", parameter->offset);
+        }
+        if (options->debug_info) {
+            debug_add_variable(parameter->name, line_of(function), parameter->offset, true);
+        }
+    }
+
+    fprintf(file, "..L%d:\n", function_body_label);
+    compile(function->function.body, file);
+
+    // nothing reaches the end after a return but the returns that share it
+    if (!options->optimize_size || function_end_label >= 0 || !ends_with_return(function->function.body)) {
+        write_comment(file, "\t;---func end---\n");
+        if (function_end_label >= 0) {
+            fprintf(file, "..L%d:\n", function_end_label);
+        }
+        compile_load_rax(0, file);
+        compile_epilogue(file);
+    }
+    if (options->debug_info) {
+        debug_end_function(file, cold_text);
+    }
+}
+
+// at -Os the code of a function is collected here before fold_stack_round_trips
+static _Thread_local FILE* size_text = NULL;
+static _Thread_local char* size_text_buffer = NULL;
+static _Thread_local size_t size_text_size = 0;
+
+// the line starting at line is text and a newline
+static bool is_line(const char* line, const char* text) {
+    size_t length = strlen(text);
+    return strncmp(line, text, length) == 0 && line[length] == '\n';
+}
+
+// the number of a "\tpush <number>" line, NULL for any other line
+static const char* pushed_number(const char* line) {
+    if (strncmp(line, "\tpush ", 6) != 0) return NULL;
+    const char* number = line + 6;
+    const char* digit = number[0] == '-' ? number + 1 : number;
+    if (*digit < '0' || *digit > '9') return NULL;
+    while (*digit >= '0' && *digit <= '9') ++digit;
+    return *digit == '\n' ? number : NULL;
+}
+
+// The stack machine pushes every value, often for the next instruction to pop it again. A push
+// and a pop of the same register next to each other are dropped, and a number pushed to be
+// popped into rcx for cmp, add or sub becomes the immediate of the instruction. Lines are
+// folded as they are kept, so the pop rax left by a fold may drop the push rax before it. The
+// text is rewritten in place, returns its new size.
+static size_t fold_stack_round_trips(char* text, size_t size) {
+    static const char* const folded_instructions[] = { "cmp", "add", "sub" };
+    // offsets of the lines kept so far
+    size_t* lines = NULL;
+    int lines_count = 0;
+    int lines_capacity = 0;
+    size_t kept = 0;
+    size_t position = 0;
+    while (position < size) {
+        const char* newline = memchr(text + position, '\n', size - position);
+        size_t length = newline != NULL ? (size_t)(newline - text) + 1 - position : size - position;
+        memmove(text + kept, text + position, length);
+        position += length;
+        if (lines_capacity < lines_count + 2) {
+            int old_capacity = lines_capacity;
+            lines_capacity = GROW_CAPACITY(old_capacity);
+            lines = GROW_ARRAY(size_t, lines, old_capacity, lines_capacity);
+        }
+        lines[lines_count++] = kept;
+        kept += length;
+        if (newline == NULL) continue;
+
+        for (;;) {
+            if (lines_count >= 2) {
+                const char* push = text + lines[lines_count - 2];
+                const char* pop = text + lines[lines_count - 1];
+                // "\tpush " and "\tpop " with the newline
+                size_t pushed_length = lines[lines_count - 1] - lines[lines_count - 2] - 7;
+                size_t popped_length = kept - lines[lines_count - 1] - 6;
+                if (strncmp(push, "\tpush ", 6) == 0 && strncmp(pop, "\tpop ", 5) == 0
+                    && pushed_length == popped_length && memcmp(push + 6, pop + 5, pushed_length) == 0) {
+                    lines_count -= 2;
+                    kept = lines[lines_count];
+                    continue;
+                }
+            }
+            if (lines_count >= 4) {
+                const char* number = pushed_number(text + lines[lines_count - 4]);
+                const char* operation = text + lines[lines_count - 1];
+                int folded = -1;
+                for (int i = 0; i < 3 && number != NULL; ++i) {
+                    if (operation[0] == '\t' && strncmp(operation + 1, folded_instructions[i], 3) == 0
+                        && is_line(operation + 4, " rax, rcx")) {
+                        folded = i;
+                    }
+                }
+                if (folded >= 0 && is_line(text + lines[lines_count - 3], "\tpop rcx")
+                    && is_line(text + lines[lines_count - 2], "\tpop rax")) {
+                    char line[64];
+                    int number_length = (int)(strchr(number, '\n') - number);
+                    int line_length = snprintf(
+                        line, sizeof(line), "\t%s rax, %.*s\n", folded_instructions[folded], number_length, number
+                    );
+                    lines_count -= 4;
+                    kept = lines[lines_count];
+                    memcpy(text + kept, "\tpop rax\n", 9);
+                    lines[lines_count++] = kept;
+                    kept += 9;
+                    memcpy(text + kept, line, line_length);
+                    lines[lines_count++] = kept;
+                    kept += line_length;
+                    continue;
+                }
+            }
+            break;
+        }
+    }
+    free(lines);
+    return kept;
+}
+
+// At -Os the function goes through fold_stack_round_trips before it is written to the file.
+static void compile_function(ASTNode* function, FILE* file) {
+    if (!options->optimize_size) {
+        write_function(function, file);
+        return;
+    }
+    size_text = open_memstream(&size_text_buffer, &size_text_size);
+    write_function(function, size_text);
+    fclose(size_text);
+    size_text = NULL;
+    fwrite(size_text_buffer, 1, fold_stack_round_trips(size_text_buffer, size_text_size), file);
+    free(size_text_buffer);
+    size_text_buffer = NULL;
+}
+
+// Like in B the name of an external vector is a word holding the address of its first element.
+// The elements of a vector without values are in .bss, like the words of `auto` outside of
+// functions.
+static void compile_vector_definition(ASTNode* vector, FILE* file) {
+    const char* name = vector->vector.name;
+    check_fasm_name(vector, name);
+    if (vector->vector.is_scalar) {
+        write_comment(bss, ";---word %s---\n", name);
+        fprintf(bss, "align 8\n");
+        fprintf(bss, "public %s\n", name);
+        fprintf(bss, "%s:\n", name);
+        fprintf(bss, "\trq 1\n");
+        return;
+    }
+    write_comment(file, ";---vector %s---\n", name);
+    if (vector->vector.count == 0) {
+        fprintf(file, "align 8\n");
+        fprintf(file, "public %s\n", name);
+        fprintf(file, "%s:\n", name);
+        fprintf(file, "\tdq ..elements_%s\n", name);
+        write_comment(bss, ";---vector %s---\n", name);
+        fprintf(bss, "align 8\n");
+        fprintf(bss, "..elements_%s:\n", name);
+        fprintf(bss, "\trq %ld\n", vector->vector.bound + 1);
+        return;
+    }
+    fprintf(file, "align 8\n");
+    fprintf(file, "public %s\n", name);
+    fprintf(file, "%s:\n", name);
+    fprintf(file, "\tdq %s+8\n", name);
+    for (int i = 0; i < vector->vector.count; ++i) {
+        fprintf(file, "\tdq %ld\n", vector->vector.values[i]);
+    }
+    Word rest = vector->vector.bound + 1 - vector->vector.count;
+    if (rest > 0) {
+        fprintf(file, "\trq %ld\n", rest);
+    }
+}
+
+static AutoVar* match_variable(ASTNode* node) {
+    if (node->type != AST_NODE_VARIABLE) return NULL;
+    return find_auto_var(node->name);
+}
+
+static bool is_variable_named(ASTNode* node, const char* name) {
+    return node->type == AST_NODE_VARIABLE && strcmp(node->name, name) == 0;
+}
+
+// vector[index] with the vector held in a variable
+static AutoVar* match_element(ASTNode* node, const char* index) {
+    if (node->type != AST_NODE_SUBSCRIPT || !is_variable_named(node->subscript.index, index)) return NULL;
+    return match_variable(node->subscript.vector);
+}
+
+static bool match_vector_loop(ASTNode* loop, VectorLoop* match) {
+    ASTNode* condition = loop->while_statement.condition;
+    ASTNode* body = loop->while_statement.body;
+    if (condition->type != AST_NODE_BINARY || condition->binary.op != TOKEN_LESS) return false;
+
+    match->index = match_variable(condition->binary.left);
+    if (match->index == NULL || match->index->is_extrn) return false;
+    const char* index = match->index->name;
+
+    // the bound is read once, so it must be a constant or an auto the loop can't change
+    match->bound = condition->binary.right;
+    if (match->bound->type != AST_NODE_LITERAL) {
+        AutoVar* bound = match_variable(match->bound);
+        if (bound == NULL || bound->is_extrn || bound == match->index) return false;
+    }
+
+    if (body->type != AST_NODE_BLOCK || body->block.count != 2) return false;
+    ASTNode* store = body->block.statements[0];
+    ASTNode* step = body->block.statements[1];
+
+    if (store->type != AST_NODE_EXPRESSION_STATEMENT || store->expression->type != AST_NODE_SUBSCRIPT_ASSIGNMENT) return false;
+    ASTNode* assignment = store->expression;
+    if (!is_variable_named(assignment->subscript.index, index)) return false;
+    match->destination = match_variable(assignment->subscript.vector);
+
+    // AVX2 has no 64-bit multiply, only additions and subtractions are vectorized
+    ASTNode* value = assignment->subscript.value;
+    if (value->type != AST_NODE_BINARY || (value->binary.op != TOKEN_PLUS && value->binary.op != TOKEN_MINUS)) return false;
+    match->op = value->binary.op;
+    match->left = match_element(value->binary.left, index);
+    match->right = match_element(value->binary.right, index);
+    if (match->destination == NULL || match->left == NULL || match->right == NULL) return false;
+    if (match->destination == match->index || match->left == match->index || match->right == match->index) return false;
+
+    if (step->type != AST_NODE_EXPRESSION_STATEMENT || step->expression->type != AST_NODE_ASSIGNMENT) return false;
+    ASTNode* increment = step->expression->assignment.value;
+    if (strcmp(step->expression->assignment.name, index) != 0 || increment->type != AST_NODE_BINARY ||
+        increment->binary.op != TOKEN_PLUS) return false;
+    ASTNode* left = increment->binary.left;
+    ASTNode* right = increment->binary.right;
+    return (is_variable_named(left, index) && right->type == AST_NODE_LITERAL && right->literal == 1) ||
+        (is_variable_named(right, index) && left->type == AST_NODE_LITERAL && left->literal == 1);
+}
+
+static void compile_load_variable(const char* reg, const AutoVar* var, FILE* file) {
+    if (var->is_extrn) {
+        fprintf(file, "\tmov %s, [%s]\n", reg, var->name);
+    }
+    else {
+        fprintf(file, "\tmov %s, [rbp-%zu]\n", reg, var->offset);
+    }
+}
+
+// Four words per iteration with AVX2 when cpuid reports it, two with SSE2 otherwise, and the
+// remaining words one by one. Vectors overlapping closer than one block run the scalar loop,
+// since a block reads its inputs before storing.
+static void compile_vector_loop(const VectorLoop* loop, FILE* file) {
+    int avx_label = new_label();
+    int avx_end_label = new_label();
+    int sse_label = new_label();
+    int scalar_label = new_label();
+    int end_label = new_label();
+    bool is_add = loop->op == TOKEN_PLUS;
+    uses_simd_level = true;
+
+    write_comment(file, "\t;---vectorized while---\n");
+    fprintf(file, "\tcall ..simd_level\n");
+    fprintf(file, "\tmov r11, rax\n");
+    compile_load_variable("rcx", loop->index, file);
+    if (loop->bound->type == AST_NODE_LITERAL) {
+        fprintf(file, "\tmov rdx, %ld\n", loop->bound->literal);
+    }
+    else {
+        compile_load_variable("rdx", find_auto_var(loop->bound->name), file);
+    }
+    compile_load_variable("r8", loop->destination, file);
+    compile_load_variable("r9", loop->left, file);
+    compile_load_variable("r10", loop->right, file);
+    const char* sources[] = { "r9", "r10" };
+    for (int i = 0; i < 2; ++i) {
+        fprintf(file, "\tmov rax, r8\n");
+        fprintf(file, "\tsub rax, %s\n", sources[i]);
+        fprintf(file, "\tdec rax\n");
+        fprintf(file, "\tcmp rax, 31\n");
+        fprintf(file, "\tjb ..L%d\n", scalar_label);
+    }
+    fprintf(file, "\tcmp r11, 2\n");
+    fprintf(file, "\tjne ..L%d\n", sse_label);
+
+    fprintf(file, "..L%d:\n", avx_label);
+    fprintf(file, "\tmov rax, rdx\n");
+    fprintf(file, "\tsub rax, rcx\n");
+    fprintf(file, "\tcmp rax, 4\n");
+    fprintf(file, "\tjl ..L%d\n", avx_end_label);
+    fprintf(file, "\tvmovdqu ymm0, [r9+rcx*8]\n");
+    fprintf(file, "\t%s ymm0, ymm0, [r10+rcx*8]\n", is_add ? "vpaddq" : "vpsubq");
+    fprintf(file, "\tvmovdqu [r8+rcx*8], ymm0\n");
+    fprintf(file, "\tadd rcx, 4\n");
+    fprintf(file, "\tjmp ..L%d\n", avx_label);
+    fprintf(file, "..L%d:\n", avx_end_label);
+    fprintf(file, "\tvzeroupper\n");
+    fprintf(file, "\tjmp ..L%d\n", scalar_label);
+
+    fprintf(file, "..L%d:\n", sse_label);
+    fprintf(file, "\tmov rax, rdx\n");
+    fprintf(file, "\tsub rax, rcx\n");
+    fprintf(file, "\tcmp rax, 2\n");
+    fprintf(file, "\tjl ..L%d\n", scalar_label);
+    fprintf(file, "\tmovdqu xmm0, [r9+rcx*8]\n");
+    fprintf(file, "\tmovdqu xmm1, [r10+rcx*8]\n");
+    fprintf(file, "\t%s xmm0, xmm1\n", is_add ? "paddq" : "psubq");
+    fprintf(file, "\tmovdqu [r8+rcx*8], xmm0\n");
+    fprintf(file, "\tadd rcx, 2\n");
+    fprintf(file, "\tjmp ..L%d\n", sse_label);
+
+    fprintf(file, "..L%d:\n", scalar_label);
+    fprintf(file, "\tcmp rcx, rdx\n");
+    fprintf(file, "\tjge ..L%d\n", end_label);
+    fprintf(file, "\tmov rax, [r9+rcx*8]\n");
+    fprintf(file, "\t%s rax, [r10+rcx*8]\n", is_add ? "add" : "sub");
+    fprintf(file, "\tmov QWORD [r8+rcx*8], rax\n");
+    fprintf(file, "\tinc rcx\n");
+    fprintf(file, "\tjmp ..L%d\n", scalar_label);
+    fprintf(file, "..L%d:\n", end_label);
+    fprintf(file, "\tmov QWORD [rbp-%zu], rcx\n", loop->index->offset);
+}
+
+// Returns 2 when AVX2 can be used (cpu support and ymm state enabled by the OS), 1 for SSE2,
+// which every x86_64 cpu has. The answer is cached after the first call.
+static void compile_simd_level(FILE* file) {
+    write_comment(file, ";---simd level---\n");
+    fprintf(file, "..simd_level:\n");
+    fprintf(file, "\tmov rax, [..simd_level_cache]\n");
+    fprintf(file, "\ttest rax, rax\n");
+    fprintf(file, "\tjnz ..simd_level_done\n");
+    fprintf(file, "\tpush rbx\n");
+    fprintf(file, "\tmov r11, 1\n");
+    fprintf(file, "\tmov eax, 1\n");
+    fprintf(file, "\tcpuid\n");
+    // osxsave and avx
+    fprintf(file, "\tand ecx, 0x18000000\n");
+    fprintf(file, "\tcmp ecx, 0x18000000\n");
+    fprintf(file, "\tjne ..simd_level_store\n");
+    fprintf(file, "\txor ecx, ecx\n");
+    fprintf(file, "\txgetbv\n");
+    fprintf(file, "\tand eax, 6\n");
+    fprintf(file, "\tcmp eax, 6\n");
+    fprintf(file, "\tjne ..simd_level_store\n");
+    fprintf(file, "\tmov eax, 7\n");
+    fprintf(file, "\txor ecx, ecx\n");
+    fprintf(file, "\tcpuid\n");
+    // avx2
+    fprintf(file, "\ttest ebx, 0x20\n");
+    fprintf(file, "\tjz ..simd_level_store\n");
+    fprintf(file, "\tmov r11, 2\n");
+    fprintf(file, "..simd_level_store:\n");
+    fprintf(file, "\tpop rbx\n");
+    fprintf(file, "\tmov [..simd_level_cache], r11\n");
+    fprintf(file, "\tmov rax, r11\n");
+    fprintf(file, "..simd_level_done:\n");
+    fprintf(file, "\tret\n");
+}
+
+static void compile_profile_counter(int site, int counter, FILE* file) {
+    fprintf(file, "\tinc QWORD [..profile_counters+%d]\n", (site * PROFILE_COUNTERS_PER_SITE + counter) * (int)sizeof(Word));
+}
+
+// Writes the counters in the format read by profile_load, called from .fini_array at exit.
+static void compile_profile_dump(int site_count, FILE* file) {
+    write_comment(file, ";---profile dump---\n");
+    fprintf(file, "..profile_dump:\n");
+    // two pushes and the padding keep the stack aligned for the calls
+    fprintf(file, "\tpush rbx\n");
+    fprintf(file, "\tpush r12\n");
+    fprintf(file, "\tsub rsp, 8\n");
+    fprintf(file, "\tlea rdi, [..profile_path]\n");
+    fprintf(file, "\tlea rsi, [..profile_mode]\n");
+    fprintf(file, "\tcall fopen\n");
+    fprintf(file, "\ttest rax, rax\n");
+    fprintf(file, "\tjz ..profile_dump_end\n");
+    fprintf(file, "\tmov rbx, rax\n");
+    fprintf(file, "\tmov rdi, rbx\n");
+    fprintf(file, "\tlea rsi, [..profile_header]\n");
+    fprintf(file, "\tmov rdx, %d\n", site_count);
+    fprintf(file, "\txor eax, eax\n");
+    fprintf(file, "\tcall fprintf\n");
+    fprintf(file, "\txor r12, r12\n");
+    fprintf(file, "..profile_dump_loop:\n");
+    fprintf(file, "\tcmp r12, %d\n", site_count);
+    fprintf(file, "\tjge ..profile_dump_close\n");
+    fprintf(file, "\tmov rdi, rbx\n");
+    fprintf(file, "\tlea rsi, [..profile_line]\n");
+    fprintf(file, "\tmov rdx, r12\n");
+    fprintf(file, "\tlea rax, [..profile_counters]\n");
+    fprintf(file, "\tmov r8, r12\n");
+    fprintf(file, "\tshl r8, 4\n");
+    fprintf(file, "\tmov rcx, [rax+r8]\n");
+    fprintf(file, "\tmov r8, [rax+r8+8]\n");
+    fprintf(file, "\txor eax, eax\n");
+    fprintf(file, "\tcall fprintf\n");
+    fprintf(file, "\tinc r12\n");
+    fprintf(file, "\tjmp ..profile_dump_loop\n");
+    fprintf(file, "..profile_dump_close:\n");
+    fprintf(file, "\tmov rdi, rbx\n");
+    fprintf(file, "\tcall fclose\n");
+    fprintf(file, "..profile_dump_end:\n");
+    fprintf(file, "\tadd rsp, 8\n");
+    fprintf(file, "\tpop r12\n");
+    fprintf(file, "\tpop rbx\n");
+    fprintf(file, "\tret\n");
+
+    fprintf(rodata, "..profile_path:\n");
+    fprintf(rodata, "\tdb \"%s\", 0\n", options->profile_generate_path);
+    fprintf(rodata, "..profile_mode:\n");
+    fprintf(rodata, "\tdb \"w\", 0\n");
+    fprintf(rodata, "..profile_header:\n");
+    fprintf(rodata, "\tdb \"bbc profile 1\", 10, \"sites %%ld\", 10, 0\n");
+    fprintf(rodata, "..profile_line:\n");
+    fprintf(rodata, "\tdb \"%%ld %%ld %%ld\", 10, 0\n");
+}
+
+static bool uses_runtime() {
+    for (int i = 0; i < RUNTIME_FUNCTIONS_COUNT; ++i) {
+        if (uses_runtime_function[i]) return true;
+    }
+    return false;
+}
+
+// Writes the format of rdi with the arguments of the other registers and the stack, the
+// conversions %d, %i, %u, %ld, %li, %lu, %c, %s and %% go to the buffer. A format with any
+// other is passed on to printf, after the buffer is flushed and stdout is made unbuffered, so
+// the output stays in order.
+static void compile_runtime_printf(FILE* file) {
+    static const char* const conversions[] = { "d", "i", "u", "c", "s", "%" };
+
+    fprintf(file, "..bbc_printf:\n");
+    fprintf(file, "\tmov r10, rdi\n");
+    fprintf(file, "..bbc_printf_check:\n");
+    fprintf(file, "\tmovzx eax, BYTE [r10]\n");
+    fprintf(file, "\tinc r10\n");
+    fprintf(file, "\ttest eax, eax\n");
+    fprintf(file, "\tjz ..bbc_printf_format\n");
+    fprintf(file, "\tcmp eax, '%%'\n");
+    fprintf(file, "\tjne ..bbc_printf_check\n");
+    fprintf(file, "\tmovzx eax, BYTE [r10]\n");
+    fprintf(file, "\tinc r10\n");
+    fprintf(file, "\tcmp eax, 'l'\n");
+    fprintf(file, "\tjne ..bbc_printf_check_conversion\n");
+    fprintf(file, "\tmovzx eax, BYTE [r10]\n");
+    fprintf(file, "\tinc r10\n");
+    // only the integer conversions take l
+    for (int i = 0; i < 3; ++i) {
+        fprintf(file, "\tcmp eax, '%s'\n", conversions[i]);
+        fprintf(file, "\tje ..bbc_printf_check\n");
+    }
+    fprintf(file, "\tjmp ..bbc_printf_libc\n");
+    fprintf(file, "..bbc_printf_check_conversion:\n");
+    for (size_t i = 0; i < sizeof(conversions) / sizeof(conversions[0]); ++i) {
+        fprintf(file, "\tcmp eax, '%s'\n", conversions[i]);
+        fprintf(file, "\tje ..bbc_printf_check\n");
+    }
+    fprintf(file, "..bbc_printf_libc:\n");
+    fprintf(file, "\tcall ..bbc_flush\n");
+    fprintf(file, "\tcmp BYTE [..bbc_printf_unbuffered], 0\n");
+    fprintf(file, "\tjne ..bbc_printf_jump\n");
+    fprintf(file, "\tmov BYTE [..bbc_printf_unbuffered], 1\n");
+    for (int i = 0; i < ARGUMENT_REGISTERS_COUNT; ++i) {
+        fprintf(file, "\tpush %s\n", argument_registers[i]);
+    }
+    // six pushes and the padding keep the stack aligned for the call
+    fprintf(file, "\tsub rsp, 8\n");
+    fprintf(file, "\tmov rdi, [stdout]\n");
+    fprintf(file, "\txor esi, esi\n");
+    // _IONBF
+    fprintf(file, "\tmov edx, 2\n");
+    fprintf(file, "\txor ecx, ecx\n");
+    fprintf(file, "\tcall setvbuf\n");
+    fprintf(file, "\tadd rsp, 8\n");
+    for (int i = ARGUMENT_REGISTERS_COUNT - 1; i >= 0; --i) {
+        fprintf(file, "\tpop %s\n", argument_registers[i]);
+    }
+    fprintf(file, "..bbc_printf_jump:\n");
+    fprintf(file, "\txor eax, eax\n");
+    fprintf(file, "\tjmp printf\n");
+
+    // the register arguments are pushed below the stack ones, rsi walks over them and skips
+    // the return address in between, rbx counts the written bytes
+    fprintf(file, "..bbc_printf_format:\n");
+    for (int i = ARGUMENT_REGISTERS_COUNT - 1; i >= 1; --i) {
+        fprintf(file, "\tpush %s\n", argument_registers[i]);
+    }
+    fprintf(file, "\tpush rbx\n");
+    fprintf(file, "\txor ebx, ebx\n");
+    fprintf(file, "\tlea rsi, [rsp+8]\n");
+    fprintf(file, "..bbc_printf_loop:\n");
+    fprintf(file, "\tmovzx eax, BYTE [rdi]\n");
+    fprintf(file, "\tinc rdi\n");
+    fprintf(file, "\ttest eax, eax\n");
+    fprintf(file, "\tjz ..bbc_printf_end\n");
+    fprintf(file, "\tcmp eax, '%%'\n");
+    fprintf(file, "\tjne ..bbc_printf_char\n");
+    fprintf(file, "\tmovzx edx, BYTE [rdi]\n");
+    fprintf(file, "\tinc rdi\n");
+    fprintf(file, "\tcmp edx, '%%'\n");
+    fprintf(file, "\tje ..bbc_printf_percent\n");
+    fprintf(file, "\tcall ..bbc_printf_argument\n");
+    fprintf(file, "\tcmp edx, 'c'\n");
+    fprintf(file, "\tje ..bbc_printf_char\n");
+    fprintf(file, "\tcmp edx, 's'\n");
+    fprintf(file, "\tje ..bbc_printf_string\n");
+    fprintf(file, "\tcmp edx, 'u'\n");
+    fprintf(file, "\tje ..bbc_printf_unsigned_int\n");
+    fprintf(file, "\tcmp edx, 'l'\n");
+    fprintf(file, "\tje ..bbc_printf_long\n");
+    fprintf(file, "\tmovsxd rax, eax\n");
+    fprintf(file, "\tjmp ..bbc_printf_signed\n");
+    fprintf(file, "..bbc_printf_unsigned_int:\n");
+    fprintf(file, "\tmov eax, eax\n");
+    fprintf(file, "\tjmp ..bbc_printf_unsigned\n");
+    fprintf(file, "..bbc_printf_long:\n");
+    fprintf(file, "\tmovzx edx, BYTE [rdi]\n");
+    fprintf(file, "\tinc rdi\n");
+    fprintf(file, "\tcmp edx, 'u'\n");
+    fprintf(file, "\tje ..bbc_printf_unsigned\n");
+    fprintf(file, "..bbc_printf_signed:\n");
+    fprintf(file, "\tcall ..bbc_reserve_number\n");
+    fprintf(file, "\tsub rbx, [..bbc_output_used]\n");
+    fprintf(file, "\tcall ..bbc_decimal\n");
+    fprintf(file, "\tadd rbx, [..bbc_output_used]\n");
+    fprintf(file, "\tjmp ..bbc_printf_loop\n");
+    fprintf(file, "..bbc_printf_unsigned:\n");
+    fprintf(file, "\tcall ..bbc_reserve_number\n");
+    fprintf(file, "\tsub rbx, [..bbc_output_used]\n");
+    fprintf(file, "\tcall ..bbc_unsigned\n");
+    fprintf(file, "\tadd rbx, [..bbc_output_used]\n");
+    fprintf(file, "\tjmp ..bbc_printf_loop\n");
+    fprintf(file, "..bbc_printf_string:\n");
+    fprintf(file, "\tmov rdx, rax\n");
+    fprintf(file, "\ttest rdx, rdx\n");
+    fprintf(file, "\tjz ..bbc_printf_loop\n");
+    fprintf(file, "..bbc_printf_string_loop:\n");
+    fprintf(file, "\tmovzx eax, BYTE [rdx]\n");
+    fprintf(file, "\ttest eax, eax\n");
+    fprintf(file, "\tjz ..bbc_printf_loop\n");
+    fprintf(file, "\tcall ..bbc_put_byte\n");
+    fprintf(file, "\tinc rbx\n");
+    fprintf(file, "\tinc rdx\n");
+    fprintf(file, "\tjmp ..bbc_printf_string_loop\n");
+    fprintf(file, "..bbc_printf_percent:\n");
+    fprintf(file, "\tmov eax, edx\n");
+    fprintf(file, "..bbc_printf_char:\n");
+    fprintf(file, "\tcall ..bbc_put_byte\n");
+    fprintf(file, "\tinc rbx\n");
+    fprintf(file, "\tjmp ..bbc_printf_loop\n");
+    fprintf(file, "..bbc_printf_end:\n");
+    fprintf(file, "\tmov rax, rbx\n");
+    fprintf(file, "\tpop rbx\n");
+    fprintf(file, "\tadd rsp, %d\n", (ARGUMENT_REGISTERS_COUNT - 1) * (int)sizeof(Word));
+    fprintf(file, "\tret\n");
+
+    // rax is the next argument, the return address of printf is 7 words up
+    fprintf(file, "..bbc_printf_argument:\n");
+    fprintf(file, "\tmov rax, [rsi]\n");
+    fprintf(file, "\tadd rsi, 8\n");
+    fprintf(file, "\tlea rcx, [rsp+%d]\n", (ARGUMENT_REGISTERS_COUNT + 1) * (int)sizeof(Word));
+    fprintf(file, "\tcmp rsi, rcx\n");
+    fprintf(file, "\tjne ..bbc_printf_argument_done\n");
+    fprintf(file, "\tadd rsi, 8\n");
+    fprintf(file, "..bbc_printf_argument_done:\n");
+    fprintf(file, "\tret\n");
+}
+
+// The output of print, putchar and printf is collected in ..bbc_output and written with one
+// system call when it is full and at exit, from .fini_array. The helpers keep the registers
+// their callers walk with: ..bbc_flush changes only rcx and r11, ..bbc_put_byte appends al
+// and changes rcx and r11 too, ..bbc_decimal and ..bbc_unsigned append rax after
+// ..bbc_reserve_number made room and keep rdi, rsi and rbx.
+static void compile_runtime(FILE* file) {
+    write_comment(file, ";---runtime---\n");
+    fprintf(file, "..bbc_flush:\n");
+    fprintf(file, "\tpush rax\n");
+    fprintf(file, "\tpush rdi\n");
+    fprintf(file, "\tpush rsi\n");
+    fprintf(file, "\tpush rdx\n");
+    fprintf(file, "\tpush r8\n");
+    fprintf(file, "\txor r8d, r8d\n");
+    fprintf(file, "..bbc_flush_loop:\n");
+    fprintf(file, "\tmov rdx, [..bbc_output_used]\n");
+    fprintf(file, "\tsub rdx, r8\n");
+    fprintf(file, "\tjle ..bbc_flush_done\n");
+    fprintf(file, "\tlea rsi, [..bbc_output]\n");
+    fprintf(file, "\tadd rsi, r8\n");
+    // write(1, ...), again after a signal and for what is left after a short write
+    fprintf(file, "\tmov edi, 1\n");
+    fprintf(file, "\tmov eax, 1\n");
+    fprintf(file, "\tsyscall\n");
+    fprintf(file, "\tcmp rax, -4\n");
+    fprintf(file, "\tje ..bbc_flush_loop\n");
+    fprintf(file, "\ttest rax, rax\n");
+    fprintf(file, "\tjle ..bbc_flush_done\n");
+    fprintf(file, "\tadd r8, rax\n");
+    fprintf(file, "\tjmp ..bbc_flush_loop\n");
+    fprintf(file, "..bbc_flush_done:\n");
+    fprintf(file, "\tmov QWORD [..bbc_output_used], 0\n");
+    fprintf(file, "\tpop r8\n");
+    fprintf(file, "\tpop rdx\n");
+    fprintf(file, "\tpop rsi\n");
+    fprintf(file, "\tpop rdi\n");
+    fprintf(file, "\tpop rax\n");
+    fprintf(file, "\tret\n");
+
+    // a stream may define the function after declaring it with extrn, the calls go to it then
+    for (int i = RUNTIME_PUTCHAR; i < RUNTIME_FUNCTIONS_COUNT; ++i) {
+        if (uses_runtime_function[i] && is_function(runtime_functions[i])) {
+            fprintf(file, "..bbc_%s:\n", runtime_functions[i]);
+            fprintf(file, "\tjmp %s\n", runtime_functions[i]);
+        }
+    }
+    if (uses_runtime_function[RUNTIME_PUTCHAR] && !is_function("putchar")) {
+        fprintf(file, "..bbc_putchar:\n");
+        fprintf(file, "\tmovzx eax, dil\n");
+    }
+    fprintf(file, "..bbc_put_byte:\n");
+    fprintf(file, "\tmov rcx, [..bbc_output_used]\n");
+    fprintf(file, "\tcmp rcx, %d\n", RUNTIME_OUTPUT_SIZE);
+    fprintf(file, "\tjb ..bbc_put_byte_store\n");
+    fprintf(file, "\tcall ..bbc_flush\n");
+    fprintf(file, "\txor ecx, ecx\n");
+    fprintf(file, "..bbc_put_byte_store:\n");
+    fprintf(file, "\tlea r11, [..bbc_output]\n");
+    fprintf(file, "\tmov [r11+rcx], al\n");
+    fprintf(file, "\tinc rcx\n");
+    fprintf(file, "\tmov [..bbc_output_used], rcx\n");
+    fprintf(file, "\tret\n");
+
+    // a word takes at most 20 characters
+    fprintf(file, "..bbc_reserve_number:\n");
+    fprintf(file, "\tcmp QWORD [..bbc_output_used], %d\n", RUNTIME_OUTPUT_SIZE - 20);
+    fprintf(file, "\tja ..bbc_flush\n");
+    fprintf(file, "\tret\n");
+
+    fprintf(file, "..bbc_decimal:\n");
+    fprintf(file, "\ttest rax, rax\n");
+    fprintf(file, "\tjns ..bbc_unsigned\n");
+    fprintf(file, "\tmov rcx, [..bbc_output_used]\n");
+    fprintf(file, "\tlea r11, [..bbc_output]\n");
+    fprintf(file, "\tmov BYTE [r11+rcx], '-'\n");
+    fprintf(file, "\tinc rcx\n");
+    fprintf(file, "\tmov [..bbc_output_used], rcx\n");
+    fprintf(file, "\tneg rax\n");
+    // the digits are made from the last one in the red zone, dividing by 10 is a multiplication
+    // with its inverse
+    fprintf(file, "..bbc_unsigned:\n");
+    fprintf(file, "\tlea r8, [rsp-8]\n");
+    fprintf(file, "\tmov r9, r8\n");
+    fprintf(file, "\tmov r10, 0xCCCCCCCCCCCCCCCD\n");
+    fprintf(file, "..bbc_unsigned_digit:\n");
+    fprintf(file, "\tmov rcx, rax\n");
+    fprintf(file, "\tmul r10\n");
+    fprintf(file, "\tshr rdx, 3\n");
+    fprintf(file, "\tmov rax, rdx\n");
+    fprintf(file, "\tlea rdx, [rdx+rdx*4]\n");
+    fprintf(file, "\tadd rdx, rdx\n");
+    fprintf(file, "\tsub rcx, rdx\n");
+    fprintf(file, "\tadd ecx, '0'\n");
+    fprintf(file, "\tdec r9\n");
+    fprintf(file, "\tmov [r9], cl\n");
+    fprintf(file, "\ttest rax, rax\n");
+    fprintf(file, "\tjnz ..bbc_unsigned_digit\n");
+    fprintf(file, "\tmov rcx, [..bbc_output_used]\n");
+    fprintf(file, "\tlea r11, [..bbc_output]\n");
+    fprintf(file, "\tadd r11, rcx\n");
+    fprintf(file, "\tmov rdx, r8\n");
+    fprintf(file, "\tsub rdx, r9\n");
+    fprintf(file, "\tadd rcx, rdx\n");
+    fprintf(file, "\tmov [..bbc_output_used], rcx\n");
+    fprintf(file, "..bbc_unsigned_copy:\n");
+    fprintf(file, "\tmov al, [r9]\n");
+    fprintf(file, "\tmov [r11], al\n");
+    fprintf(file, "\tinc r9\n");
+    fprintf(file, "\tinc r11\n");
+    fprintf(file, "\tcmp r9, r8\n");
+    fprintf(file, "\tjb ..bbc_unsigned_copy\n");
+    fprintf(file, "\tret\n");
+
+    if (uses_runtime_function[RUNTIME_PRINT]) {
+        fprintf(file, "..bbc_print:\n");
+        fprintf(file, "\tcall ..bbc_reserve_number\n");
+        fprintf(file, "\tmov rax, rdi\n");
+        fprintf(file, "\tcall ..bbc_decimal\n");
+        fprintf(file, "\tmov eax, 10\n");
+        fprintf(file, "\tjmp ..bbc_put_byte\n");
+    }
+    if (uses_runtime_function[RUNTIME_PRINTF] && !is_function("printf")) {
+        compile_runtime_printf(file);
+    }
+}
+
+// jumps on the value of the condition compiled before
+static void compile_condition_test(const char* jump, int label, FILE* file) {
+    fprintf(file, "\tpop rax\n"); --pushed_on_stack;
+    fprintf(file, "\ttest rax, rax\n");
+    fprintf(file, "\t%s ..L%d\n", jump, label);
+}
+
+// Both branches count how often they run, an if without else gets one for the counter.
+static void begin_instrumented_if(ASTNode* root, FILE* file) {
+    CompileTask* task = push_task(root, file, STEP_INSTRUMENTED_IF_THEN);
+    task->values[0] = new_label();
+    task->values[1] = new_label();
+    push_node(root->if_statement.condition, file);
+}
+
+// The more frequent branch falls through, a cold one is moved to .text.unlikely and jumps
+// back. Code that is already cold keeps its branches in place. Returns false when the
+// profile has nothing to say about the statement.
+static bool begin_profiled_if(ASTNode* root, FILE* file) {
+    int site = root->if_statement.site;
+    ASTNode* else_branch = root->if_statement.else_branch;
+    if (!profile_is_loaded() || profile_is_unreached(site)) return false;
+
+    bool can_move_cold = file != cold_text;
+    bool is_then_cold = profile_is_cold(site, 0);
+    bool is_else_cold = else_branch != NULL && profile_is_cold(site, 1);
+    bool is_else_hotter = else_branch != NULL && profile_count(site, 1) > profile_count(site, 0);
+    if (!(can_move_cold && (is_then_cold || is_else_cold)) && !is_else_hotter) return false;
+
+    int end_label = new_label();
+    int out_of_line_label = new_label();
+    CompileTask* task;
+    if (can_move_cold && (is_then_cold || is_else_cold)) {
+        write_comment(file, "\t;---if (cold %s)---\n", is_then_cold ? "then" : "else");
+        task = push_task(root, file, STEP_COLD_IF_HOT);
+        task->values[2] = is_then_cold;
+    }
+    else {
+        write_comment(file, "\t;---if (hot else)---\n");
+        task = push_task(root, file, STEP_HOT_ELSE_ELSE);
+    }
+    task->values[0] = end_label;
+    task->values[1] = out_of_line_label;
+    push_node(root->if_statement.condition, file);
+    return true;
+}
+
+static void compile_comparison(const char* set_instruction, FILE* file) {
+    fprintf(file, "\tcmp rax, rcx\n");
+    fprintf(file, "\t%s al\n", set_instruction);
+    fprintf(file, "\tmovzx rax, al\n");
+    fprintf(file, "\tpush rax\n"); ++pushed_on_stack;
+}
+
+static int compare_switch_cases(const void* a, const void* b) {
+    Word left = ((const SwitchCase*)a)->value;
+    Word right = ((const SwitchCase*)b)->value;
+    return (left > right) - (left < right);
+}
+
+static void compile_compare_with_case(Word value, FILE* file) {
+    if (fits_in_imm32(value)) {
+        fprintf(file, "\tcmp rax, %ld\n", value);
+    }
+    else {
+        fprintf(file, "\tmov rcx, %ld\n", value);
+        fprintf(file, "\tcmp rax, rcx\n");
+    }
+}
+
+static bool is_jump_table_dense(const SwitchCase* cases, int first, int last) {
+    uint64_t count = last - first + 1;
+    if (count < SWITCH_JUMP_TABLE_MIN_CASES) return false;
+
+    // the range wraps around to 0 only for the full 64-bit span
+    uint64_t range = (uint64_t)cases[last].value - (uint64_t)cases[first].value + 1;
+    return range != 0 && range <= SWITCH_JUMP_TABLE_MAX_SIZE && range <= count * SWITCH_JUMP_TABLE_MIN_DENSITY;
+}
+
+static void compile_jump_table(const SwitchCase* cases, int first, int last, int default_label, FILE* file) {
+    Word min = cases[first].value;
+    uint64_t range = (uint64_t)cases[last].value - (uint64_t)min + 1;
+    int table_label = new_label();
+
+    write_comment(file, "\t;---jump table---\n");
+    if (fits_in_imm32(min)) {
+        fprintf(file, "\tsub rax, %ld\n", min);
+    }
+    else {
+        fprintf(file, "\tmov rcx, %ld\n", min);
+        fprintf(file, "\tsub rax, rcx\n");
+    }
+    fprintf(file, "\tcmp rax, %lu\n", range - 1);
+    fprintf(file, "\tja ..L%d\n", default_label);
+    fprintf(file, "\tlea rcx, [..L%d]\n", table_label);
+    fprintf(file, "\tjmp QWORD [rcx+rax*8]\n");
+
+    FILE* table = rodata_stream();
+    fprintf(table, "align 8\n");
+    fprintf(table, "..L%d:\n", table_label);
+    int next_case = first;
+    for (uint64_t slot = 0; slot < range; ++slot) {
+        if ((uint64_t)cases[next_case].value - (uint64_t)min == slot) {
+            fprintf(table, "\tdq ..L%d\n", cases[next_case++].label);
+        }
+        else {
+            fprintf(table, "\tdq ..L%d\n", default_label);
+        }
+    }
+}
+
+// Emits dispatch for sorted cases[first..last], the switch value is in rax. Small sets are
+// compared one by one, dense ones go through a jump table and sparse ones are split in a
+// balanced binary search until one of the former applies.
+static void compile_switch_dispatch(const SwitchCase* cases, int first, int last, int default_label, FILE* file) {
+    int count = last - first + 1;
+
+    if (count <= SWITCH_COMPARE_CHAIN_MAX) {
+        write_comment(file, "\t;---compare chain---\n");
+        for (int i = first; i <= last; ++i) {
+            compile_compare_with_case(cases[i].value, file);
+            fprintf(file, "\tje ..L%d\n", cases[i].label);
+        }
+        fprintf(file, "\tjmp ..L%d\n", default_label);
+        return;
+    }
+
+    if (is_jump_table_dense(cases, first, last)) {
+        compile_jump_table(cases, first, last, default_label, file);
+        return;
+    }
+
+    int middle = first + count / 2;
+    int lower_label = new_label();
+    write_comment(file, "\t;---binary search---\n");
+    compile_compare_with_case(cases[middle].value, file);
+    fprintf(file, "\tje ..L%d\n", cases[middle].label);
+    fprintf(file, "\tjl ..L%d\n", lower_label);
+    compile_switch_dispatch(cases, middle + 1, last, default_label, file);
+    fprintf(file, "..L%d:\n", lower_label);
+    compile_switch_dispatch(cases, first, middle - 1, default_label, file);
+}
+
+// the second case of the switch with the value, in source order
+static ASTNode* duplicate_case(ASTNode* root, Word value) {
+    bool is_seen = false;
+    for (int i = 0; i < root->switch_statement.count; ++i) {
+        ASTNode* case_node = root->switch_statement.cases[i];
+        if (case_node->case_label.value != value) continue;
+        if (is_seen) return case_node;
+        is_seen = true;
+    }
+    return root;
+}
+
+// The case labels are made before the condition is compiled, the dispatch after it.
+static void begin_switch(ASTNode* root, FILE* file) {
+    int count = root->switch_statement.count;
+    int end_label = new_label();
+
+    SwitchCase* cases = malloc(sizeof(SwitchCase) * (count > 0 ? count : 1));
+    for (int i = 0; i < count; ++i) {
+        ASTNode* case_node = root->switch_statement.cases[i];
+        case_node->case_label.label = new_label();
+        cases[i] = (SwitchCase) { .value = case_node->case_label.value, .label = case_node->case_label.label };
+    }
+    qsort(cases, count, sizeof(SwitchCase), compare_switch_cases);
+    for (int i = 1; i < count; ++i) {
+        if (cases[i].value == cases[i - 1].value) {
+            Word value = cases[i].value;
+            free(cases);
+            ASTNode* duplicate = duplicate_case(root, value);
+            fprintf(source_diagnostics(source, duplicate->location), "error: duplicate case value %ld in switch\n", value);
+            fail();
+        }
+    }
+
+    int default_label = end_label;
+    ASTNode* default_case = root->switch_statement.default_case;
+    if (default_case != NULL) {
+        default_case->case_label.label = new_label();
+        default_label = default_case->case_label.label;
+    }
+
+    CompileTask* task = push_task(root, file, STEP_SWITCH_DISPATCH);
+    task->values[0] = end_label;
+    task->values[1] = default_label;
+    task->cases = cases;
+    push_node(root->switch_statement.condition, file);
+}
+
+static void compile_switch_body(const CompileTask* task) {
+    ASTNode* root = task->node;
+    FILE* file = task->file;
+    int count = root->switch_statement.count;
+    int end_label = task->values[0];
+    int default_label = task->values[1];
+
+    write_comment(file, "\t;---switch---\n");
+    fprintf(file, "\tpop rax\n"); --pushed_on_stack;
+    if (count > 0) {
+        compile_switch_dispatch(task->cases, 0, count - 1, default_label, file);
+    }
+    else {
+        fprintf(file, "\tjmp ..L%d\n", default_label);
+    }
+    free(task->cases);
+
+    push_jump_label(&break_labels, &break_labels_count, &break_labels_capacity, end_label);
+    push_task(root, file, STEP_SWITCH_END)->values[0] = end_label;
+    push_node(root->switch_statement.body, file);
+}
+
+// a return jumps to the end of an inlined call or leaves the function with rax
+static void compile_return_jump(FILE* file) {
+    if (inline_return_labels_count > 0) {
+        fprintf(file, "\tjmp ..L%d\n", inline_return_labels[inline_return_labels_count - 1]);
+    }
+    else {
+        compile_epilogue(file);
+    }
+}
+
+static void begin_while(ASTNode* root, FILE* file) {
+    int site = root->while_statement.site;
+    bool is_instrumented = options->profile_generate_path != NULL;
+    // instrumented loops stay scalar, so the body counter sees every iteration
+    VectorLoop vector_loop;
+    if (options->optimization_level > 0 && !options->optimize_size && !is_instrumented &&
+        match_vector_loop(root, &vector_loop)) {
+        compile_vector_loop(&vector_loop, file);
+        return;
+    }
+    int body_label = new_label();
+    int condition_label = new_label();
+    int end_label = new_label();
+
+    // a body that almost never runs is moved out of line, the condition falls through
+    CompileTask* task;
+    if (file != cold_text && profile_is_cold(site, 0)) {
+        write_comment(file, "\t;---while (cold body)---\n");
+        fprintf(file, "..L%d:\n", condition_label);
+        compile_line(root, file);
+        task = push_task(root, file, STEP_COLD_WHILE_BODY);
+        task->values[0] = body_label;
+        task->values[1] = condition_label;
+        task->values[2] = end_label;
+        push_node(root->while_statement.condition, file);
+        return;
+    }
+
+    // condition is placed after the body, so every iteration takes a single jump
+    write_comment(file, "\t;---while---\n");
+    fprintf(file, "\tjmp ..L%d\n", condition_label);
+    fprintf(file, "..L%d:\n", body_label);
+    if (is_instrumented) {
+        compile_profile_counter(site, 0, file);
+    }
+    push_jump_label(&break_labels, &break_labels_count, &break_labels_capacity, end_label);
+    task = push_task(root, file, STEP_WHILE_CONDITION);
+    task->values[0] = body_label;
+    task->values[1] = condition_label;
+    task->values[2] = end_label;
+    push_node(root->while_statement.body, file);
+}
+
+static void compile_binary_operation(ASTNode* root, FILE* file) {
+    write_comment(file, "\t;---binary---\n");
+    fprintf(file, "\tpop rcx\n"); --pushed_on_stack;
+    fprintf(file, "\tpop rax\n"); --pushed_on_stack;
+    switch (root->binary.op) {
+        case TOKEN_SLASH: {
+            write_comment(file, "\t;---div---\n");
+            fprintf(file, "\tcqo\n");
+            fprintf(file, "\tidiv rcx\n");
+            fprintf(file, "\tpush rax\n"); ++pushed_on_stack;
+        } break;
+        case TOKEN_ASTERISK: {
+            write_comment(file, "\t;---mul---\n");
+            fprintf(file, "\timul rax, rcx\n");
+            fprintf(file, "\tpush rax\n"); ++pushed_on_stack;
+        } break;
+        case TOKEN_PERCENT: {
+            write_comment(file, "\t;---mod---\n");
+            fprintf(file, "\tcqo\n");
+            fprintf(file, "\tidiv rcx\n");
+            fprintf(file, "\tpush rdx\n"); ++pushed_on_stack;
+        } break;
+        case TOKEN_PLUS: {
+            write_comment(file, "\t;---add---\n");
+            fprintf(file, "\tadd rax, rcx\n");
+            fprintf(file, "\tpush rax\n"); ++pushed_on_stack;
+        } break;
+        case TOKEN_MINUS: {
+            write_comment(file, "\t;---sub---\n");
+            fprintf(file, "\tsub rax, rcx\n");
+            fprintf(file, "\tpush rax\n"); ++pushed_on_stack;
+        } break;
+        case TOKEN_NOT_EQUAL: {
+            write_comment(file, "\t;---not equal---\n");
+            compile_comparison("setne", file);
+        } break;
+        case TOKEN_EQUAL_EQUAL: {
+            write_comment(file, "\t;---equal---\n");
+            compile_comparison("sete", file);
+        } break;
+        case TOKEN_GREATER: {
+            write_comment(file, "\t;---greater---\n");
+            compile_comparison("setg", file);
+        } break;
+        case TOKEN_GREATER_EQUAL: {
+            write_comment(file, "\t;---greater equal---\n");
+            compile_comparison("setge", file);
+        } break;
+        case TOKEN_LESS: {
+            write_comment(file, "\t;---less---\n");
+            compile_comparison("setl", file);
+        } break;
+        case TOKEN_LESS_EQUAL: {
+            write_comment(file, "\t;---less equal---\n");
+            compile_comparison("setle", file);
+        } break;
+        default: {
+            fprintf(
+                diagnostics(),
+                "error: invalid operator in binary operation: %s\n",
+                token_as_cstr(root->binary.op)
+            );
+            fail();
+        } break;
+    }
+}
+
+static void compile_unary_operation(ASTNode* root, FILE* file) {
+    write_comment(file, "\t;---unary---\n");
+    fprintf(file, "\tpop rax\n");  --pushed_on_stack;
+
+    switch (root->unary.op) {
+        case TOKEN_MINUS: {
+            write_comment(file, "\t;---negate---\n");
+            fprintf(file, "\tneg rax\n");
+            fprintf(file, "\tpush rax\n"); ++pushed_on_stack;
+        } break;
+        case TOKEN_NOT: {
+            write_comment(file, "\t;---not---\n");
+            fprintf(file, "\ttest rax, rax\n");
+            fprintf(file, "\tsete al\n");
+            fprintf(file, "\tmovzx rax, al\n");
+            fprintf(file, "\tpush rax\n"); ++pushed_on_stack;
+        } break;
+        default: {
+            fprintf(
+                diagnostics(),
+                "error: invalid operator in unary operation: %s\n",
+                token_as_cstr(root->unary.op)
+            );
+            fail();
+        }
+    }
+}
+
+// Compiles what the node does before its first child, the rest is pushed as later steps.
+static void begin_node(ASTNode* root, FILE* file) {
+    switch (root->type) {
+        case AST_NODE_EXPRESSION_STATEMENT:
+        case AST_NODE_IF_STATEMENT:
+        case AST_NODE_WHILE_STATEMENT:
+        case AST_NODE_SWITCH_STATEMENT:
+        case AST_NODE_BREAK_STATEMENT:
+        case AST_NODE_RETURN_STATEMENT:
+        case AST_NODE_VARIABLE_DECLARATION: {
+            compile_line(root, file);
+        } break;
+        default: break;
+    }
+
     switch (root->type) {
         case AST_NODE_BLOCK: {
-            for (int i = 0; i < root->block.count; ++i) {
-                compile(root->block.statements[i], file);
+            for (int i = root->block.count - 1; i >= 0; --i) {
+                push_node(root->block.statements[i], file);
             }
         } break;
         case AST_NODE_EXPRESSION_STATEMENT: {
-            compile(root->expression, file);
+            push_task(root, file, STEP_EXPRESSION_STATEMENT_END);
+            push_node(root->expression, file);
+        } break;
+        case AST_NODE_IF_STATEMENT: {
+            if (options->profile_generate_path != NULL) {
+                write_comment(file, "\t;---if (instrumented)---\n");
+                begin_instrumented_if(root, file);
+                break;
+            }
+            if (begin_profiled_if(root, file)) break;
+
+            int else_label = new_label();
+            write_comment(file, "\t;---if---\n");
+            push_task(root, file, STEP_IF_THEN)->values[0] = else_label;
+            push_node(root->if_statement.condition, file);
+        } break;
+        case AST_NODE_WHILE_STATEMENT: {
+            begin_while(root, file);
+        } break;
+        case AST_NODE_SWITCH_STATEMENT: {
+            begin_switch(root, file);
+        } break;
+        case AST_NODE_CASE: {
+            fprintf(file, "..L%d:\n", root->case_label.label);
+            push_node(root->case_label.statement, file);
+        } break;
+        case AST_NODE_BREAK_STATEMENT: {
+            write_comment(file, "\t;---break---\n");
+            fprintf(file, "\tjmp ..L%d\n", break_labels[break_labels_count - 1]);
+        } break;
+        case AST_NODE_RETURN_STATEMENT: {
+            if (root->expression != NULL && root->expression->type == AST_NODE_CALL &&
+                begin_tail_call(root, file)) {
+                break;
+            }
+            write_comment(file, "\t;---return---\n");
+            if (root->expression != NULL) {
+                push_task(root, file, STEP_RETURN_END);
+                push_node(root->expression, file);
+                break;
+            }
+            if (shares_function_end && inline_return_labels_count == 0) {
+                // the end of the function returns 0 too
+                if (function_end_label < 0) {
+                    function_end_label = new_label();
+                }
+                fprintf(file, "\tjmp ..L%d\n", function_end_label);
+                break;
+            }
+            compile_load_rax(0, file);
+            compile_return_jump(file);
         } break;
         case AST_NODE_VARIABLE_DECLARATION: {
-            AutoVar* existing_var = find_auto_var(root->name);
-            if (existing_var != NULL) {
-                fprintf(stderr, "error: identifier '%s' already declared\n", root->name);
-                fclose(file);
-                exit(1);
+            AutoVar* var = declare_var(root->declaration.name, false);
+            if (root->declaration.is_vector) {
+                // the words follow the pointer, v[0] at the lowest address
+                vars_offset += (root->declaration.bound + 1) * sizeof(Word);
+                write_comment(file, "\t;---auto vector---\n");
+                fprintf(file, "\tlea rax, [rbp-%zu]\n", vars_offset);
+                fprintf(file, "\tmov QWORD [rbp-%zu], rax\n", var->offset);
+            }
+            if (options->debug_info && root->location > 0) {
+                debug_add_variable(var->name, line_of(root), var->offset, false);
             }
-            vars_offset += sizeof(Word);
-            vars[vars_index++] = (AutoVar) { .name = root->name, .offset = vars_offset };
-            fprintf(file, "\t;---var_decl---\n");
-            fprintf(file, "\tsub rsp, %zu\n", sizeof(Word));
         } break;
-        case AST_NODE_ASSIGNMENT: {
-            compile(root->assignment.value, file);
-            AutoVar* var = find_auto_var(root->assignment.name);
-            if (var == NULL) {
-                fprintf(stderr, "error: undeclared identifier '%s'\n", root->name);
-                fclose(file);
-                exit(1);
+        case AST_NODE_EXTRN_DECLARATION: {
+            check_fasm_name(root, root->name);
+            declare_var(root->name, true);
+            if (is_streaming) {
+                add_stream_extrn(root->name);
             }
-            // TODO: expressions like a = b = 10 don't work (10 is not on the stack anymore,
-            // however, this value is still in rax register, so it should be used)
-            fprintf(file, "\t;---assign---\n");
-            fprintf(file, "\tpop rax\n"); --pushed_on_stack;
-            fprintf(file, "\tmov QWORD [rbp-%zu], rax\n", var->offset);
+        } break;
+        case AST_NODE_ASSIGNMENT: {
+            push_task(root, file, STEP_ASSIGNMENT_STORE);
+            push_node(root->assignment.value, file);
         } break;
         case AST_NODE_BINARY: {
-            compile(root->binary.left, file);
-            compile(root->binary.right, file);
-            fprintf(file, "\t;---binary---\n");
-            fprintf(file, "\tpop rbx\n"); --pushed_on_stack;
-            fprintf(file, "\tpop rax\n"); --pushed_on_stack;
-            switch (root->binary.op) {
-                case TOKEN_SLASH: {
-                    fprintf(file, "\t;---div---\n");
-                    fprintf(file, "\tidiv rbx\n");
-                    fprintf(file, "\tpush rax\n"); ++pushed_on_stack;
-                } break;
-                case TOKEN_ASTERISK: {
-                    fprintf(file, "\t;---mul---\n");
-                    fprintf(file, "\timul rax, rbx\n");
-                    fprintf(file, "\tpush rax\n"); ++pushed_on_stack;
-                } break;
-                case TOKEN_PERCENT: {
-                    fprintf(file, "\t;---mod---\n");
-                    fprintf(file, "\tidiv rbx\n");
-                    fprintf(file, "\tpush rdx\n"); ++pushed_on_stack;
-                } break;
-                case TOKEN_PLUS: {
-                    fprintf(file, "\t;---add---\n");
-                    fprintf(file, "\tadd rax, rbx\n");
-                    fprintf(file, "\tpush rax\n"); ++pushed_on_stack;
-                } break;
-                case TOKEN_MINUS: {
-                    fprintf(file, "\t;---sub---\n");
-                    fprintf(file, "\tsub rax, rbx\n");
-                    fprintf(file, "\tpush rax\n"); ++pushed_on_stack;
-                } break;
-                case TOKEN_NOT_EQUAL: {
-                    // TODO: not implemented
-                } break;
-                case TOKEN_EQUAL_EQUAL: {
-                    // TODO: not implemented
-                } break;
-                case TOKEN_GREATER: {
-                    // TODO: not implemented
-                } break;
-                case TOKEN_GREATER_EQUAL: {
-                    // TODO: not implemented
-                } break;
-                case TOKEN_LESS: {
-                    // TODO: not implemented
-                } break;
-                case TOKEN_LESS_EQUAL: {
-                    // TODO: not implemented
-                } break;
-                default: {
-                    fprintf(
-                        stderr,
-                        "error: invalid operator in binary operation: %s\n",
-                        token_as_cstr(root->binary.op)
-                    );
-                    exit(1);
-                } break;
-            }
+            push_task(root, file, STEP_BINARY_OPERATION);
+            push_node(root->binary.right, file);
+            push_node(root->binary.left, file);
         } break;
         case AST_NODE_UNARY: {
-            compile(root->unary.right, file);
-            fprintf(file, "\t;---unary---\n");
-            fprintf(file, "\tpop rax\n");  --pushed_on_stack;
-
-            switch (root->unary.op) {
-                case TOKEN_MINUS: {
-                    fprintf(file, "\t;---negate---\n");
-                    fprintf(file, "\tneg rax\n");
-                    fprintf(file, "\tpush rax\n"); ++pushed_on_stack;
-                } break;
-                case TOKEN_NOT: {
-                    // TODO: not implemented
-                } break;
-                default: {
-                    fprintf(
-                        stderr,
-                        "error: invalid operator in unary operation: %s\n",
-                        token_as_cstr(root->unary.op)
-                    );
-                    exit(1);
-                }
-            }
+            push_task(root, file, STEP_UNARY_OPERATION);
+            push_node(root->unary.right, file);
         } break;
         case AST_NODE_LITERAL: {
-            fprintf(file, "\t;---literal---\n");
+            write_comment(file, "\t;---literal---\n");
+            // push sign-extends its immediate, which takes one byte from -128 to 127
+            if (options->optimize_size && fits_in_imm32(root->literal)) {
+                fprintf(file, "\tpush %ld\n", root->literal); ++pushed_on_stack;
+                break;
+            }
             fprintf(file, "\tmov rax, %ld\n", root->literal);
             fprintf(file, "\tpush rax\n"); ++pushed_on_stack;
         } break;
+        case AST_NODE_STRING: {
+            int label = new_label();
+            add_string(label, root->string.bytes, root->string.length);
+            write_comment(file, "\t;---string---\n");
+            fprintf(file, "\tlea rax, [..L%d]\n", label);
+            fprintf(file, "\tpush rax\n"); ++pushed_on_stack;
+        } break;
         case AST_NODE_VARIABLE: {
             AutoVar* var = find_auto_var(root->name);
             if (var == NULL) {
-                fprintf(stderr, "error: undeclared identifier '%s'\n", root->name);
-                fclose(file);
-                exit(1);
+                // the address of a function defined in the program
+                if (is_function_or_later(root, root->name, false)) {
+                    write_comment(file, "\t;---func address---\n");
+                    fprintf(file, "\tlea rax, [%s]\n", root->name);
+                    fprintf(file, "\tpush rax\n"); ++pushed_on_stack;
+                    break;
+                }
+                fprintf(source_diagnostics(source, root->location), "error: undeclared identifier '%s'\n", root->name);
+                fail();
+            }
+            write_comment(file, "\t;---var---\n");
+            if (var->is_extrn) {
+                fprintf(file, "\tmov rax, [%s]\n", var->name);
+            }
+            else {
+                fprintf(file, "\tmov rax, [rbp-%zu]\n", var->offset);
             }
-            fprintf(file, "\t;---var---\n");
-            fprintf(file, "\tmov rax, [rbp-%zu]\n", var->offset);
             fprintf(file, "\tpush rax\n"); ++pushed_on_stack;
         } break;
+        case AST_NODE_SUBSCRIPT: {
+            push_task(root, file, STEP_SUBSCRIPT_LOAD);
+            push_node(root->subscript.index, file);
+            push_node(root->subscript.vector, file);
+        } break;
+        case AST_NODE_SUBSCRIPT_ASSIGNMENT: {
+            push_task(root, file, STEP_SUBSCRIPT_STORE);
+            push_node(root->subscript.value, file);
+            push_node(root->subscript.index, file);
+            push_node(root->subscript.vector, file);
+        } break;
+        case AST_NODE_CALL: {
+            begin_call(root, file);
+        } break;
+        case AST_NODE_INLINED_CALL: {
+            begin_inlined_call(root, file);
+        } break;
         default: {
-            fprintf(stderr, "Unknow AST node: %d\n", root->type);
-            exit(1);
+            fprintf(diagnostics(), "Unknow AST node: %d\n", root->type);
+            fail();
         };
     }
 }
 
-void compiler_compile(ASTNode* program, const char* filename) {
-    if (program->type != AST_NODE_PROGRAM) {
-        fprintf(stderr, "error: AST node for compiler is not a program\n");
-        exit(1);
+// Goes on with the node after the children pushed by its earlier step.
+static void continue_node(const CompileTask* task) {
+    ASTNode* root = task->node;
+    FILE* file = task->file;
+    const int* values = task->values;
+    switch (task->step) {
+        case STEP_START: break;
+        case STEP_LABEL: {
+            fprintf(file, "..L%d:\n", values[0]);
+        } break;
+        case STEP_EXPRESSION_STATEMENT_END: {
+            // the value of the expression is not used
+            fprintf(file, "\tpop rax\n"); --pushed_on_stack;
+        } break;
+        case STEP_IF_THEN: {
+            compile_condition_test("jz", values[0], file);
+            push_task(root, file, STEP_IF_ELSE)->values[0] = values[0];
+            push_node(root->if_statement.then_branch, file);
+        } break;
+        case STEP_IF_ELSE: {
+            int else_label = values[0];
+            if (root->if_statement.else_branch != NULL) {
+                int end_label = new_label();
+                fprintf(file, "\tjmp ..L%d\n", end_label);
+                fprintf(file, "..L%d:\n", else_label);
+                push_label_task(end_label, file);
+                push_node(root->if_statement.else_branch, file);
+            }
+            else {
+                fprintf(file, "..L%d:\n", else_label);
+            }
+        } break;
+        case STEP_INSTRUMENTED_IF_THEN: {
+            compile_condition_test("jz", values[0], file);
+            compile_profile_counter(root->if_statement.site, 0, file);
+            CompileTask* next = push_task(root, file, STEP_INSTRUMENTED_IF_ELSE);
+            next->values[0] = values[0];
+            next->values[1] = values[1];
+            push_node(root->if_statement.then_branch, file);
+        } break;
+        case STEP_INSTRUMENTED_IF_ELSE: {
+            fprintf(file, "\tjmp ..L%d\n", values[1]);
+            fprintf(file, "..L%d:\n", values[0]);
+            compile_profile_counter(root->if_statement.site, 1, file);
+            push_label_task(values[1], file);
+            if (root->if_statement.else_branch != NULL) {
+                push_node(root->if_statement.else_branch, file);
+            }
+        } break;
+        case STEP_COLD_IF_HOT: {
+            bool is_then_cold = values[2];
+            ASTNode* hot = is_then_cold ? root->if_statement.else_branch : root->if_statement.then_branch;
+            compile_condition_test(is_then_cold ? "jnz" : "jz", values[1], file);
+            CompileTask* next = push_task(root, file, STEP_COLD_IF_COLD);
+            memcpy(next->values, values, sizeof(next->values));
+            if (hot != NULL) {
+                push_node(hot, file);
+            }
+        } break;
+        case STEP_COLD_IF_COLD: {
+            bool is_then_cold = values[2];
+            ASTNode* cold = is_then_cold ? root->if_statement.then_branch : root->if_statement.else_branch;
+            fprintf(file, "..L%d:\n", values[0]);
+            FILE* cold_file = cold_text_stream();
+            fprintf(cold_file, "..L%d:\n", values[1]);
+            push_task(root, cold_file, STEP_COLD_IF_END)->values[0] = values[0];
+            push_node(cold, cold_file);
+        } break;
+        case STEP_COLD_IF_END: {
+            fprintf(file, "\tjmp ..L%d\n", values[0]);
+        } break;
+        case STEP_HOT_ELSE_ELSE: {
+            compile_condition_test("jnz", values[1], file);
+            CompileTask* next = push_task(root, file, STEP_HOT_ELSE_THEN);
+            next->values[0] = values[0];
+            next->values[1] = values[1];
+            push_node(root->if_statement.else_branch, file);
+        } break;
+        case STEP_HOT_ELSE_THEN: {
+            fprintf(file, "\tjmp ..L%d\n", values[0]);
+            fprintf(file, "..L%d:\n", values[1]);
+            push_label_task(values[0], file);
+            push_node(root->if_statement.then_branch, file);
+        } break;
+        case STEP_WHILE_CONDITION: {
+            --break_labels_count;
+            fprintf(file, "..L%d:\n", values[1]);
+            compile_line(root, file);
+            CompileTask* next = push_task(root, file, STEP_WHILE_END);
+            memcpy(next->values, values, sizeof(next->values));
+            push_node(root->while_statement.condition, file);
+        } break;
+        case STEP_WHILE_END: {
+            compile_condition_test("jnz", values[0], file);
+            fprintf(file, "..L%d:\n", values[2]);
+            if (options->profile_generate_path != NULL) {
+                compile_profile_counter(root->while_statement.site, 1, file);
+            }
+        } break;
+        case STEP_COLD_WHILE_BODY: {
+            compile_condition_test("jnz", values[0], file);
+            fprintf(file, "..L%d:\n", values[2]);
+            FILE* cold_file = cold_text_stream();
+            fprintf(cold_file, "..L%d:\n", values[0]);
+            push_jump_label(&break_labels, &break_labels_count, &break_labels_capacity, values[2]);
+            push_task(root, cold_file, STEP_COLD_WHILE_END)->values[0] = values[1];
+            push_node(root->while_statement.body, cold_file);
+        } break;
+        case STEP_COLD_WHILE_END: {
+            --break_labels_count;
+            fprintf(file, "\tjmp ..L%d\n", values[0]);
+        } break;
+        case STEP_SWITCH_DISPATCH: {
+            compile_switch_body(task);
+        } break;
+        case STEP_SWITCH_END: {
+            --break_labels_count;
+            fprintf(file, "..L%d:\n", values[0]);
+        } break;
+        case STEP_RETURN_END: {
+            fprintf(file, "\tpop rax\n"); --pushed_on_stack;
+            compile_return_jump(file);
+        } break;
+        case STEP_SELF_TAIL_CALL_END: {
+            end_self_tail_call(root->expression, file);
+        } break;
+        case STEP_TAIL_CALL_END: {
+            end_tail_call(root->expression, file);
+        } break;
+        case STEP_ASSIGNMENT_STORE: {
+            AutoVar* var = find_auto_var(root->assignment.name);
+            if (var == NULL) {
+                fprintf(source_diagnostics(source, root->location), "error: undeclared identifier '%s'\n", root->assignment.name);
+                fail();
+            }
+            // assigned value stays on the stack as the value of the expression
+            write_comment(file, "\t;---assign---\n");
+            fprintf(file, "\tmov rax, [rsp]\n");
+            if (var->is_extrn) {
+                fprintf(file, "\tmov QWORD [%s], rax\n", var->name);
+            }
+            else {
+                fprintf(file, "\tmov QWORD [rbp-%zu], rax\n", var->offset);
+            }
+        } break;
+        case STEP_BINARY_OPERATION: {
+            compile_binary_operation(root, file);
+        } break;
+        case STEP_UNARY_OPERATION: {
+            compile_unary_operation(root, file);
+        } break;
+        case STEP_SUBSCRIPT_LOAD: {
+            write_comment(file, "\t;---subscript---\n");
+            fprintf(file, "\tpop rcx\n"); --pushed_on_stack;
+            fprintf(file, "\tpop rax\n"); --pushed_on_stack;
+            fprintf(file, "\tmov rax, [rax+rcx*8]\n");
+            fprintf(file, "\tpush rax\n"); ++pushed_on_stack;
+        } break;
+        case STEP_SUBSCRIPT_STORE: {
+            // assigned value stays on the stack as the value of the expression
+            write_comment(file, "\t;---assign subscript---\n");
+            fprintf(file, "\tpop rax\n"); --pushed_on_stack;
+            fprintf(file, "\tpop rcx\n"); --pushed_on_stack;
+            fprintf(file, "\tpop rdx\n"); --pushed_on_stack;
+            fprintf(file, "\tmov QWORD [rdx+rcx*8], rax\n");
+            fprintf(file, "\tpush rax\n"); ++pushed_on_stack;
+        } break;
+        case STEP_CALL_END: {
+            end_call(task);
+        } break;
+        case STEP_INLINED_CALL_BODY: {
+            begin_inlined_body(task);
+        } break;
+        case STEP_INLINED_CALL_END: {
+            end_inlined_call(task);
+        } break;
+    }
+}
+
+// Runs the tasks of the node and of the children its steps push. They come from one stack
+// for the whole thread, so nesting is only bounded by memory.
+static void compile(ASTNode* root, FILE* file) {
+    int base = tasks_count;
+    push_node(root, file);
+    while (tasks_count > base) {
+        // the steps push tasks, which may move the array
+        const CompileTask* top = &tasks[--tasks_count];
+        if (top->step == STEP_START) {
+            begin_node(top->node, top->file);
+            continue;
+        }
+        CompileTask task = *top;
+        continue_node(&task);
+    }
+}
+
+// the tables grown while compiling, a thread may be finished after the compilation
+static void free_tables() {
+    free(vars);
+    vars = NULL;
+    vars_capacity = 0;
+    vars_index = 0;
+    free(main_vars);
+    main_vars = NULL;
+    main_vars_capacity = 0;
+    main_vars_index = 0;
+    main_vars_offset = 0;
+    free(extern_symbols);
+    extern_symbols = NULL;
+    extern_symbols_count = 0;
+    extern_symbols_capacity = 0;
+    free(function_extrns);
+    function_extrns = NULL;
+    function_extrns_count = 0;
+    function_extrns_capacity = 0;
+    free(main_extrns);
+    main_extrns = NULL;
+    main_extrns_count = 0;
+    main_extrns_capacity = 0;
+    free(early_uses);
+    early_uses = NULL;
+    early_uses_count = 0;
+    early_uses_capacity = 0;
+    // the cases of a switch are only freed once its dispatch is written
+    for (int i = 0; i < tasks_count; ++i) {
+        if (tasks[i].step == STEP_SWITCH_DISPATCH) {
+            free(tasks[i].cases);
+        }
+    }
+    free(tasks);
+    tasks = NULL;
+    tasks_count = 0;
+    tasks_capacity = 0;
+    free(break_labels);
+    break_labels = NULL;
+    break_labels_count = 0;
+    break_labels_capacity = 0;
+    free(inline_return_labels);
+    inline_return_labels = NULL;
+    inline_return_labels_count = 0;
+    inline_return_labels_capacity = 0;
+    for (int i = 0; i < symbol_table_count; ++i) {
+        free((char*)symbol_table[i].name);
     }
+    free(symbol_table);
+    symbol_table = NULL;
+    symbol_table_capacity = 0;
+    symbol_table_count = 0;
+    hash_table_free(&symbol_names);
+}
+
+static FILE* open_output(const Options* compiler_options) {
+    const char* filename = compiler_options->output_path;
+    options = compiler_options;
+    // a server thread compiles many programs, every one numbers its labels from zero
+    label_count = 0;
+    break_labels_count = 0;
+    inline_return_labels_count = 0;
+    uses_simd_level = false;
+    memset(uses_runtime_function, 0, sizeof(uses_runtime_function));
 
     FILE* file = fopen(filename, "w");
     if (file == NULL) {
-        fprintf(stderr, "error: failed to open file: %s\n", filename);
-        exit(1);
+        fprintf(diagnostics(), "error: failed to open file: %s\n", filename);
+        fail();
+    }
+    return file;
+}
+
+static FILE* open_temporary() {
+    FILE* file = tmpfile();
+    if (file == NULL) {
+        fprintf(diagnostics(), "error: failed to create a temporary file\n");
+        fail();
+    }
+    return file;
+}
+
+static void copy_temporary(FILE* from, FILE* to) {
+    char buffer[16 * 1024];
+    rewind(from);
+    size_t count;
+    while ((count = fread(buffer, 1, sizeof(buffer), from)) > 0) {
+        fwrite(buffer, 1, count, to);
+    }
+}
+
+static void write_header(FILE* file) {
+    if (options->profile_generate_path != NULL) {
+        add_extern_symbol("fopen");
+        add_extern_symbol("fprintf");
+        add_extern_symbol("fclose");
+    }
+    // the runtime printf passes the formats it does not handle on
+    Symbol* printf_symbol = find_symbol("printf");
+    if (printf_symbol != NULL && printf_symbol->is_extern) {
+        add_extern_symbol("setvbuf");
+        add_extern_symbol("stdout");
     }
 
     fprintf(file, "format ELF64\n");
+    for (int i = 0; i < extern_symbols_count; ++i) {
+        fprintf(file, "extrn %s\n", extern_symbols[i]);
+    }
     fprintf(file, "section \".text\" executable\n");
+}
+
+// At the end of .text, fasm displays its size in decimal when it assembles the output.
+static void compile_text_size_report(FILE* file) {
+    fprintf(file, "..text_size = $ - $$\n");
+    fprintf(file, "..text_divisor = 1\n");
+    fprintf(file, "repeat 19\n");
+    fprintf(file, "\tif ..text_divisor * 10 <= ..text_size\n");
+    fprintf(file, "\t\t..text_divisor = ..text_divisor * 10\n");
+    fprintf(file, "\tend if\n");
+    fprintf(file, "end repeat\n");
+    fprintf(file, "display \"bbc: .text is \"\n");
+    fprintf(file, "repeat 20\n");
+    fprintf(file, "\tif ..text_divisor > 0\n");
+    fprintf(file, "\t\tdisplay '0' + ..text_size / ..text_divisor mod 10\n");
+    fprintf(file, "\t\t..text_divisor = ..text_divisor / 10\n");
+    fprintf(file, "\tend if\n");
+    fprintf(file, "end repeat\n");
+    fprintf(file, "display \" bytes\", 10\n");
+}
+
+// Writes what was collected in a side stream after the section header, if anything was. A
+// stream collects in temporary files, a whole program in memory.
+static void write_side_stream(FILE* file, const char* header, FILE** stream, char** buffer, size_t* size) {
+    if (is_streaming) {
+        if (ftell(*stream) > 0) {
+            fprintf(file, "%s", header);
+            copy_temporary(*stream, file);
+        }
+        fclose(*stream);
+    }
+    else {
+        fclose(*stream);
+        if (*size > 0) {
+            fprintf(file, "%s", header);
+            fwrite(*buffer, 1, *size, file);
+        }
+        free(*buffer);
+        *buffer = NULL;
+    }
+    *stream = NULL;
+}
+
+// Everything after the functions, vectors either come as definitions or were already written
+// to vectors_text.
+static void write_end(FILE* file, ASTNode** vector_definitions, int vectors_count, bool has_vectors, int site_count) {
+    if (uses_simd_level) {
+        compile_simd_level(file);
+    }
+    if (options->profile_generate_path != NULL) {
+        compile_profile_dump(site_count, file);
+    }
+    if (uses_runtime()) {
+        compile_runtime(file);
+    }
+
+    if (options->optimize_size) {
+        compile_text_size_report(file);
+    }
+    write_side_stream(file, "section \".text.unlikely\" executable\n", &cold_text, &cold_text_buffer, &cold_text_size);
+    write_string_pool(rodata);
+    write_side_stream(file, "section \".rodata\"\n", &rodata, &rodata_buffer, &rodata_size);
+
+    if (has_vectors || uses_simd_level || options->profile_generate_path != NULL) {
+        fprintf(file, "section \".data\" writeable\n");
+    }
+    for (int i = 0; i < vectors_count; ++i) {
+        compile_vector_definition(vector_definitions[i], file);
+    }
+    if (vectors_text != NULL) {
+        copy_temporary(vectors_text, file);
+        fclose(vectors_text);
+        vectors_text = NULL;
+    }
+    if (uses_simd_level) {
+        fprintf(file, "align 8\n");
+        fprintf(file, "..simd_level_cache:\n");
+        fprintf(file, "\tdq 0\n");
+    }
+    if (options->profile_generate_path != NULL) {
+        fprintf(file, "align 8\n");
+        fprintf(file, "..profile_counters:\n");
+        fprintf(file, "\trq %d\n", site_count * PROFILE_COUNTERS_PER_SITE);
+    }
+    if (uses_runtime()) {
+        fprintf(bss, "align 8\n");
+        fprintf(bss, "..bbc_output_used:\n");
+        fprintf(bss, "\trq 1\n");
+        if (uses_runtime_function[RUNTIME_PRINTF]) {
+            fprintf(bss, "..bbc_printf_unbuffered:\n");
+            fprintf(bss, "\trq 1\n");
+        }
+        fprintf(bss, "..bbc_output:\n");
+        fprintf(bss, "\trq %d\n", RUNTIME_OUTPUT_SIZE / (int)sizeof(Word));
+    }
+    write_side_stream(file, "section \".bss\" writeable\n", &bss, &bss_buffer, &bss_size);
+    if (options->profile_generate_path != NULL || uses_runtime()) {
+        fprintf(file, "section \".fini_array\" writeable\n");
+    }
+    if (options->profile_generate_path != NULL) {
+        fprintf(file, "\tdq ..profile_dump\n");
+    }
+    if (uses_runtime()) {
+        fprintf(file, "\tdq ..bbc_flush\n");
+    }
+    if (options->debug_info) {
+        debug_emit(file);
+        debug_free();
+    }
+    symbols = NULL;
+    free_tables();
+
+    fclose(file);
+    output = NULL;
+}
+
+void compiler_begin(const ProgramSymbols* program, Source* program_source, const Options* compiler_options) {
+    is_streaming = false;
+    source = program_source;
+    symbols = program;
+    output = open_output(compiler_options);
+
+    for (int i = 0; i < symbols->definitions_count; ++i) {
+        define_symbol(symbols->definitions[i], symbols->is_vector[i]);
+    }
+    extern_symbols_count = 0;
+    for (int i = 0; i < symbols->extrns_count; ++i) {
+        add_extern_symbol(symbols->extrns[i]);
+    }
+    write_header(output);
 
-    // TODO: temporary, bbc doesn't support functions for now
-    fprintf(file, ";---func (NOT SUPPORTED)---\n");
+    rodata = open_memstream(&rodata_buffer, &rodata_size);
+    cold_text = open_memstream(&cold_text_buffer, &cold_text_size);
+    bss = open_memstream(&bss_buffer, &bss_size);
+
+    if (options->debug_info) {
+        debug_begin(options->input_path);
+    }
+}
+
+void compiler_compile_function(ASTNode* function) {
+    compile_function(function, output);
+}
+
+void compiler_end(ASTNode** vector_definitions, int vectors_count, int site_count) {
+    // words are all in .bss
+    bool has_vectors = false;
+    for (int i = 0; i < vectors_count; ++i) {
+        has_vectors |= !vector_definitions[i]->vector.is_scalar;
+    }
+    write_end(output, vector_definitions, vectors_count, has_vectors, site_count);
+}
+
+static void free_program_symbols() {
+    free(program_symbols.definitions);
+    free(program_symbols.is_vector);
+    free(program_symbols.extrns);
+    program_symbols = (ProgramSymbols) { 0 };
+    free(vectors);
+    vectors = NULL;
+}
+
+// A function compiled into a FunctionCode has its own streams, the ones of the program are
+// kept here until it is done. Few functions have read-only data or cold code, their streams
+// are opened by the first write.
+static _Thread_local FILE* code_text = NULL;
+static _Thread_local FILE* program_rodata = NULL;
+static _Thread_local FILE* program_cold_text = NULL;
+static _Thread_local CompiledString* program_strings = NULL;
+static _Thread_local int program_strings_count = 0;
+static _Thread_local int program_strings_capacity = 0;
+
+static void close_code_streams() {
+    fclose(code_text);
+    code_text = NULL;
+    compiled_code = NULL;
+    if (rodata != NULL) {
+        fclose(rodata);
+    }
+    rodata = program_rodata;
+    program_rodata = NULL;
+    if (cold_text != NULL) {
+        fclose(cold_text);
+    }
+    cold_text = program_cold_text;
+    program_cold_text = NULL;
+    // the strings of a function that failed
+    free_strings(strings, strings_count);
+    strings = program_strings;
+    strings_count = program_strings_count;
+    strings_capacity = program_strings_capacity;
+    program_strings = NULL;
+}
+
+// a copy of exactly size bytes, NULL for none
+static char* compact_buffer(char* buffer, size_t size) {
+    char* compact = NULL;
+    if (size > 0) {
+        compact = reallocate(NULL, size);
+        memcpy(compact, buffer, size);
+    }
+    free(buffer);
+    return compact;
+}
+
+static void compile_function_code(ASTNode* function, FunctionCode* code) {
+    int program_label_count = label_count;
+    bool program_uses_simd_level = uses_simd_level;
+    bool program_uses_runtime_function[RUNTIME_FUNCTIONS_COUNT];
+    memcpy(program_uses_runtime_function, uses_runtime_function, sizeof(uses_runtime_function));
+    label_count = 0;
+    uses_simd_level = false;
+    memset(uses_runtime_function, 0, sizeof(uses_runtime_function));
+
+    *code = (FunctionCode) { 0 };
+    program_rodata = rodata;
+    program_cold_text = cold_text;
+    program_strings = strings;
+    program_strings_count = strings_count;
+    program_strings_capacity = strings_capacity;
+    strings = NULL;
+    strings_count = 0;
+    strings_capacity = 0;
+    code_text = open_memstream(&code->text, &code->text_size);
+    compiled_code = code;
+    rodata = NULL;
+    cold_text = NULL;
+    compile_function(function, code_text);
+    // memstreams and arrays grow ahead of what is written, the code may be kept for long
+    code->strings = GROW_ARRAY(CompiledString, strings, strings_capacity, strings_count);
+    code->strings_count = strings_count;
+    strings = NULL;
+    strings_count = 0;
+    close_code_streams();
+    code->text = compact_buffer(code->text, code->text_size);
+    code->rodata = compact_buffer(code->rodata, code->rodata_size);
+    code->cold_text = compact_buffer(code->cold_text, code->cold_text_size);
+
+    code->labels_count = label_count;
+    code->uses_simd_level = uses_simd_level;
+    for (int i = 0; i < RUNTIME_FUNCTIONS_COUNT; ++i) {
+        if (uses_runtime_function[i]) {
+            code->runtime_functions |= 1u << i;
+        }
+    }
+    label_count = program_label_count;
+    uses_simd_level = program_uses_simd_level;
+    memcpy(uses_runtime_function, program_uses_runtime_function, sizeof(uses_runtime_function));
+}
+
+// Copies the code, adding base to the number of every ..L label.
+static void write_relabeled(FILE* file, const char* text, size_t size, int base) {
+    if (size == 0) return;
+    const char* end = text + size;
+    const char* copied = text;
+    for (const char* c = text; c + 3 < end; ++c) {
+        if (c[0] != '.' || c[1] != '.' || c[2] != 'L' || c[3] < '0' || c[3] > '9') continue;
+        fwrite(copied, 1, c + 3 - copied, file);
+        int label = 0;
+        for (c += 3; c < end && *c >= '0' && *c <= '9'; ++c) {
+            label = label * 10 + (*c - '0');
+        }
+        fprintf(file, "%d", base + label);
+        copied = c;
+        --c;
+    }
+    fwrite(copied, 1, end - copied, file);
+}
+
+// Writes the code with the labels the functions before it left free, like compiling the
+// function here would have.
+static void write_code(const FunctionCode* code) {
+    write_relabeled(output, code->text, code->text_size, label_count);
+    write_relabeled(rodata, code->rodata, code->rodata_size, label_count);
+    write_relabeled(cold_text, code->cold_text, code->cold_text_size, label_count);
+    for (int i = 0; i < code->strings_count; ++i) {
+        const CompiledString* string = &code->strings[i];
+        add_string(label_count + string->label, string->bytes, string->length);
+    }
+    label_count += code->labels_count;
+    uses_simd_level |= code->uses_simd_level;
+    for (int i = 0; i < RUNTIME_FUNCTIONS_COUNT; ++i) {
+        if (code->runtime_functions & (1u << i)) {
+            uses_runtime_function[i] = true;
+        }
+    }
+}
+
+void compiler_collect_extrns(ASTNode* function, ProgramSymbols* symbols) {
+    collect_extern_symbols(function->function.body, symbols);
+}
+
+void compiler_compile_code(ASTNode* function, FunctionCode* code) {
+    compile_function_code(function, code);
+}
+
+void compiler_write_code(const FunctionCode* code) {
+    write_code(code);
+}
+
+void compiler_free_code(FunctionCode* code) {
+    free(code->text);
+    free(code->rodata);
+    free(code->cold_text);
+    free_strings(code->strings, code->strings_count);
+    *code = (FunctionCode) { 0 };
+}
+
+// A function compiled on a worker thread, its errors are reported when it is written.
+typedef struct {
+    ASTNode* function;
+    FunctionCode code;
+    char* diagnostics;
+    size_t diagnostics_size;
+    bool has_failed;
+    // under the lock of the job
+    bool is_done;
+} CodegenTask;
+
+// The workers read the tables of the calling thread, which does not change them until they
+// are done, and take the next function when they finished one. The calling thread writes the
+// code of every function once the ones before it are written and frees it, so only the
+// functions finished out of order are kept.
+typedef struct {
+    const Options* options;
+    Source* source;
+    Symbol* symbol_table;
+    int symbol_table_count;
+    HashTable symbol_names;
+    Profile profile;
+    CodegenTask* tasks;
+    int tasks_count;
+    atomic_int next_task;
+    atomic_bool has_failed;
+    pthread_mutex_t lock;
+    // signalled when a task is done and when the calling thread wrote one or stopped
+    pthread_cond_t changed;
+    int written_count;
+} CodegenJob;
+
+static void run_codegen_task(CodegenTask* task) {
+    FILE* stream = open_memstream(&task->diagnostics, &task->diagnostics_size);
+    set_diagnostics(stream);
+    jmp_buf handler;
+    if (setjmp(handler) != 0) {
+        task->has_failed = true;
+        close_code_streams();
+    }
+    else {
+        set_fail_handler(&handler);
+        compile_function_code(task->function, &task->code);
+    }
+    set_fail_handler(NULL);
+    set_diagnostics(NULL);
+    fclose(stream);
+    task->diagnostics = compact_buffer(task->diagnostics, task->diagnostics_size);
+}
+
+static void* run_codegen_worker(void* argument) {
+    CodegenJob* job = argument;
+    options = job->options;
+    source = job->source;
+    symbol_table = job->symbol_table;
+    symbol_table_count = job->symbol_table_count;
+    symbol_names = job->symbol_names;
+    profile_share(job->profile);
+
+    // a serial compilation stops at the first error, the functions after it are not needed
+    while (!atomic_load(&job->has_failed)) {
+        int i = atomic_fetch_add(&job->next_task, 1);
+        if (i >= job->tasks_count) break;
+        // a function that takes long to compile does not let the others pile up behind it
+        pthread_mutex_lock(&job->lock);
+        while (i >= job->written_count + COMPILER_MAX_PENDING_FUNCTIONS && !atomic_load(&job->has_failed)) {
+            pthread_cond_wait(&job->changed, &job->lock);
+        }
+        pthread_mutex_unlock(&job->lock);
+
+        // the calling thread may be waiting for it, even after a failure
+        run_codegen_task(&job->tasks[i]);
+        if (job->tasks[i].has_failed) {
+            atomic_store(&job->has_failed, true);
+        }
+        pthread_mutex_lock(&job->lock);
+        job->tasks[i].is_done = true;
+        pthread_cond_broadcast(&job->changed);
+        pthread_mutex_unlock(&job->lock);
+    }
+
+    // the symbol table and the profile belong to the calling thread
+    symbol_table = NULL;
+    symbol_table_count = 0;
+    symbol_names = (HashTable) { 0 };
+    profile_share((Profile) { 0 });
+    free_tables();
+    return NULL;
+}
+
+// Compiles the functions on worker threads and writes their code in source order with the
+// labels a serial compilation would have given them. Returns false when no thread could be
+// started.
+static bool compile_functions_parallel(CodegenTask* tasks, int tasks_count, int threads_count) {
+    CodegenJob job = {
+        .options = options,
+        .source = source,
+        .symbol_table = symbol_table,
+        .symbol_table_count = symbol_table_count,
+        .symbol_names = symbol_names,
+        .profile = profile_current(),
+        .tasks = tasks,
+        .tasks_count = tasks_count,
+    };
+    // diagnostics of the workers look up lines, which only reads them once they are scanned
+    int line, column;
+    source_locate(source, 0, &line, &column);
+    atomic_init(&job.next_task, 0);
+    atomic_init(&job.has_failed, false);
+    pthread_mutex_init(&job.lock, NULL);
+    pthread_cond_init(&job.changed, NULL);
+
+    pthread_attr_t attributes;
+    pthread_attr_init(&attributes);
+    pthread_attr_setstacksize(&attributes, COMPILER_THREAD_STACK_SIZE);
+    pthread_t threads[COMPILER_MAX_THREADS];
+    int started = 0;
+    for (int i = 0; i < threads_count; ++i) {
+        if (pthread_create(&threads[started], &attributes, run_codegen_worker, &job) == 0) {
+            ++started;
+        }
+    }
+    pthread_attr_destroy(&attributes);
+
+    // the functions after a failed one are not compiled, or only by a worker that had not
+    // seen the failure yet
+    bool has_failed = false;
+    for (int i = 0; i < tasks_count && started > 0 && !has_failed; ++i) {
+        CodegenTask* task = &tasks[i];
+        pthread_mutex_lock(&job.lock);
+        while (!task->is_done) {
+            pthread_cond_wait(&job.changed, &job.lock);
+        }
+        pthread_mutex_unlock(&job.lock);
+
+        if (task->diagnostics_size > 0) {
+            fwrite(task->diagnostics, 1, task->diagnostics_size, diagnostics());
+        }
+        has_failed = task->has_failed;
+        if (!has_failed) {
+            write_code(&task->code);
+        }
+        compiler_free_code(&task->code);
+        free(task->diagnostics);
+        task->diagnostics = NULL;
+
+        pthread_mutex_lock(&job.lock);
+        job.written_count = i + 1;
+        pthread_cond_broadcast(&job.changed);
+        pthread_mutex_unlock(&job.lock);
+    }
+    if (has_failed) {
+        // wakes the workers waiting for room
+        pthread_mutex_lock(&job.lock);
+        atomic_store(&job.has_failed, true);
+        pthread_cond_broadcast(&job.changed);
+        pthread_mutex_unlock(&job.lock);
+    }
+    for (int i = 0; i < started; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    pthread_cond_destroy(&job.changed);
+    pthread_mutex_destroy(&job.lock);
+    if (started == 0) return false;
+
+    for (int i = 0; i < tasks_count; ++i) {
+        compiler_free_code(&tasks[i].code);
+        free(tasks[i].diagnostics);
+    }
+    if (has_failed) {
+        free(tasks);
+        fail();
+    }
+    return true;
+}
+
+// the functions of the program, on options->codegen_threads threads if it has several
+static void compile_functions(ASTNode* program) {
+    int count = program->program.count;
+    int functions_count = 0;
+    for (int i = 0; i < count; ++i) {
+        functions_count += program->program.statements[i]->type == AST_NODE_FUNCTION;
+    }
+    int threads_count = options->codegen_threads;
+    if (threads_count == 0) {
+        threads_count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (threads_count > functions_count) {
+        threads_count = functions_count;
+    }
+    if (threads_count > COMPILER_MAX_THREADS) {
+        threads_count = COMPILER_MAX_THREADS;
+    }
+
+    if (threads_count > 1) {
+        CodegenTask* tasks = calloc(functions_count, sizeof(CodegenTask));
+        if (tasks == NULL) {
+            fprintf(diagnostics(), "error: out of memory\n");
+            fail();
+        }
+        int next = 0;
+        for (int i = 0; i < count; ++i) {
+            if (program->program.statements[i]->type == AST_NODE_FUNCTION) {
+                tasks[next++].function = program->program.statements[i];
+            }
+        }
+        bool is_compiled = compile_functions_parallel(tasks, functions_count, threads_count);
+        free(tasks);
+        if (is_compiled) return;
+    }
+    for (int i = 0; i < count; ++i) {
+        if (program->program.statements[i]->type == AST_NODE_FUNCTION) {
+            compiler_compile_function(program->program.statements[i]);
+        }
+    }
+}
+
+void compiler_compile(ASTNode* program, const Options* compiler_options) {
+    if (program->type != AST_NODE_PROGRAM) {
+        fprintf(diagnostics(), "error: AST node for compiler is not a program\n");
+        fail();
+    }
+
+    int count = program->program.count;
+    program_symbols = (ProgramSymbols) {
+        .definitions = malloc(sizeof(const char*) * (count > 0 ? count : 1)),
+        .is_vector = malloc(sizeof(bool) * (count > 0 ? count : 1)),
+        .definitions_count = count,
+    };
+    vectors = malloc(sizeof(ASTNode*) * (count > 0 ? count : 1));
+    int vectors_count = 0;
+    for (int i = 0; i < count; ++i) {
+        ASTNode* definition = program->program.statements[i];
+        bool is_vector = definition->type == AST_NODE_VECTOR_DEFINITION;
+        program_symbols.definitions[i] = is_vector ? definition->vector.name : definition->function.name;
+        program_symbols.is_vector[i] = is_vector;
+        if (is_vector) {
+            vectors[vectors_count++] = definition;
+        }
+        else {
+            collect_extern_symbols(definition->function.body, &program_symbols);
+        }
+    }
+
+    compiler_begin(&program_symbols, program->program.source, compiler_options);
+    compile_functions(program);
+    compiler_end(vectors, vectors_count, program->program.site_count);
+    free_program_symbols();
+}
+
+void compiler_begin_stream(Source* program_source, const Options* compiler_options) {
+    is_streaming = true;
+    source = program_source;
+    symbols = NULL;
+    output = open_output(compiler_options);
+    extern_symbols_count = 0;
+
+    function_text = open_temporary();
+    vectors_text = open_temporary();
+    rodata = open_temporary();
+    cold_text = open_temporary();
+    bss = open_temporary();
+    main_function = (ASTNode) { .type = AST_NODE_FUNCTION, .function = { .name = "main" } };
+}
+
+void compiler_stream_definition(ASTNode* definition) {
+    if (definition->type == AST_NODE_VECTOR_DEFINITION) {
+        define_symbol(definition->vector.name, true);
+        compile_vector_definition(definition, vectors_text);
+    }
+    else {
+        define_symbol(definition->function.name, false);
+        compile_function(definition, function_text);
+    }
+}
+
+// The implicit main keeps its variables from one statement to the next, the functions
+// compiled in between have their own.
+static void swap_main_frame() {
+    AutoVar* swapped_vars = vars;
+    vars = main_vars;
+    main_vars = swapped_vars;
+    size_t swapped_capacity = vars_capacity;
+    vars_capacity = main_vars_capacity;
+    main_vars_capacity = swapped_capacity;
+    size_t swapped_index = vars_index;
+    vars_index = main_vars_index;
+    main_vars_index = swapped_index;
+    size_t swapped_offset = vars_offset;
+    vars_offset = main_vars_offset;
+    main_vars_offset = swapped_offset;
+}
+
+void compiler_stream_statements(ASTNode* statements) {
+    if (main_text == NULL) {
+        main_text = open_temporary();
+        main_body_label = new_label();
+    }
+    swap_main_frame();
+    scope_start = 0;
+    pushed_on_stack = 0;
+    current_function = &main_function;
+    // the end of main is written last
+    shares_function_end = false;
+    function_body_label = main_body_label;
+    compile(statements, main_text);
+    swap_main_frame();
+}
+
+// The prologue is written last, once the frame holds every variable of the statements.
+static void write_main(FILE* file) {
+    size_t frame_size = (main_vars_offset + 15) & ~(size_t)15;
+    write_comment(file, ";---func main---\n");
     fprintf(file, "public main\n");
     fprintf(file, "main:\n");
-
-    fprintf(file, "\t;---func start (NOT SUPPORTED)---\n");
     fprintf(file, "\tpush rbp\n");
     fprintf(file, "\tmov rbp, rsp\n");
-
-    for (int i = 0; i < program->program.count; ++i) {
-        compile(program->program.statements[i], file);
+    if (frame_size > 0) {
+        fprintf(file, "\tsub rsp, %zu\n", frame_size);
     }
+    fprintf(file, "..L%d:\n", main_body_label);
+    copy_temporary(main_text, file);
+    write_comment(file, "\t;---func end---\n");
+    compile_load_rax(0, file);
+    compile_epilogue(file);
+}
 
-    // clear unused pushed values from the stack
-    while (pushed_on_stack > 0) {
-        fprintf(file, "\tpop rbx\n"); --pushed_on_stack;
+void compiler_end_stream(int site_count) {
+    if (main_text != NULL) {
+        define_symbol("main", false);
+    }
+    for (int i = 0; i < early_uses_count; ++i) {
+        EarlyUse* use = &early_uses[i];
+        if (is_function(use->name)) continue;
+        if (use->line == 0) {
+            fprintf(diagnostics(), "%s: ", source->path);
+        }
+        else {
+            fprintf(diagnostics(), "%s:%d: ", source->path, use->line);
+        }
+        if (use->is_call) {
+            fprintf(diagnostics(), "error: call to undeclared function '%s'\n", use->name);
+        }
+        else {
+            fprintf(diagnostics(), "error: undeclared identifier '%s'\n", use->name);
+        }
+        fail();
+    }
+    // like for a whole program, the ones of main come after the ones of all functions
+    for (int i = 0; i < function_extrns_count; ++i) {
+        add_extern_symbol(function_extrns[i]);
+    }
+    for (int i = 0; i < main_extrns_count; ++i) {
+        add_extern_symbol(main_extrns[i]);
     }
 
-    fprintf(file, "\t;---function end (NOT SUPPORTED)---\n");
-    fprintf(file, "\tadd rsp, %zu\n", vars_offset);
-    fprintf(file, "\tpop rbp\n");
-    fprintf(file, "\tmov rax, 0\n");
-    fprintf(file, "\tret\n");
+    write_header(output);
+    copy_temporary(function_text, output);
+    fclose(function_text);
+    function_text = NULL;
+    if (main_text != NULL) {
+        write_main(output);
+        fclose(main_text);
+        main_text = NULL;
+    }
+    bool has_vectors = ftell(vectors_text) > 0;
+    write_end(output, NULL, 0, has_vectors, site_count);
+}
 
-    fclose(file);
+void compiler_abort() {
+    if (code_text != NULL) {
+        close_code_streams();
+    }
+    FILE** streams[] = { &output, &rodata, &cold_text, &bss, &function_text, &main_text, &vectors_text, &size_text };
+    for (size_t i = 0; i < sizeof(streams) / sizeof(streams[0]); ++i) {
+        if (*streams[i] != NULL) {
+            fclose(*streams[i]);
+            *streams[i] = NULL;
+        }
+    }
+    free(rodata_buffer);
+    rodata_buffer = NULL;
+    free(cold_text_buffer);
+    cold_text_buffer = NULL;
+    free(bss_buffer);
+    bss_buffer = NULL;
+    free(size_text_buffer);
+    size_text_buffer = NULL;
+    free_strings(strings, strings_count);
+    strings = NULL;
+    strings_count = 0;
+    strings_capacity = 0;
+    free_program_symbols();
+    symbols = NULL;
+    free_tables();
+    debug_free();
 }
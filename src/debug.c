@@ -0,0 +1,391 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "debug.h"
+#include "utils.h"
+
+// DWARF constants used below
+#define DW_TAG_FORMAL_PARAMETER 0x05
+#define DW_TAG_COMPILE_UNIT 0x11
+#define DW_TAG_BASE_TYPE 0x24
+#define DW_TAG_SUBPROGRAM 0x2e
+#define DW_TAG_VARIABLE 0x34
+
+#define DW_AT_LOCATION 0x02
+#define DW_AT_NAME 0x03
+#define DW_AT_BYTE_SIZE 0x0b
+#define DW_AT_STMT_LIST 0x10
+#define DW_AT_LOW_PC 0x11
+#define DW_AT_HIGH_PC 0x12
+#define DW_AT_LANGUAGE 0x13
+#define DW_AT_COMP_DIR 0x1b
+#define DW_AT_PRODUCER 0x25
+#define DW_AT_DECL_FILE 0x3a
+#define DW_AT_DECL_LINE 0x3b
+#define DW_AT_ENCODING 0x3e
+#define DW_AT_EXTERNAL 0x3f
+#define DW_AT_FRAME_BASE 0x40
+#define DW_AT_TYPE 0x49
+
+#define DW_FORM_ADDR 0x01
+#define DW_FORM_DATA2 0x05
+#define DW_FORM_DATA4 0x06
+#define DW_FORM_STRING 0x08
+#define DW_FORM_BLOCK1 0x0a
+#define DW_FORM_DATA1 0x0b
+#define DW_FORM_FLAG 0x0c
+#define DW_FORM_REF4 0x13
+
+#define DW_LANG_C89 0x0001
+#define DW_ATE_SIGNED 0x05
+#define DW_OP_BREG6 0x76
+#define DW_OP_FBREG 0x91
+
+#define DW_LNS_COPY 0x01
+#define DW_LNS_ADVANCE_LINE 0x03
+#define DW_LNS_SET_COLUMN 0x05
+#define DW_LNE_END_SEQUENCE 0x01
+#define DW_LNE_SET_ADDRESS 0x02
+
+// abbreviation codes of .debug_abbrev
+typedef enum {
+    ABBREV_COMPILE_UNIT = 1,
+    ABBREV_BASE_TYPE,
+    ABBREV_SUBPROGRAM,
+    ABBREV_FORMAL_PARAMETER,
+    ABBREV_VARIABLE,
+} Abbrev;
+
+typedef struct {
+    int label;
+    int line;
+    int column;
+    // position of the stream right after the label
+    long position;
+} DebugLine;
+
+// rows of one contiguous piece of code, emitted as one line number sequence
+typedef struct {
+    DebugLine* lines;
+    int count;
+    int capacity;
+    int end_label;
+} DebugSequence;
+
+typedef struct {
+    const char* name;
+    int line;
+    Word offset;
+    bool is_parameter;
+} DebugVariable;
+
+typedef struct {
+    const char* name;
+    int line;
+    DebugSequence code;
+    DebugSequence cold_code;
+    DebugVariable* variables;
+    int variables_count;
+    int variables_capacity;
+} DebugFunction;
+
+static _Thread_local const char* source_path = NULL;
+static _Thread_local DebugFunction* functions = NULL;
+static _Thread_local int functions_count = 0;
+static _Thread_local int functions_capacity = 0;
+static _Thread_local int label_count = 0;
+
+void debug_begin(const char* path) {
+    source_path = path;
+    functions_count = 0;
+    label_count = 0;
+}
+
+void debug_begin_function(const char* name, int line) {
+    if (functions_capacity < functions_count + 1) {
+        int old_capacity = functions_capacity;
+        functions_capacity = GROW_CAPACITY(old_capacity);
+        functions = GROW_ARRAY(DebugFunction, functions, old_capacity, functions_capacity);
+    }
+    functions[functions_count++] = (DebugFunction) { .name = name, .line = line };
+}
+
+void debug_add_variable(const char* name, int line, Word offset, bool is_parameter) {
+    DebugFunction* function = &functions[functions_count - 1];
+    if (function->variables_capacity < function->variables_count + 1) {
+        int old_capacity = function->variables_capacity;
+        function->variables_capacity = GROW_CAPACITY(old_capacity);
+        function->variables = GROW_ARRAY(DebugVariable, function->variables, old_capacity, function->variables_capacity);
+    }
+    function->variables[function->variables_count++] = (DebugVariable) {
+        .name = name,
+        .line = line,
+        .offset = offset,
+        .is_parameter = is_parameter,
+    };
+}
+
+void debug_mark_line(FILE* stream, bool is_cold, int line, int column) {
+    DebugFunction* function = &functions[functions_count - 1];
+    DebugSequence* sequence = is_cold ? &function->cold_code : &function->code;
+    // a statement that emitted no code is replaced by the next one at the same address
+    if (sequence->count > 0 && sequence->lines[sequence->count - 1].position == ftell(stream)) {
+        sequence->lines[sequence->count - 1].line = line;
+        sequence->lines[sequence->count - 1].column = column;
+        return;
+    }
+    if (sequence->capacity < sequence->count + 1) {
+        int old_capacity = sequence->capacity;
+        sequence->capacity = GROW_CAPACITY(old_capacity);
+        sequence->lines = GROW_ARRAY(DebugLine, sequence->lines, old_capacity, sequence->capacity);
+    }
+    int label = label_count++;
+    fprintf(stream, "..Ldebug%d:\n", label);
+    sequence->lines[sequence->count++] = (DebugLine) {
+        .label = label,
+        .line = line,
+        .column = column,
+        .position = ftell(stream),
+    };
+}
+
+void debug_end_function(FILE* code, FILE* cold_code) {
+    DebugFunction* function = &functions[functions_count - 1];
+    function->code.end_label = label_count++;
+    fprintf(code, "..Ldebug%d:\n", function->code.end_label);
+    if (function->cold_code.count > 0) {
+        function->cold_code.end_label = label_count++;
+        fprintf(cold_code, "..Ldebug%d:\n", function->cold_code.end_label);
+    }
+}
+
+static void emit_uleb128(unsigned long value, FILE* file) {
+    fprintf(file, "\tdb ");
+    do {
+        unsigned char byte = value & 0x7f;
+        value >>= 7;
+        fprintf(file, value != 0 ? "%u, " : "%u", value != 0 ? byte | 0x80 : byte);
+    } while (value != 0);
+    fprintf(file, "\n");
+}
+
+static int sleb128_size(long value) {
+    int size = 0;
+    bool more = true;
+    while (more) {
+        unsigned char byte = value & 0x7f;
+        value >>= 7;
+        more = !((value == 0 && (byte & 0x40) == 0) || (value == -1 && (byte & 0x40) != 0));
+        ++size;
+    }
+    return size;
+}
+
+static void emit_sleb128(long value, FILE* file) {
+    fprintf(file, "\tdb ");
+    bool more = true;
+    while (more) {
+        unsigned char byte = value & 0x7f;
+        value >>= 7;
+        more = !((value == 0 && (byte & 0x40) == 0) || (value == -1 && (byte & 0x40) != 0));
+        fprintf(file, more ? "%u, " : "%u", more ? byte | 0x80 : byte);
+    }
+    fprintf(file, "\n");
+}
+
+// quotes can't be escaped in fasm strings, so they and control characters are written as numbers
+static void emit_string(const char* string, FILE* file) {
+    fprintf(file, "\tdb ");
+    bool is_quoted = false;
+    for (const char* c = string; *c != '\0'; ++c) {
+        bool is_plain = *c >= ' ' && *c != '"' && *c != 0x7f;
+        if (is_plain && !is_quoted) {
+            fprintf(file, "\"");
+        }
+        else if (!is_plain && is_quoted) {
+            fprintf(file, "\", ");
+        }
+        if (is_plain) {
+            fputc(*c, file);
+        }
+        else {
+            fprintf(file, "%u, ", (unsigned char)*c);
+        }
+        is_quoted = is_plain;
+    }
+    fprintf(file, is_quoted ? "\", 0\n" : "0\n");
+}
+
+static void emit_abbrev(Abbrev code, int tag, bool has_children, const int* attributes, int count, FILE* file) {
+    fprintf(file, "\tdb %d, %d, %d\n", code, tag, has_children ? 1 : 0);
+    for (int i = 0; i < count; ++i) {
+        fprintf(file, "\tdb %d, %d\n", attributes[2 * i], attributes[2 * i + 1]);
+    }
+    fprintf(file, "\tdb 0, 0\n");
+}
+
+static void emit_debug_abbrev(FILE* file) {
+    static const int compile_unit[] = {
+        DW_AT_PRODUCER, DW_FORM_STRING,
+        DW_AT_LANGUAGE, DW_FORM_DATA2,
+        DW_AT_NAME, DW_FORM_STRING,
+        DW_AT_COMP_DIR, DW_FORM_STRING,
+        DW_AT_LOW_PC, DW_FORM_ADDR,
+        DW_AT_STMT_LIST, DW_FORM_DATA4,
+    };
+    static const int base_type[] = {
+        DW_AT_NAME, DW_FORM_STRING,
+        DW_AT_ENCODING, DW_FORM_DATA1,
+        DW_AT_BYTE_SIZE, DW_FORM_DATA1,
+    };
+    static const int subprogram[] = {
+        DW_AT_NAME, DW_FORM_STRING,
+        DW_AT_EXTERNAL, DW_FORM_FLAG,
+        DW_AT_DECL_FILE, DW_FORM_DATA1,
+        DW_AT_DECL_LINE, DW_FORM_DATA4,
+        DW_AT_LOW_PC, DW_FORM_ADDR,
+        DW_AT_HIGH_PC, DW_FORM_ADDR,
+        DW_AT_FRAME_BASE, DW_FORM_BLOCK1,
+    };
+    static const int variable[] = {
+        DW_AT_NAME, DW_FORM_STRING,
+        DW_AT_DECL_FILE, DW_FORM_DATA1,
+        DW_AT_DECL_LINE, DW_FORM_DATA4,
+        DW_AT_TYPE, DW_FORM_REF4,
+        DW_AT_LOCATION, DW_FORM_BLOCK1,
+    };
+
+    fprintf(file, "section \".debug_abbrev\"\n");
+    fprintf(file, "..debug_abbrev:\n");
+    emit_abbrev(ABBREV_COMPILE_UNIT, DW_TAG_COMPILE_UNIT, true, compile_unit, 6, file);
+    emit_abbrev(ABBREV_BASE_TYPE, DW_TAG_BASE_TYPE, false, base_type, 3, file);
+    emit_abbrev(ABBREV_SUBPROGRAM, DW_TAG_SUBPROGRAM, true, subprogram, 7, file);
+    emit_abbrev(ABBREV_FORMAL_PARAMETER, DW_TAG_FORMAL_PARAMETER, false, variable, 5, file);
+    emit_abbrev(ABBREV_VARIABLE, DW_TAG_VARIABLE, false, variable, 5, file);
+    fprintf(file, "\tdb 0\n");
+}
+
+static void emit_debug_info(FILE* file) {
+    char* directory = getcwd(NULL, 0);
+
+    fprintf(file, "section \".debug_info\"\n");
+    fprintf(file, "..debug_info:\n");
+    fprintf(file, "\tdd ..debug_info_end - ..debug_info_version\n");
+    fprintf(file, "..debug_info_version:\n");
+    fprintf(file, "\tdw 3\n");
+    fprintf(file, "\tdd ..debug_abbrev\n");
+    fprintf(file, "\tdb 8\n");
+
+    fprintf(file, "\tdb %d\n", ABBREV_COMPILE_UNIT);
+    emit_string("bbc", file);
+    fprintf(file, "\tdw %d\n", DW_LANG_C89);
+    emit_string(source_path, file);
+    emit_string(directory != NULL ? directory : "", file);
+    fprintf(file, "\tdq 0\n");
+    fprintf(file, "\tdd ..debug_line\n");
+
+    // B has a single type
+    fprintf(file, "..debug_word_type:\n");
+    fprintf(file, "\tdb %d\n", ABBREV_BASE_TYPE);
+    emit_string("word", file);
+    fprintf(file, "\tdb %d, %zu\n", DW_ATE_SIGNED, sizeof(Word));
+
+    for (int i = 0; i < functions_count; ++i) {
+        DebugFunction* function = &functions[i];
+        fprintf(file, "\tdb %d\n", ABBREV_SUBPROGRAM);
+        emit_string(function->name, file);
+        fprintf(file, "\tdb 1, 1\n");
+        fprintf(file, "\tdd %d\n", function->line);
+        fprintf(file, "\tdq %s\n", function->name);
+        fprintf(file, "\tdq ..Ldebug%d\n", function->code.end_label);
+        // the frame base is rbp, locals are addressed below it
+        fprintf(file, "\tdb 2, %d, 0\n", DW_OP_BREG6);
+
+        for (int j = 0; j < function->variables_count; ++j) {
+            DebugVariable* variable = &function->variables[j];
+            fprintf(file, "\tdb %d\n", variable->is_parameter ? ABBREV_FORMAL_PARAMETER : ABBREV_VARIABLE);
+            emit_string(variable->name, file);
+            fprintf(file, "\tdb 1\n");
+            fprintf(file, "\tdd %d\n", variable->line);
+            fprintf(file, "\tdd ..debug_word_type - ..debug_info\n");
+            fprintf(file, "\tdb %d, %d\n", 1 + sleb128_size(-variable->offset), DW_OP_FBREG);
+            emit_sleb128(-variable->offset, file);
+        }
+        fprintf(file, "\tdb 0\n");
+    }
+    fprintf(file, "\tdb 0\n");
+    fprintf(file, "..debug_info_end:\n");
+
+    free(directory);
+}
+
+static void emit_sequence(const DebugSequence* sequence, FILE* file) {
+    if (sequence->count == 0) return;
+
+    // registers start at line 1, column 0 for every sequence
+    int line = 1;
+    int column = 0;
+    for (int i = 0; i < sequence->count; ++i) {
+        const DebugLine* row = &sequence->lines[i];
+        fprintf(file, "\tdb 0, 9, %d\n", DW_LNE_SET_ADDRESS);
+        fprintf(file, "\tdq ..Ldebug%d\n", row->label);
+        if (row->line != line) {
+            fprintf(file, "\tdb %d\n", DW_LNS_ADVANCE_LINE);
+            emit_sleb128(row->line - line, file);
+            line = row->line;
+        }
+        if (row->column != column) {
+            fprintf(file, "\tdb %d\n", DW_LNS_SET_COLUMN);
+            emit_uleb128(row->column, file);
+            column = row->column;
+        }
+        fprintf(file, "\tdb %d\n", DW_LNS_COPY);
+    }
+    fprintf(file, "\tdb 0, 9, %d\n", DW_LNE_SET_ADDRESS);
+    fprintf(file, "\tdq ..Ldebug%d\n", sequence->end_label);
+    fprintf(file, "\tdb 0, 1, %d\n", DW_LNE_END_SEQUENCE);
+}
+
+static void emit_debug_line(FILE* file) {
+    fprintf(file, "section \".debug_line\"\n");
+    fprintf(file, "..debug_line:\n");
+    fprintf(file, "\tdd ..debug_line_end - ..debug_line_version\n");
+    fprintf(file, "..debug_line_version:\n");
+    fprintf(file, "\tdw 3\n");
+    fprintf(file, "\tdd ..debug_line_program - ..debug_line_header\n");
+    fprintf(file, "..debug_line_header:\n");
+    // minimum instruction length, default is_stmt, line base, line range, opcode base
+    fprintf(file, "\tdb 1, 1, -5, 14, 13\n");
+    fprintf(file, "\tdb 0, 1, 1, 1, 1, 0, 0, 0, 1, 0, 0, 1\n");
+    // no include directories, the source is the only file
+    fprintf(file, "\tdb 0\n");
+    emit_string(source_path, file);
+    fprintf(file, "\tdb 0, 0, 0\n");
+    fprintf(file, "\tdb 0\n");
+    fprintf(file, "..debug_line_program:\n");
+    for (int i = 0; i < functions_count; ++i) {
+        emit_sequence(&functions[i].code, file);
+        emit_sequence(&functions[i].cold_code, file);
+    }
+    fprintf(file, "..debug_line_end:\n");
+}
+
+void debug_emit(FILE* file) {
+    emit_debug_abbrev(file);
+    emit_debug_info(file);
+    emit_debug_line(file);
+}
+
+void debug_free() {
+    for (int i = 0; i < functions_count; ++i) {
+        free(functions[i].code.lines);
+        free(functions[i].cold_code.lines);
+        free(functions[i].variables);
+    }
+    free(functions);
+    functions = NULL;
+    functions_count = 0;
+    functions_capacity = 0;
+}
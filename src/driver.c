@@ -0,0 +1,122 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "astfile.h"
+#include "cbackend.h"
+#include "compiler.h"
+#include "driver.h"
+#include "lexer.h"
+#include "optimizer.h"
+#include "parser.h"
+#include "pipeline.h"
+#include "profile.h"
+#include "source.h"
+#include "stream.h"
+#include "utils.h"
+
+// state of the compilation running on this thread, kept for driver_abort
+static _Thread_local Source source = { 0 };
+static _Thread_local TokenArray token_array = { 0 };
+static _Thread_local ASTNode* ast = NULL;
+
+// Optimizes and compiles the tree, or writes it as it was parsed into an AST file.
+static void compile_tree(const Options* options) {
+    if (options->emit == EMIT_AST) {
+        if (options->print_stages) {
+            parser_print_output(ast, 0);
+            printf("----------------------------------------------------------------\n");
+        }
+        astfile_write(options->output_path, ast, &source);
+        return;
+    }
+    if (options->profile_use_path != NULL) {
+        profile_load(options->profile_use_path, ast->program.site_count);
+    }
+    optimizer_optimize(ast, options);
+    if (options->print_stages) {
+        parser_print_output(ast, 0);
+        printf("----------------------------------------------------------------\n");
+    }
+    if (options->emit == EMIT_C) {
+        cbackend_compile(ast, options);
+    }
+    else {
+        compiler_compile(ast, options);
+    }
+    profile_free();
+}
+
+// The tree of an AST file is compiled like a parsed one, diagnostics and debug info name the
+// source it was parsed from.
+static void compile_ast_file(const Options* options) {
+    if (options->pipeline || options->stream) {
+        fprintf(diagnostics(), "error: --pipeline and --stream cannot compile an AST file: %s\n", options->input_path);
+        fail();
+    }
+    ast = astfile_load(options->input_path, &source);
+    Options file_options = *options;
+    file_options.input_path = source.path;
+    compile_tree(&file_options);
+
+    parser_free_ast(ast);
+    ast = NULL;
+    source_close(&source);
+    astfile_close();
+}
+
+void driver_compile(const Options* options) {
+    if (astfile_is_ast_file(options->input_path)) {
+        compile_ast_file(options);
+        return;
+    }
+    source = source_open(options->input_path);
+    if (options->pipeline) {
+        pipeline_compile(&source, options);
+        source_close(&source);
+        return;
+    }
+    if (options->stream) {
+        stream_compile(&source, options);
+        source_close(&source);
+        return;
+    }
+
+    // TODO: move token_array from main to parser
+    if (options->lex_threads == 1) {
+        token_array = lexer_lex(&source);
+    }
+    else {
+        int threads_count = options->lex_threads;
+        if (threads_count == 0) {
+            threads_count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+        }
+        token_array = lexer_lex_parallel(&source, threads_count);
+    }
+    if (options->print_stages) {
+        lexer_print_output(token_array);
+        printf("----------------------------------------------------------------\n");
+    }
+
+    ast = parser_parse(options->input_path, &token_array);
+    compile_tree(options);
+
+    parser_free_ast(ast);
+    ast = NULL;
+    lexer_free_tokens(&token_array);
+    source_close(&source);
+}
+
+void driver_abort() {
+    compiler_abort();
+    cbackend_abort();
+    stream_abort();
+    profile_free();
+    // a tree that failed in the parser is not complete yet and is leaked
+    if (ast != NULL) {
+        parser_free_ast(ast);
+        ast = NULL;
+    }
+    lexer_free_tokens(&token_array);
+    source_close(&source);
+    astfile_close();
+}
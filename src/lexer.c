@@ -1,4 +1,5 @@
 #include <ctype.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -7,25 +8,66 @@
 #include "utils.h"
 
 typedef struct Lexer {
+    Source* source;
     const char* start;
     const char* current;
-    int line;
 } Lexer;
 
-static Lexer lexer;
+static _Thread_local Lexer lexer;
+
+// in the order of their token types, shared by all threads
+static const char* const keywords[] = {
+    "auto", "extrn",
+    "if", "else",
+    "switch", "case", "default",
+    "goto", "while", "break",
+    "return", "print"
+};
+static const int keywords_amount = sizeof(keywords) / sizeof(keywords[0]);
+
+static const char* const error_messages[] = {
+    "Unterminated string",
+    "Unknown token",
+    "Token too long",
+};
+
+typedef enum {
+    ERROR_UNTERMINATED_STRING,
+    ERROR_UNKNOWN_TOKEN,
+    ERROR_TOKEN_TOO_LONG,
+} LexerError;
+
+// Reads the next chunk when the lexer reached the end of what was read so far, a token cut
+// by the chunk boundary continues in the appended bytes. Returns false at the end of input.
+static bool lexer_refill() {
+    Source* source = lexer.source;
+    // a '\0' inside the input ends it
+    if (lexer.current != source->buffer + source->size) return false;
+
+    size_t start = lexer.start - source->buffer;
+    size_t current = lexer.current - source->buffer;
+    bool is_refilled = source_refill(source);
+    lexer.start = source->buffer + start;
+    lexer.current = source->buffer + current;
+    if (source->size > UINT32_MAX) {
+        fprintf(diagnostics(), "error: %s is larger than 4 GiB\n", source->path);
+        fail();
+    }
+    return is_refilled;
+}
 
 inline static bool lexer_is_at_end() {
-    return *lexer.current == '\0';
+    return *lexer.current == '\0' && !lexer_refill();
 }
 
 inline static char lexer_peek() {
+    if (*lexer.current == '\0') {
+        lexer_refill();
+    }
     return *lexer.current;
 }
 
 inline static char lexer_advance() {
-    if (*lexer.current == '\n') {
-        lexer.line++;
-    }
     return *lexer.current++;
 }
 
@@ -36,21 +78,22 @@ inline static bool lexer_advance_if(char expected) {
     return true; 
 }
 
-inline static Token lexer_make_token(TokenType type) {
+inline static Token lexer_make_error_token(LexerError error) {
     return (Token) {
-        .type = type,
-        .value = lexer.start,
-        .line = lexer.line,
-        .length = (int)(lexer.current - lexer.start)
+        .offset = (uint32_t)(lexer.start - lexer.source->buffer),
+        .length = error,
+        .type = TOKEN_ERROR,
     };
 }
 
-inline static Token lexer_make_error_token(const char* message) {
+inline static Token lexer_make_token(TokenType type) {
+    if (lexer.current - lexer.start > TOKEN_MAX_LENGTH) {
+        return lexer_make_error_token(ERROR_TOKEN_TOO_LONG);
+    }
     return (Token) {
-        .type = TOKEN_ERROR,
-        .value = message,
-        .line = lexer.line,
-        .length = strlen(message)
+        .offset = (uint32_t)(lexer.start - lexer.source->buffer),
+        .length = (uint32_t)(lexer.current - lexer.start),
+        .type = type,
     };
 }
 
@@ -77,15 +120,6 @@ static Token lexer_read_identifier() {
     }
 
     // TODO: optimize this
-    const char* keywords[] = {
-        "auto", "extrn",
-        "if", "else",
-        "switch", "case",
-        "goto", "while",
-        "return", "print" // TODO: temporary
-    };
-    const int keywords_amount = sizeof(keywords) / sizeof(keywords[0]);
-
     for (int i = 0; i < keywords_amount; ++i) {
         int length = (int)(lexer.current - lexer.start);
         int keyword_length = strlen(keywords[i]);
@@ -123,7 +157,7 @@ static Token lexer_read_string() {
     }
 
     if (lexer_peek() != '"') {
-        return lexer_make_error_token("Unterminated string");
+        return lexer_make_error_token(ERROR_UNTERMINATED_STRING);
     }
 
     Token token = lexer_make_token(TOKEN_STRING_LITERAL);
@@ -155,6 +189,8 @@ static Token lexer_next_token() {
             return lexer_make_token(TOKEN_LEFT_BRACKET);
         case ']':
             return lexer_make_token(TOKEN_RIGHT_BRACKET);
+        case ',':
+            return lexer_make_token(TOKEN_COMMA);
         case '.':
             return lexer_make_token(TOKEN_DOT);
         case '?':
@@ -198,23 +234,251 @@ static Token lexer_next_token() {
         return lexer_read_identifier();
     }
 
-    return lexer_make_error_token("Unknown token");
+    return lexer_make_error_token(ERROR_UNKNOWN_TOKEN);
+}
+
+// Appends the tokens from start up to the next '\0' to the array, the TOKEN_EOF at the end
+// only when asked for.
+static void lexer_lex_range(TokenArray* array, const char* start, bool ends_with_eof) {
+    lexer.source = array->source;
+    lexer.start = start;
+    lexer.current = start;
+
+    for (;;) {
+        Token token = lexer_next_token();
+        if (token.type == TOKEN_EOF && !ends_with_eof) break;
+        if (array->capacity < array->count + 1) {
+            int old_capacity = array->capacity;
+            array->capacity = GROW_CAPACITY(old_capacity);
+            array->tokens = GROW_ARRAY(Token, array->tokens, old_capacity, array->capacity);
+        }
+        array->tokens[array->count++] = token;
+        if (token.type == TOKEN_EOF) break;
+    }
+}
+
+void lexer_begin(Source* source) {
+    lexer.source = source;
+    lexer.start = source->buffer;
+    lexer.current = source->buffer;
+}
+
+Token lexer_next() {
+    return lexer_next_token();
+}
+
+void lexer_drop_source(uint32_t offset) {
+    Source* source = lexer.source;
+    size_t start = lexer.start - source->buffer;
+    size_t current = lexer.current - source->buffer;
+    source_drop(source, offset);
+    lexer.start = source->buffer + start - offset;
+    lexer.current = source->buffer + current - offset;
+}
+
+TokenArray lexer_lex(Source* source) {
+    TokenArray array = { .source = source };
+    // the array always ends with TOKEN_EOF, even without trailing whitespace in the source
+    lexer_lex_range(&array, source->buffer, true);
+    return array;
+}
+
+typedef struct LexerChunk {
+    const char* start;
+    bool is_last;
+    TokenArray tokens;
+} LexerChunk;
+
+static void* lexer_lex_chunk(void* argument) {
+    LexerChunk* chunk = argument;
+    lexer_lex_range(&chunk->tokens, chunk->start, chunk->is_last);
+    return NULL;
+}
+
+// Counts the '"' in [from, to) to keep track of whether a position is inside a string.
+static size_t lexer_count_quotes(const char* from, const char* to) {
+    size_t count = 0;
+    while ((from = memchr(from, '"', to - from)) != NULL) {
+        ++count;
+        ++from;
+    }
+    return count;
+}
+
+// A string is everything between a '"' and the next one and every '"' outside of a string
+// starts one, so an even number of quotes before a position means it is outside of strings.
+// Whitespace there separates tokens, so lexing both sides of it on their own gives the same
+// tokens as lexing it all at once. Returns the offset of such a character at or after from,
+// quotes counts the quotes before it.
+static size_t lexer_find_boundary(const char* buffer, size_t size, size_t from, size_t* quotes) {
+    for (size_t i = from; i < size; ++i) {
+        switch (buffer[i]) {
+            case '"': {
+                ++*quotes;
+            } break;
+            case ' ':
+            case '\t':
+            case '\r':
+            case '\n': {
+                if (*quotes % 2 == 0) return i;
+            } break;
+            default:
+                break;
+        }
+    }
+    return size;
+}
+
+TokenArray lexer_lex_parallel(Source* source, int threads_count) {
+    source_read_all(source);
+
+    char* buffer = source->buffer;
+    // the serial lexer stops at the first '\0' of the input
+    size_t size = strlen(buffer);
+    if ((size_t)threads_count > size / LEXER_MIN_CHUNK_SIZE) {
+        threads_count = (int)(size / LEXER_MIN_CHUNK_SIZE);
+    }
+    if (threads_count > LEXER_MAX_THREADS) {
+        threads_count = LEXER_MAX_THREADS;
+    }
+    if (threads_count <= 1) {
+        return lexer_lex(source);
+    }
+
+    // Chunks end with the whitespace character at the boundary replaced by '\0', so every
+    // thread stops at the end of its chunk without checking for it. All of them are placed
+    // before the threads start and restored after they finished.
+    LexerChunk chunks[LEXER_MAX_THREADS];
+    size_t boundaries[LEXER_MAX_THREADS];
+    char replaced[LEXER_MAX_THREADS];
+    int chunks_count = 0;
+    size_t start = 0;
+    size_t quotes = 0;
+    while (chunks_count < threads_count - 1) {
+        size_t target = size / threads_count * (chunks_count + 1);
+        if (target < start) {
+            target = start;
+        }
+        quotes += lexer_count_quotes(buffer + start, buffer + target);
+        size_t boundary = lexer_find_boundary(buffer, size, target, &quotes);
+        if (boundary == size) break;
+
+        chunks[chunks_count] = (LexerChunk) { .start = buffer + start, .tokens = { .source = source } };
+        boundaries[chunks_count] = boundary;
+        replaced[chunks_count++] = buffer[boundary];
+        buffer[boundary] = '\0';
+        start = boundary + 1;
+    }
+    chunks[chunks_count++] = (LexerChunk) { .start = buffer + start, .is_last = true, .tokens = { .source = source } };
+
+    // the calling thread lexes the first chunk, and any chunk no thread could be started for
+    pthread_t threads[LEXER_MAX_THREADS];
+    bool is_started[LEXER_MAX_THREADS] = { false };
+    for (int i = 1; i < chunks_count; ++i) {
+        is_started[i] = pthread_create(&threads[i], NULL, lexer_lex_chunk, &chunks[i]) == 0;
+    }
+    for (int i = 0; i < chunks_count; ++i) {
+        if (is_started[i]) {
+            pthread_join(threads[i], NULL);
+        }
+        else {
+            lexer_lex_chunk(&chunks[i]);
+        }
+    }
+    for (int i = 0; i < chunks_count - 1; ++i) {
+        buffer[boundaries[i]] = replaced[i];
+    }
+
+    TokenArray array = chunks[0].tokens;
+    int count = array.count;
+    for (int i = 1; i < chunks_count; ++i) {
+        count += chunks[i].tokens.count;
+    }
+    if (array.capacity < count) {
+        array.tokens = GROW_ARRAY(Token, array.tokens, array.capacity, count);
+        array.capacity = count;
+    }
+    for (int i = 1; i < chunks_count; ++i) {
+        memcpy(array.tokens + array.count, chunks[i].tokens.tokens, chunks[i].tokens.count * sizeof(Token));
+        array.count += chunks[i].tokens.count;
+        lexer_free_tokens(&chunks[i].tokens);
+    }
+    return array;
+}
+
+static void lexer_append_token(TokenArray* array, Token token) {
+    if (array->capacity < array->count + 1) {
+        int old_capacity = array->capacity;
+        array->capacity = GROW_CAPACITY(old_capacity);
+        array->tokens = GROW_ARRAY(Token, array->tokens, old_capacity, array->capacity);
+    }
+    array->tokens[array->count++] = token;
 }
 
-TokenArray lexer_lex(const char* source) {
-    lexer.start = source;
-    lexer.current = source;
-    lexer.line = 1;
+// where the lexer continues after the token, a string ends with the quote after it
+static size_t lexer_token_end(Token token) {
+    return token.offset + token.length + (token.type == TOKEN_STRING_LITERAL);
+}
+
+TokenArray lexer_relex(Source* source, const TokenArray* previous) {
+    source_read_all(source);
+    if (source->size > UINT32_MAX) {
+        fprintf(diagnostics(), "error: %s is larger than 4 GiB\n", source->path);
+        fail();
+    }
+    // like the serial lexer, both stop at their first '\0'
+    const char* old_buffer = previous->source->buffer;
+    const char* buffer = source->buffer;
+    size_t old_size = strlen(old_buffer);
+    size_t size = strlen(buffer);
+    size_t common = old_size < size ? old_size : size;
+    size_t prefix = 0;
+    while (prefix < common && old_buffer[prefix] == buffer[prefix]) {
+        ++prefix;
+    }
+    size_t suffix = 0;
+    while (suffix < common - prefix && old_buffer[old_size - 1 - suffix] == buffer[size - 1 - suffix]) {
+        ++suffix;
+    }
 
-    TokenArray array = { 0 };
+    // A token is kept when the byte after it is unchanged, that byte decides where it ends.
+    TokenArray array = { .source = source };
+    size_t resume = 0;
+    int kept = 0;
+    for (; kept < previous->count; ++kept) {
+        Token token = previous->tokens[kept];
+        if (token.type == TOKEN_EOF || token.type == TOKEN_ERROR || lexer_token_end(token) >= prefix) break;
+        lexer_append_token(&array, token);
+        resume = lexer_token_end(token);
+    }
 
-    while (!lexer_is_at_end()) {
-        if (array.capacity < array.count + 1) {
-            int old_capacity = array.capacity;
-            array.capacity = GROW_CAPACITY(old_capacity);
-            array.tokens = GROW_ARRAY(Token, array.tokens, old_capacity, array.capacity);
+    // Once a token starts in the unchanged suffix where one started before, the rest lexes
+    // like before and the old tokens are moved by the change in size.
+    int64_t delta = (int64_t)size - (int64_t)old_size;
+    int old_index = kept;
+    lexer.source = source;
+    lexer.start = buffer + resume;
+    lexer.current = buffer + resume;
+    for (;;) {
+        Token token = lexer_next_token();
+        bool may_match = token.type != TOKEN_EOF && token.type != TOKEN_ERROR && token.type != TOKEN_STRING_LITERAL;
+        if (may_match && token.offset >= size - suffix) {
+            uint32_t old_offset = (uint32_t)(token.offset - delta);
+            while (old_index < previous->count - 1 && previous->tokens[old_index].offset < old_offset) {
+                ++old_index;
+            }
+            Token old = previous->tokens[old_index];
+            if (old.offset == old_offset && old.type == token.type && old.length == token.length) {
+                for (int i = old_index; i < previous->count; ++i) {
+                    Token moved = previous->tokens[i];
+                    moved.offset = (uint32_t)(moved.offset + delta);
+                    lexer_append_token(&array, moved);
+                }
+                return array;
+            }
         }
-        array.tokens[array.count++] = lexer_next_token();
+        lexer_append_token(&array, token);
+        if (token.type == TOKEN_EOF) break;
     }
     return array;
 }
@@ -236,14 +500,14 @@ void lexer_print_output(TokenArray output) {
         if (type == TOKEN_IDENTIFIER || type == TOKEN_WORD_LITERAL || type == TOKEN_STRING_LITERAL) {
             printf(
                 "Line: %d,\ttoken: %s,\tvalue: %.*s\n",
-                token->line,
+                token_line(&output, token),
                 token_as_cstr(type),
-                token->length,
-                token->value
+                (int)token->length,
+                token_value(&output, token)
             );
         }
         else {
-            printf("Line: %d,\ttoken: %s\n", token->line, token_as_cstr(type));
+            printf("Line: %d,\ttoken: %s\n", token_line(&output, token), token_as_cstr(type));
         }
 
         if (type == TOKEN_EOF) break;
@@ -296,8 +560,10 @@ const char* token_as_cstr(TokenType type) {
         "else",
         "switch",
         "case",
+        "default",
         "goto",
         "while",
+        "break",
         "return",
         "print",
     
@@ -306,3 +572,14 @@ const char* token_as_cstr(TokenType type) {
 
     return token_strings[type];
 }
+
+const char* token_value(const TokenArray* token_array, const Token* token) {
+    if (token->type == TOKEN_ERROR) return error_messages[token->length];
+    return token_array->source->buffer + token->offset;
+}
+
+int token_line(const TokenArray* token_array, const Token* token) {
+    int line, column;
+    source_locate(token_array->source, token->offset, &line, &column);
+    return line;
+}
@@ -0,0 +1,2063 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "optimizer.h"
+#include "parser.h"
+#include "profile.h"
+#include "utils.h"
+
+// inliner cost model: a call is inlined when the callee body has at most INLINE_MAX_COST
+// nodes, every constant argument is expected to fold away INLINE_CONSTANT_ARGUMENT_BONUS more
+#define INLINE_MAX_COST 24
+#define INLINE_CONSTANT_ARGUMENT_BONUS 6
+// with -Os only bodies about as small as the call they replace, and loops are not unrolled
+#define INLINE_MAX_COST_SIZE 6
+// with a profile, calls inside hot sites may cost this many times more, calls on cold paths
+// are never inlined and loops that never ran are never unrolled
+#define PROFILE_HOT_FACTOR 2
+// loops with a constant trip count of at most LOOP_UNROLL_MAX_TRIPS are replaced by copies of
+// their body, as long as the copies stay under LOOP_UNROLL_MAX_NODES nodes
+#define LOOP_UNROLL_MAX_TRIPS 8
+#define LOOP_UNROLL_MAX_NODES 128
+typedef struct NameList {
+    const char** names;
+    int count;
+    int capacity;
+} NameList;
+
+typedef struct FunctionTable {
+    ASTNode** functions;
+    bool* inlinable;
+    int count;
+    int capacity;
+    // the first function of every name, by its hash
+    HashTable names;
+    // number of enclosing cold and hot profile sites of the visited node
+    int cold_depth;
+    int hot_depth;
+    bool optimize_size;
+} FunctionTable;
+
+// What a walk does below a node it enters. The arguments of an inlined call come before its
+// body, which only sees the names of the callee.
+typedef enum {
+    WALK_CHILDREN,
+    WALK_ARGUMENTS,
+    WALK_SKIP,
+} WalkAction;
+
+typedef WalkAction (*WalkEnter)(ASTNode** slot, void* context);
+typedef void (*WalkLeave)(ASTNode** slot, void* context);
+
+// a node on the way down a walk, its children from next_child to child_limit are left
+typedef struct WalkFrame {
+    ASTNode** slot;
+    int next_child;
+    int child_limit;
+} WalkFrame;
+
+// The passes walk the tree from stacks instead of recursing, so deep trees only need memory.
+// A walk started from the callbacks of another one uses the entries above it. The frames are
+// for the walks that need walk_parent, walk_tree uses the steps.
+static _Thread_local WalkFrame* walk_frames = NULL;
+static _Thread_local int walk_frames_count = 0;
+static _Thread_local int walk_frames_capacity = 0;
+
+// a node walk_tree has yet to enter or leave
+typedef struct WalkStep {
+    ASTNode** slot;
+    bool is_leaving;
+} WalkStep;
+
+// the steps of walk_tree, the last one first
+static _Thread_local WalkStep* walk_steps = NULL;
+static _Thread_local int walk_steps_count = 0;
+static _Thread_local int walk_steps_capacity = 0;
+
+typedef struct Walk {
+    // the frames below base belong to the walks this one was started from
+    int base;
+    ASTNode** root;
+    // the node left last keeps its frame until the next step, so its parent can be found
+    bool is_left;
+} Walk;
+
+static Walk walk_begin(ASTNode** root) {
+    return (Walk) { .base = walk_frames_count, .root = root, .is_left = false };
+}
+
+static void push_walk_frame(ASTNode** slot) {
+    if (walk_frames_capacity < walk_frames_count + 1) {
+        int old_capacity = walk_frames_capacity;
+        walk_frames_capacity = GROW_CAPACITY(old_capacity);
+        walk_frames = GROW_ARRAY(WalkFrame, walk_frames, old_capacity, walk_frames_capacity);
+    }
+    // the slots parser_child_slot has for the node, optional ones may hold NULL
+    ASTNode* node = *slot;
+    int child_limit;
+    switch (node->type) {
+        case AST_NODE_PROGRAM: child_limit = node->program.count; break;
+        case AST_NODE_BLOCK: child_limit = node->block.count; break;
+        case AST_NODE_CALL: child_limit = node->call.count; break;
+        case AST_NODE_INLINED_CALL: child_limit = node->inlined_call.count + 1; break;
+        case AST_NODE_IF_STATEMENT:
+        case AST_NODE_SUBSCRIPT:
+        case AST_NODE_SUBSCRIPT_ASSIGNMENT:
+            child_limit = 3;
+            break;
+        case AST_NODE_WHILE_STATEMENT:
+        case AST_NODE_SWITCH_STATEMENT:
+        case AST_NODE_BINARY:
+            child_limit = 2;
+            break;
+        case AST_NODE_FUNCTION:
+        case AST_NODE_EXPRESSION_STATEMENT:
+        case AST_NODE_RETURN_STATEMENT:
+        case AST_NODE_CASE:
+        case AST_NODE_ASSIGNMENT:
+        case AST_NODE_UNARY:
+            child_limit = 1;
+            break;
+        default: child_limit = 0; break;
+    }
+    walk_frames[walk_frames_count++] = (WalkFrame) { .slot = slot, .next_child = 0, .child_limit = child_limit };
+}
+
+// The slot of the next node entered or left in the order a recursive walk reaches them, NULL
+// at the end. Nodes are entered before their children and left after them, the node in the
+// slot may be replaced on either.
+static ASTNode** walk_next(Walk* walk, bool* is_leaving) {
+    *is_leaving = false;
+    if (walk->root != NULL) {
+        push_walk_frame(walk->root);
+        walk->root = NULL;
+        return walk_frames[walk_frames_count - 1].slot;
+    }
+    if (walk->is_left) {
+        --walk_frames_count;
+        walk->is_left = false;
+    }
+    while (walk_frames_count > walk->base) {
+        WalkFrame* top = &walk_frames[walk_frames_count - 1];
+        if (top->next_child < top->child_limit) {
+            ASTNode** child = parser_child_slot(*top->slot, top->next_child++);
+            if (child == NULL) {
+                top->child_limit = 0;
+            }
+            else if (*child != NULL) {
+                push_walk_frame(child);
+                return child;
+            }
+        }
+        else {
+            walk->is_left = true;
+            *is_leaving = true;
+            return top->slot;
+        }
+    }
+    return NULL;
+}
+
+// The node holding the one just entered or left and its index there, NULL for the root.
+static ASTNode* walk_parent(const Walk* walk, int* index) {
+    if (walk_frames_count - 2 < walk->base) return NULL;
+    const WalkFrame* parent = &walk_frames[walk_frames_count - 2];
+    *index = parent->next_child - 1;
+    return *parent->slot;
+}
+
+static void reserve_walk_steps(int count) {
+    int old_capacity = walk_steps_capacity;
+    walk_steps_capacity = GROW_CAPACITY(old_capacity);
+    if (walk_steps_capacity < walk_steps_count + count) {
+        walk_steps_capacity = walk_steps_count + count;
+    }
+    walk_steps = GROW_ARRAY(WalkStep, walk_steps, old_capacity, walk_steps_capacity);
+}
+
+// Pushes the step that leaves the node unless leaving is NULL, then the children of the node
+// last to first, so they come off the stack in order. Only the arguments of an inlined call
+// with is_arguments_only. Nothing is pushed for a node that never has children, false then.
+static bool push_child_steps(ASTNode* node, bool is_arguments_only, ASTNode** leaving) {
+    int children_count = 3;
+    switch (node->type) {
+        case AST_NODE_PROGRAM: children_count = node->program.count; break;
+        case AST_NODE_BLOCK: children_count = node->block.count; break;
+        case AST_NODE_CALL: children_count = node->call.count; break;
+        case AST_NODE_INLINED_CALL: children_count = node->inlined_call.count + 1; break;
+        case AST_NODE_VECTOR_DEFINITION:
+        case AST_NODE_BREAK_STATEMENT:
+        case AST_NODE_VARIABLE_DECLARATION:
+        case AST_NODE_EXTRN_DECLARATION:
+        case AST_NODE_LITERAL:
+        case AST_NODE_STRING:
+        case AST_NODE_VARIABLE:
+            return false;
+        default: break;
+    }
+    // one check for all of them, every walk pushes the children of most nodes it enters
+    if (walk_steps_capacity < walk_steps_count + children_count + 1) {
+        reserve_walk_steps(children_count + 1);
+    }
+    WalkStep* top = &walk_steps[walk_steps_count];
+    if (leaving != NULL) {
+        *top++ = (WalkStep) { leaving, true };
+    }
+    switch (node->type) {
+        case AST_NODE_PROGRAM: {
+            for (int i = node->program.count - 1; i >= 0; --i) {
+                *top++ = (WalkStep) { &node->program.statements[i], false };
+            }
+        } break;
+        case AST_NODE_FUNCTION: {
+            *top++ = (WalkStep) { &node->function.body, false };
+        } break;
+        case AST_NODE_BLOCK: {
+            for (int i = node->block.count - 1; i >= 0; --i) {
+                *top++ = (WalkStep) { &node->block.statements[i], false };
+            }
+        } break;
+        case AST_NODE_EXPRESSION_STATEMENT:
+        case AST_NODE_RETURN_STATEMENT: {
+            if (node->expression != NULL) {
+                *top++ = (WalkStep) { &node->expression, false };
+            }
+        } break;
+        case AST_NODE_IF_STATEMENT: {
+            if (node->if_statement.else_branch != NULL) {
+                *top++ = (WalkStep) { &node->if_statement.else_branch, false };
+            }
+            *top++ = (WalkStep) { &node->if_statement.then_branch, false };
+            *top++ = (WalkStep) { &node->if_statement.condition, false };
+        } break;
+        case AST_NODE_WHILE_STATEMENT: {
+            *top++ = (WalkStep) { &node->while_statement.body, false };
+            *top++ = (WalkStep) { &node->while_statement.condition, false };
+        } break;
+        case AST_NODE_SWITCH_STATEMENT: {
+            // case nodes are reached through the body
+            *top++ = (WalkStep) { &node->switch_statement.body, false };
+            *top++ = (WalkStep) { &node->switch_statement.condition, false };
+        } break;
+        case AST_NODE_CASE: {
+            *top++ = (WalkStep) { &node->case_label.statement, false };
+        } break;
+        case AST_NODE_ASSIGNMENT: {
+            *top++ = (WalkStep) { &node->assignment.value, false };
+        } break;
+        case AST_NODE_BINARY: {
+            *top++ = (WalkStep) { &node->binary.right, false };
+            *top++ = (WalkStep) { &node->binary.left, false };
+        } break;
+        case AST_NODE_UNARY: {
+            *top++ = (WalkStep) { &node->unary.right, false };
+        } break;
+        case AST_NODE_SUBSCRIPT:
+        case AST_NODE_SUBSCRIPT_ASSIGNMENT: {
+            if (node->subscript.value != NULL) {
+                *top++ = (WalkStep) { &node->subscript.value, false };
+            }
+            *top++ = (WalkStep) { &node->subscript.index, false };
+            *top++ = (WalkStep) { &node->subscript.vector, false };
+        } break;
+        case AST_NODE_CALL: {
+            for (int i = node->call.count - 1; i >= 0; --i) {
+                *top++ = (WalkStep) { &node->call.arguments[i], false };
+            }
+        } break;
+        case AST_NODE_INLINED_CALL: {
+            if (!is_arguments_only) {
+                *top++ = (WalkStep) { &node->inlined_call.body, false };
+            }
+            for (int i = node->inlined_call.count - 1; i >= 0; --i) {
+                *top++ = (WalkStep) { &node->inlined_call.arguments[i], false };
+            }
+        } break;
+        default: break;
+    }
+    walk_steps_count = (int)(top - walk_steps);
+    return true;
+}
+
+// Runs enter on every node before its children and leave after them, either may be NULL.
+// Without walk_parent the children can wait on a plain stack.
+static void walk_tree(ASTNode** root, WalkEnter enter, WalkLeave leave, void* context) {
+    int base = walk_steps_count;
+    if (walk_steps_capacity < walk_steps_count + 1) {
+        reserve_walk_steps(1);
+    }
+    walk_steps[walk_steps_count++] = (WalkStep) { root, false };
+    while (walk_steps_count > base) {
+        WalkStep step = walk_steps[--walk_steps_count];
+        if (step.is_leaving) {
+            leave(step.slot, context);
+            continue;
+        }
+        WalkAction action = enter != NULL ? enter(step.slot, context) : WALK_CHILDREN;
+        // a node with no children to walk is left at once, its step would come off next
+        ASTNode* node = *step.slot;
+        bool has_children = action != WALK_SKIP && node->type != AST_NODE_LITERAL && node->type != AST_NODE_VARIABLE &&
+            push_child_steps(node, action == WALK_ARGUMENTS, leave != NULL ? step.slot : NULL);
+        if (!has_children && leave != NULL) {
+            leave(step.slot, context);
+        }
+    }
+}
+
+static void name_list_add(NameList* list, const char* name) {
+    if (list->capacity < list->count + 1) {
+        int old_capacity = list->capacity;
+        list->capacity = GROW_CAPACITY(old_capacity);
+        list->names = GROW_ARRAY(const char*, list->names, old_capacity, list->capacity);
+    }
+    list->names[list->count++] = name;
+}
+
+static bool name_list_contains(const NameList* list, const char* name) {
+    for (int i = 0; i < list->count; ++i) {
+        if (strcmp(list->names[i], name) == 0) return true;
+    }
+    return false;
+}
+
+static char** duplicate_names(char** names, int count) {
+    if (count == 0) return NULL;
+    char** copy = malloc(sizeof(char*) * count);
+    for (int i = 0; i < count; ++i) {
+        copy[i] = strdup(names[i]);
+    }
+    return copy;
+}
+
+static ASTNode** clone_node_array(ASTNode** nodes, int count) {
+    if (count == 0) return NULL;
+    ASTNode** copy = malloc(sizeof(ASTNode*) * count);
+    memcpy(copy, nodes, sizeof(ASTNode*) * count);
+    return copy;
+}
+
+static WalkAction collect_cases_visitor(ASTNode** child, void* context) {
+    ASTNode* node = *child;
+    ASTNode* switch_node = context;
+    if (node->type == AST_NODE_CASE) {
+        if (node->case_label.is_default) {
+            switch_node->switch_statement.default_case = node;
+        }
+        else {
+            ASTNode*** cases = &switch_node->switch_statement.cases;
+            int* count = &switch_node->switch_statement.count;
+            int* capacity = &switch_node->switch_statement.capacity;
+            if (*capacity < *count + 1) {
+                int old_capacity = *capacity;
+                *capacity = GROW_CAPACITY(old_capacity);
+                *cases = GROW_ARRAY(ASTNode*, *cases, old_capacity, *capacity);
+            }
+            (*cases)[(*count)++] = node;
+        }
+    }
+    // cases of a nested switch belong to it
+    return node->type == AST_NODE_SWITCH_STATEMENT ? WALK_SKIP : WALK_CHILDREN;
+}
+
+// Copies the node into its slot before the walk reaches its children, which are still the
+// ones of the original.
+static WalkAction clone_visitor(ASTNode** child, void* context) {
+    (void)context;
+    const ASTNode* node = *child;
+    ASTNode* copy = malloc(sizeof(ASTNode));
+    *copy = *node;
+    *child = copy;
+
+    switch (node->type) {
+        case AST_NODE_PROGRAM: {
+            copy->program.statements = clone_node_array(node->program.statements, node->program.count);
+            copy->program.capacity = node->program.count;
+        } break;
+        case AST_NODE_FUNCTION: {
+            copy->function.name = strdup(node->function.name);
+            copy->function.parameters = duplicate_names(node->function.parameters, node->function.parameter_count);
+        } break;
+        case AST_NODE_BLOCK: {
+            copy->block.statements = clone_node_array(node->block.statements, node->block.count);
+            copy->block.capacity = node->block.count;
+        } break;
+        case AST_NODE_SWITCH_STATEMENT: {
+            copy->switch_statement.cases = NULL;
+            copy->switch_statement.count = 0;
+            copy->switch_statement.capacity = 0;
+            copy->switch_statement.default_case = NULL;
+        } break;
+        case AST_NODE_VARIABLE_DECLARATION: {
+            copy->declaration.name = strdup(node->declaration.name);
+        } break;
+        case AST_NODE_EXTRN_DECLARATION:
+        case AST_NODE_VARIABLE: {
+            copy->name = strdup(node->name);
+        } break;
+        case AST_NODE_STRING: {
+            copy->string.bytes = malloc(node->string.length + 1);
+            memcpy(copy->string.bytes, node->string.bytes, node->string.length + 1);
+        } break;
+        case AST_NODE_ASSIGNMENT: {
+            copy->assignment.name = strdup(node->assignment.name);
+        } break;
+        case AST_NODE_CALL: {
+            copy->call.name = strdup(node->call.name);
+            copy->call.arguments = clone_node_array(node->call.arguments, node->call.count);
+            copy->call.capacity = node->call.count;
+        } break;
+        case AST_NODE_INLINED_CALL: {
+            copy->inlined_call.name = strdup(node->inlined_call.name);
+            copy->inlined_call.parameters = duplicate_names(node->inlined_call.parameters, node->inlined_call.count);
+            copy->inlined_call.arguments = clone_node_array(node->inlined_call.arguments, node->inlined_call.count);
+        } break;
+        default: break;
+    }
+
+    return WALK_CHILDREN;
+}
+
+// the case list of a copied switch, once its body is copied
+static void collect_cases(ASTNode** child, void* context) {
+    ASTNode* node = *child;
+    (void)context;
+    if (node->type == AST_NODE_SWITCH_STATEMENT) {
+        walk_tree(&node->switch_statement.body, collect_cases_visitor, NULL, node);
+    }
+}
+
+// Deep copy, the switch case list of the copy points into the copied body.
+static ASTNode* clone_ast(const ASTNode* node) {
+    ASTNode* copy = (ASTNode*)node;
+    walk_tree(&copy, clone_visitor, collect_cases, NULL);
+    return copy;
+}
+
+static WalkAction count_nodes_visitor(ASTNode** child, void* context) {
+    (void)child;
+    int* count = context;
+    ++*count;
+    return WALK_CHILDREN;
+}
+
+static int count_nodes(ASTNode* node) {
+    int count = 0;
+    walk_tree(&node, count_nodes_visitor, NULL, &count);
+    return count;
+}
+
+// Turns the node into a literal in place, so parents don't have to be updated.
+static void replace_with_literal(ASTNode* node, Word value) {
+    switch (node->type) {
+        case AST_NODE_BINARY: {
+            parser_free_ast(node->binary.left);
+            parser_free_ast(node->binary.right);
+        } break;
+        case AST_NODE_UNARY: {
+            parser_free_ast(node->unary.right);
+        } break;
+        case AST_NODE_VARIABLE: {
+            free(node->name);
+        } break;
+        default: break;
+    }
+    node->type = AST_NODE_LITERAL;
+    node->literal = value;
+}
+
+// Evaluates operators with literal operands, B arithmetic wraps around like the generated code.
+static bool evaluate_binary(TokenType op, Word left, Word right, Word* result) {
+    switch (op) {
+        case TOKEN_PLUS: *result = (Word)((uint64_t)left + (uint64_t)right); return true;
+        case TOKEN_MINUS: *result = (Word)((uint64_t)left - (uint64_t)right); return true;
+        case TOKEN_ASTERISK: *result = (Word)((uint64_t)left * (uint64_t)right); return true;
+        case TOKEN_SLASH:
+        case TOKEN_PERCENT: {
+            // leave the trap to the runtime
+            if (right == 0 || (left == INT64_MIN && right == -1)) return false;
+            *result = op == TOKEN_SLASH ? left / right : left % right;
+            return true;
+        }
+        case TOKEN_EQUAL_EQUAL: *result = left == right; return true;
+        case TOKEN_NOT_EQUAL: *result = left != right; return true;
+        case TOKEN_GREATER: *result = left > right; return true;
+        case TOKEN_GREATER_EQUAL: *result = left >= right; return true;
+        case TOKEN_LESS: *result = left < right; return true;
+        case TOKEN_LESS_EQUAL: *result = left <= right; return true;
+        default: return false;
+    }
+}
+
+// children are folded before their parent, so whole constant expressions collapse
+static void fold_constants_visitor(ASTNode** child, void* context) {
+    (void)context;
+    ASTNode* node = *child;
+    if (node->type == AST_NODE_BINARY) {
+        ASTNode* left = node->binary.left;
+        ASTNode* right = node->binary.right;
+        Word value;
+        if (left->type == AST_NODE_LITERAL && right->type == AST_NODE_LITERAL &&
+            evaluate_binary(node->binary.op, left->literal, right->literal, &value)) {
+            replace_with_literal(node, value);
+        }
+    }
+    else if (node->type == AST_NODE_UNARY && node->unary.right->type == AST_NODE_LITERAL) {
+        Word operand = node->unary.right->literal;
+        if (node->unary.op == TOKEN_MINUS) {
+            replace_with_literal(node, (Word)(0 - (uint64_t)operand));
+        }
+        else if (node->unary.op == TOKEN_NOT) {
+            replace_with_literal(node, !operand);
+        }
+    }
+}
+
+static void fold_constants(ASTNode* node) {
+    walk_tree(&node, NULL, fold_constants_visitor, NULL);
+}
+
+typedef struct Substitution {
+    const char* name;
+    Word value;
+} Substitution;
+
+static WalkAction substitute_visitor(ASTNode** child, void* context) {
+    const Substitution* substitution = context;
+    ASTNode* node = *child;
+    if (node->type == AST_NODE_VARIABLE && strcmp(node->name, substitution->name) == 0) {
+        replace_with_literal(node, substitution->value);
+    }
+    return WALK_CHILDREN;
+}
+
+typedef struct CalleeScan {
+    NameList own_names;
+    bool is_leaf;
+    bool uses_only_own_names;
+} CalleeScan;
+
+static WalkAction collect_declarations_visitor(ASTNode** child, void* context) {
+    NameList* names = context;
+    if ((*child)->type == AST_NODE_VARIABLE_DECLARATION) {
+        name_list_add(names, (*child)->declaration.name);
+    }
+    return WALK_CHILDREN;
+}
+
+static WalkAction scan_callee_visitor(ASTNode** child, void* context) {
+    CalleeScan* scan = context;
+    ASTNode* node = *child;
+    switch (node->type) {
+        case AST_NODE_CALL:
+        case AST_NODE_INLINED_CALL: {
+            scan->is_leaf = false;
+        } break;
+        case AST_NODE_EXTRN_DECLARATION: {
+            scan->uses_only_own_names = false;
+        } break;
+        case AST_NODE_VARIABLE: {
+            scan->uses_only_own_names &= name_list_contains(&scan->own_names, node->name);
+        } break;
+        case AST_NODE_ASSIGNMENT: {
+            scan->uses_only_own_names &= name_list_contains(&scan->own_names, node->assignment.name);
+        } break;
+        default: break;
+    }
+    return WALK_CHILDREN;
+}
+
+typedef struct AssignmentSearch {
+    const char* name;
+    bool found;
+} AssignmentSearch;
+
+static WalkAction find_assignment_visitor(ASTNode** child, void* context) {
+    AssignmentSearch* search = context;
+    if ((*child)->type == AST_NODE_ASSIGNMENT && strcmp((*child)->assignment.name, search->name) == 0) {
+        search->found = true;
+    }
+    return search->found ? WALK_SKIP : WALK_CHILDREN;
+}
+
+static bool is_assigned(ASTNode* node, const char* name) {
+    AssignmentSearch search = { .name = name, .found = false };
+    walk_tree(&node, find_assignment_visitor, NULL, &search);
+    return search.found;
+}
+
+// Only leaf functions that touch nothing but their own parameters and autos are inlined,
+// so the body means the same thing wherever it is placed.
+static bool is_inlinable(ASTNode* function) {
+    CalleeScan scan = { .own_names = { 0 }, .is_leaf = true, .uses_only_own_names = true };
+    for (int i = 0; i < function->function.parameter_count; ++i) {
+        name_list_add(&scan.own_names, function->function.parameters[i]);
+    }
+    walk_tree(&function->function.body, collect_declarations_visitor, NULL, &scan.own_names);
+    walk_tree(&function->function.body, scan_callee_visitor, NULL, &scan);
+    free(scan.own_names.names);
+    return scan.is_leaf && scan.uses_only_own_names;
+}
+
+static int find_function(const FunctionTable* table, const char* name) {
+    return hash_table_find(&table->names, hash_string(name), name);
+}
+
+// `return expression;`, possibly wrapped in a block
+static ASTNode** single_return_expression(ASTNode* body) {
+    if (body->type == AST_NODE_BLOCK && body->block.count == 1) {
+        body = body->block.statements[0];
+    }
+    if (body->type == AST_NODE_RETURN_STATEMENT && body->expression != NULL) {
+        return &body->expression;
+    }
+    return NULL;
+}
+
+static ASTNode* inline_call(ASTNode* call, ASTNode* callee) {
+    int count = call->call.count;
+    ASTNode* body = clone_ast(callee->function.body);
+
+    // constant arguments of parameters that are never assigned are substituted into the body
+    bool* substituted = calloc(count > 0 ? count : 1, sizeof(bool));
+    int remaining = 0;
+    for (int i = 0; i < count; ++i) {
+        const char* parameter = callee->function.parameters[i];
+        ASTNode* argument = call->call.arguments[i];
+        if (argument->type == AST_NODE_LITERAL && !is_assigned(body, parameter)) {
+            Substitution substitution = { .name = parameter, .value = argument->literal };
+            walk_tree(&body, substitute_visitor, NULL, &substitution);
+            substituted[i] = true;
+        }
+        else {
+            ++remaining;
+        }
+    }
+    fold_constants(body);
+
+    ASTNode* result = NULL;
+    ASTNode** return_expression = single_return_expression(body);
+    if (remaining == 0 && return_expression != NULL) {
+        result = *return_expression;
+        *return_expression = NULL;
+        parser_free_ast(body);
+    }
+    else {
+        result = malloc(sizeof(ASTNode));
+        result->type = AST_NODE_INLINED_CALL;
+        result->location = call->location;
+        result->inlined_call.name = strdup(callee->function.name);
+        result->inlined_call.parameters = remaining > 0 ? malloc(sizeof(char*) * remaining) : NULL;
+        result->inlined_call.arguments = remaining > 0 ? malloc(sizeof(ASTNode*) * remaining) : NULL;
+        result->inlined_call.count = 0;
+        result->inlined_call.body = body;
+        for (int i = 0; i < count; ++i) {
+            if (substituted[i]) continue;
+            int index = result->inlined_call.count++;
+            result->inlined_call.parameters[index] = strdup(callee->function.parameters[i]);
+            result->inlined_call.arguments[index] = call->call.arguments[i];
+            call->call.arguments[i] = NULL;
+        }
+    }
+
+    for (int i = 0; i < count; ++i) {
+        if (call->call.arguments[i] != NULL) {
+            parser_free_ast(call->call.arguments[i]);
+        }
+    }
+    call->call.count = 0;
+    parser_free_ast(call);
+    free(substituted);
+    return result;
+}
+
+// Whether the child of the parent at the index is on a cold or a hot path of the profile. The
+// condition of an if or while statement shares the heat of the statement.
+static void child_heat(ASTNode* parent, int index, bool* is_cold, bool* is_hot) {
+    *is_cold = false;
+    *is_hot = false;
+    if (parent == NULL || !profile_is_loaded()) return;
+
+    int site;
+    if (parent->type == AST_NODE_IF_STATEMENT) site = parent->if_statement.site;
+    else if (parent->type == AST_NODE_WHILE_STATEMENT) site = parent->while_statement.site;
+    else return;
+    // the then branch and the loop body are branch 0 of the site, the else branch is branch 1
+    *is_cold = profile_is_unreached(site) || (index > 0 && profile_is_cold(site, index - 1));
+    *is_hot = profile_is_hot(site);
+}
+
+static void inline_call_if_cheap(ASTNode** child, void* context) {
+    FunctionTable* table = context;
+    ASTNode* node = *child;
+    if (node->type != AST_NODE_CALL || table->cold_depth > 0) return;
+
+    int index = find_function(table, node->call.name);
+    if (index < 0 || !table->inlinable[index]) return;
+    ASTNode* callee = table->functions[index];
+    if (callee->function.parameter_count != node->call.count) return;
+
+    int constant_arguments = 0;
+    for (int i = 0; i < node->call.count; ++i) {
+        constant_arguments += node->call.arguments[i]->type == AST_NODE_LITERAL;
+    }
+    int cost = count_nodes(callee->function.body) - constant_arguments * INLINE_CONSTANT_ARGUMENT_BONUS;
+    int max_cost = table->hot_depth > 0 ? INLINE_MAX_COST * PROFILE_HOT_FACTOR : INLINE_MAX_COST;
+    if (table->optimize_size) {
+        max_cost = INLINE_MAX_COST_SIZE;
+    }
+    if (cost > max_cost) return;
+
+    *child = inline_call(node, callee);
+}
+
+static void inline_calls(ASTNode** root, FunctionTable* table) {
+    // arguments first, so calls nested in them are inlined too
+    if (!profile_is_loaded()) {
+        walk_tree(root, NULL, inline_call_if_cheap, table);
+        return;
+    }
+    // the heat of a node comes from the statement holding it
+    Walk walk = walk_begin(root);
+    bool is_leaving;
+    ASTNode** child;
+    while ((child = walk_next(&walk, &is_leaving)) != NULL) {
+        int index = 0;
+        bool is_cold, is_hot;
+        child_heat(walk_parent(&walk, &index), index, &is_cold, &is_hot);
+        if (!is_leaving) {
+            table->cold_depth += is_cold;
+            table->hot_depth += is_hot;
+            continue;
+        }
+        inline_call_if_cheap(child, table);
+        table->cold_depth -= is_cold;
+        table->hot_depth -= is_hot;
+    }
+}
+
+static ASTNode* make_literal(Word value) {
+    ASTNode* node = calloc(1, sizeof(ASTNode));
+    node->type = AST_NODE_LITERAL;
+    node->literal = value;
+    return node;
+}
+
+static ASTNode* make_variable(const char* name) {
+    ASTNode* node = calloc(1, sizeof(ASTNode));
+    node->type = AST_NODE_VARIABLE;
+    node->name = strdup(name);
+    return node;
+}
+
+static ASTNode* make_binary(ASTNode* left, TokenType op, ASTNode* right) {
+    ASTNode* node = calloc(1, sizeof(ASTNode));
+    node->type = AST_NODE_BINARY;
+    node->binary.left = left;
+    node->binary.op = op;
+    node->binary.right = right;
+    return node;
+}
+
+static ASTNode* make_assignment_statement(const char* name, ASTNode* value) {
+    ASTNode* assignment = calloc(1, sizeof(ASTNode));
+    assignment->type = AST_NODE_ASSIGNMENT;
+    assignment->assignment.name = strdup(name);
+    assignment->assignment.value = value;
+
+    ASTNode* node = calloc(1, sizeof(ASTNode));
+    node->type = AST_NODE_EXPRESSION_STATEMENT;
+    node->expression = assignment;
+    return node;
+}
+
+static ASTNode* make_declaration(const char* name) {
+    ASTNode* node = calloc(1, sizeof(ASTNode));
+    node->type = AST_NODE_VARIABLE_DECLARATION;
+    node->declaration.name = strdup(name);
+    node->declaration.is_vector = false;
+    node->declaration.bound = 0;
+    return node;
+}
+
+static ASTNode* make_block() {
+    ASTNode* node = calloc(1, sizeof(ASTNode));
+    node->type = AST_NODE_BLOCK;
+    return node;
+}
+
+static void block_insert(ASTNode* block, int index, ASTNode* statement) {
+    if (block->block.capacity < block->block.count + 1) {
+        int old_capacity = block->block.capacity;
+        block->block.capacity = GROW_CAPACITY(old_capacity);
+        block->block.statements = GROW_ARRAY(ASTNode*, block->block.statements, old_capacity, block->block.capacity);
+    }
+    memmove(
+        &block->block.statements[index + 1],
+        &block->block.statements[index],
+        sizeof(ASTNode*) * (block->block.count - index)
+    );
+    block->block.statements[index] = statement;
+    ++block->block.count;
+}
+
+static void block_append(ASTNode* block, ASTNode* statement) {
+    block_insert(block, block->block.count, statement);
+}
+
+typedef struct NodePairs {
+    const ASTNode** nodes;
+    int count;
+    int capacity;
+} NodePairs;
+
+static void push_node_pair(NodePairs* pairs, const ASTNode* a, const ASTNode* b) {
+    if (pairs->capacity < pairs->count + 2) {
+        int old_capacity = pairs->capacity;
+        pairs->capacity = GROW_CAPACITY(old_capacity);
+        pairs->nodes = GROW_ARRAY(const ASTNode*, pairs->nodes, old_capacity, pairs->capacity);
+    }
+    pairs->nodes[pairs->count++] = a;
+    pairs->nodes[pairs->count++] = b;
+}
+
+// Structural equality of expressions, used to hoist repeated invariant expressions only once.
+// The operands left to compare are kept in pairs on a stack.
+static bool expressions_equal(const ASTNode* a, const ASTNode* b) {
+    NodePairs pairs = { 0 };
+    push_node_pair(&pairs, a, b);
+    bool is_equal = true;
+    while (is_equal && pairs.count > 0) {
+        b = pairs.nodes[--pairs.count];
+        a = pairs.nodes[--pairs.count];
+        if (a->type != b->type) {
+            is_equal = false;
+            break;
+        }
+        switch (a->type) {
+            case AST_NODE_LITERAL: is_equal = a->literal == b->literal; break;
+            case AST_NODE_VARIABLE: is_equal = strcmp(a->name, b->name) == 0; break;
+            case AST_NODE_BINARY: {
+                is_equal = a->binary.op == b->binary.op;
+                push_node_pair(&pairs, a->binary.right, b->binary.right);
+                push_node_pair(&pairs, a->binary.left, b->binary.left);
+            } break;
+            case AST_NODE_UNARY: {
+                is_equal = a->unary.op == b->unary.op;
+                push_node_pair(&pairs, a->unary.right, b->unary.right);
+            } break;
+            default: is_equal = false; break;
+        }
+    }
+    free(pairs.nodes);
+    return is_equal;
+}
+
+typedef struct LoopContext {
+    // parameters and autos of the function, the only names calls can't change behind our back
+    NameList locals;
+    // names assigned anywhere in the loop being optimized
+    NameList assigned;
+    // names its body declares, they are not in scope in the preheader
+    NameList declared;
+    int temporary_count;
+} LoopContext;
+
+// Walks that only look at statements leave out expressions, statements in them are only found
+// in the bodies of inlined calls, and those belong to the callee.
+static WalkAction skip_expressions(const ASTNode* node) {
+    switch (node->type) {
+        case AST_NODE_BLOCK:
+        case AST_NODE_IF_STATEMENT:
+        case AST_NODE_WHILE_STATEMENT:
+        case AST_NODE_SWITCH_STATEMENT:
+        case AST_NODE_CASE:
+            return WALK_CHILDREN;
+        default:
+            return WALK_SKIP;
+    }
+}
+
+static WalkAction skip_expressions_visitor(ASTNode** child, void* context) {
+    (void)context;
+    return skip_expressions(*child);
+}
+
+static WalkAction collect_locals_visitor(ASTNode** child, void* context) {
+    NameList* locals = context;
+    ASTNode* node = *child;
+    if (node->type == AST_NODE_VARIABLE_DECLARATION) {
+        name_list_add(locals, node->declaration.name);
+    }
+    return skip_expressions(node);
+}
+
+static WalkAction collect_assigned_visitor(ASTNode** child, void* context) {
+    NameList* assigned = context;
+    if ((*child)->type == AST_NODE_ASSIGNMENT && !name_list_contains(assigned, (*child)->assignment.name)) {
+        name_list_add(assigned, (*child)->assignment.name);
+    }
+    return WALK_CHILDREN;
+}
+
+typedef struct NodeSearch {
+    ASTNodeType type;
+    const char* name;
+    int count;
+} NodeSearch;
+
+static WalkAction count_nodes_of_type_visitor(ASTNode** child, void* context) {
+    NodeSearch* search = context;
+    ASTNode* node = *child;
+    if (node->type == search->type &&
+        (search->name == NULL || strcmp(node->assignment.name, search->name) == 0)) {
+        ++search->count;
+    }
+    return WALK_CHILDREN;
+}
+
+static bool contains_node_of_type(ASTNode* node, ASTNodeType type) {
+    NodeSearch search = { .type = type, .name = NULL, .count = 0 };
+    walk_tree(&node, count_nodes_of_type_visitor, NULL, &search);
+    return search.count > 0;
+}
+
+static int count_assignments(ASTNode* node, const char* name) {
+    NodeSearch search = { .type = AST_NODE_ASSIGNMENT, .name = name, .count = 0 };
+    walk_tree(&node, count_nodes_of_type_visitor, NULL, &search);
+    return search.count;
+}
+
+static char* make_temporary_name(LoopContext* context, const char* prefix) {
+    // a dot can't appear in a B identifier, so temporaries never clash with user names
+    char name[32];
+    snprintf(name, sizeof(name), "%s.%d", prefix, context->temporary_count++);
+    return strdup(name);
+}
+
+// `i = i + c`, `i = c + i` or `i = i - c` as a statement of its own, step is the wrapped increment
+static bool match_induction_step(ASTNode* statement, const char** name, Word* step) {
+    if (statement->type != AST_NODE_EXPRESSION_STATEMENT || statement->expression->type != AST_NODE_ASSIGNMENT) return false;
+
+    ASTNode* assignment = statement->expression;
+    ASTNode* value = assignment->assignment.value;
+    if (value->type != AST_NODE_BINARY) return false;
+
+    const char* target = assignment->assignment.name;
+    ASTNode* left = value->binary.left;
+    ASTNode* right = value->binary.right;
+    bool left_is_target = left->type == AST_NODE_VARIABLE && strcmp(left->name, target) == 0;
+    bool right_is_target = right->type == AST_NODE_VARIABLE && strcmp(right->name, target) == 0;
+
+    if (value->binary.op == TOKEN_PLUS && left_is_target && right->type == AST_NODE_LITERAL) {
+        *step = right->literal;
+    }
+    else if (value->binary.op == TOKEN_PLUS && right_is_target && left->type == AST_NODE_LITERAL) {
+        *step = left->literal;
+    }
+    else if (value->binary.op == TOKEN_MINUS && left_is_target && right->type == AST_NODE_LITERAL) {
+        *step = (Word)(0 - (uint64_t)right->literal);
+    }
+    else {
+        return false;
+    }
+    *name = target;
+    return true;
+}
+
+// Loops like `i = 0; while (i < 4) { ...; i = i + 1; }` run a number of times known at compile
+// time, they are replaced by that many copies of the body.
+static bool unroll_loop(ASTNode** loop_slot, ASTNode* block, int index, LoopContext* context) {
+    ASTNode* loop = *loop_slot;
+    ASTNode* condition = loop->while_statement.condition;
+    ASTNode* body = loop->while_statement.body;
+
+    if (condition->type != AST_NODE_BINARY || condition->binary.left->type != AST_NODE_VARIABLE ||
+        condition->binary.right->type != AST_NODE_LITERAL) return false;
+    const char* name = condition->binary.left->name;
+    if (!name_list_contains(&context->locals, name) || body->type != AST_NODE_BLOCK || block == NULL) return false;
+
+    int site = loop->while_statement.site;
+    if (profile_is_unreached(site)) return false;
+    int max_trips = profile_is_hot(site) ? LOOP_UNROLL_MAX_TRIPS * PROFILE_HOT_FACTOR : LOOP_UNROLL_MAX_TRIPS;
+    int max_nodes = profile_is_hot(site) ? LOOP_UNROLL_MAX_NODES * PROFILE_HOT_FACTOR : LOOP_UNROLL_MAX_NODES;
+
+    // the initial value comes from the closest earlier `i = constant;` in the same block
+    ASTNode* initializer = NULL;
+    for (int i = index - 1; i >= 0 && initializer == NULL; --i) {
+        ASTNode* statement = block->block.statements[i];
+        if (statement->type == AST_NODE_EXPRESSION_STATEMENT && statement->expression->type == AST_NODE_ASSIGNMENT &&
+            strcmp(statement->expression->assignment.name, name) == 0 &&
+            statement->expression->assignment.value->type == AST_NODE_LITERAL) {
+            initializer = statement;
+        }
+        else if (count_assignments(statement, name) > 0 || contains_node_of_type(statement, AST_NODE_CASE)) {
+            return false;
+        }
+    }
+    if (initializer == NULL) return false;
+    Word value = initializer->expression->assignment.value->literal;
+
+    // the copies must not break out, be jumped into or redeclare autos
+    if (contains_node_of_type(body, AST_NODE_BREAK_STATEMENT) ||
+        contains_node_of_type(body, AST_NODE_CASE) ||
+        contains_node_of_type(body, AST_NODE_VARIABLE_DECLARATION)) return false;
+
+    const char* step_name = NULL;
+    Word step = 0;
+    bool has_step = false;
+    for (int i = 0; i < body->block.count; ++i) {
+        if (match_induction_step(body->block.statements[i], &step_name, &step) && strcmp(step_name, name) == 0) {
+            has_step = true;
+            break;
+        }
+    }
+    if (!has_step || count_assignments(body, name) != 1) return false;
+
+    int trips = 0;
+    Word holds;
+    while (evaluate_binary(condition->binary.op, value, condition->binary.right->literal, &holds) && holds) {
+        if (++trips > max_trips) return false;
+        value = (Word)((uint64_t)value + (uint64_t)step);
+    }
+    // the comparison operator could not be evaluated
+    if (!evaluate_binary(condition->binary.op, value, condition->binary.right->literal, &holds)) return false;
+    if (trips * count_nodes(body) > max_nodes) return false;
+
+    ASTNode* unrolled = make_block();
+    for (int i = 0; i < trips; ++i) {
+        block_append(unrolled, clone_ast(body));
+    }
+    parser_free_ast(loop);
+    *loop_slot = unrolled;
+    return true;
+}
+
+// Loops are unrolled when the block holding them is left, after the loops inside them, so
+// fully unrolled ones make their parent unrollable. Only loops in blocks are unrolled.
+static void unroll_block_loops_visitor(ASTNode** child, void* context) {
+    ASTNode* block = *child;
+    if (block->type != AST_NODE_BLOCK) return;
+    for (int i = 0; i < block->block.count; ++i) {
+        if (block->block.statements[i]->type == AST_NODE_WHILE_STATEMENT) {
+            unroll_loop(&block->block.statements[i], block, i, context);
+        }
+    }
+}
+
+static void unroll_loops(ASTNode** root, LoopContext* context) {
+    walk_tree(root, skip_expressions_visitor, unroll_block_loops_visitor, context);
+}
+
+typedef struct InductionUse {
+    const char* name;
+    Word factor;
+    const char* temporary;
+    bool found;
+} InductionUse;
+
+static bool is_induction_use(ASTNode* node, const char* name, Word* factor) {
+    if (node->type != AST_NODE_BINARY || node->binary.op != TOKEN_ASTERISK) return false;
+    ASTNode* left = node->binary.left;
+    ASTNode* right = node->binary.right;
+    if (left->type == AST_NODE_VARIABLE && strcmp(left->name, name) == 0 && right->type == AST_NODE_LITERAL) {
+        *factor = right->literal;
+        return true;
+    }
+    if (right->type == AST_NODE_VARIABLE && strcmp(right->name, name) == 0 && left->type == AST_NODE_LITERAL) {
+        *factor = left->literal;
+        return true;
+    }
+    return false;
+}
+
+// Finds the first `i * k` (temporary == NULL) or replaces every `i * k` with the temporary.
+static WalkAction induction_use_visitor(ASTNode** child, void* context) {
+    InductionUse* use = context;
+    ASTNode* node = *child;
+    Word factor;
+
+    if (is_induction_use(node, use->name, &factor)) {
+        if (use->temporary == NULL && !use->found) {
+            use->factor = factor;
+            use->found = true;
+        }
+        else if (use->temporary != NULL && factor == use->factor) {
+            parser_free_ast(node);
+            *child = make_variable(use->temporary);
+        }
+        return WALK_SKIP;
+    }
+    return node->type == AST_NODE_INLINED_CALL ? WALK_ARGUMENTS : WALK_CHILDREN;
+}
+
+// For an induction variable stepped once per iteration by `i = i + c`, every `i * k` in the
+// loop is replaced by a temporary set to i * k in the preheader and increased by c * k right
+// after the step.
+static void reduce_induction_variables(ASTNode* loop, ASTNode* preheader, LoopContext* context) {
+    ASTNode* body = loop->while_statement.body;
+    if (body->type != AST_NODE_BLOCK || contains_node_of_type(body, AST_NODE_CASE)) return;
+
+    for (int i = 0; i < body->block.count; ++i) {
+        const char* name = NULL;
+        Word step = 0;
+        if (!match_induction_step(body->block.statements[i], &name, &step)) continue;
+        if (!name_list_contains(&context->locals, name) || name_list_contains(&context->declared, name)) continue;
+        if (count_assignments(loop, name) != 1) continue;
+
+        for (;;) {
+            InductionUse use = { .name = name, .factor = 0, .temporary = NULL, .found = false };
+            walk_tree(&loop->while_statement.condition, induction_use_visitor, NULL, &use);
+            if (!use.found) walk_tree(&loop->while_statement.body, induction_use_visitor, NULL, &use);
+            if (!use.found) break;
+
+            char* temporary = make_temporary_name(context, "iv");
+            block_append(preheader, make_declaration(temporary));
+            block_append(preheader, make_assignment_statement(
+                temporary, make_binary(make_variable(name), TOKEN_ASTERISK, make_literal(use.factor))
+            ));
+
+            use.temporary = temporary;
+            walk_tree(&loop->while_statement.condition, induction_use_visitor, NULL, &use);
+            walk_tree(&loop->while_statement.body, induction_use_visitor, NULL, &use);
+
+            Word increment = (Word)((uint64_t)step * (uint64_t)use.factor);
+            block_insert(body, i + 1, make_assignment_statement(
+                temporary, make_binary(make_variable(temporary), TOKEN_PLUS, make_literal(increment))
+            ));
+            free(temporary);
+        }
+    }
+}
+
+typedef struct InvarianceCheck {
+    LoopContext* loop;
+    bool is_invariant;
+} InvarianceCheck;
+
+static WalkAction invariance_visitor(ASTNode** child, void* context) {
+    InvarianceCheck* check = context;
+    LoopContext* loop = check->loop;
+    ASTNode* node = *child;
+    switch (node->type) {
+        case AST_NODE_LITERAL:
+        case AST_NODE_STRING:
+            break;
+        case AST_NODE_VARIABLE: {
+            check->is_invariant &= name_list_contains(&loop->locals, node->name) &&
+                !name_list_contains(&loop->assigned, node->name) && !name_list_contains(&loop->declared, node->name);
+        } break;
+        case AST_NODE_BINARY: {
+            check->is_invariant &= node->binary.op != TOKEN_SLASH && node->binary.op != TOKEN_PERCENT;
+        } break;
+        case AST_NODE_UNARY:
+            break;
+        default: {
+            check->is_invariant = false;
+        } break;
+    }
+    return check->is_invariant ? WALK_CHILDREN : WALK_SKIP;
+}
+
+// Pure expressions over constants and locals that the loop never assigns. Division is left
+// in place, it could trap in a loop that never runs.
+static bool is_loop_invariant(ASTNode* node, LoopContext* context) {
+    InvarianceCheck check = { .loop = context, .is_invariant = true };
+    walk_tree(&node, invariance_visitor, NULL, &check);
+    return check.is_invariant;
+}
+
+typedef struct Hoisting {
+    LoopContext* loop;
+    ASTNode* preheader;
+    // hoisted expressions and the temporaries holding them
+    ASTNode** expressions;
+    char** temporaries;
+    int count;
+    int capacity;
+} Hoisting;
+
+static WalkAction hoist_visitor(ASTNode** child, void* context) {
+    Hoisting* hoisting = context;
+    ASTNode* node = *child;
+
+    if ((node->type == AST_NODE_BINARY || node->type == AST_NODE_UNARY) && is_loop_invariant(node, hoisting->loop)) {
+        for (int i = 0; i < hoisting->count; ++i) {
+            if (expressions_equal(hoisting->expressions[i], node)) {
+                parser_free_ast(node);
+                *child = make_variable(hoisting->temporaries[i]);
+                return WALK_SKIP;
+            }
+        }
+
+        char* temporary = make_temporary_name(hoisting->loop, "licm");
+        block_append(hoisting->preheader, make_declaration(temporary));
+        block_append(hoisting->preheader, make_assignment_statement(temporary, node));
+        if (hoisting->capacity < hoisting->count + 1) {
+            int old_capacity = hoisting->capacity;
+            hoisting->capacity = GROW_CAPACITY(old_capacity);
+            hoisting->expressions = GROW_ARRAY(ASTNode*, hoisting->expressions, old_capacity, hoisting->capacity);
+            hoisting->temporaries = GROW_ARRAY(char*, hoisting->temporaries, old_capacity, hoisting->capacity);
+        }
+        hoisting->expressions[hoisting->count] = node;
+        hoisting->temporaries[hoisting->count++] = temporary;
+        *child = make_variable(temporary);
+        return WALK_SKIP;
+    }
+    return node->type == AST_NODE_INLINED_CALL ? WALK_ARGUMENTS : WALK_CHILDREN;
+}
+
+static void hoist_invariants(ASTNode* loop, ASTNode* preheader, LoopContext* context) {
+    context->assigned.count = 0;
+    walk_tree(&loop, collect_assigned_visitor, NULL, &context->assigned);
+
+    Hoisting hoisting = { .loop = context, .preheader = preheader, 0 };
+    walk_tree(&loop->while_statement.condition, hoist_visitor, NULL, &hoisting);
+    walk_tree(&loop->while_statement.body, hoist_visitor, NULL, &hoisting);
+    for (int i = 0; i < hoisting.count; ++i) {
+        free(hoisting.temporaries[i]);
+    }
+    free(hoisting.expressions);
+    free(hoisting.temporaries);
+}
+
+// inner loops are left first, their preheaders become part of the outer loop
+static void optimize_loops_visitor(ASTNode** child, void* context) {
+    ASTNode* node = *child;
+    if (node->type != AST_NODE_WHILE_STATEMENT) return;
+    // a case label jumping into the loop would skip the preheader
+    if (contains_node_of_type(node->while_statement.body, AST_NODE_CASE)) return;
+
+    LoopContext* loop_context = context;
+    loop_context->declared.count = 0;
+    walk_tree(&node->while_statement.body, collect_declarations_visitor, NULL, &loop_context->declared);
+    ASTNode* preheader = make_block();
+    reduce_induction_variables(node, preheader, context);
+    hoist_invariants(node, preheader, context);
+    if (preheader->block.count == 0) {
+        parser_free_ast(preheader);
+        return;
+    }
+    block_append(preheader, node);
+    *child = preheader;
+}
+
+static int name_list_index(const NameList* list, const char* name) {
+    for (int i = 0; i < list->count; ++i) {
+        if (strcmp(list->names[i], name) == 0) return i;
+    }
+    return -1;
+}
+
+static WalkAction case_label_visitor(ASTNode** child, void* context) {
+    bool* is_found = context;
+    ASTNode* node = *child;
+    if (node->type == AST_NODE_CASE) *is_found = true;
+    if (*is_found) return WALK_SKIP;
+    bool is_statement_list = node->type == AST_NODE_BLOCK || node->type == AST_NODE_IF_STATEMENT ||
+        node->type == AST_NODE_WHILE_STATEMENT;
+    return is_statement_list ? WALK_CHILDREN : WALK_SKIP;
+}
+
+// Case labels of the switch being visited, labels of nested switches don't count. They make a
+// statement reachable from the dispatch as well as from the code before it.
+static bool contains_case_label(ASTNode* node) {
+    bool is_found = false;
+    walk_tree(&node, case_label_visitor, NULL, &is_found);
+    return is_found;
+}
+
+// A statement can be dropped when nothing jumps into it and it declares no autos used elsewhere.
+static bool is_discardable(ASTNode* node) {
+    return !contains_node_of_type(node, AST_NODE_CASE) && !contains_node_of_type(node, AST_NODE_VARIABLE_DECLARATION);
+}
+
+static WalkAction side_effects_visitor(ASTNode** child, void* context) {
+    bool* has_effects = context;
+    ASTNode* node = *child;
+    switch (node->type) {
+        case AST_NODE_LITERAL:
+        case AST_NODE_STRING:
+        case AST_NODE_VARIABLE:
+        case AST_NODE_UNARY:
+            break;
+        case AST_NODE_BINARY: {
+            TokenType op = node->binary.op;
+            if (op == TOKEN_SLASH || op == TOKEN_PERCENT) {
+                ASTNode* divisor = node->binary.right;
+                if (divisor->type != AST_NODE_LITERAL || divisor->literal == 0 || divisor->literal == -1) {
+                    *has_effects = true;
+                }
+            }
+        } break;
+        default: {
+            *has_effects = true;
+        } break;
+    }
+    return *has_effects ? WALK_SKIP : WALK_CHILDREN;
+}
+
+// Calls, stores and possibly trapping divisions must stay even when their value is unused.
+static bool has_side_effects(ASTNode* node) {
+    bool has_effects = false;
+    walk_tree(&node, side_effects_visitor, NULL, &has_effects);
+    return has_effects;
+}
+
+// Constant propagation state, one slot per local of the function being optimized. Copies of
+// the struct share the slots.
+typedef struct ConstantState {
+    bool* known;
+    Word* values;
+} ConstantState;
+
+// Where propagation goes on with a statement once the statements it holds are done.
+typedef enum {
+    PROPAGATE_STATEMENT,
+    PROPAGATE_IF_END,
+    PROPAGATE_WHILE_END,
+    PROPAGATE_SWITCH_END,
+} PropagationStep;
+
+typedef struct PropagationTask {
+    ASTNode** slot;
+    PropagationStep step;
+    // the state the statement changes and the copy its else branch or body started from
+    ConstantState state;
+    ConstantState branch_state;
+    // the dispatch state of the enclosing switch, restored when a switch ends
+    ConstantState saved_entry;
+} PropagationTask;
+
+// An expression left to propagate into, or an assignment whose value is done.
+typedef struct ExpressionTask {
+    ASTNode* node;
+    bool is_store;
+} ExpressionTask;
+
+typedef struct Propagation {
+    const NameList* locals;
+    // state at the dispatch of the innermost switch, every case label resumes from it, known is
+    // NULL outside of switches
+    ConstantState switch_entry;
+    // propagation runs tasks from stacks instead of recursing, so deep trees only need memory
+    PropagationTask* tasks;
+    int tasks_count;
+    int tasks_capacity;
+    ExpressionTask* expressions;
+    int expressions_count;
+    int expressions_capacity;
+} Propagation;
+
+// the stacks of the last propagation, the next function starts with their room
+static _Thread_local Propagation kept_propagation = { 0 };
+
+static ConstantState state_copy(const ConstantState* state, int count) {
+    ConstantState copy = {
+        .known = malloc(sizeof(bool) * (count > 0 ? count : 1)),
+        .values = malloc(sizeof(Word) * (count > 0 ? count : 1)),
+    };
+    memcpy(copy.known, state->known, sizeof(bool) * count);
+    memcpy(copy.values, state->values, sizeof(Word) * count);
+    return copy;
+}
+
+static void state_assign(ConstantState* state, const ConstantState* other, int count) {
+    memcpy(state->known, other->known, sizeof(bool) * count);
+    memcpy(state->values, other->values, sizeof(Word) * count);
+}
+
+static void state_free(ConstantState* state) {
+    free(state->known);
+    free(state->values);
+}
+
+// Where two paths meet only the values both agree on stay known.
+static void state_merge(ConstantState* state, const ConstantState* other, int count) {
+    for (int i = 0; i < count; ++i) {
+        if (!other->known[i] || state->values[i] != other->values[i]) {
+            state->known[i] = false;
+        }
+    }
+}
+
+static void state_forget_assigned(ConstantState* state, const NameList* locals, ASTNode* node) {
+    NameList assigned = { 0 };
+    walk_tree(&node, collect_assigned_visitor, NULL, &assigned);
+    for (int i = 0; i < assigned.count; ++i) {
+        int index = name_list_index(locals, assigned.names[i]);
+        if (index >= 0) state->known[index] = false;
+    }
+    free(assigned.names);
+}
+
+static void push_expression_task(Propagation* propagation, ASTNode* node, bool is_store) {
+    if (propagation->expressions_capacity < propagation->expressions_count + 1) {
+        int old_capacity = propagation->expressions_capacity;
+        propagation->expressions_capacity = GROW_CAPACITY(old_capacity);
+        propagation->expressions = GROW_ARRAY(ExpressionTask, propagation->expressions, old_capacity, propagation->expressions_capacity);
+    }
+    propagation->expressions[propagation->expressions_count++] = (ExpressionTask) { .node = node, .is_store = is_store };
+}
+
+// Follows the evaluation order of the generated code: operands left to right, call arguments
+// right to left, the value of an assignment before the store.
+static void propagate_expression(ASTNode* root, Propagation* propagation, ConstantState* state) {
+    push_expression_task(propagation, root, false);
+    while (propagation->expressions_count > 0) {
+        ExpressionTask task = propagation->expressions[--propagation->expressions_count];
+        ASTNode* node = task.node;
+        if (task.is_store) {
+            ASTNode* value = node->assignment.value;
+            fold_constants(value);
+            int index = name_list_index(propagation->locals, node->assignment.name);
+            if (index >= 0) {
+                state->known[index] = value->type == AST_NODE_LITERAL;
+                state->values[index] = value->type == AST_NODE_LITERAL ? value->literal : 0;
+            }
+            continue;
+        }
+
+        // the operand evaluated first is pushed last
+        switch (node->type) {
+            case AST_NODE_VARIABLE: {
+                int index = name_list_index(propagation->locals, node->name);
+                if (index >= 0 && state->known[index]) {
+                    replace_with_literal(node, state->values[index]);
+                }
+            } break;
+            case AST_NODE_ASSIGNMENT: {
+                push_expression_task(propagation, node, true);
+                push_expression_task(propagation, node->assignment.value, false);
+            } break;
+            case AST_NODE_BINARY: {
+                push_expression_task(propagation, node->binary.right, false);
+                push_expression_task(propagation, node->binary.left, false);
+            } break;
+            case AST_NODE_UNARY: {
+                push_expression_task(propagation, node->unary.right, false);
+            } break;
+            case AST_NODE_SUBSCRIPT:
+            case AST_NODE_SUBSCRIPT_ASSIGNMENT: {
+                if (node->subscript.value != NULL) {
+                    push_expression_task(propagation, node->subscript.value, false);
+                }
+                push_expression_task(propagation, node->subscript.index, false);
+                push_expression_task(propagation, node->subscript.vector, false);
+            } break;
+            case AST_NODE_CALL: {
+                for (int i = 0; i < node->call.count; ++i) {
+                    push_expression_task(propagation, node->call.arguments[i], false);
+                }
+            } break;
+            case AST_NODE_INLINED_CALL: {
+                // the body only sees its own names
+                for (int i = 0; i < node->inlined_call.count; ++i) {
+                    push_expression_task(propagation, node->inlined_call.arguments[i], false);
+                }
+            } break;
+            default: break;
+        }
+    }
+}
+
+// The task of the statement runs after every task pushed after it, the statements it holds
+// are pushed last.
+static PropagationTask* push_propagation_task(Propagation* propagation, ASTNode** slot, PropagationStep step, ConstantState state) {
+    if (propagation->tasks_capacity < propagation->tasks_count + 1) {
+        int old_capacity = propagation->tasks_capacity;
+        propagation->tasks_capacity = GROW_CAPACITY(old_capacity);
+        propagation->tasks = GROW_ARRAY(PropagationTask, propagation->tasks, old_capacity, propagation->tasks_capacity);
+    }
+    // the other states belong to the steps that fill them in, they are not cleared
+    PropagationTask* task = &propagation->tasks[propagation->tasks_count++];
+    task->slot = slot;
+    task->step = step;
+    task->state = state;
+    return task;
+}
+
+static void begin_statement_propagation(ASTNode** slot, Propagation* propagation, ConstantState state) {
+    ASTNode* node = *slot;
+    int count = propagation->locals->count;
+
+    switch (node->type) {
+        case AST_NODE_BLOCK: {
+            for (int i = node->block.count - 1; i >= 0; --i) {
+                push_propagation_task(propagation, &node->block.statements[i], PROPAGATE_STATEMENT, state);
+            }
+        } break;
+        case AST_NODE_EXPRESSION_STATEMENT: {
+            propagate_expression(node->expression, propagation, &state);
+            fold_constants(node->expression);
+        } break;
+        case AST_NODE_RETURN_STATEMENT: {
+            if (node->expression != NULL) {
+                propagate_expression(node->expression, propagation, &state);
+                fold_constants(node->expression);
+            }
+        } break;
+        case AST_NODE_VARIABLE_DECLARATION: {
+            int index = name_list_index(propagation->locals, node->declaration.name);
+            if (index >= 0) state.known[index] = false;
+        } break;
+        case AST_NODE_IF_STATEMENT: {
+            ASTNode* condition = node->if_statement.condition;
+            propagate_expression(condition, propagation, &state);
+            fold_constants(condition);
+
+            if (condition->type == AST_NODE_LITERAL) {
+                ASTNode** kept = condition->literal ? &node->if_statement.then_branch : &node->if_statement.else_branch;
+                ASTNode** dropped = condition->literal ? &node->if_statement.else_branch : &node->if_statement.then_branch;
+                if (*dropped == NULL || is_discardable(*dropped)) {
+                    ASTNode* branch = *kept != NULL ? *kept : make_block();
+                    // detach the kept branch, the statement itself still needs a then branch to free
+                    if (kept == &node->if_statement.then_branch) {
+                        node->if_statement.then_branch = make_block();
+                    }
+                    else {
+                        node->if_statement.else_branch = NULL;
+                    }
+                    parser_free_ast(node);
+                    *slot = branch;
+                    push_propagation_task(propagation, slot, PROPAGATE_STATEMENT, state);
+                    break;
+                }
+            }
+
+            ConstantState else_state = state_copy(&state, count);
+            push_propagation_task(propagation, slot, PROPAGATE_IF_END, state)->branch_state = else_state;
+            if (node->if_statement.else_branch != NULL) {
+                push_propagation_task(propagation, &node->if_statement.else_branch, PROPAGATE_STATEMENT, else_state);
+            }
+            push_propagation_task(propagation, &node->if_statement.then_branch, PROPAGATE_STATEMENT, state);
+        } break;
+        case AST_NODE_WHILE_STATEMENT: {
+            // the condition is reached from before the loop, from the end of the body and from
+            // case labels inside it, only names the loop never assigns keep their values
+            state_forget_assigned(&state, propagation->locals, node);
+            if (propagation->switch_entry.known != NULL && contains_case_label(node->while_statement.body)) {
+                state_merge(&state, &propagation->switch_entry, count);
+            }
+            ASTNode* condition = node->while_statement.condition;
+            propagate_expression(condition, propagation, &state);
+            fold_constants(condition);
+
+            if (condition->type == AST_NODE_LITERAL && condition->literal == 0 && is_discardable(node)) {
+                parser_free_ast(node);
+                *slot = make_block();
+                break;
+            }
+
+            ConstantState body_state = state_copy(&state, count);
+            push_propagation_task(propagation, slot, PROPAGATE_WHILE_END, state)->branch_state = body_state;
+            push_propagation_task(propagation, &node->while_statement.body, PROPAGATE_STATEMENT, body_state);
+        } break;
+        case AST_NODE_SWITCH_STATEMENT: {
+            propagate_expression(node->switch_statement.condition, propagation, &state);
+            fold_constants(node->switch_statement.condition);
+
+            state_forget_assigned(&state, propagation->locals, node->switch_statement.body);
+            ConstantState body_state = state_copy(&state, count);
+            PropagationTask* end = push_propagation_task(propagation, slot, PROPAGATE_SWITCH_END, state);
+            end->branch_state = body_state;
+            end->saved_entry = propagation->switch_entry;
+            propagation->switch_entry = state;
+            push_propagation_task(propagation, &node->switch_statement.body, PROPAGATE_STATEMENT, body_state);
+        } break;
+        case AST_NODE_CASE: {
+            state_assign(&state, &propagation->switch_entry, count);
+            push_propagation_task(propagation, &node->case_label.statement, PROPAGATE_STATEMENT, state);
+        } break;
+        default: break;
+    }
+}
+
+static void propagate_constants(ASTNode* function, const NameList* locals) {
+    int count = locals->count;
+    // parameters and uninitialized autos are unknown on entry
+    ConstantState state = {
+        .known = calloc(count > 0 ? count : 1, sizeof(bool)),
+        .values = calloc(count > 0 ? count : 1, sizeof(Word)),
+    };
+    Propagation propagation = kept_propagation;
+    propagation.locals = locals;
+    push_propagation_task(&propagation, &function->function.body, PROPAGATE_STATEMENT, state);
+    while (propagation.tasks_count > 0) {
+        PropagationTask task = propagation.tasks[--propagation.tasks_count];
+        switch (task.step) {
+            case PROPAGATE_STATEMENT: {
+                begin_statement_propagation(task.slot, &propagation, task.state);
+            } break;
+            case PROPAGATE_IF_END: {
+                state_merge(&task.state, &task.branch_state, count);
+                state_free(&task.branch_state);
+            } break;
+            case PROPAGATE_WHILE_END: {
+                state_free(&task.branch_state);
+                // break statements leave with whatever the body assigned
+                state_forget_assigned(&task.state, locals, *task.slot);
+            } break;
+            case PROPAGATE_SWITCH_END: {
+                propagation.switch_entry = task.saved_entry;
+                state_free(&task.branch_state);
+            } break;
+        }
+    }
+    kept_propagation = propagation;
+    state_free(&state);
+}
+
+// Where the liveness analysis goes on with a statement once the statements it holds are done.
+typedef enum {
+    LIVENESS_STATEMENT,
+    LIVENESS_IF_END,
+    LIVENESS_WHILE_ITERATION,
+    LIVENESS_SWITCH_END,
+    LIVENESS_CASE_END,
+} LivenessStep;
+
+typedef struct LivenessTask {
+    ASTNode** slot;
+    LivenessStep step;
+    // names live after the statement, and before it once its tasks are done
+    bool* live;
+    bool apply;
+    // live sets of the else branch, of the exit, head and body of a loop and of the cases of a switch
+    bool* else_live;
+    bool* exit_live;
+    bool* head_live;
+    bool* body_live;
+    bool* case_live;
+    // the sets of the enclosing loop or switch, restored when a loop or switch ends
+    bool* saved_break_live;
+    bool* saved_case_live;
+    // a loop body runs once more to remove its stores after its live sets stopped growing
+    bool is_applying;
+} LivenessTask;
+
+typedef struct Liveness {
+    const NameList* locals;
+    // live names where a break of the innermost loop or switch continues
+    bool* break_live;
+    // live names at the case labels of the innermost switch, all reachable from its dispatch
+    bool* case_live;
+    // the analysis runs tasks from a stack instead of recursing, so deep trees only need memory
+    LivenessTask* tasks;
+    int tasks_count;
+    int tasks_capacity;
+} Liveness;
+
+// the stack of the last analysis, the next function starts with its room
+static _Thread_local Liveness kept_liveness = { 0 };
+
+typedef struct Uses {
+    bool* live;
+    const NameList* locals;
+} Uses;
+
+static WalkAction add_uses_visitor(ASTNode** child, void* context) {
+    Uses* uses = context;
+    ASTNode* node = *child;
+    switch (node->type) {
+        case AST_NODE_VARIABLE: {
+            int index = name_list_index(uses->locals, node->name);
+            if (index >= 0) uses->live[index] = true;
+        } break;
+        case AST_NODE_CALL: {
+            // an auto holding the address of a function
+            int index = name_list_index(uses->locals, node->call.name);
+            if (index >= 0) uses->live[index] = true;
+        } break;
+        case AST_NODE_INLINED_CALL:
+            return WALK_ARGUMENTS;
+        default: break;
+    }
+    return WALK_CHILDREN;
+}
+
+static void add_uses(ASTNode* node, bool* live, const NameList* locals) {
+    Uses uses = { .live = live, .locals = locals };
+    walk_tree(&node, add_uses_visitor, NULL, &uses);
+}
+
+static bool* live_copy(const bool* live, int count) {
+    bool* copy = malloc(sizeof(bool) * (count > 0 ? count : 1));
+    memcpy(copy, live, sizeof(bool) * count);
+    return copy;
+}
+
+// The task of the statement runs after every task pushed after it, the statements it holds
+// are pushed last.
+static LivenessTask* push_liveness_task(Liveness* liveness, ASTNode** slot, LivenessStep step, bool* live, bool apply) {
+    if (liveness->tasks_capacity < liveness->tasks_count + 1) {
+        int old_capacity = liveness->tasks_capacity;
+        liveness->tasks_capacity = GROW_CAPACITY(old_capacity);
+        liveness->tasks = GROW_ARRAY(LivenessTask, liveness->tasks, old_capacity, liveness->tasks_capacity);
+    }
+    // the other sets belong to the steps that fill them in, they are not cleared
+    LivenessTask* task = &liveness->tasks[liveness->tasks_count++];
+    task->slot = slot;
+    task->step = step;
+    task->live = live;
+    task->apply = apply;
+    task->is_applying = false;
+    return task;
+}
+
+// Runs the body of the loop once more, on the names live at its head.
+static void push_loop_body(Liveness* liveness, const LivenessTask* loop, bool apply) {
+    int count = liveness->locals->count;
+    memcpy(loop->body_live, loop->head_live, sizeof(bool) * count);
+    ASTNode* node = *loop->slot;
+    push_liveness_task(liveness, &node->while_statement.body, LIVENESS_STATEMENT, loop->body_live, apply);
+}
+
+// Backward liveness over the statement, live holds the names live after it on entry and the
+// names live before it once its tasks are done. Stores found dead are removed only when apply
+// is set, loops run the analysis until their live sets stop growing first.
+static void begin_dead_store_elimination(ASTNode** slot, bool* live, Liveness* liveness, bool apply) {
+    ASTNode* node = *slot;
+    const NameList* locals = liveness->locals;
+    int count = locals->count;
+
+    switch (node->type) {
+        case AST_NODE_BLOCK: {
+            for (int i = 0; i < node->block.count; ++i) {
+                push_liveness_task(liveness, &node->block.statements[i], LIVENESS_STATEMENT, live, apply);
+            }
+        } break;
+        case AST_NODE_EXPRESSION_STATEMENT: {
+            // `a = b = value` with a and b dead only needs the value
+            ASTNode* expression = node->expression;
+            while (expression->type == AST_NODE_ASSIGNMENT) {
+                int index = name_list_index(locals, expression->assignment.name);
+                if (index < 0 || live[index]) break;
+                expression = expression->assignment.value;
+            }
+            if (expression != node->expression) {
+                if (!has_side_effects(expression)) {
+                    if (apply) {
+                        parser_free_ast(node);
+                        *slot = make_block();
+                    }
+                    break;
+                }
+                if (apply) {
+                    ASTNode* store = node->expression;
+                    while (store != expression) {
+                        ASTNode* next = store->assignment.value;
+                        free(store->assignment.name);
+                        free(store);
+                        store = next;
+                    }
+                    node->expression = expression;
+                }
+            }
+            if (expression->type == AST_NODE_ASSIGNMENT) {
+                int index = name_list_index(locals, expression->assignment.name);
+                if (index >= 0) live[index] = false;
+            }
+            add_uses(expression, live, locals);
+        } break;
+        case AST_NODE_RETURN_STATEMENT: {
+            memset(live, 0, sizeof(bool) * count);
+            if (node->expression != NULL) {
+                add_uses(node->expression, live, locals);
+            }
+        } break;
+        case AST_NODE_BREAK_STATEMENT: {
+            memcpy(live, liveness->break_live, sizeof(bool) * count);
+        } break;
+        case AST_NODE_IF_STATEMENT: {
+            bool* else_live = live_copy(live, count);
+            push_liveness_task(liveness, slot, LIVENESS_IF_END, live, apply)->else_live = else_live;
+            if (node->if_statement.else_branch != NULL) {
+                push_liveness_task(liveness, &node->if_statement.else_branch, LIVENESS_STATEMENT, else_live, apply);
+            }
+            push_liveness_task(liveness, &node->if_statement.then_branch, LIVENESS_STATEMENT, live, apply);
+        } break;
+        case AST_NODE_WHILE_STATEMENT: {
+            LivenessTask* loop = push_liveness_task(liveness, slot, LIVENESS_WHILE_ITERATION, live, apply);
+            loop->exit_live = live_copy(live, count);
+            loop->head_live = live_copy(live, count);
+            loop->body_live = live_copy(live, count);
+            loop->saved_break_live = liveness->break_live;
+            add_uses(node->while_statement.condition, loop->head_live, locals);
+
+            liveness->break_live = loop->exit_live;
+            push_loop_body(liveness, loop, false);
+        } break;
+        case AST_NODE_SWITCH_STATEMENT: {
+            LivenessTask* end = push_liveness_task(liveness, slot, LIVENESS_SWITCH_END, live, apply);
+            end->exit_live = live_copy(live, count);
+            // without a matching case the dispatch goes straight past the switch
+            end->case_live = live_copy(live, count);
+            end->saved_break_live = liveness->break_live;
+            end->saved_case_live = liveness->case_live;
+
+            liveness->break_live = end->exit_live;
+            liveness->case_live = end->case_live;
+            push_liveness_task(liveness, &node->switch_statement.body, LIVENESS_STATEMENT, live, apply);
+        } break;
+        case AST_NODE_CASE: {
+            push_liveness_task(liveness, slot, LIVENESS_CASE_END, live, apply);
+            push_liveness_task(liveness, &node->case_label.statement, LIVENESS_STATEMENT, live, apply);
+        } break;
+        default: break;
+    }
+}
+
+static void end_loop_iteration(LivenessTask* loop, Liveness* liveness) {
+    int count = liveness->locals->count;
+    if (!loop->is_applying) {
+        bool changed = false;
+        for (int i = 0; i < count; ++i) {
+            if (loop->body_live[i] && !loop->head_live[i]) {
+                loop->head_live[i] = true;
+                changed = true;
+            }
+        }
+        if (changed || loop->apply) {
+            loop->is_applying = !changed;
+            *push_liveness_task(liveness, loop->slot, LIVENESS_WHILE_ITERATION, loop->live, loop->apply) = *loop;
+            push_loop_body(liveness, loop, loop->is_applying);
+            return;
+        }
+    }
+
+    liveness->break_live = loop->saved_break_live;
+    memcpy(loop->live, loop->head_live, sizeof(bool) * count);
+    free(loop->exit_live);
+    free(loop->head_live);
+    free(loop->body_live);
+}
+
+static void eliminate_dead_stores(ASTNode** slot, bool* live, Liveness* liveness) {
+    const NameList* locals = liveness->locals;
+    int count = locals->count;
+
+    push_liveness_task(liveness, slot, LIVENESS_STATEMENT, live, true);
+    while (liveness->tasks_count > 0) {
+        LivenessTask task = liveness->tasks[--liveness->tasks_count];
+        switch (task.step) {
+            case LIVENESS_STATEMENT: {
+                begin_dead_store_elimination(task.slot, task.live, liveness, task.apply);
+            } break;
+            case LIVENESS_IF_END: {
+                for (int i = 0; i < count; ++i) {
+                    task.live[i] = task.live[i] || task.else_live[i];
+                }
+                free(task.else_live);
+                add_uses((*task.slot)->if_statement.condition, task.live, locals);
+            } break;
+            case LIVENESS_WHILE_ITERATION: {
+                end_loop_iteration(&task, liveness);
+            } break;
+            case LIVENESS_SWITCH_END: {
+                liveness->break_live = task.saved_break_live;
+                liveness->case_live = task.saved_case_live;
+                memcpy(task.live, task.case_live, sizeof(bool) * count);
+                add_uses((*task.slot)->switch_statement.condition, task.live, locals);
+                free(task.exit_live);
+                free(task.case_live);
+            } break;
+            case LIVENESS_CASE_END: {
+                for (int i = 0; i < count; ++i) {
+                    liveness->case_live[i] = liveness->case_live[i] || task.live[i];
+                }
+            } break;
+        }
+    }
+}
+
+typedef struct References {
+    const NameList* locals;
+    bool* referenced;
+    // declarations are freed only after the walk, the names of locals point into them
+    ASTNode** unused;
+    int unused_count;
+    int unused_capacity;
+} References;
+
+static WalkAction collect_references_visitor(ASTNode** child, void* context) {
+    References* references = context;
+    ASTNode* node = *child;
+    const char* name = NULL;
+    if (node->type == AST_NODE_VARIABLE) name = node->name;
+    else if (node->type == AST_NODE_ASSIGNMENT) name = node->assignment.name;
+    else if (node->type == AST_NODE_CALL) name = node->call.name;
+
+    if (name != NULL) {
+        int index = name_list_index(references->locals, name);
+        if (index >= 0) references->referenced[index] = true;
+    }
+    return node->type == AST_NODE_INLINED_CALL ? WALK_ARGUMENTS : WALK_CHILDREN;
+}
+
+static WalkAction remove_unused_autos_visitor(ASTNode** child, void* context) {
+    References* references = context;
+    ASTNode* node = *child;
+    if (node->type == AST_NODE_VARIABLE_DECLARATION) {
+        int index = name_list_index(references->locals, node->declaration.name);
+        if (index >= 0 && !references->referenced[index]) {
+            if (references->unused_capacity < references->unused_count + 1) {
+                int old_capacity = references->unused_capacity;
+                references->unused_capacity = GROW_CAPACITY(old_capacity);
+                references->unused = GROW_ARRAY(ASTNode*, references->unused, old_capacity, references->unused_capacity);
+            }
+            references->unused[references->unused_count++] = node;
+            *child = make_block();
+        }
+    }
+    return skip_expressions(node);
+}
+
+// Dead stores and unused autos leave empty blocks behind, statement lists drop them once their
+// statements are done.
+static void remove_empty_statements_visitor(ASTNode** child, void* context) {
+    (void)context;
+    ASTNode* node = *child;
+    if (node->type != AST_NODE_BLOCK) return;
+
+    int kept = 0;
+    for (int i = 0; i < node->block.count; ++i) {
+        ASTNode* statement = node->block.statements[i];
+        if (statement->type == AST_NODE_BLOCK && statement->block.count == 0) {
+            parser_free_ast(statement);
+            continue;
+        }
+        node->block.statements[kept++] = statement;
+    }
+    node->block.count = kept;
+}
+
+static void eliminate_dead_code(ASTNode* function, const NameList* locals) {
+    int count = locals->count;
+    bool* live = calloc(count > 0 ? count : 1, sizeof(bool));
+    Liveness liveness = kept_liveness;
+    liveness.locals = locals;
+    eliminate_dead_stores(&function->function.body, live, &liveness);
+    kept_liveness = liveness;
+    free(live);
+
+    References references = {
+        .locals = locals,
+        .referenced = calloc(count > 0 ? count : 1, sizeof(bool)),
+        .unused = NULL,
+        .unused_count = 0,
+        .unused_capacity = 0,
+    };
+    walk_tree(&function->function.body, collect_references_visitor, NULL, &references);
+    walk_tree(&function->function.body, remove_unused_autos_visitor, NULL, &references);
+    for (int i = 0; i < references.unused_count; ++i) {
+        parser_free_ast(references.unused[i]);
+    }
+    free(references.unused);
+    free(references.referenced);
+
+    walk_tree(&function->function.body, NULL, remove_empty_statements_visitor, NULL);
+}
+
+// functions inlining may copy from, added as they come
+static _Thread_local FunctionTable table;
+
+static void optimize_function(ASTNode* function) {
+    LoopContext context = { 0 };
+    for (int i = 0; i < function->function.parameter_count; ++i) {
+        name_list_add(&context.locals, function->function.parameters[i]);
+    }
+    walk_tree(&function->function.body, collect_locals_visitor, NULL, &context.locals);
+
+    if (!table.optimize_size) {
+        unroll_loops(&function->function.body, &context);
+    }
+    // unrolled copies see their induction variable as constants
+    propagate_constants(function, &context.locals);
+    walk_tree(&function->function.body, skip_expressions_visitor, optimize_loops_visitor, &context);
+    eliminate_dead_code(function, &context.locals);
+
+    free(context.locals.names);
+    free(context.assigned.names);
+    free(context.declared.names);
+}
+
+static WalkAction collect_callees_visitor(ASTNode** child, void* context) {
+    ASTNode* node = *child;
+    if (node->type == AST_NODE_CALL) {
+        name_list_add(context, node->call.name);
+    }
+    return WALK_CHILDREN;
+}
+
+// pipelines and --watch ask for the callees of every function, not only of optimized ones
+int optimizer_callees(ASTNode* function, const char*** names) {
+    NameList callees = { 0 };
+    walk_tree(&function->function.body, collect_callees_visitor, NULL, &callees);
+    *names = callees.names;
+    return callees.count;
+}
+
+void optimizer_begin(const Options* options) {
+    table = (FunctionTable) { .optimize_size = options->optimize_size };
+}
+
+void optimizer_add_function(ASTNode* function) {
+    if (table.capacity < table.count + 1) {
+        int old_capacity = table.capacity;
+        table.capacity = GROW_CAPACITY(old_capacity);
+        table.functions = GROW_ARRAY(ASTNode*, table.functions, old_capacity, table.capacity);
+        table.inlinable = GROW_ARRAY(bool, table.inlinable, old_capacity, table.capacity);
+    }
+    table.inlinable[table.count] = is_inlinable(function);
+    hash_table_add(&table.names, hash_string(function->function.name), function->function.name, table.count);
+    table.functions[table.count++] = function;
+}
+
+void optimizer_optimize_function(ASTNode* function) {
+    inline_calls(&function->function.body, &table);
+    // inlined constants may have made the surrounding expressions constant
+    fold_constants(function->function.body);
+    optimize_function(function);
+}
+
+void optimizer_optimize_statements(ASTNode* statements) {
+    fold_constants(statements);
+}
+
+void optimizer_end() {
+    free(table.functions);
+    free(table.inlinable);
+    hash_table_free(&table.names);
+    table = (FunctionTable) { 0 };
+    free(walk_frames);
+    walk_frames = NULL;
+    walk_frames_count = 0;
+    walk_frames_capacity = 0;
+    free(walk_steps);
+    walk_steps = NULL;
+    walk_steps_count = 0;
+    walk_steps_capacity = 0;
+    free(kept_propagation.tasks);
+    free(kept_propagation.expressions);
+    kept_propagation = (Propagation) { 0 };
+    free(kept_liveness.tasks);
+    kept_liveness = (Liveness) { 0 };
+}
+
+void optimizer_optimize(ASTNode* program, const Options* options) {
+    if (options->optimization_level == 0) return;
+
+    optimizer_begin(options);
+    for (int i = 0; i < program->program.count; ++i) {
+        ASTNode* node = program->program.statements[i];
+        if (node->type == AST_NODE_FUNCTION) {
+            optimizer_add_function(node);
+        }
+    }
+    for (int i = 0; i < table.count; ++i) {
+        optimizer_optimize_function(table.functions[i]);
+    }
+    optimizer_end();
+}
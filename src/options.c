@@ -0,0 +1,232 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "compiler.h"
+#include "lexer.h"
+#include "options.h"
+#include "utils.h"
+
+void options_usage(const char* program) {
+    FILE* out = diagnostics();
+    fprintf(out, "usage: %s [options] <input.b>    (- reads the standard input)\n", program);
+    fprintf(out, "       %s --server <socket>\n", program);
+    fprintf(out, "       %s --connect <socket> [options] <input.b>\n", program);
+    fprintf(out, "options:\n");
+    fprintf(out, "  -o <output>      write the output to this file (default: test.asm, test.c, test.bast)\n");
+    fprintf(out, "  -O0              disable the optimizer\n");
+    fprintf(out, "  -O1              enable the optimizer (default)\n");
+    fprintf(out, "  -Os              enable the optimizer, but make the code as small as possible, fasm\n");
+    fprintf(out, "                   displays the size of .text when it assembles it\n");
+    fprintf(out, "  -g               emit debug info mapping the code to source lines\n");
+    fprintf(out, "  --emit=asm|c     write fasm assembly (default) or C99 to build with a C compiler\n");
+    fprintf(out, "  --emit=ast, --emit-ast <output>\n");
+    fprintf(out, "                   write the parsed program as an AST file, given as the input it is\n");
+    fprintf(out, "                   optimized and compiled without lexing and parsing it again\n");
+    fprintf(out, "  --report-tail-calls\n");
+    fprintf(out, "                   list which calls in tail position became jumps\n");
+    fprintf(out, "  --profile-generate[=<file>]\n");
+    fprintf(out, "                   count branches at run time and write them to the file at exit\n");
+    fprintf(out, "                   (default: bbc.profile)\n");
+    fprintf(out, "  --profile-use=<file>\n");
+    fprintf(out, "                   lay out code and tune the optimizer using a profile\n");
+    fprintf(out, "  --lex-threads=<n>\n");
+    fprintf(out, "                   lex large inputs on n threads, 0 uses one per cpu (default: 1)\n");
+    fprintf(out, "  --codegen-threads=<n>\n");
+    fprintf(out, "                   generate the code of the functions on n threads, 0 uses one per\n");
+    fprintf(out, "                   cpu (default: 1), the output is the same as on one\n");
+    fprintf(out, "  --pipeline       lex, parse and compile on separate threads, every function is\n");
+    fprintf(out, "                   compiled once it is parsed (the stages are not printed)\n");
+    fprintf(out, "  --stream         compile and free every definition and statement once it is\n");
+    fprintf(out, "                   parsed, memory does not grow with the input (calls are not\n");
+    fprintf(out, "                   inlined, the stages are not printed)\n");
+    fprintf(out, "  --watch          compile, then again every time the input is written, only the\n");
+    fprintf(out, "                   definitions that changed are parsed and compiled again\n");
+    fprintf(out, "  --server <socket>\n");
+    fprintf(out, "                   stay resident and compile requests sent to the unix socket\n");
+    fprintf(out, "  --connect <socket>\n");
+    fprintf(out, "                   let the server listening on the socket do the compilation\n");
+}
+
+Options options_parse(int argc, char** argv) {
+    Options options = {
+        .input_path = NULL,
+        .output_path = NULL,
+        .optimization_level = 1,
+        .optimize_size = false,
+        .report_tail_calls = false,
+        .debug_info = false,
+        .profile_generate_path = NULL,
+        .profile_use_path = NULL,
+        .lex_threads = 1,
+        .codegen_threads = 1,
+        .pipeline = false,
+        .stream = false,
+        .watch = false,
+        .emit = EMIT_ASM,
+        .print_stages = true,
+    };
+
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        if (strcmp(arg, "-o") == 0 && i + 1 < argc) {
+            options.output_path = argv[++i];
+        }
+        else if (strcmp(arg, "-O0") == 0) {
+            options.optimization_level = 0;
+            options.optimize_size = false;
+        }
+        else if (strcmp(arg, "-O1") == 0) {
+            options.optimization_level = 1;
+            options.optimize_size = false;
+        }
+        else if (strcmp(arg, "-Os") == 0) {
+            options.optimization_level = 1;
+            options.optimize_size = true;
+        }
+        else if (strcmp(arg, "-g") == 0) {
+            options.debug_info = true;
+        }
+        else if (strcmp(arg, "--emit=asm") == 0) {
+            options.emit = EMIT_ASM;
+        }
+        else if (strcmp(arg, "--emit=c") == 0) {
+            options.emit = EMIT_C;
+        }
+        else if (strcmp(arg, "--emit=ast") == 0) {
+            options.emit = EMIT_AST;
+        }
+        else if (strcmp(arg, "--emit-ast") == 0 && i + 1 < argc) {
+            options.emit = EMIT_AST;
+            options.output_path = argv[++i];
+        }
+        else if (strcmp(arg, "--report-tail-calls") == 0) {
+            options.report_tail_calls = true;
+        }
+        else if (strcmp(arg, "--profile-generate") == 0) {
+            options.profile_generate_path = "bbc.profile";
+        }
+        else if (strncmp(arg, "--profile-generate=", 19) == 0) {
+            options.profile_generate_path = arg + 19;
+        }
+        else if (strncmp(arg, "--profile-use=", 14) == 0) {
+            options.profile_use_path = arg + 14;
+        }
+        else if (strcmp(arg, "--pipeline") == 0) {
+            options.pipeline = true;
+        }
+        else if (strcmp(arg, "--stream") == 0) {
+            options.stream = true;
+        }
+        else if (strcmp(arg, "--watch") == 0) {
+            options.watch = true;
+        }
+        else if (strncmp(arg, "--lex-threads=", 14) == 0) {
+            char* end;
+            long threads = strtol(arg + 14, &end, 10);
+            if (arg[14] == '\0' || *end != '\0' || threads < 0 || threads > LEXER_MAX_THREADS) {
+                fprintf(diagnostics(), "error: invalid number of lexer threads: %s\n", arg + 14);
+                fail();
+            }
+            options.lex_threads = (int)threads;
+        }
+        else if (strncmp(arg, "--codegen-threads=", 18) == 0) {
+            char* end;
+            long threads = strtol(arg + 18, &end, 10);
+            if (arg[18] == '\0' || *end != '\0' || threads < 0 || threads > COMPILER_MAX_THREADS) {
+                fprintf(diagnostics(), "error: invalid number of codegen threads: %s\n", arg + 18);
+                fail();
+            }
+            options.codegen_threads = (int)threads;
+        }
+        else if (arg[0] == '-' && arg[1] != '\0') {
+            options_usage(argv[0]);
+            fprintf(diagnostics(), "error: unknown option: %s\n", arg);
+            fail();
+        }
+        else {
+            options.input_path = arg;
+        }
+    }
+
+    if (options.input_path == NULL) {
+        options_usage(argv[0]);
+        fprintf(diagnostics(), "error: input file not specified\n");
+        fail();
+    }
+    if (options.profile_generate_path != NULL && options.profile_use_path != NULL) {
+        fprintf(diagnostics(), "error: --profile-generate and --profile-use cannot be used together\n");
+        fail();
+    }
+    // the profile has to match the number of sites before anything is optimized
+    if (options.pipeline && options.profile_use_path != NULL) {
+        fprintf(diagnostics(), "error: --pipeline cannot be used with --profile-use\n");
+        fail();
+    }
+    if (options.pipeline && options.lex_threads != 1) {
+        fprintf(diagnostics(), "error: --pipeline cannot be used with --lex-threads\n");
+        fail();
+    }
+    if (options.stream && (options.pipeline || options.lex_threads != 1)) {
+        fprintf(diagnostics(), "error: --stream cannot be used with --pipeline or --lex-threads\n");
+        fail();
+    }
+    // the number of sites is only known at the end of a stream
+    if (options.stream && options.profile_use_path != NULL) {
+        fprintf(diagnostics(), "error: --stream cannot be used with --profile-use\n");
+        fail();
+    }
+    // debug info keeps the lines and names of every function until the end
+    if (options.stream && options.debug_info) {
+        fprintf(diagnostics(), "error: --stream cannot be used with -g\n");
+        fail();
+    }
+    // functions come one at a time there, and debug info describes them in the order they
+    // are compiled
+    if (options.codegen_threads != 1 && (options.pipeline || options.stream || options.debug_info)) {
+        fprintf(diagnostics(), "error: --codegen-threads cannot be used with --pipeline, --stream or -g\n");
+        fail();
+    }
+    // the C backend lowers the whole optimized AST at once and leaves the code to the C compiler
+    if (options.emit == EMIT_C && (options.pipeline || options.stream)) {
+        fprintf(diagnostics(), "error: --emit=c cannot be used with --pipeline or --stream\n");
+        fail();
+    }
+    // the tree is written whole, before anything is optimized
+    if (options.emit == EMIT_AST && (options.pipeline || options.stream || options.watch)) {
+        fprintf(diagnostics(), "error: --emit=ast cannot be used with --pipeline, --stream or --watch\n");
+        fail();
+    }
+    bool needs_assembly = options.debug_info || options.profile_generate_path != NULL || options.report_tail_calls;
+    if (options.emit == EMIT_C && needs_assembly) {
+        fprintf(
+            diagnostics(), "error: --emit=c cannot be used with -g, --profile-generate or --report-tail-calls\n"
+        );
+        fail();
+    }
+    // the code of every function is kept and written again as it is, the input is read again
+    if (options.watch && strcmp(options.input_path, "-") == 0) {
+        fprintf(diagnostics(), "error: --watch cannot read the standard input\n");
+        fail();
+    }
+    if (options.watch && (options.pipeline || options.stream || options.emit == EMIT_C || options.debug_info)) {
+        fprintf(diagnostics(), "error: --watch cannot be used with --pipeline, --stream, --emit=c or -g\n");
+        fail();
+    }
+    // profiles count sites of the whole program, which is not parsed again
+    if (options.watch && (options.profile_generate_path != NULL || options.profile_use_path != NULL)) {
+        fprintf(diagnostics(), "error: --watch cannot be used with --profile-generate or --profile-use\n");
+        fail();
+    }
+    if (options.watch) {
+        options.print_stages = false;
+    }
+    if (options.output_path == NULL) {
+        options.output_path = options.emit == EMIT_C ? "test.c" : options.emit == EMIT_AST ? "test.bast" : "test.asm";
+    }
+    // the path ends up in a string of the generated assembly
+    if (options.profile_generate_path != NULL && strpbrk(options.profile_generate_path, "\"\n") != NULL) {
+        fprintf(diagnostics(), "error: invalid profile path: %s\n", options.profile_generate_path);
+        fail();
+    }
+    return options;
+}
@@ -7,19 +7,91 @@
 #include "parser.h"
 #include "utils.h"
 
+// An if, while, switch, case or block whose statements are being parsed.
+typedef struct StatementFrame {
+    // TOKEN_IF, TOKEN_WHILE, TOKEN_SWITCH, TOKEN_CASE (also for default) or TOKEN_LEFT_BRACE
+    TokenType type;
+    Token* start;
+    ASTNode* condition;
+    // the then branch of an if once it is parsed, the node of a switch, case or block
+    ASTNode* node;
+    ASTNode* enclosing_switch;
+} StatementFrame;
+
+typedef enum OperatorKind {
+    // also '=', which binds the weakest
+    OPERATOR_BINARY,
+    OPERATOR_UNARY,
+    // wait for their closing token
+    OPERATOR_PARENTHESIS,
+    OPERATOR_SUBSCRIPT,
+    OPERATOR_CALL,
+} OperatorKind;
+
+#define ASSIGNMENT_PRECEDENCE 1
+// levels the printed tree is indented by, deeper lines give their depth instead
+#define PRINT_INDENT_MAX 32
+
+typedef struct PendingOperator {
+    OperatorKind kind;
+    TokenType op;
+    // the call whose arguments are parsed
+    ASTNode* call;
+} PendingOperator;
+
 typedef struct Parser {
     const char* file_path;
+    TokenArray* token_array;
     Token* tokens;
     Token* current;
     int count;
+    ASTNode* current_switch;
+    int breakable_depth;
+    // profile sites are numbered in the order their statements are parsed
+    int site_count;
+    // statements outside of function definitions form the body of an implicit main
+    ASTNode* implicit_main_body;
+    bool has_statements;
+    bool has_main;
+    // definitions of the last `auto` outside of functions, returned one at a time
+    ASTNode** globals;
+    int globals_count;
+    int globals_capacity;
+    int next_global;
+    // their extrn declarations, added to the implicit main before its next statement
+    ASTNode** global_extrns;
+    int global_extrns_count;
+    int global_extrns_capacity;
+    // statements and expressions being parsed, see parse_statement and parse_expression
+    StatementFrame* frames;
+    int frames_count;
+    int frames_capacity;
+    PendingOperator* operators;
+    int operators_count;
+    int operators_capacity;
+    ASTNode** operands;
+    int operands_count;
+    int operands_capacity;
 } Parser;
 
-static Parser parser;
+static _Thread_local Parser parser;
+
+inline static const char* value_of(const Token* token) {
+    return token_value(parser.token_array, token);
+}
+
+inline static int line_of(const Token* token) {
+    return token_line(parser.token_array, token);
+}
+
+inline static int length_of(const Token* token) {
+    return token->type == TOKEN_ERROR ? (int)strlen(value_of(token)) : (int)token->length;
+}
 
 static void consume_expected(TokenType token, const char* error_if_fail) {
     if (parser.current->type != token) {
-        fprintf(stderr, "%s:%d: error: %s\n", parser.file_path, parser.current->line, error_if_fail);
-        exit(1);
+        fprintf(diagnostics(), "%s:%d: error: %s\n", parser.file_path, line_of(parser.current), error_if_fail);
+        fail();
     }
     ++parser.current;
 }
@@ -43,46 +115,117 @@ inline static Token* previous() {
     return parser.current - 1;
 }
 
-static ASTNode* make_node_program() {
+static void append_node(ASTNode*** nodes, int* count, int* capacity, ASTNode* node) {
+    if (*capacity < *count + 1) {
+        int old_capacity = *capacity;
+        *capacity = GROW_CAPACITY(old_capacity);
+        *nodes = GROW_ARRAY(ASTNode*, *nodes, old_capacity, *capacity);
+    }
+    (*nodes)[(*count)++] = node;
+}
+
+// Expressions get the location of the last token consumed when they are made, statements
+// are moved to their first token by parse_statement.
+static ASTNode* make_node(ASTNodeType type) {
+    Token* token = parser.current == parser.tokens ? parser.current : previous();
     ASTNode* node = calloc(1, sizeof(ASTNode));
-    node->type = AST_NODE_PROGRAM;
+    node->type = type;
+    node->location = token->offset + 1;
+    return node;
+}
+
+static void set_location(ASTNode* node, const Token* token) {
+    node->location = token->offset + 1;
+}
+
+static ASTNode* make_node_program() {
+    ASTNode* node = make_node(AST_NODE_PROGRAM);
+    return node;
+}
+
+static ASTNode* make_node_function(char* name, char** parameters, int parameter_count, ASTNode* body) {
+    ASTNode* node = make_node(AST_NODE_FUNCTION);
+    node->function.name = name;
+    node->function.parameters = parameters;
+    node->function.parameter_count = parameter_count;
+    node->function.body = body;
     return node;
 }
 
 static ASTNode* make_node_expression_statement(ASTNode* expression) {
-    ASTNode* node = malloc(sizeof(ASTNode));
-    node->type = AST_NODE_EXPRESSION_STATEMENT;
+    ASTNode* node = make_node(AST_NODE_EXPRESSION_STATEMENT);
     node->expression = expression;
     return node;
 }
 
 static ASTNode* make_node_if_statement(ASTNode* condition, ASTNode* then_branch, ASTNode* else_branch) {
-    ASTNode* node = malloc(sizeof(ASTNode));
-    node->type = AST_NODE_IF_STATEMENT;
+    ASTNode* node = make_node(AST_NODE_IF_STATEMENT);
     node->if_statement.condition = condition;
     node->if_statement.then_branch = then_branch;
     node->if_statement.else_branch = else_branch;
+    node->if_statement.site = parser.site_count++;
     return node;
 }
 
 static ASTNode* make_node_while_statement(ASTNode* condition, ASTNode* body) {
-    ASTNode* node = malloc(sizeof(ASTNode));
-    node->type = AST_NODE_WHILE_STATEMENT;
+    ASTNode* node = make_node(AST_NODE_WHILE_STATEMENT);
     node->while_statement.condition = condition;
     node->while_statement.body = body;
+    node->while_statement.site = parser.site_count++;
+    return node;
+}
+
+static ASTNode* make_node_switch_statement(ASTNode* condition) {
+    ASTNode* node = make_node(AST_NODE_SWITCH_STATEMENT);
+    node->switch_statement.condition = condition;
     return node;
 }
 
-static ASTNode* make_node_variable_declaration(char* name) {
-    ASTNode* node = malloc(sizeof(ASTNode));
-    node->type = AST_NODE_VARIABLE_DECLARATION;
+static ASTNode* make_node_case(Word value, bool is_default) {
+    ASTNode* node = make_node(AST_NODE_CASE);
+    node->case_label.value = value;
+    node->case_label.is_default = is_default;
+    node->case_label.label = -1;
+    node->case_label.statement = NULL;
+    return node;
+}
+
+static ASTNode* make_node_break_statement() {
+    ASTNode* node = make_node(AST_NODE_BREAK_STATEMENT);
+    return node;
+}
+
+static ASTNode* make_node_return_statement(ASTNode* expression) {
+    ASTNode* node = make_node(AST_NODE_RETURN_STATEMENT);
+    node->expression = expression;
+    return node;
+}
+
+static ASTNode* make_node_extrn_declaration(char* name) {
+    ASTNode* node = make_node(AST_NODE_EXTRN_DECLARATION);
     node->name = name;
     return node;
 }
 
+static ASTNode* make_node_variable_declaration(char* name, bool is_vector, Word bound) {
+    ASTNode* node = make_node(AST_NODE_VARIABLE_DECLARATION);
+    node->declaration.name = name;
+    node->declaration.is_vector = is_vector;
+    node->declaration.bound = bound;
+    return node;
+}
+
+static ASTNode* make_node_vector_definition(char* name, Word bound, Word* values, int count) {
+    ASTNode* node = make_node(AST_NODE_VECTOR_DEFINITION);
+    node->vector.name = name;
+    node->vector.bound = bound;
+    node->vector.values = values;
+    node->vector.count = count;
+    return node;
+}
+
 static ASTNode* make_node_block() {
-    ASTNode* node = calloc(1, sizeof(ASTNode));
-    node->type = AST_NODE_BLOCK;
+    ASTNode* node = make_node(AST_NODE_BLOCK);
     return node;
 }
 
@@ -95,8 +238,7 @@ static ASTNode* make_node_block() {
 // }
 
 static ASTNode* make_node_binary(ASTNode* left, TokenType op, ASTNode* right) {
-    ASTNode* node = malloc(sizeof(ASTNode));
-    node->type = AST_NODE_BINARY;
+    ASTNode* node = make_node(AST_NODE_BINARY);
     node->binary.left = left;
     node->binary.op = op;
     node->binary.right = right;
@@ -104,341 +246,1189 @@ static ASTNode* make_node_binary(ASTNode* left, TokenType op, ASTNode* right) {
 }
 
 static ASTNode* make_node_unary(TokenType op, ASTNode* right) {
-    ASTNode* node = malloc(sizeof(ASTNode));
-    node->type = AST_NODE_UNARY;
+    ASTNode* node = make_node(AST_NODE_UNARY);
     node->unary.op = op;
     node->unary.right = right;
     return node;
 }
 
 static ASTNode* make_node_literal(Word value) {
-    ASTNode* node = malloc(sizeof(ASTNode));
-    node->type = AST_NODE_LITERAL;
+    ASTNode* node = make_node(AST_NODE_LITERAL);
     node->literal = value;
     return node;
 }
 
+static ASTNode* make_node_string(char* bytes, int length) {
+    ASTNode* node = make_node(AST_NODE_STRING);
+    node->string.bytes = bytes;
+    node->string.length = length;
+    return node;
+}
+
 static ASTNode* make_node_variable(char* name) {
-    ASTNode* node = malloc(sizeof(ASTNode));
-    node->type = AST_NODE_VARIABLE;
+    ASTNode* node = make_node(AST_NODE_VARIABLE);
     node->name = name;
     return node;
 }
 
+static ASTNode* make_node_subscript(ASTNode* vector, ASTNode* index) {
+    ASTNode* node = make_node(AST_NODE_SUBSCRIPT);
+    node->subscript.vector = vector;
+    node->subscript.index = index;
+    node->subscript.value = NULL;
+    return node;
+}
+
+static ASTNode* make_node_call(char* name) {
+    ASTNode* node = make_node(AST_NODE_CALL);
+    node->call.name = name;
+    return node;
+}
+
 static ASTNode* parse_program();
+static bool is_function_definition();
+static ASTNode* parse_function();
+static bool is_vector_definition();
+static ASTNode* parse_vector_definition();
+static void parse_global_declaration();
 static ASTNode* parse_declaration();
 static ASTNode* parse_statement();
-static ASTNode* parse_block();
-
+static ASTNode* parse_simple_statement();
+static Word parse_constant();
 static ASTNode* parse_expression();
-static ASTNode* parse_assignment();
-static ASTNode* parse_equality();
-static ASTNode* parse_comparison();
-static ASTNode* parse_term();
-static ASTNode* parse_factor();
-static ASTNode* parse_unary();
-static ASTNode* parse_primary();
 
-static ASTNode* parse_program() {
-    ASTNode* node = make_node_program();
+static void append_statement(ASTNode* statement) {
+    append_node(
+        &parser.implicit_main_body->block.statements,
+        &parser.implicit_main_body->block.count,
+        &parser.implicit_main_body->block.capacity,
+        statement
+    );
+}
+
+// Parses top-level statements into the implicit main until a definition, NULL at the end.
+static ASTNode* parse_definition() {
+    if (parser.next_global < parser.globals_count) {
+        return parser.globals[parser.next_global++];
+    }
+    parser.globals_count = 0;
+    parser.next_global = 0;
+
     while (parser.current->type != TOKEN_EOF) {
-        if (node->program.capacity < node->program.count + 1) {
-            int old_capacity = node->program.capacity;
-            node->program.capacity = GROW_CAPACITY(old_capacity);
-            node->program.statements = GROW_ARRAY(ASTNode*, node->program.statements, old_capacity, node->program.capacity);
+        if (is_function_definition()) {
+            ASTNode* function = parse_function();
+            parser.has_main |= strcmp(function->function.name, "main") == 0;
+            return function;
+        }
+        if (is_vector_definition()) {
+            return parse_vector_definition();
+        }
+        if (parser_is_global_declaration(parser.current)) {
+            parse_global_declaration();
+            return parser.globals[parser.next_global++];
+        }
+        if (parser.implicit_main_body == NULL) {
+            parser.implicit_main_body = make_node_block();
+            set_location(parser.implicit_main_body, parser.current);
         }
-        node->program.statements[node->program.count++] = parse_declaration();
+        parser.has_statements = true;
+        for (int i = 0; i < parser.global_extrns_count; ++i) {
+            append_statement(parser.global_extrns[i]);
+        }
+        parser.global_extrns_count = 0;
+        append_statement(parse_declaration());
+    }
+    return NULL;
+}
+
+static ASTNode* make_implicit_main() {
+    if (parser.has_statements && parser.has_main) {
+        fprintf(diagnostics(), "%s: error: statements outside of functions cannot be mixed with a main function\n", parser.file_path);
+        fail();
+    }
+    ASTNode* body = parser.implicit_main_body;
+    if (body == NULL) return NULL;
+    ASTNode* main_function = make_node_function(strdup("main"), NULL, 0, body);
+    main_function->location = body->location;
+    parser.implicit_main_body = NULL;
+    return main_function;
+}
+
+static ASTNode* parse_program() {
+    ASTNode* node = make_node_program();
+    ASTNode* definition;
+    while ((definition = parse_definition()) != NULL) {
+        append_node(&node->program.statements, &node->program.count, &node->program.capacity, definition);
+    }
+
+    ASTNode* main_function = make_implicit_main();
+    if (main_function != NULL) {
+        append_node(&node->program.statements, &node->program.count, &node->program.capacity, main_function);
     }
     return node;
 }
 
-static ASTNode* parse_declaration() {
-    if (match(1, TOKEN_AUTO)) {
-        consume_expected(TOKEN_IDENTIFIER, "expected identifier name after 'auto'\n");
-        char* name = strndup(previous()->value, previous()->length);
-        consume_expected(TOKEN_SEMICOLON, "expected ';' after expression");
-        return make_node_variable_declaration(name);
+bool parser_ends_before(TopLevelSplitter* splitter, Token token) {
+    bool is_end = splitter->may_end && token.type != TOKEN_ELSE;
+    switch (token.type) {
+        case TOKEN_LEFT_PAREN:
+        case TOKEN_LEFT_BRACKET:
+        case TOKEN_LEFT_BRACE: {
+            ++splitter->depth;
+        } break;
+        case TOKEN_RIGHT_PAREN:
+        case TOKEN_RIGHT_BRACKET:
+        case TOKEN_RIGHT_BRACE: {
+            --splitter->depth;
+        } break;
+        default:
+            break;
     }
+    splitter->may_end = splitter->depth == 0 && (token.type == TOKEN_SEMICOLON || token.type == TOKEN_RIGHT_BRACE);
+    return is_end;
+}
+
+// name(a, b) followed by anything else than ';' starts a function definition
+bool parser_is_function_definition(const Token* token) {
+    if (token[0].type != TOKEN_IDENTIFIER || token[1].type != TOKEN_LEFT_PAREN) return false;
+
+    token += 2;
+    if (token->type == TOKEN_IDENTIFIER) {
+        ++token;
+        while (token[0].type == TOKEN_COMMA && token[1].type == TOKEN_IDENTIFIER) {
+            token += 2;
+        }
+    }
+    return token[0].type == TOKEN_RIGHT_PAREN && token[1].type != TOKEN_SEMICOLON;
+}
+
+static bool is_function_definition() {
+    return parser_is_function_definition(parser.current);
+}
+
+static ASTNode* parse_function() {
+    Token* start = parser.current;
+    consume_expected(TOKEN_IDENTIFIER, "expected function name");
+    char* name = strndup(value_of(previous()), previous()->length);
+    consume_expected(TOKEN_LEFT_PAREN, "expected '(' after function name");
+
+    char** parameters = NULL;
+    int parameter_count = 0;
+    int parameter_capacity = 0;
+    if (parser.current->type != TOKEN_RIGHT_PAREN) {
+        do {
+            consume_expected(TOKEN_IDENTIFIER, "expected parameter name");
+            if (parameter_capacity < parameter_count + 1) {
+                int old_capacity = parameter_capacity;
+                parameter_capacity = GROW_CAPACITY(old_capacity);
+                parameters = GROW_ARRAY(char*, parameters, old_capacity, parameter_capacity);
+            }
+            parameters[parameter_count++] = strndup(value_of(previous()), previous()->length);
+        } while (match(1, TOKEN_COMMA));
+    }
+    consume_expected(TOKEN_RIGHT_PAREN, "expected ')' after parameters");
+
+    ASTNode* body = parse_statement();
+    ASTNode* function = make_node_function(name, parameters, parameter_count, body);
+    set_location(function, start);
+    return function;
+}
+
+// name[bound] followed by ';' or initial values defines an external vector, the bound is optional
+bool parser_is_vector_definition(const Token* token) {
+    if (token[0].type != TOKEN_IDENTIFIER || token[1].type != TOKEN_LEFT_BRACKET) return false;
+
+    token += 2;
+    if (token->type == TOKEN_WORD_LITERAL) ++token;
+    if (token->type != TOKEN_RIGHT_BRACKET) return false;
+    ++token;
+    return token->type == TOKEN_SEMICOLON || token->type == TOKEN_WORD_LITERAL || token->type == TOKEN_MINUS;
+}
+
+static bool is_vector_definition() {
+    return parser_is_vector_definition(parser.current);
+}
+
+static ASTNode* parse_vector_definition() {
+    consume_expected(TOKEN_IDENTIFIER, "expected vector name");
+    char* name = strndup(value_of(previous()), previous()->length);
+    consume_expected(TOKEN_LEFT_BRACKET, "expected '[' after vector name");
+    Word bound = -1;
+    if (match(1, TOKEN_WORD_LITERAL)) {
+        bound = strtoll(value_of(previous()), NULL, 10);
+    }
+    consume_expected(TOKEN_RIGHT_BRACKET, "expected ']' after vector size");
+
+    Word* values = NULL;
+    int count = 0;
+    int capacity = 0;
+    if (parser.current->type != TOKEN_SEMICOLON) {
+        do {
+            if (capacity < count + 1) {
+                int old_capacity = capacity;
+                capacity = GROW_CAPACITY(old_capacity);
+                values = GROW_ARRAY(Word, values, old_capacity, capacity);
+            }
+            values[count++] = parse_constant();
+        } while (match(1, TOKEN_COMMA));
+    }
+    consume_expected(TOKEN_SEMICOLON, "expected ';' after vector definition");
+
+    // without a bound the vector is as long as its initializer
+    if (bound < count - 1) {
+        bound = count - 1;
+    }
+    if (bound < 0) {
+        fprintf(diagnostics(), "%s:%d: error: vector '%s' has no size\n", parser.file_path, line_of(previous()), name);
+        fail();
+    }
+    return make_node_vector_definition(name, bound, values, count);
+}
+
+bool parser_is_global_declaration(const Token* token) {
+    return token->type == TOKEN_AUTO;
+}
+
+// `auto a, v[10];` outside of functions defines a as an external word and v as an external
+// vector. The statements of the implicit main after it see them through `extrn a, v;`, which
+// is not a statement of its own, so the declaration goes with a main function too.
+static void parse_global_declaration() {
+    Token* start = parser.current;
+    consume_expected(TOKEN_AUTO, "expected 'auto'");
+    do {
+        consume_expected(TOKEN_IDENTIFIER, "expected identifier name after 'auto'");
+        Token* name_token = previous();
+        char* name = strndup(value_of(name_token), name_token->length);
+        ASTNode* definition;
+        if (match(1, TOKEN_LEFT_BRACKET)) {
+            consume_expected(TOKEN_WORD_LITERAL, "expected vector size");
+            Word bound = strtoll(value_of(previous()), NULL, 10);
+            consume_expected(TOKEN_RIGHT_BRACKET, "expected ']' after vector size");
+            definition = make_node_vector_definition(name, bound, NULL, 0);
+        }
+        else {
+            definition = make_node_vector_definition(name, 0, NULL, 0);
+            definition->vector.is_scalar = true;
+        }
+        set_location(definition, name_token);
+        append_node(&parser.globals, &parser.globals_count, &parser.globals_capacity, definition);
+
+        ASTNode* extrn = make_node_extrn_declaration(strdup(name));
+        set_location(extrn, start);
+        append_node(&parser.global_extrns, &parser.global_extrns_count, &parser.global_extrns_capacity, extrn);
+    } while (match(1, TOKEN_COMMA));
+    consume_expected(TOKEN_SEMICOLON, "expected ';' after declaration");
+}
+
+// B escapes start with '*': *n newline, *t tab, *0 '\0', *e end of file, *( '{', *) '}',
+// ** and *'. The lexer ends a string at the first '"', so *" is not one of them.
+static ASTNode* parse_string(Token* token) {
+    const char* text = value_of(token);
+    char* bytes = malloc(token->length + 1);
+    int length = 0;
+    for (uint32_t i = 0; i < token->length; ++i) {
+        if (text[i] != '*') {
+            bytes[length++] = text[i];
+            continue;
+        }
+        char escape = i + 1 < token->length ? text[++i] : '\0';
+        switch (escape) {
+            case 'n': bytes[length++] = '\n'; break;
+            case 't': bytes[length++] = '\t'; break;
+            case '0': bytes[length++] = '\0'; break;
+            case 'e': bytes[length++] = 4; break;
+            case '(': bytes[length++] = '{'; break;
+            case ')': bytes[length++] = '}'; break;
+            case '*': bytes[length++] = '*'; break;
+            case '\'': bytes[length++] = '\''; break;
+            default: {
+                fprintf(
+                    diagnostics(), "%s:%d: error: invalid escape in string: '*%c'\n",
+                    parser.file_path, line_of(token), escape != '\0' ? escape : ' '
+                );
+                fail();
+            }
+        }
+    }
+    bytes[length] = '\0';
+    return make_node_string(bytes, length);
+}
+
+// `auto` and `extrn` declarations inside of functions
+static bool is_declaration() {
+    return parser.current->type == TOKEN_AUTO || parser.current->type == TOKEN_EXTRN;
+}
 
+static ASTNode* parse_names_declaration() {
+    Token* start = parser.current;
+    TokenType kind = parser.current->type;
+    ++parser.current;
+    // a list of names is returned as a block of single declarations
+    ASTNode* declarations = make_node_block();
+    do {
+        consume_expected(TOKEN_IDENTIFIER, kind == TOKEN_AUTO ? "expected identifier name after 'auto'" : "expected identifier name after 'extrn'");
+        char* name = strndup(value_of(previous()), previous()->length);
+        ASTNode* declaration = NULL;
+        if (kind == TOKEN_AUTO && match(1, TOKEN_LEFT_BRACKET)) {
+            consume_expected(TOKEN_WORD_LITERAL, "expected vector size");
+            Word bound = strtoll(value_of(previous()), NULL, 10);
+            consume_expected(TOKEN_RIGHT_BRACKET, "expected ']' after vector size");
+            declaration = make_node_variable_declaration(name, true, bound);
+        }
+        else if (kind == TOKEN_AUTO) {
+            declaration = make_node_variable_declaration(name, false, 0);
+        }
+        else {
+            declaration = make_node_extrn_declaration(name);
+        }
+        append_node(&declarations->block.statements, &declarations->block.count, &declarations->block.capacity, declaration);
+    } while (match(1, TOKEN_COMMA));
+    consume_expected(TOKEN_SEMICOLON, "expected ';' after declaration");
+
+    if (declarations->block.count == 1) {
+        ASTNode* declaration = declarations->block.statements[0];
+        free(declarations->block.statements);
+        free(declarations);
+        set_location(declaration, start);
+        return declaration;
+    }
+    set_location(declarations, start);
+    return declarations;
+}
+
+static ASTNode* parse_declaration() {
+    if (is_declaration()) {
+        return parse_names_declaration();
+    }
     return parse_statement();
 }
 
-static ASTNode* parse_statement() {
+static void push_frame(TokenType type, Token* start, ASTNode* condition, ASTNode* node) {
+    if (parser.frames_capacity < parser.frames_count + 1) {
+        int old_capacity = parser.frames_capacity;
+        parser.frames_capacity = GROW_CAPACITY(old_capacity);
+        parser.frames = GROW_ARRAY(StatementFrame, parser.frames, old_capacity, parser.frames_capacity);
+    }
+    parser.frames[parser.frames_count++] = (StatementFrame) {
+        .type = type,
+        .start = start,
+        .condition = condition,
+        .node = node,
+        .enclosing_switch = parser.current_switch,
+    };
+}
+
+// Adds the declarations that follow to the block of the innermost frame, returns the block
+// at its '}' or NULL when a statement comes next.
+static ASTNode* continue_block() {
+    StatementFrame* frame = &parser.frames[parser.frames_count - 1];
+    ASTNode* block = frame->node;
+    while (parser.current->type != TOKEN_RIGHT_BRACE && parser.current->type != TOKEN_EOF) {
+        if (!is_declaration()) return NULL;
+        append_node(&block->block.statements, &block->block.count, &block->block.capacity, parse_names_declaration());
+    }
+    consume_expected(TOKEN_RIGHT_BRACE, "expected '}' after block");
+    set_location(block, frame->start);
+    --parser.frames_count;
+    return block;
+}
+
+// Parses a statement up to the first statement it contains, whose parent waits in a frame.
+// Returns the statement when it contains none.
+static ASTNode* begin_statement() {
+    Token* start = parser.current;
     if (match(1, TOKEN_IF)) {
         consume_expected(TOKEN_LEFT_PAREN, "expected '(' after 'if'");
         ASTNode* condition = parse_expression();
         consume_expected(TOKEN_RIGHT_PAREN, "expected ')' after 'if' condition");
-
-        ASTNode* then_branch = parse_statement();
-        ASTNode* else_branch = NULL;
-        if (match(1, TOKEN_ELSE)) {
-            else_branch = parse_statement();
-        }
-
-        return make_node_if_statement(condition, then_branch, else_branch);
+        push_frame(TOKEN_IF, start, condition, NULL);
+        return NULL;
     }
 
     if (match(1, TOKEN_WHILE)) {
         consume_expected(TOKEN_LEFT_PAREN, "expected '(' after 'while'");
         ASTNode* condition = parse_expression();
         consume_expected(TOKEN_RIGHT_PAREN, "expected ')' after 'while' condition");
+        ++parser.breakable_depth;
+        push_frame(TOKEN_WHILE, start, condition, NULL);
+        return NULL;
+    }
 
-        ASTNode* body = parse_statement();
+    if (match(1, TOKEN_SWITCH)) {
+        consume_expected(TOKEN_LEFT_PAREN, "expected '(' after 'switch'");
+        ASTNode* condition = parse_expression();
+        consume_expected(TOKEN_RIGHT_PAREN, "expected ')' after 'switch' condition");
 
-        return make_node_while_statement(condition, body);
+        ASTNode* node = make_node_switch_statement(condition);
+        push_frame(TOKEN_SWITCH, start, NULL, node);
+        parser.current_switch = node;
+        ++parser.breakable_depth;
+        return NULL;
+    }
+
+    if (match(2, TOKEN_CASE, TOKEN_DEFAULT)) {
+        Token* label_token = previous();
+        ASTNode* switch_node = parser.current_switch;
+        if (switch_node == NULL) {
+            fprintf(
+                diagnostics(), "%s:%d: error: '%s' label outside of switch\n",
+                parser.file_path,
+                line_of(label_token),
+                token_as_cstr(label_token->type)
+            );
+            fail();
+        }
+
+        bool is_default = label_token->type == TOKEN_DEFAULT;
+        Word value = is_default ? 0 : parse_constant();
+        consume_expected(TOKEN_COLON, "expected ':' after case label");
+
+        ASTNode* node = make_node_case(value, is_default);
+        if (is_default) {
+            if (switch_node->switch_statement.default_case != NULL) {
+                fprintf(diagnostics(), "%s:%d: error: multiple default labels in one switch\n", parser.file_path, line_of(label_token));
+                fail();
+            }
+            switch_node->switch_statement.default_case = node;
+        }
+        else {
+            append_node(
+                &switch_node->switch_statement.cases,
+                &switch_node->switch_statement.count,
+                &switch_node->switch_statement.capacity,
+                node
+            );
+        }
+        push_frame(TOKEN_CASE, start, NULL, node);
+        return NULL;
     }
 
     if (match(1, TOKEN_LEFT_BRACE)) {
-        ASTNode* node = parse_block();
-        consume_expected(TOKEN_RIGHT_BRACE, "expected '}' after block");
-        return node;
+        push_frame(TOKEN_LEFT_BRACE, start, NULL, make_node_block());
+        return continue_block();
     }
 
-    ASTNode* expression = parse_expression();
-    consume_expected(TOKEN_SEMICOLON, "expected ';' after expression");
-    return make_node_expression_statement(expression);
+    ASTNode* node = parse_simple_statement();
+    set_location(node, start);
+    return node;
 }
 
-static ASTNode* parse_block() {
-    ASTNode* node = make_node_block();
-    while (parser.current->type != TOKEN_RIGHT_BRACE && parser.current->type != TOKEN_EOF) {
-        if (node->block.capacity < node->block.count + 1) {
-            int old_capacity = node->block.capacity;
-            node->block.capacity = GROW_CAPACITY(old_capacity);
-            node->block.statements = GROW_ARRAY(ASTNode*, node->block.statements, old_capacity, node->block.capacity);
+// Gives the statement to the innermost frame. Returns the statement of the frame when it is
+// complete, or NULL when it takes another one.
+static ASTNode* end_statement(ASTNode* statement) {
+    StatementFrame* frame = &parser.frames[parser.frames_count - 1];
+    ASTNode* node = frame->node;
+    switch (frame->type) {
+        case TOKEN_IF: {
+            if (node == NULL) {
+                frame->node = statement;
+                if (match(1, TOKEN_ELSE)) return NULL;
+                node = make_node_if_statement(frame->condition, statement, NULL);
+            }
+            else {
+                node = make_node_if_statement(frame->condition, node, statement);
+            }
+        } break;
+        case TOKEN_WHILE: {
+            --parser.breakable_depth;
+            node = make_node_while_statement(frame->condition, statement);
+        } break;
+        case TOKEN_SWITCH: {
+            node->switch_statement.body = statement;
+            --parser.breakable_depth;
+            parser.current_switch = frame->enclosing_switch;
+        } break;
+        case TOKEN_CASE: {
+            node->case_label.statement = statement;
+        } break;
+        default: {
+            append_node(&node->block.statements, &node->block.count, &node->block.capacity, statement);
+            return continue_block();
         }
-        node->block.statements[node->block.count++] = parse_declaration();
     }
+    set_location(node, frame->start);
+    --parser.frames_count;
     return node;
 }
 
-static ASTNode* parse_expression() {
-    return parse_assignment();
+// Statements inside of statements wait for their parents on parser.frames instead of the C
+// stack, so an else if chain or nested blocks are only bounded by memory.
+static ASTNode* parse_statement() {
+    int base = parser.frames_count;
+    for (;;) {
+        ASTNode* node = begin_statement();
+        while (node != NULL && parser.frames_count > base) {
+            node = end_statement(node);
+        }
+        if (node != NULL) return node;
+    }
 }
 
-static ASTNode* parse_assignment() {
-    ASTNode* expression = parse_equality();
-
-    if (match(1, TOKEN_EQUAL)) {
-        ASTNode* value = parse_assignment();
+static ASTNode* parse_simple_statement() {
+    if (match(1, TOKEN_BREAK)) {
+        if (parser.breakable_depth == 0) {
+            fprintf(diagnostics(), "%s:%d: error: 'break' outside of loop or switch\n", parser.file_path, line_of(previous()));
+            fail();
+        }
+        consume_expected(TOKEN_SEMICOLON, "expected ';' after 'break'");
+        return make_node_break_statement();
+    }
 
-        if (expression->type == AST_NODE_VARIABLE) {
-            char* name = expression->name;
-            expression->type = AST_NODE_ASSIGNMENT;
-            expression->assignment.name = name;
-            expression->assignment.value = value;
-            return expression;
+    if (match(1, TOKEN_RETURN)) {
+        ASTNode* expression = NULL;
+        if (parser.current->type != TOKEN_SEMICOLON) {
+            expression = parse_expression();
         }
-        fprintf(stderr, "error: invalid assignment target\n");
-        exit(1);
+        consume_expected(TOKEN_SEMICOLON, "expected ';' after return");
+        return make_node_return_statement(expression);
+    }
+
+    // `print x;` is a call of the runtime print, print is a keyword so no function can have
+    // the name
+    if (match(1, TOKEN_PRINT)) {
+        ASTNode* call = make_node_call(strdup("print"));
+        append_node(&call->call.arguments, &call->call.count, &call->call.capacity, parse_expression());
+        consume_expected(TOKEN_SEMICOLON, "expected ';' after print");
+        return make_node_expression_statement(call);
     }
 
-    return expression;
+    ASTNode* expression = parse_expression();
+    consume_expected(TOKEN_SEMICOLON, "expected ';' after expression");
+    return make_node_expression_statement(expression);
 }
 
-static ASTNode* parse_equality() {
-    ASTNode* left = parse_comparison();
+// case labels and vector initializers, a number with an optional minus sign
+static Word parse_constant() {
+    bool negative = match(1, TOKEN_MINUS);
+    consume_expected(TOKEN_WORD_LITERAL, "expected constant");
+    Word value = strtoll(value_of(previous()), NULL, 10);
+    return negative ? -value : value;
+}
 
-    while (match(2, TOKEN_EQUAL_EQUAL, TOKEN_NOT_EQUAL)) {
-        TokenType op = previous()->type;
-        ASTNode* right = parse_comparison();
-        left = make_node_binary(left, op, right);
+// from '=', which groups to the right, to '*', '/' and '%', 0 for other tokens
+static int binary_precedence(TokenType type) {
+    switch (type) {
+        case TOKEN_EQUAL: return ASSIGNMENT_PRECEDENCE;
+        case TOKEN_EQUAL_EQUAL:
+        case TOKEN_NOT_EQUAL: return 2;
+        case TOKEN_GREATER:
+        case TOKEN_GREATER_EQUAL:
+        case TOKEN_LESS:
+        case TOKEN_LESS_EQUAL: return 3;
+        case TOKEN_PLUS:
+        case TOKEN_MINUS: return 4;
+        case TOKEN_SLASH:
+        case TOKEN_ASTERISK:
+        case TOKEN_PERCENT: return 5;
+        default: return 0;
     }
-    return left;
 }
 
-static ASTNode* parse_comparison() {
-    ASTNode* left = parse_term();
-
-    while (match(4, TOKEN_GREATER, TOKEN_GREATER_EQUAL, TOKEN_LESS, TOKEN_LESS_EQUAL)) {
-        TokenType op = previous()->type;
-        ASTNode* right = parse_term();
-        left = make_node_binary(left, op, right);
-    }
-    return left;
+static void push_operand(ASTNode* node) {
+    append_node(&parser.operands, &parser.operands_count, &parser.operands_capacity, node);
 }
 
-static ASTNode* parse_term() {
-    ASTNode* left = parse_factor();
+static ASTNode* pop_operand() {
+    return parser.operands[--parser.operands_count];
+}
 
-    while (match(2, TOKEN_PLUS, TOKEN_MINUS)) {
-        TokenType op = previous()->type;
-        ASTNode* right = parse_factor();
-        left = make_node_binary(left, op, right);
+static void push_operator(OperatorKind kind, TokenType op, ASTNode* call) {
+    if (parser.operators_capacity < parser.operators_count + 1) {
+        int old_capacity = parser.operators_capacity;
+        parser.operators_capacity = GROW_CAPACITY(old_capacity);
+        parser.operators = GROW_ARRAY(PendingOperator, parser.operators, old_capacity, parser.operators_capacity);
     }
-    return left;
+    parser.operators[parser.operators_count++] = (PendingOperator) { .kind = kind, .op = op, .call = call };
 }
 
-static ASTNode* parse_factor() {
-    ASTNode* left = parse_unary();
+static PendingOperator* top_operator(int base) {
+    return parser.operators_count > base ? &parser.operators[parser.operators_count - 1] : NULL;
+}
 
-    while (match(3, TOKEN_SLASH, TOKEN_ASTERISK, TOKEN_PERCENT)) {
-        TokenType op = previous()->type;
-        ASTNode* right = parse_unary();
-        left = make_node_binary(left, op, right);
+// Applies the pending binary operators and assignments that bind tighter than an operator
+// of the precedence, down to the innermost parenthesis, subscript or call.
+static void reduce_operators(int base, int precedence) {
+    for (PendingOperator* top = top_operator(base); top != NULL && top->kind == OPERATOR_BINARY; top = top_operator(base)) {
+        int top_precedence = binary_precedence(top->op);
+        if (top_precedence < precedence || (top_precedence == precedence && precedence == ASSIGNMENT_PRECEDENCE)) {
+            return;
+        }
+        --parser.operators_count;
+        ASTNode* right = pop_operand();
+        ASTNode* left = pop_operand();
+        if (top->op != TOKEN_EQUAL) {
+            push_operand(make_node_binary(left, top->op, right));
+            continue;
+        }
+
+        if (left->type == AST_NODE_VARIABLE) {
+            char* name = left->name;
+            left->type = AST_NODE_ASSIGNMENT;
+            left->assignment.name = name;
+            left->assignment.value = right;
+        }
+        else if (left->type == AST_NODE_SUBSCRIPT) {
+            left->type = AST_NODE_SUBSCRIPT_ASSIGNMENT;
+            left->subscript.value = right;
+        }
+        else {
+            fprintf(diagnostics(), "error: invalid assignment target\n");
+            fail();
+        }
+        push_operand(left);
     }
-    return left;
 }
 
-static ASTNode* parse_unary() {
+// Parses a literal, string or name with the unary operator before it. Returns false after an
+// opening parenthesis or the opening of a call with arguments, where an operand comes next.
+static bool parse_operand() {
+    // the operand of a unary operator cannot have one of its own
     if (match(2, TOKEN_MINUS, TOKEN_NOT)) {
-        TokenType op = previous()->type;
-        ASTNode* right = parse_primary();
-        return make_node_unary(op, right);
+        push_operator(OPERATOR_UNARY, previous()->type, NULL);
     }
-    return parse_primary();
-}
 
-static ASTNode* parse_primary() {
     if (match(1, TOKEN_WORD_LITERAL)) {
-        Word value = strtoll(previous()->value, NULL, 10);
-        return make_node_literal(value);
+        Word value = strtoll(value_of(previous()), NULL, 10);
+        push_operand(make_node_literal(value));
+        return true;
+    }
+    if (match(1, TOKEN_STRING_LITERAL)) {
+        push_operand(parse_string(previous()));
+        return true;
     }
     if (match(1, TOKEN_LEFT_PAREN)) {
-        ASTNode* inside = parse_expression();
-        consume_expected(TOKEN_RIGHT_PAREN, "expected closing parenthesis");
-        return inside;
+        push_operator(OPERATOR_PARENTHESIS, TOKEN_LEFT_PAREN, NULL);
+        return false;
     }
     if (match(1, TOKEN_IDENTIFIER)) {
-        char* name = strndup(previous()->value, previous()->length);
-        return make_node_variable(name);
+        char* name = strndup(value_of(previous()), previous()->length);
+        if (match(1, TOKEN_LEFT_PAREN)) {
+            ASTNode* node = make_node_call(name);
+            if (parser.current->type != TOKEN_RIGHT_PAREN) {
+                push_operator(OPERATOR_CALL, TOKEN_LEFT_PAREN, node);
+                return false;
+            }
+            consume_expected(TOKEN_RIGHT_PAREN, "expected ')' after arguments");
+            push_operand(node);
+            return true;
+        }
+        push_operand(make_node_variable(name));
+        return true;
     }
     fprintf(
-        stderr, "%s:%d: error: invalid token: '%.*s'\n",    
+        diagnostics(), "%s:%d: error: invalid token: '%.*s'\n",    
         parser.file_path,
-        parser.current->line,    
-        parser.current->length,    
-        parser.current->value
+        line_of(parser.current),    
+        length_of(parser.current),
+        value_of(parser.current)
     );
-    exit(1);
+    fail();
 }
 
-ASTNode* parser_parse(const char* file_path, TokenArray* token_array) {
+// Closes the innermost parenthesis, subscript or call around the complete operand. Returns
+// false when a call goes on with another argument.
+static bool close_operator() {
+    PendingOperator* top = &parser.operators[parser.operators_count - 1];
+    switch (top->kind) {
+        case OPERATOR_PARENTHESIS: {
+            consume_expected(TOKEN_RIGHT_PAREN, "expected closing parenthesis");
+        } break;
+        case OPERATOR_SUBSCRIPT: {
+            consume_expected(TOKEN_RIGHT_BRACKET, "expected ']' after index");
+            ASTNode* index = pop_operand();
+            ASTNode* vector = pop_operand();
+            push_operand(make_node_subscript(vector, index));
+        } break;
+        default: {
+            ASTNode* call = top->call;
+            append_node(&call->call.arguments, &call->call.count, &call->call.capacity, pop_operand());
+            if (match(1, TOKEN_COMMA)) return false;
+            consume_expected(TOKEN_RIGHT_PAREN, "expected ')' after arguments");
+            push_operand(call);
+        } break;
+    }
+    --parser.operators_count;
+    return true;
+}
+
+// A precedence climbing loop over explicit stacks of operands and pending operators, so the
+// nesting of parentheses, subscripts and calls is only bounded by memory.
+static ASTNode* parse_expression() {
+    int base = parser.operators_count;
+    for (;;) {
+        if (!parse_operand()) continue;
+        // the operand goes on with subscripts, then an operator or what closes it
+        for (;;) {
+            if (match(1, TOKEN_LEFT_BRACKET)) {
+                push_operator(OPERATOR_SUBSCRIPT, TOKEN_LEFT_BRACKET, NULL);
+                break;
+            }
+            PendingOperator* top = top_operator(base);
+            if (top != NULL && top->kind == OPERATOR_UNARY) {
+                --parser.operators_count;
+                push_operand(make_node_unary(top->op, pop_operand()));
+            }
+
+            int precedence = binary_precedence(parser.current->type);
+            if (precedence > 0) {
+                reduce_operators(base, precedence);
+                push_operator(OPERATOR_BINARY, parser.current->type, NULL);
+                ++parser.current;
+                break;
+            }
+            reduce_operators(base, 0);
+            if (parser.operators_count == base) {
+                return pop_operand();
+            }
+            if (!close_operator()) break;
+        }
+    }
+}
+
+void parser_begin(const char* file_path) {
     parser.file_path = file_path;
+    parser.globals_count = 0;
+    parser.next_global = 0;
+    parser.global_extrns_count = 0;
+    parser.current_switch = NULL;
+    parser.breakable_depth = 0;
+    parser.site_count = 0;
+    parser.implicit_main_body = NULL;
+    parser.has_statements = false;
+    parser.has_main = false;
+    // a parse that failed may have left them
+    parser.frames_count = 0;
+    parser.operators_count = 0;
+    parser.operands_count = 0;
+}
+
+void parser_set_tokens(TokenArray* token_array, Token* first) {
+    parser.token_array = token_array;
     parser.tokens = token_array->tokens;
     parser.count = token_array->count;
-    parser.current = parser.tokens;
+    parser.current = first;
+}
 
-    return parse_program();
+static void free_globals() {
+    free(parser.globals);
+    parser.globals = NULL;
+    parser.globals_count = 0;
+    parser.globals_capacity = 0;
+    parser.next_global = 0;
+    // declared after the last statement
+    for (int i = 0; i < parser.global_extrns_count; ++i) {
+        parser_free_ast(parser.global_extrns[i]);
+    }
+    free(parser.global_extrns);
+    parser.global_extrns = NULL;
+    parser.global_extrns_count = 0;
+    parser.global_extrns_capacity = 0;
 }
 
-void parser_free_ast(ASTNode* root) {
-    switch (root->type) {
+static void free_stacks() {
+    free(parser.frames);
+    free(parser.operators);
+    free(parser.operands);
+    parser.frames = NULL;
+    parser.frames_capacity = 0;
+    parser.operators = NULL;
+    parser.operators_capacity = 0;
+    parser.operands = NULL;
+    parser.operands_capacity = 0;
+}
+
+ASTNode* parser_parse(const char* file_path, TokenArray* token_array) {
+    parser_begin(file_path);
+    parser_set_tokens(token_array, token_array->tokens);
+
+    ASTNode* program = parse_program();
+    free_globals();
+    free_stacks();
+    program->program.site_count = parser.site_count;
+    program->program.source = token_array->source;
+    return program;
+}
+
+ASTNode* parser_next_definition() {
+    return parse_definition();
+}
+
+ASTNode* parser_take_statements() {
+    ASTNode* statements = parser.implicit_main_body;
+    parser.implicit_main_body = NULL;
+    return statements;
+}
+
+ASTNode* parser_end(int* site_count) {
+    *site_count = parser.site_count;
+    free_globals();
+    free_stacks();
+    return make_implicit_main();
+}
+
+typedef struct FreedNode {
+    ASTNode* node;
+    int next_child;
+} FreedNode;
+
+typedef struct FreeStack {
+    FreedNode* items;
+    int count;
+    int capacity;
+} FreeStack;
+
+static void push_freed(FreeStack* stack, ASTNode* node) {
+    if (stack->capacity < stack->count + 1) {
+        int old_capacity = stack->capacity;
+        stack->capacity = GROW_CAPACITY(old_capacity);
+        stack->items = GROW_ARRAY(FreedNode, stack->items, old_capacity, stack->capacity);
+    }
+    stack->items[stack->count++] = (FreedNode) { .node = node, .next_child = 0 };
+}
+
+ASTNode** parser_child_slot(ASTNode* node, int index) {
+    switch (node->type) {
         case AST_NODE_PROGRAM: {
-            for (int i = 0; i < root->program.count; ++i) {
-                parser_free_ast(root->program.statements[i]);
-            }
-            free(root->program.statements);
-        } break;
+            return index < node->program.count ? &node->program.statements[index] : NULL;
+        }
+        case AST_NODE_FUNCTION: {
+            return index == 0 ? &node->function.body : NULL;
+        }
         case AST_NODE_BLOCK: {
-            for (int i = 0; i < root->block.count; ++i) {
-                parser_free_ast(root->block.statements[i]);
-            }
-            free(root->block.statements);
-        } break;
-        case AST_NODE_EXPRESSION_STATEMENT: {
-            parser_free_ast(root->expression);
-        } break;
-        case AST_NODE_IF_STATEMENT : {
-            parser_free_ast(root->if_statement.condition);
-            parser_free_ast(root->if_statement.then_branch);
-            if (root->if_statement.else_branch != NULL) {
-                parser_free_ast(root->if_statement.else_branch);
+            return index < node->block.count ? &node->block.statements[index] : NULL;
+        }
+        case AST_NODE_EXPRESSION_STATEMENT:
+        case AST_NODE_RETURN_STATEMENT: {
+            return index == 0 ? &node->expression : NULL;
+        }
+        case AST_NODE_IF_STATEMENT: {
+            switch (index) {
+                case 0: return &node->if_statement.condition;
+                case 1: return &node->if_statement.then_branch;
+                case 2: return &node->if_statement.else_branch;
+                default: return NULL;
             }
-        } break;
+        }
         case AST_NODE_WHILE_STATEMENT: {
-            parser_free_ast(root->while_statement.condition);
-            parser_free_ast(root->while_statement.body);
-        } break;
-        case AST_NODE_VARIABLE_DECLARATION: {
-            free(root->name);
-        } break;
+            return index == 0 ? &node->while_statement.condition :
+                   index == 1 ? &node->while_statement.body : NULL;
+        }
+        case AST_NODE_SWITCH_STATEMENT: {
+            return index == 0 ? &node->switch_statement.condition :
+                   index == 1 ? &node->switch_statement.body : NULL;
+        }
+        case AST_NODE_CASE: {
+            return index == 0 ? &node->case_label.statement : NULL;
+        }
         case AST_NODE_ASSIGNMENT: {
-            free(root->assignment.name);
-            parser_free_ast(root->assignment.value);
-        } break;
+            return index == 0 ? &node->assignment.value : NULL;
+        }
         case AST_NODE_BINARY: {
-            parser_free_ast(root->binary.left);
-            parser_free_ast(root->binary.right);
-        } break;
+            return index == 0 ? &node->binary.left :
+                   index == 1 ? &node->binary.right : NULL;
+        }
         case AST_NODE_UNARY: {
-            parser_free_ast(root->unary.right);
-        } break;
-        case AST_NODE_LITERAL: break;
-        case AST_NODE_VARIABLE: {
-            free(root->name);
-        } break;
-        default: {
-            fprintf(stderr, "error: unknown AST node to free: %d\n", root->type);
-        } break;
+            return index == 0 ? &node->unary.right : NULL;
+        }
+        case AST_NODE_SUBSCRIPT:
+        case AST_NODE_SUBSCRIPT_ASSIGNMENT: {
+            switch (index) {
+                case 0: return &node->subscript.vector;
+                case 1: return &node->subscript.index;
+                case 2: return &node->subscript.value;
+                default: return NULL;
+            }
+        }
+        case AST_NODE_CALL: {
+            return index < node->call.count ? &node->call.arguments[index] : NULL;
+        }
+        case AST_NODE_INLINED_CALL: {
+            if (index < node->inlined_call.count) return &node->inlined_call.arguments[index];
+            return index == node->inlined_call.count ? &node->inlined_call.body : NULL;
+        }
+        default: return NULL;
     }
-    free (root);
 }
 
-void parser_print_output(ASTNode* root, int indent) {
-    for (int i = 0; i < indent; ++i) printf("  ");
-
-    switch (root->type) {
+// what the node owns besides its children, and the node
+static void free_node(ASTNode* node) {
+    switch (node->type) {
         case AST_NODE_PROGRAM: {
-            printf("Program:\n");
-            for (int i = 0; i < root->program.count; ++i) {
-                parser_print_output(root->program.statements[i], indent + 1);                
-            }
+            free(node->program.statements);
         } break;
-        case AST_NODE_BLOCK: {
-            printf("Block:\n");
-            for (int i = 0; i < root->block.count; ++i) {
-                parser_print_output(root->block.statements[i], indent + 1);                
+        case AST_NODE_FUNCTION: {
+            free(node->function.name);
+            for (int i = 0; i < node->function.parameter_count; ++i) {
+                free(node->function.parameters[i]);
             }
+            free(node->function.parameters);
         } break;
-        case AST_NODE_EXPRESSION_STATEMENT: {
-            printf("ExprStmt:\n");
-            parser_print_output(root->expression, indent + 1);
+        case AST_NODE_BLOCK: {
+            free(node->block.statements);
         } break;
-        case AST_NODE_IF_STATEMENT: {
-            printf("If:\n");
-            parser_print_output(root->if_statement.condition, indent + 1);
-            for (int i = 0; i < indent; ++i) printf("  ");
-            printf("Then:\n");
-            parser_print_output(root->if_statement.then_branch, indent + 1);
-            if (root->if_statement.else_branch != NULL) {
-                for (int i = 0; i < indent; ++i) printf("  ");
-                printf("Else:\n");
-                parser_print_output(root->if_statement.else_branch, indent + 1);
-            }
+        case AST_NODE_SWITCH_STATEMENT: {
+            free(node->switch_statement.cases);
         } break;
-        case AST_NODE_WHILE_STATEMENT: {
-            printf("While:\n");
-            parser_print_output(root->while_statement.condition, indent + 1);
-            for (int i = 0; i < indent; ++i) printf("  ");
-            printf("Then:\n");
-            parser_print_output(root->while_statement.body, indent + 1);
+        case AST_NODE_EXPRESSION_STATEMENT:
+        case AST_NODE_RETURN_STATEMENT:
+        case AST_NODE_IF_STATEMENT:
+        case AST_NODE_WHILE_STATEMENT:
+        case AST_NODE_CASE:
+        case AST_NODE_BREAK_STATEMENT:
+        case AST_NODE_BINARY:
+        case AST_NODE_UNARY:
+        case AST_NODE_SUBSCRIPT:
+        case AST_NODE_SUBSCRIPT_ASSIGNMENT:
+        case AST_NODE_LITERAL: break;
+        case AST_NODE_VECTOR_DEFINITION: {
+            free(node->vector.name);
+            free(node->vector.values);
         } break;
         case AST_NODE_VARIABLE_DECLARATION: {
-            printf("VarDecl: %s\n", root->name);
+            free(node->declaration.name);
         } break;
-        case AST_NODE_ASSIGNMENT: {
-            printf("Assignment: %s\n", root->assignment.name);
-            parser_print_output(root->assignment.value, indent + 1);
+        case AST_NODE_EXTRN_DECLARATION:
+        case AST_NODE_VARIABLE: {
+            free(node->name);
         } break;
-        case AST_NODE_BINARY: {
-            printf("Binary: %s\n", token_as_cstr(root->binary.op));
-            parser_print_output(root->binary.left, indent + 1);
-            parser_print_output(root->binary.right, indent + 1);
+        case AST_NODE_ASSIGNMENT: {
+            free(node->assignment.name);
         } break;
-        case AST_NODE_UNARY: {
-            printf("Unary: %s\n", token_as_cstr(root->unary.op));
-            parser_print_output(root->unary.right, indent + 1);
+        case AST_NODE_STRING: {
+            free(node->string.bytes);
         } break;
-        case AST_NODE_LITERAL: {
-            printf("Literal: %ld\n", root->literal);
+        case AST_NODE_CALL: {
+            free(node->call.name);
+            free(node->call.arguments);
         } break;
-        case AST_NODE_VARIABLE: {
-            printf("Variable: %s\n", root->name);
+        case AST_NODE_INLINED_CALL: {
+            free(node->inlined_call.name);
+            for (int i = 0; i < node->inlined_call.count; ++i) {
+                free(node->inlined_call.parameters[i]);
+            }
+            free(node->inlined_call.parameters);
+            free(node->inlined_call.arguments);
         } break;
         default: {
-            fprintf(stderr, "%s:%d: error: unknown AST node: %d\n", parser.file_path, parser.current->line, root->type);
-            exit(1);
+            fprintf(diagnostics(), "error: unknown AST node to free: %d\n", node->type);
         } break;
     }
+    free(node);
+}
+
+// The nodes on the way down to the one being freed are on a stack of their own, so deep trees
+// do not need a deep C stack. Every node is freed after its children, in about the order the
+// parser made them, and the stack only grows with the depth of the tree: a large block freed
+// here would make malloc sort out every node freed before it.
+void parser_free_ast(ASTNode* root) {
+    FreeStack stack = { 0 };
+    push_freed(&stack, root);
+    while (stack.count > 0) {
+        FreedNode* top = &stack.items[stack.count - 1];
+        ASTNode** child = parser_child_slot(top->node, top->next_child++);
+        if (child == NULL) {
+            free_node(top->node);
+            --stack.count;
+        }
+        else if (*child != NULL) {
+            push_freed(&stack, *child);
+        }
+    }
+    free(stack.items);
+}
+
+// A node left to print, or a line printed between the children of one.
+typedef struct PrintItem {
+    ASTNode* node;
+    int indent;
+    // printed instead of a node, followed by the name when there is one
+    const char* label;
+    const char* name;
+} PrintItem;
+
+typedef struct PrintStack {
+    PrintItem* items;
+    int count;
+    int capacity;
+} PrintStack;
+
+static void push_item(PrintStack* stack, PrintItem item) {
+    if (stack->capacity < stack->count + 1) {
+        int old_capacity = stack->capacity;
+        stack->capacity = GROW_CAPACITY(old_capacity);
+        stack->items = GROW_ARRAY(PrintItem, stack->items, old_capacity, stack->capacity);
+    }
+    stack->items[stack->count++] = item;
+}
+
+static void push_printed(PrintStack* stack, ASTNode* node, int indent) {
+    push_item(stack, (PrintItem) { .node = node, .indent = indent });
+}
+
+static void push_label(PrintStack* stack, const char* label, const char* name, int indent) {
+    push_item(stack, (PrintItem) { .label = label, .name = name, .indent = indent });
+}
+
+// Children are pushed last to first, so they come off the stack in order.
+void parser_print_output(ASTNode* root, int indent) {
+    PrintStack stack = { 0 };
+    push_printed(&stack, root, indent);
+    while (stack.count > 0) {
+        PrintItem item = stack.items[--stack.count];
+        for (int i = 0; i < item.indent && i < PRINT_INDENT_MAX; ++i) printf("  ");
+        if (item.indent > PRINT_INDENT_MAX) printf("[%d] ", item.indent);
+        if (item.node == NULL) {
+            printf(item.name != NULL ? "%s%s\n" : "%s\n", item.label, item.name);
+            continue;
+        }
+
+        ASTNode* node = item.node;
+        int child_indent = item.indent + 1;
+        switch (node->type) {
+            case AST_NODE_PROGRAM: {
+                printf("Program:\n");
+                for (int i = node->program.count - 1; i >= 0; --i) {
+                    push_printed(&stack, node->program.statements[i], child_indent);
+                }
+            } break;
+            case AST_NODE_FUNCTION: {
+                printf("Function: %s(", node->function.name);
+                for (int i = 0; i < node->function.parameter_count; ++i) {
+                    printf(i == 0 ? "%s" : ", %s", node->function.parameters[i]);
+                }
+                printf(")\n");
+                push_printed(&stack, node->function.body, child_indent);
+            } break;
+            case AST_NODE_VECTOR_DEFINITION: {
+                if (node->vector.is_scalar) {
+                    printf("Word: %s\n", node->vector.name);
+                    break;
+                }
+                printf("Vector: %s[%ld]", node->vector.name, node->vector.bound);
+                for (int i = 0; i < node->vector.count; ++i) {
+                    printf(i == 0 ? " %ld" : ", %ld", node->vector.values[i]);
+                }
+                printf("\n");
+            } break;
+            case AST_NODE_BLOCK: {
+                printf("Block:\n");
+                for (int i = node->block.count - 1; i >= 0; --i) {
+                    push_printed(&stack, node->block.statements[i], child_indent);
+                }
+            } break;
+            case AST_NODE_EXPRESSION_STATEMENT: {
+                printf("ExprStmt:\n");
+                push_printed(&stack, node->expression, child_indent);
+            } break;
+            case AST_NODE_IF_STATEMENT: {
+                printf("If:\n");
+                if (node->if_statement.else_branch != NULL) {
+                    push_printed(&stack, node->if_statement.else_branch, child_indent);
+                    push_label(&stack, "Else:", NULL, item.indent);
+                }
+                push_printed(&stack, node->if_statement.then_branch, child_indent);
+                push_label(&stack, "Then:", NULL, item.indent);
+                push_printed(&stack, node->if_statement.condition, child_indent);
+            } break;
+            case AST_NODE_WHILE_STATEMENT: {
+                printf("While:\n");
+                push_printed(&stack, node->while_statement.body, child_indent);
+                push_label(&stack, "Then:", NULL, item.indent);
+                push_printed(&stack, node->while_statement.condition, child_indent);
+            } break;
+            case AST_NODE_SWITCH_STATEMENT: {
+                printf("Switch:\n");
+                push_printed(&stack, node->switch_statement.body, child_indent);
+                push_label(&stack, "Body:", NULL, item.indent);
+                push_printed(&stack, node->switch_statement.condition, child_indent);
+            } break;
+            case AST_NODE_CASE: {
+                if (node->case_label.is_default) {
+                    printf("Default:\n");
+                }
+                else {
+                    printf("Case: %ld\n", node->case_label.value);
+                }
+                push_printed(&stack, node->case_label.statement, child_indent);
+            } break;
+            case AST_NODE_BREAK_STATEMENT: {
+                printf("Break\n");
+            } break;
+            case AST_NODE_RETURN_STATEMENT: {
+                printf("Return:\n");
+                if (node->expression != NULL) {
+                    push_printed(&stack, node->expression, child_indent);
+                }
+            } break;
+            case AST_NODE_EXTRN_DECLARATION: {
+                printf("Extrn: %s\n", node->name);
+            } break;
+            case AST_NODE_VARIABLE_DECLARATION: {
+                if (node->declaration.is_vector) {
+                    printf("VarDecl: %s[%ld]\n", node->declaration.name, node->declaration.bound);
+                }
+                else {
+                    printf("VarDecl: %s\n", node->declaration.name);
+                }
+            } break;
+            case AST_NODE_ASSIGNMENT: {
+                printf("Assignment: %s\n", node->assignment.name);
+                push_printed(&stack, node->assignment.value, child_indent);
+            } break;
+            case AST_NODE_BINARY: {
+                printf("Binary: %s\n", token_as_cstr(node->binary.op));
+                push_printed(&stack, node->binary.right, child_indent);
+                push_printed(&stack, node->binary.left, child_indent);
+            } break;
+            case AST_NODE_UNARY: {
+                printf("Unary: %s\n", token_as_cstr(node->unary.op));
+                push_printed(&stack, node->unary.right, child_indent);
+            } break;
+            case AST_NODE_LITERAL: {
+                printf("Literal: %ld\n", node->literal);
+            } break;
+            case AST_NODE_STRING: {
+                printf("String: \"");
+                for (int i = 0; i < node->string.length; ++i) {
+                    unsigned char c = node->string.bytes[i];
+                    printf(c >= ' ' && c <= '~' && c != '*' ? "%c" : "*%03o", c);
+                }
+                printf("\"\n");
+            } break;
+            case AST_NODE_VARIABLE: {
+                printf("Variable: %s\n", node->name);
+            } break;
+            case AST_NODE_SUBSCRIPT: {
+                printf("Subscript:\n");
+                push_printed(&stack, node->subscript.index, child_indent);
+                push_printed(&stack, node->subscript.vector, child_indent);
+            } break;
+            case AST_NODE_SUBSCRIPT_ASSIGNMENT: {
+                printf("SubscriptAssignment:\n");
+                push_printed(&stack, node->subscript.value, child_indent);
+                push_printed(&stack, node->subscript.index, child_indent);
+                push_printed(&stack, node->subscript.vector, child_indent);
+            } break;
+            case AST_NODE_CALL: {
+                printf("Call: %s\n", node->call.name);
+                for (int i = node->call.count - 1; i >= 0; --i) {
+                    push_printed(&stack, node->call.arguments[i], child_indent);
+                }
+            } break;
+            case AST_NODE_INLINED_CALL: {
+                printf("InlinedCall: %s\n", node->inlined_call.name);
+                push_printed(&stack, node->inlined_call.body, child_indent);
+                for (int i = node->inlined_call.count - 1; i >= 0; --i) {
+                    push_printed(&stack, node->inlined_call.arguments[i], child_indent);
+                    push_label(&stack, "Argument: ", node->inlined_call.parameters[i], item.indent);
+                }
+            } break;
+            default: {
+                fprintf(diagnostics(), "%s:%d: error: unknown AST node: %d\n", parser.file_path, line_of(parser.current), node->type);
+                free(stack.items);
+                fail();
+            } break;
+        }
+    }
+    free(stack.items);
 }
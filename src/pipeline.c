@@ -0,0 +1,525 @@
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "compiler.h"
+#include "lexer.h"
+#include "optimizer.h"
+#include "parser.h"
+#include "pipeline.h"
+#include "ring.h"
+#include "utils.h"
+
+// batches are cut at the first definition or statement ending after this many tokens, so at
+// most RING_CAPACITY of them wait for the parser
+#define PIPELINE_BATCH_TOKENS 4096
+// no stage recurses on the depth of the source, this is far more than their deepest calls use
+#define PIPELINE_THREAD_STACK_SIZE (1024 * 1024)
+
+typedef enum {
+    STAGE_SCANNER,
+    STAGE_LEXER,
+    STAGE_PARSER,
+    STAGE_CODEGEN,
+    STAGES_COUNT
+} StageKind;
+
+// Diagnostics of a stage are kept until all of them finished, then they are printed in the
+// order of the stages and the first failed one ends the compilation. A compiler error is only
+// reported when parsing succeeded, like without the pipeline.
+typedef struct Stage {
+    char* diagnostics;
+    size_t diagnostics_size;
+    bool has_failed;
+} Stage;
+
+// Tokens of whole definitions and statements ending with TOKEN_EOF. Every batch after the
+// first one starts with the last token of the previous one, see make_node in the parser.
+typedef struct TokenBatch {
+    TokenArray tokens;
+    int first;
+} TokenBatch;
+
+typedef struct Pipeline {
+    Source* source;
+    const Options* options;
+    atomic_bool is_cancelled;
+    // TokenBatch pointers, NULL after the last one
+    Ring batches;
+    // definitions in the order they were parsed, NULL after the last one
+    Ring definitions;
+    // Collected from the tokens by the scanner, so the code generator knows every name before
+    // the parser got to it. Complete once are_symbols_ready is set.
+    ProgramSymbols symbols;
+    atomic_bool are_symbols_ready;
+    // extrn declarations of the statements outside of functions come after the ones of all
+    // functions, their implicit main is the last function
+    const char** main_extrns;
+    int main_extrns_count;
+    int main_extrns_capacity;
+    bool has_implicit_main;
+    int definitions_capacity;
+    // set by the parser before it passes the last definition
+    int site_count;
+    Stage stages[STAGES_COUNT];
+} Pipeline;
+
+static void add_name(const char*** names, int* count, int* capacity, const char* name) {
+    if (*capacity < *count + 1) {
+        int old_capacity = *capacity;
+        *capacity = GROW_CAPACITY(old_capacity);
+        *names = GROW_ARRAY(const char*, *names, old_capacity, *capacity);
+    }
+    (*names)[(*count)++] = name;
+}
+
+static char* token_name(const TokenArray* tokens, const Token* token) {
+    return strndup(token_value(tokens, token), token->length);
+}
+
+static void add_definition(Pipeline* pipeline, const TokenArray* tokens, const Token* name, bool is_vector) {
+    ProgramSymbols* symbols = &pipeline->symbols;
+    if (pipeline->definitions_capacity < symbols->definitions_count + 1) {
+        int old_capacity = pipeline->definitions_capacity;
+        pipeline->definitions_capacity = GROW_CAPACITY(old_capacity);
+        symbols->definitions = GROW_ARRAY(const char*, symbols->definitions, old_capacity, pipeline->definitions_capacity);
+        symbols->is_vector = GROW_ARRAY(bool, symbols->is_vector, old_capacity, pipeline->definitions_capacity);
+    }
+    symbols->definitions[symbols->definitions_count] = name != NULL ? token_name(tokens, name) : strdup("main");
+    symbols->is_vector[symbols->definitions_count++] = is_vector;
+}
+
+// Looks at a definition or statement the way the parser will, from start to the token after it.
+static void add_symbols(Pipeline* pipeline, const TokenArray* tokens, int start, int end) {
+    const Token* token = tokens->tokens + start;
+    bool is_function = parser_is_function_definition(token);
+    if (is_function || parser_is_vector_definition(token)) {
+        add_definition(pipeline, tokens, token, !is_function);
+    }
+    else if (!parser_is_global_declaration(token)) {
+        pipeline->has_implicit_main = true;
+    }
+    // `auto a, v[10];` defines a and v, the extrn declarations of main are the parser's
+    if (parser_is_global_declaration(token)) {
+        for (int i = start + 1; i < end && tokens->tokens[i].type == TOKEN_IDENTIFIER; ++i) {
+            add_definition(pipeline, tokens, &tokens->tokens[i], true);
+            while (i + 1 < end && tokens->tokens[i + 1].type != TOKEN_COMMA && tokens->tokens[i + 1].type != TOKEN_SEMICOLON) {
+                ++i;
+            }
+            i += 1;
+        }
+    }
+
+    // `extrn a, b;`
+    ProgramSymbols* symbols = &pipeline->symbols;
+    for (int i = start; i < end; ++i) {
+        if (tokens->tokens[i].type != TOKEN_EXTRN) continue;
+
+        while (i + 1 < end && tokens->tokens[i + 1].type == TOKEN_IDENTIFIER) {
+            char* name = token_name(tokens, &tokens->tokens[i + 1]);
+            if (is_function) {
+                add_name(&symbols->extrns, &symbols->extrns_count, &symbols->extrns_capacity, name);
+            }
+            else {
+                add_name(&pipeline->main_extrns, &pipeline->main_extrns_count, &pipeline->main_extrns_capacity, name);
+            }
+            i += 2;
+            if (i >= end || tokens->tokens[i].type != TOKEN_COMMA) break;
+        }
+    }
+}
+
+static void finish_symbols(Pipeline* pipeline) {
+    ProgramSymbols* symbols = &pipeline->symbols;
+    for (int i = 0; i < pipeline->main_extrns_count; ++i) {
+        add_name(&symbols->extrns, &symbols->extrns_count, &symbols->extrns_capacity, pipeline->main_extrns[i]);
+    }
+    free(pipeline->main_extrns);
+    pipeline->main_extrns = NULL;
+    pipeline->main_extrns_count = 0;
+    if (pipeline->has_implicit_main) {
+        add_definition(pipeline, NULL, NULL, false);
+    }
+    atomic_store_explicit(&pipeline->are_symbols_ready, true, memory_order_release);
+}
+
+static void free_symbols(Pipeline* pipeline) {
+    ProgramSymbols* symbols = &pipeline->symbols;
+    for (int i = 0; i < symbols->definitions_count; ++i) {
+        free((char*)symbols->definitions[i]);
+    }
+    free(symbols->definitions);
+    free(symbols->is_vector);
+    for (int i = 0; i < symbols->extrns_count; ++i) {
+        free((char*)symbols->extrns[i]);
+    }
+    free(symbols->extrns);
+    for (int i = 0; i < pipeline->main_extrns_count; ++i) {
+        free((char*)pipeline->main_extrns[i]);
+    }
+    free(pipeline->main_extrns);
+}
+
+static void append_token(TokenArray* array, Token token) {
+    if (array->capacity < array->count + 1) {
+        int old_capacity = array->capacity;
+        array->capacity = GROW_CAPACITY(old_capacity);
+        array->tokens = GROW_ARRAY(Token, array->tokens, old_capacity, array->capacity);
+    }
+    array->tokens[array->count++] = token;
+}
+
+static void free_batch(TokenBatch* batch) {
+    if (batch == NULL) return;
+    lexer_free_tokens(&batch->tokens);
+    free(batch);
+}
+
+static TokenBatch* make_batch(Source* source) {
+    TokenBatch* batch = malloc(sizeof(TokenBatch));
+    if (batch == NULL) {
+        fprintf(diagnostics(), "error: out of memory\n");
+        fail();
+    }
+    *batch = (TokenBatch) { .tokens = { .source = source }, .first = 0 };
+    return batch;
+}
+
+// the tokens of the definition or statement being scanned, freed when the stage fails
+static _Thread_local TokenArray scanned = { 0 };
+
+// Lexes the source on its own, the code generator needs all names before the first function
+// while the other stages may be waiting for it.
+static void scan_symbols(Pipeline* pipeline) {
+    lexer_begin(pipeline->source);
+    scanned = (TokenArray) { .source = pipeline->source };
+    TopLevelSplitter splitter = { 0 };
+    for (;;) {
+        Token token = lexer_next();
+        bool is_end = parser_ends_before(&splitter, token) || token.type == TOKEN_EOF;
+        append_token(&scanned, token);
+        if (is_end && scanned.count > 1) {
+            add_symbols(pipeline, &scanned, 0, scanned.count - 1);
+            scanned.tokens[0] = token;
+            scanned.count = 1;
+        }
+        if (token.type == TOKEN_EOF) break;
+    }
+    lexer_free_tokens(&scanned);
+    finish_symbols(pipeline);
+}
+
+// the batch being filled, freed when the stage fails
+static _Thread_local TokenBatch* lexer_batch = NULL;
+
+static void lex(Pipeline* pipeline) {
+    lexer_begin(pipeline->source);
+    lexer_batch = make_batch(pipeline->source);
+    TopLevelSplitter splitter = { 0 };
+    for (;;) {
+        Token token = lexer_next();
+        TokenArray* tokens = &lexer_batch->tokens;
+        append_token(tokens, token);
+        if (token.type == TOKEN_EOF) break;
+
+        int last = tokens->count - 1;
+        if (parser_ends_before(&splitter, token) && last - lexer_batch->first >= PIPELINE_BATCH_TOKENS) {
+            TokenBatch* next = make_batch(pipeline->source);
+            append_token(&next->tokens, tokens->tokens[last - 1]);
+            append_token(&next->tokens, token);
+            next->first = 1;
+            tokens->tokens[last] = (Token) { .offset = token.offset, .length = 0, .type = TOKEN_EOF };
+
+            TokenBatch* full = lexer_batch;
+            lexer_batch = next;
+            if (!ring_push(&pipeline->batches, full)) {
+                free_batch(full);
+                return;
+            }
+        }
+    }
+
+    TokenBatch* last = lexer_batch;
+    lexer_batch = NULL;
+    if (!ring_push(&pipeline->batches, last)) {
+        free_batch(last);
+        return;
+    }
+    ring_push(&pipeline->batches, NULL);
+}
+
+// the batch being parsed, freed when the stage fails
+static _Thread_local TokenBatch* parser_batch = NULL;
+
+static void next_batch(TokenBatch* batch) {
+    free_batch(parser_batch);
+    parser_batch = batch;
+}
+
+// A batch is freed once the next one arrives, the parser looks at the last token it consumed.
+static void parse(Pipeline* pipeline) {
+    parser_begin(pipeline->options->input_path);
+    for (;;) {
+        void* item;
+        if (!ring_pop(&pipeline->batches, &item)) {
+            next_batch(NULL);
+            return;
+        }
+        if (item == NULL) break;
+
+        next_batch(item);
+        parser_set_tokens(&parser_batch->tokens, parser_batch->tokens.tokens + parser_batch->first);
+        ASTNode* definition;
+        while ((definition = parser_next_definition()) != NULL) {
+            if (!ring_push(&pipeline->definitions, definition)) {
+                parser_free_ast(definition);
+                next_batch(NULL);
+                return;
+            }
+        }
+    }
+
+    ASTNode* main_function = parser_end(&pipeline->site_count);
+    next_batch(NULL);
+    if (main_function != NULL && !ring_push(&pipeline->definitions, main_function)) {
+        parser_free_ast(main_function);
+        return;
+    }
+    ring_push(&pipeline->definitions, NULL);
+}
+
+// Definitions the code generator received, all of them stay until the end because inlining
+// copies from them. next is the first one not compiled yet.
+typedef struct Received {
+    ASTNode** definitions;
+    int count;
+    int capacity;
+    int next;
+    bool is_complete;
+    ASTNode** vectors;
+    int vectors_count;
+    int vectors_capacity;
+} Received;
+
+static _Thread_local Received received = { 0 };
+
+static void free_received() {
+    for (int i = 0; i < received.count; ++i) {
+        parser_free_ast(received.definitions[i]);
+    }
+    free(received.definitions);
+    free(received.vectors);
+    received = (Received) { 0 };
+}
+
+// false at the end of the definitions
+static bool receive(Pipeline* pipeline) {
+    if (received.is_complete) return false;
+
+    void* item;
+    if (!ring_pop(&pipeline->definitions, &item) || item == NULL) {
+        received.is_complete = true;
+        return false;
+    }
+    ASTNode* definition = item;
+    if (received.capacity < received.count + 1) {
+        int old_capacity = received.capacity;
+        received.capacity = GROW_CAPACITY(old_capacity);
+        received.definitions = GROW_ARRAY(ASTNode*, received.definitions, old_capacity, received.capacity);
+    }
+    received.definitions[received.count++] = definition;
+
+    if (definition->type == AST_NODE_VECTOR_DEFINITION) {
+        if (received.vectors_capacity < received.vectors_count + 1) {
+            int old_capacity = received.vectors_capacity;
+            received.vectors_capacity = GROW_CAPACITY(old_capacity);
+            received.vectors = GROW_ARRAY(ASTNode*, received.vectors, old_capacity, received.vectors_capacity);
+        }
+        received.vectors[received.vectors_count++] = definition;
+    }
+    else if (pipeline->options->optimization_level > 0) {
+        optimizer_add_function(definition);
+    }
+    return true;
+}
+
+// Inlining into a function sees the callees defined after it unoptimized, like when the whole
+// program is optimized at once, so they are received before it is optimized. The symbols are
+// in the order of the definitions.
+static void receive_callees(Pipeline* pipeline, ASTNode* function) {
+    const char** callees;
+    int count = optimizer_callees(function, &callees);
+    const ProgramSymbols* symbols = &pipeline->symbols;
+    for (int i = 0; i < count; ++i) {
+        for (int j = received.count; j < symbols->definitions_count; ++j) {
+            if (symbols->is_vector[j] || strcmp(symbols->definitions[j], callees[i]) != 0) continue;
+            while (received.count <= j && receive(pipeline)) {}
+            break;
+        }
+    }
+    free(callees);
+}
+
+static void generate_code(Pipeline* pipeline) {
+    int attempts = 0;
+    while (!atomic_load_explicit(&pipeline->are_symbols_ready, memory_order_acquire)) {
+        if (atomic_load_explicit(&pipeline->is_cancelled, memory_order_relaxed)) return;
+        ring_backoff(&attempts);
+    }
+
+    const Options* options = pipeline->options;
+    compiler_begin(&pipeline->symbols, pipeline->source, options);
+    optimizer_begin(options);
+    for (;;) {
+        if (received.next == received.count && !receive(pipeline)) break;
+
+        ASTNode* definition = received.definitions[received.next++];
+        if (definition->type != AST_NODE_FUNCTION) continue;
+        if (options->optimization_level > 0) {
+            receive_callees(pipeline, definition);
+            optimizer_optimize_function(definition);
+        }
+        compiler_compile_function(definition);
+    }
+    if (atomic_load_explicit(&pipeline->is_cancelled, memory_order_relaxed)) {
+        compiler_abort();
+    }
+    else {
+        compiler_end(received.vectors, received.vectors_count, pipeline->site_count);
+    }
+    optimizer_end();
+    free_received();
+}
+
+typedef struct StageThread {
+    Pipeline* pipeline;
+    StageKind kind;
+} StageThread;
+
+static void* run_stage(void* argument) {
+    StageThread* thread = argument;
+    Pipeline* pipeline = thread->pipeline;
+    Stage* stage = &pipeline->stages[thread->kind];
+    FILE* stream = open_memstream(&stage->diagnostics, &stage->diagnostics_size);
+    set_diagnostics(stream);
+
+    jmp_buf handler;
+    if (setjmp(handler) != 0) {
+        set_fail_handler(NULL);
+        stage->has_failed = true;
+        switch (thread->kind) {
+            case STAGE_SCANNER: {
+                lexer_free_tokens(&scanned);
+                atomic_store(&pipeline->is_cancelled, true);
+            } break;
+            case STAGE_LEXER: {
+                free_batch(lexer_batch);
+                lexer_batch = NULL;
+                atomic_store(&pipeline->is_cancelled, true);
+            } break;
+            case STAGE_PARSER: {
+                // like in driver_abort, the statements parsed so far are leaked
+                next_batch(NULL);
+                atomic_store(&pipeline->is_cancelled, true);
+            } break;
+            case STAGE_CODEGEN: {
+                compiler_abort();
+                optimizer_end();
+                // the error is only reported if the parser gets through the rest
+                void* item;
+                while (!received.is_complete && ring_pop(&pipeline->definitions, &item) && item != NULL) {
+                    parser_free_ast(item);
+                }
+                free_received();
+            } break;
+            default:
+                break;
+        }
+    }
+    else {
+        set_fail_handler(&handler);
+        switch (thread->kind) {
+            case STAGE_SCANNER: scan_symbols(pipeline); break;
+            case STAGE_LEXER: lex(pipeline); break;
+            case STAGE_PARSER: parse(pipeline); break;
+            case STAGE_CODEGEN: generate_code(pipeline); break;
+            default: break;
+        }
+        set_fail_handler(NULL);
+    }
+    set_diagnostics(NULL);
+    fclose(stream);
+    return NULL;
+}
+
+void pipeline_compile(Source* source, const Options* options) {
+    // tokens point into the buffer, it must not move while the parser reads them
+    source_read_all(source);
+    // the first lookup builds the line table, later ones from any thread only read it
+    int line, column;
+    source_locate(source, 0, &line, &column);
+
+    Pipeline* pipeline = calloc(1, sizeof(Pipeline));
+    if (pipeline == NULL) {
+        fprintf(diagnostics(), "error: out of memory\n");
+        fail();
+    }
+    pipeline->source = source;
+    pipeline->options = options;
+    atomic_init(&pipeline->is_cancelled, false);
+    atomic_init(&pipeline->are_symbols_ready, false);
+    ring_init(&pipeline->batches, &pipeline->is_cancelled);
+    ring_init(&pipeline->definitions, &pipeline->is_cancelled);
+
+    pthread_attr_t attributes;
+    pthread_attr_init(&attributes);
+    pthread_attr_setstacksize(&attributes, PIPELINE_THREAD_STACK_SIZE);
+    StageThread stage_threads[STAGES_COUNT];
+    pthread_t threads[STAGES_COUNT];
+    int started = 0;
+    for (int i = 0; i < STAGES_COUNT; ++i) {
+        stage_threads[i] = (StageThread) { .pipeline = pipeline, .kind = i };
+        if (pthread_create(&threads[i], &attributes, run_stage, &stage_threads[i]) != 0) {
+            atomic_store(&pipeline->is_cancelled, true);
+            break;
+        }
+        ++started;
+    }
+    pthread_attr_destroy(&attributes);
+    for (int i = 0; i < started; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+
+    // what a cancelled stage did not take from the rings, nothing waits for them anymore
+    atomic_store(&pipeline->is_cancelled, true);
+    void* item;
+    while (ring_pop(&pipeline->batches, &item)) {
+        free_batch(item);
+    }
+    while (ring_pop(&pipeline->definitions, &item)) {
+        if (item != NULL) {
+            parser_free_ast(item);
+        }
+    }
+    free_symbols(pipeline);
+
+    bool has_failed = started < STAGES_COUNT;
+    if (has_failed) {
+        fprintf(diagnostics(), "error: failed to start the pipeline threads\n");
+    }
+    for (int i = 0; i < started; ++i) {
+        Stage* stage = &pipeline->stages[i];
+        if (!has_failed) {
+            fwrite(stage->diagnostics, 1, stage->diagnostics_size, diagnostics());
+            has_failed = stage->has_failed;
+        }
+        free(stage->diagnostics);
+    }
+    free(pipeline);
+    if (has_failed) {
+        fail();
+    }
+}
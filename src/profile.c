@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "profile.h"
+#include "utils.h"
+
+// an arm below 1 / PROFILE_COLD_RATIO of the executions of its site is cold
+#define PROFILE_COLD_RATIO 100
+// a site above 1 / PROFILE_HOT_RATIO of the hottest site is hot
+#define PROFILE_HOT_RATIO 10
+
+static _Thread_local Word* counters = NULL;
+static _Thread_local int sites_count = 0;
+static _Thread_local Word hottest = 0;
+
+// The file is written by the instrumented program at exit:
+//     bbc profile 1
+//     sites <count>
+//     <site> <counter 0> <counter 1>
+void profile_load(const char* path, int site_count) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        fprintf(diagnostics(), "error: failed to open profile: %s\n", path);
+        fail();
+    }
+
+    int version = 0;
+    long count = 0;
+    if (fscanf(file, "bbc profile %d sites %ld", &version, &count) != 2 || version != 1) {
+        fprintf(diagnostics(), "error: invalid profile: %s\n", path);
+        fail();
+    }
+    // a profile of another version of the program would put counts on the wrong statements
+    if (count != site_count) {
+        fprintf(diagnostics(), "warning: profile %s does not match the program, ignoring it\n", path);
+        fclose(file);
+        return;
+    }
+
+    sites_count = site_count;
+    counters = calloc(sites_count > 0 ? sites_count * PROFILE_COUNTERS_PER_SITE : 1, sizeof(Word));
+    long site;
+    Word taken, not_taken;
+    while (fscanf(file, "%ld %ld %ld", &site, &taken, &not_taken) == 3) {
+        if (site < 0 || site >= sites_count) {
+            fprintf(diagnostics(), "error: invalid profile site %ld in %s\n", site, path);
+            fail();
+        }
+        counters[site * PROFILE_COUNTERS_PER_SITE] = taken;
+        counters[site * PROFILE_COUNTERS_PER_SITE + 1] = not_taken;
+        if (taken + not_taken > hottest) {
+            hottest = taken + not_taken;
+        }
+    }
+    fclose(file);
+}
+
+void profile_free() {
+    free(counters);
+    counters = NULL;
+    sites_count = 0;
+    hottest = 0;
+}
+
+Profile profile_current() {
+    return (Profile) { .counters = counters, .sites_count = sites_count, .hottest = hottest };
+}
+
+void profile_share(Profile profile) {
+    counters = profile.counters;
+    sites_count = profile.sites_count;
+    hottest = profile.hottest;
+}
+
+bool profile_is_loaded() {
+    return counters != NULL;
+}
+
+Word profile_count(int site, int counter) {
+    if (counters == NULL || site < 0 || site >= sites_count) return 0;
+    return counters[site * PROFILE_COUNTERS_PER_SITE + counter];
+}
+
+static Word profile_total(int site) {
+    return profile_count(site, 0) + profile_count(site, 1);
+}
+
+bool profile_is_unreached(int site) {
+    return counters != NULL && profile_total(site) == 0;
+}
+
+bool profile_is_cold(int site, int counter) {
+    Word total = profile_total(site);
+    return counters != NULL && total > 0 && profile_count(site, counter) * PROFILE_COLD_RATIO < total;
+}
+
+bool profile_is_hot(int site) {
+    Word total = profile_total(site);
+    return counters != NULL && total > 0 && total * PROFILE_HOT_RATIO >= hottest;
+}
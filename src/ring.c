@@ -0,0 +1,44 @@
+#include <sched.h>
+#include <time.h>
+#include "ring.h"
+
+void ring_backoff(int* attempts) {
+    if (++*attempts < RING_YIELDS_BEFORE_SLEEP) {
+        sched_yield();
+        return;
+    }
+    struct timespec pause = { .tv_sec = 0, .tv_nsec = RING_SLEEP_NANOSECONDS };
+    nanosleep(&pause, NULL);
+}
+
+void ring_init(Ring* ring, atomic_bool* is_cancelled) {
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    ring->is_cancelled = is_cancelled;
+}
+
+bool ring_push(Ring* ring, void* item) {
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    int attempts = 0;
+    while (tail - atomic_load_explicit(&ring->head, memory_order_acquire) == RING_CAPACITY) {
+        if (atomic_load_explicit(ring->is_cancelled, memory_order_relaxed)) return false;
+        ring_backoff(&attempts);
+    }
+    ring->slots[tail % RING_CAPACITY] = item;
+    // the item is written before the consumer can see the new tail
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+bool ring_pop(Ring* ring, void** item) {
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    int attempts = 0;
+    while (atomic_load_explicit(&ring->tail, memory_order_acquire) == head) {
+        if (atomic_load_explicit(ring->is_cancelled, memory_order_relaxed)) return false;
+        ring_backoff(&attempts);
+    }
+    *item = ring->slots[head % RING_CAPACITY];
+    // the slot is read before the producer can reuse it
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    return true;
+}
@@ -0,0 +1,264 @@
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "driver.h"
+#include "options.h"
+#include "server.h"
+#include "utils.h"
+
+// A request is the working directory of the client followed by its arguments, every string
+// ends with '\0' and the client shuts down its side of the socket after the last one. The
+// reply is one byte with the exit status followed by the diagnostics.
+#define SERVER_MAX_REQUEST_SIZE (64 * 1024)
+#define SERVER_MAX_ARGUMENTS 256
+#define SERVER_MAX_THREADS 64
+// a request walks its trees on stacks of its own on the heap, so its C stack only holds fixed
+// frames, the largest a buffer of a few kilobytes
+#define SERVER_THREAD_STACK_SIZE (1024 * 1024)
+
+// paths of the request being compiled, relative ones are resolved against the client directory
+static _Thread_local char input_path[PATH_MAX];
+static _Thread_local char output_path[PATH_MAX];
+static _Thread_local char profile_use_path[PATH_MAX];
+
+static bool write_all(int socket, const void* data, size_t size) {
+    const char* bytes = data;
+    while (size > 0) {
+        ssize_t written = write(socket, bytes, size);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) return false;
+        bytes += written;
+        size -= written;
+    }
+    return true;
+}
+
+static const char* resolve_path(const char* directory, const char* path, char* resolved) {
+    if (path == NULL) return NULL;
+    int length = path[0] == '/'
+        ? snprintf(resolved, PATH_MAX, "%s", path)
+        : snprintf(resolved, PATH_MAX, "%s/%s", directory, path);
+    if (length >= PATH_MAX) {
+        fprintf(diagnostics(), "error: path too long: %s\n", path);
+        fail();
+    }
+    return resolved;
+}
+
+static void compile_request(const char* directory, int argc, char** argv) {
+    // these run a process of their own, a request only compiles once
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--watch") == 0 || strcmp(argv[i], "--server") == 0
+                || strcmp(argv[i], "--connect") == 0) {
+            fprintf(diagnostics(), "error: %s cannot be sent to the server\n", argv[i]);
+            fail();
+        }
+    }
+    Options options = options_parse(argc, argv);
+    if (strcmp(options.input_path, "-") == 0) {
+        fprintf(diagnostics(), "error: the server can't read the standard input of the client\n");
+        fail();
+    }
+    // the output of one request must not mix with the others
+    options.print_stages = false;
+    options.input_path = resolve_path(directory, options.input_path, input_path);
+    options.output_path = resolve_path(directory, options.output_path, output_path);
+    options.profile_use_path = resolve_path(directory, options.profile_use_path, profile_use_path);
+    // --profile-generate is left alone, the program opens the file when it runs
+    driver_compile(&options);
+}
+
+// the only locals around setjmp are the arguments, which longjmp can't clobber as they are
+// not changed after it
+static unsigned char compile_guarded(const char* directory, int argc, char** argv) {
+    jmp_buf handler;
+    if (setjmp(handler) != 0) {
+        set_fail_handler(NULL);
+        driver_abort();
+        return 1;
+    }
+    set_fail_handler(&handler);
+    compile_request(directory, argc, argv);
+    set_fail_handler(NULL);
+    return 0;
+}
+
+static unsigned char run_request(char* request, size_t size) {
+    char* argv[SERVER_MAX_ARGUMENTS + 1];
+    int argc = 0;
+    argv[argc++] = "bbc";
+    const char* directory = NULL;
+    for (size_t i = 0; i < size; i += strlen(request + i) + 1) {
+        if (directory == NULL) {
+            directory = request + i;
+        }
+        else if (argc < SERVER_MAX_ARGUMENTS) {
+            argv[argc++] = request + i;
+        }
+        else {
+            fprintf(diagnostics(), "error: too many arguments\n");
+            return 1;
+        }
+    }
+    argv[argc] = NULL;
+    if (directory == NULL || request[size - 1] != '\0') {
+        fprintf(diagnostics(), "error: malformed request\n");
+        return 1;
+    }
+
+    return compile_guarded(directory, argc, argv);
+}
+
+static void serve_client(int client) {
+    char* request = malloc(SERVER_MAX_REQUEST_SIZE);
+    size_t size = 0;
+    for (;;) {
+        ssize_t received = read(client, request + size, SERVER_MAX_REQUEST_SIZE - size);
+        if (received < 0 && errno == EINTR) continue;
+        if (received <= 0) break;
+        size += received;
+        if (size == SERVER_MAX_REQUEST_SIZE) break;
+    }
+
+    char* diagnostics_buffer = NULL;
+    size_t diagnostics_size = 0;
+    FILE* stream = open_memstream(&diagnostics_buffer, &diagnostics_size);
+    set_diagnostics(stream);
+    unsigned char status = 1;
+    if (size == SERVER_MAX_REQUEST_SIZE) {
+        fprintf(stream, "error: request too large\n");
+    }
+    else if (size == 0) {
+        fprintf(stream, "error: malformed request\n");
+    }
+    else {
+        status = run_request(request, size);
+    }
+    set_diagnostics(NULL);
+    fclose(stream);
+
+    // a client that went away has nobody to tell
+    if (write_all(client, &status, 1)) {
+        write_all(client, diagnostics_buffer, diagnostics_size);
+    }
+    free(diagnostics_buffer);
+    free(request);
+}
+
+static void* serve(void* argument) {
+    int listener = *(int*)argument;
+    for (;;) {
+        int client = accept(listener, NULL, NULL);
+        if (client < 0) {
+            if (errno != EINTR && errno != ECONNABORTED) {
+                perror("error: accept");
+            }
+            continue;
+        }
+        serve_client(client);
+        close(client);
+    }
+    return NULL;
+}
+
+static bool make_address(const char* path, struct sockaddr_un* address) {
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address->sun_path)) {
+        fprintf(stderr, "error: socket path too long: %s\n", path);
+        return false;
+    }
+    strcpy(address->sun_path, path);
+    return true;
+}
+
+int server_run(const char* path) {
+    struct sockaddr_un address;
+    if (!make_address(path, &address)) return 1;
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {
+        perror("error: socket");
+        return 1;
+    }
+    // a socket left behind by a server that was killed
+    unlink(path);
+    if (bind(listener, (struct sockaddr*)&address, sizeof(address)) < 0 || listen(listener, SOMAXCONN) < 0) {
+        fprintf(stderr, "error: failed to listen on %s: %s\n", path, strerror(errno));
+        close(listener);
+        return 1;
+    }
+    // writing to a client that disconnected must not end the server
+    signal(SIGPIPE, SIG_IGN);
+
+    long threads_count = sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads_count < 1) threads_count = 1;
+    if (threads_count > SERVER_MAX_THREADS) threads_count = SERVER_MAX_THREADS;
+
+    pthread_attr_t attributes;
+    pthread_attr_init(&attributes);
+    pthread_attr_setstacksize(&attributes, SERVER_THREAD_STACK_SIZE);
+    pthread_t threads[SERVER_MAX_THREADS];
+    int started = 0;
+    for (long i = 0; i < threads_count; ++i) {
+        if (pthread_create(&threads[started], &attributes, serve, &listener) == 0) {
+            ++started;
+        }
+    }
+    pthread_attr_destroy(&attributes);
+    if (started == 0) {
+        fprintf(stderr, "error: failed to start worker threads\n");
+        close(listener);
+        return 1;
+    }
+    fprintf(stderr, "bbc: listening on %s with %d threads\n", path, started);
+
+    for (int i = 0; i < started; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    close(listener);
+    return 0;
+}
+
+int server_request(const char* path, int argc, char** argv) {
+    struct sockaddr_un address;
+    if (!make_address(path, &address)) return 1;
+
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server < 0 || connect(server, (struct sockaddr*)&address, sizeof(address)) < 0) {
+        fprintf(stderr, "error: failed to connect to %s: %s\n", path, strerror(errno));
+        if (server >= 0) close(server);
+        return 1;
+    }
+
+    char* directory = getcwd(NULL, 0);
+    bool is_sent = directory != NULL && write_all(server, directory, strlen(directory) + 1);
+    for (int i = 0; i < argc && is_sent; ++i) {
+        is_sent = write_all(server, argv[i], strlen(argv[i]) + 1);
+    }
+    free(directory);
+    shutdown(server, SHUT_WR);
+
+    unsigned char status = 1;
+    if (!is_sent || read(server, &status, 1) != 1) {
+        fprintf(stderr, "error: no reply from %s\n", path);
+        close(server);
+        return 1;
+    }
+    char buffer[4096];
+    ssize_t received;
+    while ((received = read(server, buffer, sizeof(buffer))) > 0) {
+        fwrite(buffer, 1, received, stderr);
+    }
+    close(server);
+    return status;
+}
@@ -0,0 +1,159 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "source.h"
+#include "utils.h"
+
+#define SOURCE_CHUNK_SIZE (64 * 1024)
+
+Source source_open(const char* path) {
+    Source source = { .path = path };
+    if (strcmp(path, "-") == 0) {
+        source.file = stdin;
+    }
+    else {
+        source.file = fopen(path, "rb");
+        if (source.file == NULL) {
+            fprintf(diagnostics(), "error: failed to open file: %s\n", path);
+            fail();
+        }
+    }
+    source.capacity = SOURCE_CHUNK_SIZE + 1;
+    source.buffer = malloc(source.capacity);
+    if (source.buffer == NULL) {
+        fprintf(diagnostics(), "error: failed to allocate memory for file: %s\n", path);
+        fail();
+    }
+    source.buffer[0] = '\0';
+    return source;
+}
+
+bool source_refill(Source* source) {
+    if (source->is_at_end) return false;
+
+    if (source->capacity < source->size + SOURCE_CHUNK_SIZE + 1) {
+        size_t capacity = source->capacity * 2;
+        char* buffer = realloc(source->buffer, capacity);
+        if (buffer == NULL) {
+            fprintf(diagnostics(), "error: failed to allocate memory for file: %s\n", source->path);
+            fail();
+        }
+        source->buffer = buffer;
+        source->capacity = capacity;
+    }
+
+    size_t count = fread(source->buffer + source->size, 1, SOURCE_CHUNK_SIZE, source->file);
+    if (count == 0) {
+        if (ferror(source->file)) {
+            fprintf(diagnostics(), "error: failed to read file: %s\n", source->path);
+            fail();
+        }
+        source->is_at_end = true;
+    }
+    source->size += count;
+    source->buffer[source->size] = '\0';
+    return count > 0;
+}
+
+void source_read_all(Source* source) {
+    while (source_refill(source)) {
+        if (source->size > UINT32_MAX) {
+            fprintf(diagnostics(), "error: %s is larger than 4 GiB\n", source->path);
+            fail();
+        }
+    }
+}
+
+static void add_line_start(Source* source, uint32_t offset) {
+    if (source->lines_capacity < source->lines_count + 1) {
+        int old_capacity = source->lines_capacity;
+        source->lines_capacity = GROW_CAPACITY(old_capacity);
+        source->line_starts = GROW_ARRAY(uint32_t, source->line_starts, old_capacity, source->lines_capacity);
+    }
+    source->line_starts[source->lines_count++] = offset;
+}
+
+// The table of line starts is built by the first lookup and extended with the bytes read since
+// the previous one, memchr does the scanning a vector at a time.
+static void scan_lines(Source* source) {
+    if (source->lines_count == 0) {
+        add_line_start(source, 0);
+    }
+    if (source->lines_scanned < source->size) {
+        const char* end = source->buffer + source->size;
+        const char* newline = source->buffer + source->lines_scanned;
+        while ((newline = memchr(newline, '\n', end - newline)) != NULL) {
+            ++newline;
+            add_line_start(source, newline - source->buffer);
+        }
+        source->lines_scanned = source->size;
+    }
+}
+
+// last line starting at or before the offset
+static int find_line(const Source* source, size_t offset) {
+    int low = 0;
+    int high = source->lines_count - 1;
+    while (low < high) {
+        int middle = low + (high - low + 1) / 2;
+        if (source->line_starts[middle] <= offset) {
+            low = middle;
+        }
+        else {
+            high = middle - 1;
+        }
+    }
+    return low;
+}
+
+// Lookups after the whole input was read and scanned only read the table.
+void source_locate(Source* source, size_t offset, int* line, int* column) {
+    scan_lines(source);
+    int index = find_line(source, offset);
+    *line = source->dropped_lines + index + 1;
+    *column = (int)(offset - source->line_starts[index]) + 1;
+    if (index == 0) {
+        *column += (int)source->dropped_columns;
+    }
+}
+
+FILE* source_diagnostics(Source* source, uint32_t location) {
+    FILE* out = diagnostics();
+    if (location == 0) {
+        fprintf(out, "%s: ", source->path);
+    }
+    else {
+        int line, column;
+        source_locate(source, location - 1, &line, &column);
+        fprintf(out, "%s:%d: ", source->path, line);
+    }
+    return out;
+}
+
+// The line holding the new first byte becomes the first one of the table, starting at 0.
+void source_drop(Source* source, size_t count) {
+    if (count == 0) return;
+    scan_lines(source);
+    int index = find_line(source, count);
+    source->dropped_columns = (index == 0 ? source->dropped_columns : 0) + (count - source->line_starts[index]);
+    source->dropped_lines += index;
+    source->lines_count -= index;
+    memmove(source->line_starts, source->line_starts + index, source->lines_count * sizeof(uint32_t));
+    source->line_starts[0] = 0;
+    for (int i = 1; i < source->lines_count; ++i) {
+        source->line_starts[i] -= count;
+    }
+    source->lines_scanned -= count;
+
+    source->size -= count;
+    memmove(source->buffer, source->buffer + count, source->size + 1);
+}
+
+void source_close(Source* source) {
+    if (source->file != NULL && source->file != stdin) {
+        fclose(source->file);
+    }
+    free(source->buffer);
+    free(source->line_starts);
+    *source = (Source) { 0 };
+}
@@ -0,0 +1,89 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "compiler.h"
+#include "lexer.h"
+#include "optimizer.h"
+#include "parser.h"
+#include "stream.h"
+#include "utils.h"
+
+// tokens of the definition or statement being compiled, after the last token of the one before
+static _Thread_local TokenArray tokens = { 0 };
+
+static void append_token(Token token) {
+    if (tokens.capacity < tokens.count + 1) {
+        int old_capacity = tokens.capacity;
+        tokens.capacity = GROW_CAPACITY(old_capacity);
+        tokens.tokens = GROW_ARRAY(Token, tokens.tokens, old_capacity, tokens.capacity);
+    }
+    tokens.tokens[tokens.count++] = token;
+}
+
+// Functions are optimized on their own, inlining would have to keep the ones it copies from.
+static void compile_definition(ASTNode* definition, const Options* options) {
+    if (definition->type == AST_NODE_FUNCTION && options->optimization_level > 0) {
+        optimizer_optimize_function(definition);
+    }
+    compiler_stream_definition(definition);
+    parser_free_ast(definition);
+}
+
+// Parses and compiles the tokens from first on, they hold one definition or statement.
+static void compile_tokens(int first, const Options* options) {
+    parser_set_tokens(&tokens, tokens.tokens + first);
+    ASTNode* definition;
+    while ((definition = parser_next_definition()) != NULL) {
+        compile_definition(definition, options);
+    }
+    ASTNode* statements = parser_take_statements();
+    if (statements != NULL) {
+        if (options->optimization_level > 0) {
+            optimizer_optimize_statements(statements);
+        }
+        compiler_stream_statements(statements);
+        parser_free_ast(statements);
+    }
+}
+
+void stream_compile(Source* source, const Options* options) {
+    lexer_begin(source);
+    parser_begin(options->input_path);
+    compiler_begin_stream(source, options);
+    // nothing is added to the functions inlining copies from
+    optimizer_begin(options);
+
+    // Like the batches of the pipeline, the tokens of a definition or statement end with
+    // TOKEN_EOF and the ones after the first start with the last token of the one before.
+    tokens = (TokenArray) { .source = source };
+    TopLevelSplitter splitter = { 0 };
+    int first = 0;
+    for (;;) {
+        Token token = lexer_next();
+        bool is_end = token.type == TOKEN_EOF || parser_ends_before(&splitter, token);
+        if (is_end && tokens.count > first) {
+            append_token((Token) { .offset = token.offset, .length = 0, .type = TOKEN_EOF });
+            compile_tokens(first, options);
+
+            // nothing looks at the source before the last token again
+            Token last = tokens.tokens[tokens.count - 2];
+            lexer_drop_source(last.offset);
+            token.offset -= last.offset;
+            last.offset = 0;
+            tokens.tokens[0] = last;
+            tokens.count = 1;
+            first = 1;
+        }
+        if (token.type == TOKEN_EOF) break;
+        append_token(token);
+    }
+
+    int site_count;
+    // statements outside of functions were taken already, this only checks them
+    parser_end(&site_count);
+    compiler_end_stream(site_count);
+    lexer_free_tokens(&tokens);
+}
+
+void stream_abort() {
+    lexer_free_tokens(&tokens);
+}
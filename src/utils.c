@@ -1,39 +1,107 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "utils.h"
 
-void* reallocate(void* pointer, int new_size) {
+static _Thread_local FILE* diagnostics_stream = NULL;
+static _Thread_local jmp_buf* fail_handler = NULL;
+
+FILE* diagnostics() {
+    return diagnostics_stream != NULL ? diagnostics_stream : stderr;
+}
+
+void set_diagnostics(FILE* stream) {
+    diagnostics_stream = stream;
+}
+
+void set_fail_handler(jmp_buf* handler) {
+    fail_handler = handler;
+}
+
+void fail() {
+    if (fail_handler != NULL) {
+        longjmp(*fail_handler, 1);
+    }
+    exit(1);
+}
+
+void* reallocate(void* pointer, size_t new_size) {
     if (new_size == 0) {
         free(pointer);
         return NULL;
     }
 
     void* result = realloc(pointer, new_size);
-    if (result == NULL) exit(1);
+    if (result == NULL) {
+        fprintf(diagnostics(), "error: out of memory\n");
+        fail();
+    }
     return result;
 }
 
-char* file_read(const char* filename) {
-    FILE* file = fopen(filename, "rb");
-    if (file == NULL) {
-        fprintf(stderr, "error: failed to open file: %s\n", filename);
-        exit(1);
+uint64_t hash_bytes(uint64_t hash, const void* data, size_t size) {
+    const unsigned char* bytes = data;
+    for (size_t i = 0; i < size; ++i) {
+        hash = (hash ^ bytes[i]) * 1099511628211u;
     }
+    return hash;
+}
 
-    fseek(file, 0, SEEK_END);
-    int length = ftell(file);
-    rewind(file);
+uint64_t hash_string(const char* string) {
+    return hash_bytes(HASH_SEED, string, strlen(string));
+}
 
-    char* content = (char*)malloc(sizeof(char) * length + 1);
-    if (content == NULL) {
-        fprintf(stderr, "error: failed to allocate memory for file: %s\n", filename);
-        exit(1);
+// the slot of the key, or the empty one it would go to
+static HashSlot* find_slot(const HashTable* table, uint64_t hash, const char* name) {
+    size_t mask = table->capacity - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        HashSlot* slot = &table->slots[i];
+        if (slot->index < 0) return slot;
+        if (slot->hash == hash && (name == NULL || strcmp(slot->name, name) == 0)) return slot;
     }
+}
+
+static void grow_table(HashTable* table) {
+    HashSlot* old_slots = table->slots;
+    size_t old_capacity = table->capacity;
+    table->capacity = old_capacity < 64 ? 64 : old_capacity * 2;
+    table->slots = GROW_ARRAY(HashSlot, NULL, 0, table->capacity);
+    for (size_t i = 0; i < table->capacity; ++i) {
+        table->slots[i].index = -1;
+    }
+    for (size_t i = 0; i < old_capacity; ++i) {
+        if (old_slots[i].index >= 0) {
+            *find_slot(table, old_slots[i].hash, old_slots[i].name) = old_slots[i];
+        }
+    }
+    free(old_slots);
+}
+
+int hash_table_find(const HashTable* table, uint64_t hash, const char* name) {
+    if (table->count == 0) return -1;
+    return find_slot(table, hash, name)->index;
+}
 
-    fread(content, 1, length, file);
-    content[length] = '\0';
+int hash_table_add(HashTable* table, uint64_t hash, const char* name, int index) {
+    if (table->capacity < (table->count + 1) * 2) {
+        grow_table(table);
+    }
+    HashSlot* slot = find_slot(table, hash, name);
+    if (slot->index < 0) {
+        *slot = (HashSlot) { .hash = hash, .name = name, .index = index };
+        ++table->count;
+    }
+    return slot->index;
+}
 
-    fclose(file);
+void hash_table_clear(HashTable* table) {
+    for (size_t i = 0; i < table->capacity; ++i) {
+        table->slots[i].index = -1;
+    }
+    table->count = 0;
+}
 
-    return content;
+void hash_table_free(HashTable* table) {
+    free(table->slots);
+    *table = (HashTable) { 0 };
 }
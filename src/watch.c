@@ -0,0 +1,659 @@
+#include <errno.h>
+#include <limits.h>
+#include <setjmp.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <time.h>
+#include <unistd.h>
+#include "compiler.h"
+#include "lexer.h"
+#include "optimizer.h"
+#include "parser.h"
+#include "source.h"
+#include "utils.h"
+#include "watch.h"
+
+#define WATCH_EVENTS_SIZE (16 * 1024)
+
+typedef struct {
+    uint64_t key;
+    // looked up by the last compilation, the others are dropped after it
+    bool is_used;
+    // definitions by the hash of their tokens: the names a function calls and the hashes of
+    // the names it uses, the tree of a vector or the ones of the words and vectors of `auto`
+    // outside of functions
+    char** callees;
+    int callees_count;
+    uint64_t* names;
+    int names_count;
+    ASTNode** vectors;
+    int vectors_count;
+    // compiled functions by the hash of what their code depends on, see function_key
+    FunctionCode code;
+    char** extrns;
+    int extrns_count;
+} CacheEntry;
+
+// the entries are found by their key through keys
+typedef struct {
+    CacheEntry* entries;
+    int count;
+    int capacity;
+    HashTable keys;
+} Cache;
+
+static _Thread_local Cache definitions_cache = { 0 };
+static _Thread_local Cache code_cache = { 0 };
+
+typedef enum {
+    UNIT_FUNCTION,
+    UNIT_VECTOR,
+    UNIT_STATEMENTS,
+    // `auto` outside of functions, statements that define words and vectors too
+    UNIT_GLOBALS,
+} UnitKind;
+
+// A top-level definition or statement of the current version of the source. The statements
+// outside of functions form the implicit main, a unit of its own after all the others.
+typedef struct {
+    UnitKind kind;
+    // the tokens [first, end), first is -1 for the implicit main
+    int first;
+    int end;
+    uint64_t hash;
+    // owned, for functions and vectors
+    char* name;
+    // parsed by this compilation, NULL when the cache had what was needed
+    ASTNode* tree;
+    // for functions, the code is compiled again
+    bool is_compiled;
+    uint64_t code_key;
+} Unit;
+
+static _Thread_local Unit* units = NULL;
+static _Thread_local int units_count = 0;
+static _Thread_local int units_capacity = 0;
+// indices of the function units by their name
+static _Thread_local HashTable function_names = { 0 };
+
+// the source compiled last and the one before it, the tokens of the last are lexed again from
+// the ones of the one before
+static _Thread_local Source sources[2];
+static _Thread_local int current_source = 0;
+static _Thread_local TokenArray tokens = { 0 };
+// the tokens of a unit being parsed, see parse_tokens
+static _Thread_local TokenArray batch = { 0 };
+static _Thread_local ProgramSymbols program = { 0 };
+// indices of the definitions of program by the hash of their name
+static _Thread_local HashTable definition_names = { 0 };
+// compiled and not in the cache yet
+static _Thread_local FunctionCode pending_code = { 0 };
+
+static uint64_t hash_word(uint64_t hash, uint64_t word) {
+    return hash_bytes(hash, &word, sizeof(word));
+}
+
+// NULL for keys the cache does not have, the entry is kept by the next eviction
+static CacheEntry* lookup_entry(Cache* cache, uint64_t key) {
+    int index = hash_table_find(&cache->keys, key, NULL);
+    if (index < 0) return NULL;
+    cache->entries[index].is_used = true;
+    return &cache->entries[index];
+}
+
+// Entries move when the cache grows, so pointers to them are only good until the next one
+// is added.
+static CacheEntry* add_entry(Cache* cache, uint64_t key) {
+    if (cache->capacity < cache->count + 1) {
+        int old_capacity = cache->capacity;
+        cache->capacity = GROW_CAPACITY(old_capacity);
+        cache->entries = GROW_ARRAY(CacheEntry, cache->entries, old_capacity, cache->capacity);
+    }
+    CacheEntry* entry = &cache->entries[cache->count];
+    *entry = (CacheEntry) { .key = key, .is_used = true };
+    hash_table_add(&cache->keys, key, NULL, cache->count++);
+    return entry;
+}
+
+static char** copy_names(const char** names, int count) {
+    char** copies = malloc(sizeof(char*) * (count > 0 ? count : 1));
+    for (int i = 0; i < count; ++i) {
+        copies[i] = strdup(names[i]);
+    }
+    return copies;
+}
+
+static void free_names(char** names, int count) {
+    for (int i = 0; i < count; ++i) {
+        free(names[i]);
+    }
+    free(names);
+}
+
+static void free_entry(CacheEntry* entry) {
+    free_names(entry->callees, entry->callees_count);
+    free(entry->names);
+    for (int i = 0; i < entry->vectors_count; ++i) {
+        parser_free_ast(entry->vectors[i]);
+    }
+    free(entry->vectors);
+    compiler_free_code(&entry->code);
+    free_names(entry->extrns, entry->extrns_count);
+}
+
+// Drops what the last compilation did not look up, the program changed since it was needed.
+static void evict_unused(Cache* cache) {
+    // the entries kept are moved down and indexed again
+    int used = 0;
+    hash_table_clear(&cache->keys);
+    for (int i = 0; i < cache->count; ++i) {
+        CacheEntry* entry = &cache->entries[i];
+        if (!entry->is_used) {
+            free_entry(entry);
+            continue;
+        }
+        entry->is_used = false;
+        cache->entries[used] = *entry;
+        hash_table_add(&cache->keys, entry->key, NULL, used++);
+    }
+    cache->count = used;
+}
+
+static void free_units() {
+    for (int i = 0; i < units_count; ++i) {
+        free(units[i].name);
+        if (units[i].tree != NULL) {
+            parser_free_ast(units[i].tree);
+        }
+    }
+    units_count = 0;
+}
+
+static void read_source(const char* path) {
+    Source* previous = &sources[current_source];
+    Source* next = &sources[1 - current_source];
+    *next = source_open(path);
+    TokenArray next_tokens;
+    if (tokens.tokens != NULL) {
+        next_tokens = lexer_relex(next, &tokens);
+    }
+    else {
+        source_read_all(next);
+        next_tokens = lexer_lex(next);
+    }
+    lexer_free_tokens(&tokens);
+    source_close(previous);
+    tokens = next_tokens;
+    current_source = 1 - current_source;
+}
+
+// the tokens decide the hash, not the whitespace between them
+static uint64_t hash_tokens(int first, int end) {
+    uint64_t hash = HASH_SEED;
+    for (int i = first; i < end; ++i) {
+        const Token* token = &tokens.tokens[i];
+        hash = hash_word(hash, token->type);
+        if (token->type == TOKEN_ERROR) {
+            hash = hash_word(hash, token->length);
+        }
+        else {
+            hash = hash_word(hash, token->length);
+            hash = hash_bytes(hash, token_value(&tokens, token), token->length);
+        }
+    }
+    return hash != 0 ? hash : 1;
+}
+
+static Unit* add_unit(UnitKind kind, int first, int end) {
+    if (units_capacity < units_count + 1) {
+        int old_capacity = units_capacity;
+        units_capacity = GROW_CAPACITY(old_capacity);
+        units = GROW_ARRAY(Unit, units, old_capacity, units_capacity);
+    }
+    Unit* unit = &units[units_count++];
+    *unit = (Unit) { .kind = kind, .first = first, .end = end };
+    return unit;
+}
+
+// Splits the tokens where the stream would, the implicit main hashes all statements together.
+static void split_units() {
+    TopLevelSplitter splitter = { 0 };
+    int first = 0;
+    uint64_t statements_hash = HASH_SEED;
+    bool has_statements = false;
+    for (int i = 0; i < tokens.count; ++i) {
+        Token token = tokens.tokens[i];
+        bool is_end = token.type == TOKEN_EOF || parser_ends_before(&splitter, token);
+        if (!is_end || i == first) continue;
+
+        const Token* start = &tokens.tokens[first];
+        UnitKind kind = parser_is_function_definition(start) ? UNIT_FUNCTION
+            : parser_is_vector_definition(start) ? UNIT_VECTOR
+            : parser_is_global_declaration(start) ? UNIT_GLOBALS
+            : UNIT_STATEMENTS;
+        Unit* unit = add_unit(kind, first, i);
+        unit->hash = hash_tokens(first, i);
+        // the extrn declarations of `auto` are part of the implicit main, which only exists
+        // with statements
+        if (kind == UNIT_STATEMENTS || kind == UNIT_GLOBALS) {
+            statements_hash = hash_word(statements_hash, unit->hash);
+            has_statements |= kind == UNIT_STATEMENTS;
+        }
+        else {
+            unit->name = strndup(token_value(&tokens, start), start->length);
+        }
+        first = i;
+    }
+    if (has_statements) {
+        Unit* main_unit = add_unit(UNIT_FUNCTION, -1, -1);
+        main_unit->hash = statements_hash != 0 ? statements_hash : 1;
+        main_unit->name = strdup("main");
+    }
+}
+
+static void index_functions() {
+    hash_table_clear(&function_names);
+    for (int i = 0; i < units_count; ++i) {
+        // a name defined twice fails in the compiler
+        if (units[i].kind == UNIT_FUNCTION) {
+            hash_table_add(&function_names, hash_string(units[i].name), units[i].name, i);
+        }
+    }
+}
+
+// the index of the function unit with the name, -1 if the program does not define it
+static int find_function(const char* name) {
+    return hash_table_find(&function_names, hash_string(name), name);
+}
+
+// Parses the tokens like the stream does: after the last token of the unit before them and
+// followed by TOKEN_EOF.
+static ASTNode* parse_tokens(int first, int end) {
+    batch = (TokenArray) { .tokens = batch.tokens, .capacity = batch.capacity, .source = tokens.source };
+    int needed = end - first + 2;
+    if (batch.capacity < needed) {
+        batch.tokens = GROW_ARRAY(Token, batch.tokens, batch.capacity, needed);
+        batch.capacity = needed;
+    }
+    if (first > 0) {
+        batch.tokens[batch.count++] = tokens.tokens[first - 1];
+    }
+    memcpy(batch.tokens + batch.count, tokens.tokens + first, sizeof(Token) * (end - first));
+    batch.count += end - first;
+    batch.tokens[batch.count++] = (Token) { .offset = tokens.tokens[end].offset, .length = 0, .type = TOKEN_EOF };
+    parser_set_tokens(&batch, batch.tokens + (first > 0));
+    return parser_next_definition();
+}
+
+static void parse_unit(Unit* unit) {
+    if (unit->tree != NULL) return;
+    if (unit->first >= 0) {
+        unit->tree = parse_tokens(unit->first, unit->end);
+        return;
+    }
+    // the implicit main is made of all statements outside of functions, the definitions of
+    // `auto` are in the cache already
+    for (int i = 0; i < units_count; ++i) {
+        if (units[i].kind != UNIT_STATEMENTS && units[i].kind != UNIT_GLOBALS) continue;
+        ASTNode* definition = parse_tokens(units[i].first, units[i].end);
+        for (; definition != NULL; definition = parser_next_definition()) {
+            parser_free_ast(definition);
+        }
+    }
+    int site_count;
+    unit->tree = parser_end(&site_count);
+}
+
+static void learn_globals(Unit* unit) {
+    CacheEntry* entry = add_entry(&definitions_cache, unit->hash);
+    int capacity = 0;
+    for (ASTNode* definition = parse_tokens(unit->first, unit->end); definition != NULL; definition = parser_next_definition()) {
+        if (capacity < entry->vectors_count + 1) {
+            int old_capacity = capacity;
+            capacity = GROW_CAPACITY(old_capacity);
+            entry->vectors = GROW_ARRAY(ASTNode*, entry->vectors, old_capacity, capacity);
+        }
+        entry->vectors[entry->vectors_count++] = definition;
+    }
+    // drops the extrn declarations waiting for the next statement, the implicit main is parsed
+    // again with all of its statements
+    int site_count;
+    parser_end(&site_count);
+}
+
+static int compare_hashes(const void* a, const void* b) {
+    uint64_t left = *(const uint64_t*)a;
+    uint64_t right = *(const uint64_t*)b;
+    return left < right ? -1 : left > right;
+}
+
+static void add_names(CacheEntry* entry, int* capacity, int first, int end) {
+    for (int i = first; i < end; ++i) {
+        const Token* token = &tokens.tokens[i];
+        if (token->type != TOKEN_IDENTIFIER) continue;
+        if (*capacity < entry->names_count + 1) {
+            int old_capacity = *capacity;
+            *capacity = GROW_CAPACITY(old_capacity);
+            entry->names = GROW_ARRAY(uint64_t, entry->names, old_capacity, *capacity);
+        }
+        entry->names[entry->names_count++] = hash_bytes(HASH_SEED, token_value(&tokens, token), token->length);
+    }
+}
+
+// Every identifier of the function once, its parameters and autos too: which of them the
+// program defines as functions or vectors is all the code needs to know about the program.
+static void collect_names(Unit* unit, CacheEntry* entry) {
+    int capacity = 0;
+    if (unit->first >= 0) {
+        add_names(entry, &capacity, unit->first, unit->end);
+    }
+    else {
+        for (int i = 0; i < units_count; ++i) {
+            if (units[i].kind == UNIT_STATEMENTS || units[i].kind == UNIT_GLOBALS) {
+                add_names(entry, &capacity, units[i].first, units[i].end);
+            }
+        }
+    }
+    if (entry->names_count == 0) return;
+    qsort(entry->names, entry->names_count, sizeof(uint64_t), compare_hashes);
+    int unique = 1;
+    for (int i = 1; i < entry->names_count; ++i) {
+        if (entry->names[i] != entry->names[unique - 1]) {
+            entry->names[unique++] = entry->names[i];
+        }
+    }
+    entry->names_count = unique;
+    entry->names = GROW_ARRAY(uint64_t, entry->names, capacity, unique);
+}
+
+// Parses the definitions the cache does not know yet and remembers what functions call and
+// what vectors hold, which does not change as long as their tokens do not.
+static void learn_definitions() {
+    for (int i = 0; i < units_count; ++i) {
+        Unit* unit = &units[i];
+        if (unit->kind == UNIT_STATEMENTS || lookup_entry(&definitions_cache, unit->hash) != NULL) continue;
+
+        if (unit->kind == UNIT_GLOBALS) {
+            learn_globals(unit);
+            continue;
+        }
+        parse_unit(unit);
+        CacheEntry* entry = add_entry(&definitions_cache, unit->hash);
+        if (unit->kind == UNIT_VECTOR) {
+            entry->vectors = malloc(sizeof(ASTNode*));
+            entry->vectors[0] = unit->tree;
+            entry->vectors_count = 1;
+            unit->tree = NULL;
+        }
+        else {
+            const char** callees;
+            entry->callees_count = optimizer_callees(unit->tree, &callees);
+            entry->callees = copy_names(callees, entry->callees_count);
+            free(callees);
+            collect_names(unit, entry);
+        }
+    }
+}
+
+// 0 for names the program does not define, 1 for functions and 2 for words and vectors
+static uint64_t name_kind(uint64_t name) {
+    int definition = hash_table_find(&definition_names, name, NULL);
+    if (definition < 0) return 0;
+    return program.is_vector[definition] ? 2 : 1;
+}
+
+// The code of a function depends on its tokens, on what the names it uses are in the program
+// and on the functions it calls, whose bodies inlining may copy before or after optimizing
+// them. Only leaf functions using nothing but their own names are inlined, so the names in
+// the bodies of the callees do not matter.
+static uint64_t function_key(int index) {
+    Unit* unit = &units[index];
+    uint64_t key = hash_word(HASH_SEED, unit->hash);
+    CacheEntry* entry = lookup_entry(&definitions_cache, unit->hash);
+    for (int i = 0; i < entry->names_count; ++i) {
+        key = hash_word(key, name_kind(entry->names[i]));
+    }
+    for (int i = 0; i < entry->callees_count; ++i) {
+        int callee = find_function(entry->callees[i]);
+        if (callee < 0) continue;
+        key = hash_word(key, units[callee].hash);
+        key = hash_word(key, callee < index);
+    }
+    return key != 0 ? key : 1;
+}
+
+static _Thread_local int definitions_capacity = 0;
+
+static void add_symbol(const char* name, bool is_vector) {
+    if (definitions_capacity < program.definitions_count + 1) {
+        int old_capacity = definitions_capacity;
+        definitions_capacity = GROW_CAPACITY(old_capacity);
+        program.definitions = GROW_ARRAY(const char*, program.definitions, old_capacity, definitions_capacity);
+        program.is_vector = GROW_ARRAY(bool, program.is_vector, old_capacity, definitions_capacity);
+    }
+    // a name defined twice fails in the compiler
+    hash_table_add(&definition_names, hash_string(name), NULL, program.definitions_count);
+    program.definitions[program.definitions_count] = name;
+    program.is_vector[program.definitions_count++] = is_vector;
+}
+
+static void collect_symbols() {
+    free(program.definitions);
+    free(program.is_vector);
+    free(program.extrns);
+    program = (ProgramSymbols) { 0 };
+    definitions_capacity = 0;
+    hash_table_clear(&definition_names);
+    for (int i = 0; i < units_count; ++i) {
+        if (units[i].kind == UNIT_STATEMENTS) continue;
+        if (units[i].kind == UNIT_GLOBALS) {
+            CacheEntry* entry = lookup_entry(&definitions_cache, units[i].hash);
+            for (int j = 0; j < entry->vectors_count; ++j) {
+                add_symbol(entry->vectors[j]->vector.name, true);
+            }
+            continue;
+        }
+        add_symbol(units[i].name, units[i].kind == UNIT_VECTOR);
+    }
+}
+
+static void append_extrns(const char** names, int count) {
+    for (int i = 0; i < count; ++i) {
+        if (program.extrns_capacity < program.extrns_count + 1) {
+            int old_capacity = program.extrns_capacity;
+            program.extrns_capacity = GROW_CAPACITY(old_capacity);
+            program.extrns = GROW_ARRAY(const char*, program.extrns, old_capacity, program.extrns_capacity);
+        }
+        program.extrns[program.extrns_count++] = names[i];
+    }
+}
+
+// Returns the number of functions compiled again.
+static int compile(const Options* options) {
+    read_source(options->input_path);
+    free_units();
+    split_units();
+    index_functions();
+    // the parser only sees both when it parses the whole program
+    Unit* last = units_count > 0 ? &units[units_count - 1] : NULL;
+    if (last != NULL && last->first < 0 && find_function("main") != units_count - 1) {
+        fprintf(
+            diagnostics(), "%s: error: statements outside of functions cannot be mixed with a main function\n",
+            options->input_path
+        );
+        fail();
+    }
+    parser_begin(options->input_path);
+    learn_definitions();
+
+    collect_symbols();
+    int compiled_count = 0;
+    for (int i = 0; i < units_count; ++i) {
+        Unit* unit = &units[i];
+        if (unit->kind != UNIT_FUNCTION) continue;
+        unit->code_key = function_key(i);
+        unit->is_compiled = lookup_entry(&code_cache, unit->code_key) == NULL;
+        if (!unit->is_compiled) continue;
+
+        ++compiled_count;
+        parse_unit(unit);
+        CacheEntry* entry = lookup_entry(&definitions_cache, unit->hash);
+        for (int j = 0; j < entry->callees_count; ++j) {
+            int callee = find_function(entry->callees[j]);
+            if (callee >= 0) {
+                parse_unit(&units[callee]);
+            }
+        }
+    }
+
+    // like optimizer_optimize, the functions inlining copies from are parsed too
+    if (options->optimization_level > 0) {
+        optimizer_begin(options);
+        for (int i = 0; i < units_count; ++i) {
+            if (units[i].kind == UNIT_FUNCTION && units[i].tree != NULL) {
+                optimizer_add_function(units[i].tree);
+            }
+        }
+        for (int i = 0; i < units_count; ++i) {
+            if (units[i].kind == UNIT_FUNCTION && units[i].tree != NULL) {
+                optimizer_optimize_function(units[i].tree);
+            }
+        }
+        optimizer_end();
+    }
+
+    for (int i = 0; i < units_count; ++i) {
+        Unit* unit = &units[i];
+        if (unit->kind != UNIT_FUNCTION) continue;
+        if (unit->is_compiled) {
+            compiler_collect_extrns(unit->tree, &program);
+        }
+        else {
+            CacheEntry* entry = lookup_entry(&code_cache, unit->code_key);
+            append_extrns((const char**)entry->extrns, entry->extrns_count);
+        }
+    }
+    // the definitions are the symbols without the functions
+    int vectors_count = 0;
+    ASTNode** vectors = malloc(sizeof(ASTNode*) * (program.definitions_count > 0 ? program.definitions_count : 1));
+    for (int i = 0; i < units_count; ++i) {
+        if (units[i].kind != UNIT_VECTOR && units[i].kind != UNIT_GLOBALS) continue;
+        CacheEntry* entry = lookup_entry(&definitions_cache, units[i].hash);
+        for (int j = 0; j < entry->vectors_count; ++j) {
+            vectors[vectors_count++] = entry->vectors[j];
+        }
+    }
+
+    compiler_begin(&program, tokens.source, options);
+    for (int i = 0; i < units_count; ++i) {
+        Unit* unit = &units[i];
+        if (unit->kind != UNIT_FUNCTION) continue;
+        if (!unit->is_compiled) {
+            compiler_write_code(&lookup_entry(&code_cache, unit->code_key)->code);
+            continue;
+        }
+        compiler_compile_code(unit->tree, &pending_code);
+        compiler_write_code(&pending_code);
+
+        ProgramSymbols extrns = { 0 };
+        compiler_collect_extrns(unit->tree, &extrns);
+        CacheEntry* entry = add_entry(&code_cache, unit->code_key);
+        entry->code = pending_code;
+        pending_code = (FunctionCode) { 0 };
+        entry->extrns = copy_names(extrns.extrns, extrns.extrns_count);
+        entry->extrns_count = extrns.extrns_count;
+        free(extrns.extrns);
+    }
+    // there are no profile sites without profiles
+    compiler_end(vectors, vectors_count, 0);
+    free(vectors);
+
+    free_units();
+    evict_unused(&definitions_cache);
+    evict_unused(&code_cache);
+    return compiled_count;
+}
+
+static double now_ms() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * 1000.0 + time.tv_nsec / 1000000.0;
+}
+
+// Compiles and reports how long it took, an error is reported and waits for the next change.
+static void run_compilation(const Options* options) {
+    double start = now_ms();
+    jmp_buf handler;
+    if (setjmp(handler) != 0) {
+        set_fail_handler(NULL);
+        compiler_abort();
+        optimizer_end();
+        compiler_free_code(&pending_code);
+        // like in driver_abort, a tree that failed in the parser is leaked
+        free_units();
+        // the caches only hold what compiled, the entries of this compilation stay
+        fflush(diagnostics());
+        return;
+    }
+    set_fail_handler(&handler);
+    int compiled_count = compile(options);
+    set_fail_handler(NULL);
+    fprintf(
+        diagnostics(), "bbc: compiled %s, %d function%s compiled again in %.1f ms\n",
+        options->input_path, compiled_count, compiled_count == 1 ? "" : "s", now_ms() - start
+    );
+    fflush(diagnostics());
+}
+
+int watch_run(const Options* options) {
+    // editors often write a new file and rename it over the old one, so the directory is watched
+    char directory[PATH_MAX];
+    const char* name = strrchr(options->input_path, '/');
+    if (name == NULL) {
+        strcpy(directory, ".");
+        name = options->input_path;
+    }
+    else {
+        int length = name == options->input_path ? 1 : (int)(name - options->input_path);
+        if (length >= PATH_MAX) {
+            fprintf(stderr, "error: path too long: %s\n", options->input_path);
+            return 1;
+        }
+        snprintf(directory, sizeof(directory), "%.*s", length, options->input_path);
+        ++name;
+    }
+
+    int notify = inotify_init1(IN_CLOEXEC);
+    if (notify < 0 || inotify_add_watch(notify, directory, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        fprintf(stderr, "error: failed to watch %s: %s\n", directory, strerror(errno));
+        if (notify >= 0) close(notify);
+        return 1;
+    }
+
+    run_compilation(options);
+    char events[WATCH_EVENTS_SIZE] __attribute__((aligned(__alignof__(struct inotify_event))));
+    for (;;) {
+        ssize_t size = read(notify, events, sizeof(events));
+        if (size < 0 && errno == EINTR) continue;
+        if (size <= 0) {
+            perror("error: inotify");
+            close(notify);
+            return 1;
+        }
+        bool is_changed = false;
+        for (char* event = events; event < events + size;) {
+            struct inotify_event* change = (struct inotify_event*)event;
+            if (change->len > 0 && strcmp(change->name, name) == 0) {
+                is_changed = true;
+            }
+            event += sizeof(struct inotify_event) + change->len;
+        }
+        if (is_changed) {
+            run_compilation(options);
+        }
+    }
+}